@@ -39,7 +39,7 @@ static const char usage_messages[] =
 #undef PROTOTYPES
 #include "applets.h"
 
-static struct BB_applet *applet_using;
+struct BB_applet *applet_using;
 
 /* The -1 arises because of the {0,NULL,0,-1} entry above. */
 const size_t NUM_APPLETS = (sizeof (applets) / sizeof (struct BB_applet) - 1);
@@ -457,7 +457,7 @@ void bb_show_usage (void)
 			applet_using->name, usage_string);
 	}
 
-  exit (bb_default_error_retval);
+  bb_xfunc_exit (bb_default_error_retval);
 }
 
 static int applet_name_compare (const void *x, const void *y)
@@ -28,59 +28,81 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 #include "unarchive.h"
 #include "busybox.h"
 
-/* NOTE: If you vary HASH_PRIME sizes be aware,
- * 1) Tweaking these will have a big effect on how much memory this program uses.
- * 2) For computational efficiency these hash tables should be at least 20%
- *    larger than the maximum number of elements stored in it.
- * 3) All _HASH_PRIME's must be a prime number or chaos is assured, if your looking
- *    for a prime, try http://www.utm.edu/research/primes/lists/small/10000.txt
- * 4) If you go bigger than 15 bits you may get into trouble (untested) as its
- *    sometimes cast to an unsigned int, if you go to 16 bit you will overlap
- *    int's and chaos is assured, 16381 is the max prime for 14 bit field
- */
-
-/* NAME_HASH_PRIME, Stores package names and versions,
- * I estimate it should be at least 50% bigger than PACKAGE_HASH_PRIME,
- * as there a lot of duplicate version numbers */
-#define NAME_HASH_PRIME 16381
-static char *name_hashtable[NAME_HASH_PRIME + 1];
-
-/* PACKAGE_HASH_PRIME, Maximum number of unique packages,
- * It must not be smaller than STATUS_HASH_PRIME,
- * Currently only packages from status_hashtable are stored in here, but in
- * future this may be used to store packages not only from a status file,
- * but an available_hashtable, and even multiple packages files.
+/* All the strings we know about (package names, versions, status lines)
+ * live in name_hashtable, indexed by a small dense id which is what the
+ * rest of the structures store.  name_index is an open addressed table of
+ * ids + 1 used to find the id of a string, it is doubled whenever it gets
+ * three quarters full so there is no upper limit on the number of names.
+ *
+ * Id 0 is always the empty string, so a status of 0 means "no status". */
+static char **name_hashtable;
+static unsigned int name_count;
+static unsigned int name_alloc;
+static unsigned int *name_index;
+static unsigned int name_index_mask;
+
+/* package_hashtable holds every package we know of, either from the status
+ * file or from a .deb, indexed by package id.  Packages with the same name
+ * (but different versions) are chained together through ->next, starting
+ * from name_first_package[name id], so lookups don't need a hash of their own.
  * Package can be stored more than once if they have different versions.
  * e.g. The same package may have different versions in the status file
  *      and available file */
-#define PACKAGE_HASH_PRIME 10007
 typedef struct edge_s {
 	unsigned int operator:3;
 	unsigned int type:4;
-	unsigned int name:14;
-	unsigned int version:14;
+	unsigned int name;
+	unsigned int version;
 } edge_t;
 
 typedef struct common_node_s {
-	unsigned int name:14;
-	unsigned int version:14;
-	unsigned int num_of_edges:14;
+	unsigned int name;
+	unsigned int version;
+	unsigned int num_of_edges;
+	unsigned int next;	/* package id + 1 of the next one with this name */
 	edge_t **edge;
 } common_node_t;
-static common_node_t *package_hashtable[PACKAGE_HASH_PRIME + 1];
-
-/* Currently it doesnt store packages that have state-status of not-installed
- * So it only really has to be the size of the maximum number of packages
- * likely to be installed at any one time, so there is a bit of leeway here */
-#define STATUS_HASH_PRIME 8191
+static common_node_t **package_hashtable;
+static unsigned int package_count;
+static unsigned int package_alloc;
+static unsigned int *name_first_package;
+
+/* status_hashtable is indexed by the name id of the package, so it grows
+ * along with name_hashtable.  It doesnt store packages that have
+ * state-status of not-installed, those entries are simply NULL. */
 typedef struct status_node_s {
-	unsigned int package:14;	/* has to fit PACKAGE_HASH_PRIME */
-	unsigned int status:14;		/* has to fit STATUS_HASH_PRIME */
+	unsigned int package;
+	unsigned int status;
 } status_node_t;
-static status_node_t *status_hashtable[STATUS_HASH_PRIME + 1];
+static status_node_t **status_hashtable;
+
+/* Where each stanza of the status file lives in the mapped copy of it,
+ * so write_status_file() can copy unchanged ones through untouched */
+typedef struct status_stanza_s {
+	unsigned int start;	/* first byte of the stanza */
+	unsigned int end;	/* just past its last field (newline excluded) */
+	int status_num;		/* -1 if it didnt make a status node */
+	unsigned int status;	/* status as it was in the file */
+	int has_package;
+} status_stanza_t;
+static char *status_map;
+static size_t status_map_len;
+static int status_map_mmapped;
+static status_stanza_t *status_stanza;
+static unsigned int status_stanza_count;
+
+/* One "Name: value" field of a control stanza, pointing into the buffer */
+typedef struct control_field_s {
+	const char *name;
+	int name_len;
+	const char *value;
+	int value_len;
+} control_field_t;
 
 /* Even numbers are for 'extras', like ored dependencies or null */
 enum edge_type_e {
@@ -121,71 +143,115 @@ enum dpkg_opt_e {
 typedef struct deb_file_s {
 	char *control_file;
 	char *filename;
-	unsigned int package:14;
+	unsigned int package;
 } deb_file_t;
 
 
-static void make_hash(const char *key, unsigned int *start, unsigned int *decrement, const int hash_prime)
+#if ENABLE_FEATURE_DPKG_TIMING
+static struct timeval phase_start;
+static int dpkg_timing;
+
+static void phase_begin(void)
 {
-	unsigned long int hash_num = key[0];
-	int len = strlen(key);
-	int i;
+	if (dpkg_timing)
+		gettimeofday(&phase_start, NULL);
+}
+
+/* How long since phase_begin() */
+static unsigned long phase_usec(void)
+{
+	struct timeval now;
 
-	/* Maybe i should have uses a "proper" hashing algorithm here instead
-	 * of making one up myself, seems to be working ok though. */
-	for(i = 1; i < len; i++) {
-		/* shifts the ascii based value and adds it to previous value
-		 * shift amount is mod 24 because long int is 32 bit and data
-		 * to be shifted is 8, don't want to shift data to where it has
-		 * no effect*/
-		hash_num += ((key[i] + key[i-1]) << ((key[i] * i) % 24));
-	}
-	*start = (unsigned int) hash_num % hash_prime;
-	*decrement = (unsigned int) 1 + (hash_num % (hash_prime - 1));
+	if (!dpkg_timing)
+		return(0);
+	gettimeofday(&now, NULL);
+	return((now.tv_sec - phase_start.tv_sec) * 1000000UL
+		+ now.tv_usec - phase_start.tv_usec);
 }
 
-/* this adds the key to the hash table */
-static int search_name_hashtable(const char *key)
+static void phase_report(const char *phase, const char *what, unsigned long usec)
 {
-	unsigned int probe_address = 0;
-	unsigned int probe_decrement = 0;
-//	char *temp;
-
-	make_hash(key, &probe_address, &probe_decrement, NAME_HASH_PRIME);
-	while(name_hashtable[probe_address] != NULL) {
-		if (strcmp(name_hashtable[probe_address], key) == 0) {
-			return(probe_address);
-		} else {
-			probe_address -= probe_decrement;
-			if ((int)probe_address < 0) {
-				probe_address += NAME_HASH_PRIME;
-			}
-		}
+	if (!dpkg_timing)
+		return;
+	bb_error_msg("%s%s%s: %lu.%06lus", phase, what ? " " : "",
+		what ? what : "", usec / 1000000, usec % 1000000);
+}
+
+#define phase_end(phase, what)	phase_report(phase, what, phase_usec())
+#else
+#define phase_begin()			((void)0)
+#define phase_usec()			0UL
+#define phase_report(phase, what, usec)	((void)0)
+#define phase_end(phase, what)	((void)0)
+#endif
+
+static unsigned int hash_name(const char *key, int len)
+{
+	unsigned int hash_num = 2166136261U;
+
+	while (len--)
+		hash_num = (hash_num ^ (unsigned char) *key++) * 16777619U;
+	return(hash_num);
+}
+
+static void grow_name_index(void)
+{
+	unsigned int new_mask = name_index_mask ? name_index_mask * 2 + 1 : 1023;
+	unsigned int *new_index = xzalloc((new_mask + 1) * sizeof(unsigned int));
+	unsigned int i, probe_address;
+
+	for (i = 0; i < name_count; i++) {
+		probe_address = hash_name(name_hashtable[i], strlen(name_hashtable[i])) & new_mask;
+		while (new_index[probe_address])
+			probe_address = (probe_address + 1) & new_mask;
+		new_index[probe_address] = i + 1;
 	}
-	name_hashtable[probe_address] = bb_xstrdup(key);
-	return(probe_address);
+	free(name_index);
+	name_index = new_index;
+	name_index_mask = new_mask;
 }
 
-/* this DOESNT add the key to the hashtable
- * TODO make it consistent with search_name_hashtable
- */
-static unsigned int search_status_hashtable(const char *key)
+/* this adds the key to the hash table, if it isnt already there */
+static unsigned int search_name_hashtable_len(const char *key, int len)
 {
-	unsigned int probe_address = 0;
-	unsigned int probe_decrement = 0;
+	unsigned int probe_address;
+	unsigned int id;
 
-	make_hash(key, &probe_address, &probe_decrement, STATUS_HASH_PRIME);
-	while(status_hashtable[probe_address] != NULL) {
-		if (strcmp(key, name_hashtable[package_hashtable[status_hashtable[probe_address]->package]->name]) == 0) {
-			break;
-		} else {
-			probe_address -= probe_decrement;
-			if ((int)probe_address < 0) {
-				probe_address += STATUS_HASH_PRIME;
-			}
+	if (name_count * 4 >= name_index_mask * 3)
+		grow_name_index();
+
+	probe_address = hash_name(key, len) & name_index_mask;
+	while ((id = name_index[probe_address]) != 0) {
+		const char *name = name_hashtable[id - 1];
+		if (strncmp(name, key, len) == 0 && name[len] == '\0') {
+			return(id - 1);
 		}
+		probe_address = (probe_address + 1) & name_index_mask;
+	}
+
+	if (name_count == name_alloc) {
+		/* The per name tables have to keep up with us */
+		name_alloc = name_alloc ? name_alloc * 2 : 1024;
+		name_hashtable = xrealloc(name_hashtable, name_alloc * sizeof(char *));
+		status_hashtable = xrealloc(status_hashtable, name_alloc * sizeof(status_node_t *));
+		name_first_package = xrealloc(name_first_package, name_alloc * sizeof(unsigned int));
+		memset(status_hashtable + name_count, 0, (name_alloc - name_count) * sizeof(status_node_t *));
+		memset(name_first_package + name_count, 0, (name_alloc - name_count) * sizeof(unsigned int));
 	}
-	return(probe_address);
+	name_hashtable[name_count] = bb_xstrndup(key, len);
+	name_index[probe_address] = ++name_count;
+	return(name_count - 1);
+}
+
+static unsigned int search_name_hashtable(const char *key)
+{
+	return(search_name_hashtable_len(key, strlen(key)));
+}
+
+/* Status nodes are indexed by the package name */
+static unsigned int search_status_hashtable(const char *key)
+{
+	return(search_name_hashtable(key));
 }
 
 /* Need to rethink version comparison, maybe the official dpkg has something i can use ? */
@@ -306,16 +372,16 @@ static int version_compare(const unsigned int ver1, const unsigned int ver2)
 		deb_ver2++;
 	}
 	result = version_compare_part(upstream_ver1, upstream_ver2);
+	if (result == 0) {
+		/* Compare debian versions */
+		result = version_compare_part(deb_ver1, deb_ver2);
+	}
 
+	/* deb_ver1 and deb_ver2 point into these */
 	free(upstream_ver1);
 	free(upstream_ver2);
 
-	if (result != 0) {
-		return(result);
-	}
-
-	/* Compare debian versions */
-	return(version_compare_part(deb_ver1, deb_ver2));
+	return(result);
 }
 
 static int test_version(const unsigned int version1, const unsigned int version2, const unsigned int operator)
@@ -354,27 +420,43 @@ static int test_version(const unsigned int version1, const unsigned int version2
 }
 
 
+/* Returns the matching package, or the free package id to store a new one
+ * in (with add_package) if there isnt one */
 static int search_package_hashtable(const unsigned int name, const unsigned int version, const unsigned int operator)
 {
-	unsigned int probe_address = 0;
-	unsigned int probe_decrement = 0;
-
-	make_hash(name_hashtable[name], &probe_address, &probe_decrement, PACKAGE_HASH_PRIME);
-	while(package_hashtable[probe_address] != NULL) {
-		if (package_hashtable[probe_address]->name == name) {
-			if (operator == VER_ANY) {
-				return(probe_address);
-			}
-			if (test_version(package_hashtable[probe_address]->version, version, operator)) {
-				return(probe_address);
-			}
+	unsigned int package_num = name_first_package[name];
+
+	while (package_num != 0) {
+		const common_node_t *node = package_hashtable[package_num - 1];
+		if (operator == VER_ANY) {
+			return(package_num - 1);
 		}
-		probe_address -= probe_decrement;
-		if ((int)probe_address < 0) {
-			probe_address += PACKAGE_HASH_PRIME;
+		if (test_version(node->version, version, operator)) {
+			return(package_num - 1);
 		}
+		package_num = node->next;
 	}
-	return(probe_address);
+
+	if (package_count == package_alloc) {
+		package_alloc = package_alloc ? package_alloc * 2 : 1024;
+		package_hashtable = xrealloc(package_hashtable, package_alloc * sizeof(common_node_t *));
+	}
+	package_hashtable[package_count] = NULL;
+	return(package_count);
+}
+
+/* package_num must be what search_package_hashtable just returned */
+static void add_package(const unsigned int package_num, common_node_t *node)
+{
+	unsigned int *link = &name_first_package[node->name];
+
+	while (*link != 0) {
+		link = &package_hashtable[*link - 1]->next;
+	}
+	*link = package_num + 1;
+	node->next = 0;
+	package_hashtable[package_num] = node;
+	package_count++;
 }
 
 /*
@@ -396,7 +478,7 @@ static int search_package_hashtable(const unsigned int name, const unsigned int
 static int search_for_provides(int needle, int start_at) {
 	int i, j;
 	common_node_t *p;
-	for (i = start_at + 1; i < PACKAGE_HASH_PRIME; i++) {
+	for (i = start_at + 1; i < package_count; i++) {
 		p = package_hashtable[i];
 		if ( p == NULL ) continue;
 		for(j = 0; j < p->num_of_edges; j++)
@@ -426,9 +508,9 @@ static void add_edge_to_node(common_node_t *node, edge_t *edge)
  * field contains the number of EDGE nodes which follow as part of
  * this alternative.
  */
-static void add_split_dependencies(common_node_t *parent_node, const char *whole_line, unsigned int edge_type)
+static void add_split_dependencies(common_node_t *parent_node, const char *whole_line, int line_len, unsigned int edge_type)
 {
-	char *line = bb_xstrdup(whole_line);
+	char *line = bb_xstrndup(whole_line, line_len);
 	char *line2;
 	char *line_ptr1 = NULL;
 	char *line_ptr2 = NULL;
@@ -537,76 +619,119 @@ static void free_package(common_node_t *node)
 	}
 }
 
-static unsigned int fill_package_struct(char *control_buffer)
+/*
+ * Gets the next field of the control stanza in [buffer, end) without copying
+ * anything, returns where the field after it starts or NULL if there are no
+ * more.  Continuation lines are part of the value, and like
+ * read_package_field() fields without a name or a value are skipped.
+ */
+static const char *next_control_field(const char *buffer, const char *end, control_field_t *field)
+{
+	while (buffer < end) {
+		const char *line = buffer;
+		const char *colon = NULL;
+		const char *value;
+
+		/* The name runs up to the ':' */
+		while (buffer < end && *buffer != '\n') {
+			if (*buffer == ':') {
+				colon = buffer;
+				break;
+			}
+			buffer++;
+		}
+
+		/* The value runs up to a newline that doesnt start a continuation line */
+		value = buffer;
+		while (buffer < end) {
+			if (*buffer == '\n' && (buffer + 1 == end || (buffer[1] != ' ' && buffer[1] != '\t'))) {
+				break;
+			}
+			buffer++;
+		}
+		if (colon == NULL) {
+			buffer++;
+			continue;
+		}
+
+		line += strspn(line, " \t");
+		field->name = line;
+		field->name_len = colon - line;
+		value = colon + 1;
+		while (value < buffer && (*value == ' ' || *value == '\t' || *value == '\n')) {
+			value++;
+		}
+		field->value = value;
+		field->value_len = buffer - value;
+		buffer++;
+		if (field->name_len > 0 && field->value_len > 0) {
+			return(buffer);
+		}
+	}
+	return(NULL);
+}
+
+static int field_is(const control_field_t *field, const char *name)
+{
+	return(strncmp(field->name, name, field->name_len) == 0 && name[field->name_len] == '\0');
+}
+
+/* Returns the package number, or -1 if the stanza isnt a complete package.
+ * If status isnt NULL it gets the Status: field, if there is one. */
+static unsigned int fill_package_struct(const char *control_buffer, int buffer_length, control_field_t *status)
 {
 	static const char *const field_names[] = { "Package", "Version",
 		"Pre-Depends", "Depends","Replaces", "Provides",
 		"Conflicts", "Suggests", "Recommends", "Enhances", 0
 	};
+	static const unsigned char field_edges[] = { 0, 0,
+		EDGE_PRE_DEPENDS, EDGE_DEPENDS, EDGE_REPLACES, EDGE_PROVIDES,
+		EDGE_CONFLICTS, EDGE_SUGGESTS, EDGE_RECOMMENDS, EDGE_ENHANCES
+	};
 
 	common_node_t *new_node = (common_node_t *) xzalloc(sizeof(common_node_t));
-	char *field_name;
-	char *field_value;
-	int field_start = 0;
+	const char *end = control_buffer + buffer_length;
+	const unsigned int unknown = search_name_hashtable("unknown");
+	control_field_t field;
 	int num = -1;
-	int buffer_length = strlen(control_buffer);
 
-	new_node->version = search_name_hashtable("unknown");
-	while (field_start < buffer_length) {
+	if (status) {
+		status->value = NULL;
+	}
+	new_node->version = unknown;
+	while ((control_buffer = next_control_field(control_buffer, end, &field)) != NULL) {
 		unsigned short field_num;
 
-		field_start += read_package_field(&control_buffer[field_start],
-				&field_name, &field_value);
-
-		if (field_name == NULL) {
-			goto fill_package_struct_cleanup; /* Oh no, the dreaded goto statement ! */
+		for (field_num = 0; field_names[field_num]; field_num++) {
+			if (field_is(&field, field_names[field_num])) {
+				break;
+			}
 		}
-
-		field_num = compare_string_array(field_names, field_name);
 		switch(field_num) {
 			case 0: /* Package */
-				new_node->name = search_name_hashtable(field_value);
+				new_node->name = search_name_hashtable_len(field.value, field.value_len);
 				break;
 			case 1: /* Version */
-				new_node->version = search_name_hashtable(field_value);
-				break;
-			case 2: /* Pre-Depends */
-				add_split_dependencies(new_node, field_value, EDGE_PRE_DEPENDS);
-				break;
-			case 3: /* Depends */
-				add_split_dependencies(new_node, field_value, EDGE_DEPENDS);
-				break;
-			case 4: /* Replaces */
-				add_split_dependencies(new_node, field_value, EDGE_REPLACES);
+				new_node->version = search_name_hashtable_len(field.value, field.value_len);
 				break;
-			case 5: /* Provides */
-				add_split_dependencies(new_node, field_value, EDGE_PROVIDES);
-				break;
-			case 6: /* Conflicts */
-				add_split_dependencies(new_node, field_value, EDGE_CONFLICTS);
-				break;
-			case 7: /* Suggests */
-				add_split_dependencies(new_node, field_value, EDGE_SUGGESTS);
-				break;
-			case 8: /* Recommends */
-				add_split_dependencies(new_node, field_value, EDGE_RECOMMENDS);
+			case 10: /* fill_package_struct doesnt handle the status field */
+				if (status && field_is(&field, "Status")) {
+					*status = field;
+				}
 				break;
-			case 9: /* Enhances */
-				add_split_dependencies(new_node, field_value, EDGE_ENHANCES);
+			default: /* Pre-Depends ... Enhances */
+				add_split_dependencies(new_node, field.value, field.value_len, field_edges[field_num]);
 				break;
 		}
-fill_package_struct_cleanup:
-		free(field_name);
-		free(field_value);
 	}
 
-	if (new_node->version == search_name_hashtable("unknown")) {
+	if (new_node->version == unknown) {
 		free_package(new_node);
 		return(-1);
 	}
 	num = search_package_hashtable(new_node->name, new_node->version, VER_EQUAL);
 	if (package_hashtable[num] == NULL) {
-		package_hashtable[num] = new_node;
+		add_package(num, new_node);
 	} else {
 		free_package(new_node);
 	}
@@ -639,7 +764,7 @@ static unsigned int get_status(const unsigned int status_node, const int num)
 static void set_status(const unsigned int status_node_num, const char *new_value, const int position)
 {
 	const unsigned int new_value_len = strlen(new_value);
-	const unsigned int new_value_num = search_name_hashtable(new_value);
+	unsigned int new_value_num = search_name_hashtable(new_value);
 	unsigned int want = get_status(status_node_num, 1);
 	unsigned int flag = get_status(status_node_num, 2);
 	unsigned int status = get_status(status_node_num, 3);
@@ -666,7 +791,9 @@ static void set_status(const unsigned int status_node_num, const char *new_value
 	}
 
 	new_status = bb_xasprintf("%s %s %s", name_hashtable[want], name_hashtable[flag], name_hashtable[status]);
-	status_hashtable[status_node_num]->status = search_name_hashtable(new_status);
+	/* Adding the name may move status_hashtable */
+	new_value_num = search_name_hashtable(new_status);
+	status_hashtable[status_node_num]->status = new_value_num;
 	free(new_status);
 	return;
 }
@@ -696,166 +823,205 @@ static const char *describe_status(int status_num) {
 }
 
 
+/* Looks for the named field in the stanza [buffer, end) */
+static int find_control_field(const char *buffer, const char *end, const char *name, control_field_t *field)
+{
+	while ((buffer = next_control_field(buffer, end, field)) != NULL) {
+		if (field_is(field, name)) {
+			return(TRUE);
+		}
+	}
+	return(FALSE);
+}
+
 static void index_status_file(const char *filename)
 {
-	FILE *status_file;
-	char *control_buffer;
-	char *status_line;
-	status_node_t *status_node = NULL;
-	unsigned int status_num;
-
-	status_file = bb_xfopen(filename, "r");
-	while ((control_buffer = fgets_str(status_file, "\n\n")) != NULL) {
-		const unsigned int package_num = fill_package_struct(control_buffer);
+	struct stat stat_buf;
+	const char *stanza;
+	const char *end;
+	int fd;
+
+	fd = bb_xopen(filename, O_RDONLY);
+	fstat(fd, &stat_buf);
+	status_map_len = stat_buf.st_size;
+	if (status_map_len) {
+		/* Everything below just points into this, nothing is copied */
+		status_map = mmap(NULL, status_map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+		status_map_mmapped = (status_map != MAP_FAILED);
+		if (!status_map_mmapped) {
+			status_map = xmalloc(status_map_len);
+			if (bb_full_read(fd, status_map, status_map_len) != (ssize_t)status_map_len) {
+				bb_perror_msg_and_die("%s", filename);
+			}
+		}
+	}
+	close(fd);
+
+	stanza = status_map;
+	end = status_map + status_map_len;
+	while (stanza < end) {
+		status_stanza_t *entry;
+		control_field_t field;
+		const char *stanza_end;
+		unsigned int package_num;
+
+		/* Stanzas are separated by blank lines */
+		while (stanza < end && *stanza == '\n') {
+			stanza++;
+		}
+		if (stanza == end) {
+			break;
+		}
+		stanza_end = stanza;
+		while (stanza_end < end && !(stanza_end[0] == '\n'
+				&& (stanza_end + 1 == end || stanza_end[1] == '\n'))) {
+			stanza_end++;
+		}
+
+		if ((status_stanza_count & 1023) == 0) {
+			status_stanza = xrealloc(status_stanza, (status_stanza_count + 1024) * sizeof(status_stanza_t));
+		}
+		entry = &status_stanza[status_stanza_count++];
+		entry->start = stanza - status_map;
+		entry->end = stanza_end - status_map;
+		entry->status_num = -1;
+		entry->status = 0;
+		entry->has_package = find_control_field(stanza, stanza_end, "Package", &field);
+
+		package_num = fill_package_struct(stanza, stanza_end - stanza, &field);
 		if (package_num != -1) {
-			status_node = xmalloc(sizeof(status_node_t));
-			/* fill_package_struct doesnt handle the status field */
-			status_line = strstr(control_buffer, "Status:");
-			if (status_line != NULL) {
-				status_line += 7;
-				status_line += strspn(status_line, " \n\t");
-				status_line = bb_xstrndup(status_line, strcspn(status_line, "\n\0"));
-				status_node->status = search_name_hashtable(status_line);
-				free(status_line);
+			status_node_t *status_node = xmalloc(sizeof(status_node_t));
+
+			status_node->status = 0;
+			if (field.value != NULL) {
+				const char *eol = memchr(field.value, '\n', field.value_len);
+				status_node->status = search_name_hashtable_len(field.value,
+						eol ? eol - field.value : field.value_len);
 			}
 			status_node->package = package_num;
-			status_num = search_status_hashtable(name_hashtable[package_hashtable[status_node->package]->name]);
-			status_hashtable[status_num] = status_node;
+			entry->status_num = package_hashtable[package_num]->name;
+			entry->status = status_node->status;
+			status_hashtable[entry->status_num] = status_node;
 		}
-		free(control_buffer);
+		stanza = stanza_end;
 	}
-	fclose(status_file);
 	return;
 }
 
 static void write_buffer_no_status(FILE *new_status_file, const char *control_buffer)
 {
-	char *name;
-	char *value;
-	int start = 0;
-	while (1) {
-		start += read_package_field(&control_buffer[start], &name, &value);
-		if (name == NULL) {
-			break;
-		}
-		if (strcmp(name, "Status") != 0) {
-			fprintf(new_status_file, "%s: %s\n", name, value);
+	const char *end = control_buffer + strlen(control_buffer);
+	control_field_t field;
+
+	while ((control_buffer = next_control_field(control_buffer, end, &field)) != NULL) {
+		if (!field_is(&field, "Status")) {
+			fprintf(new_status_file, "%.*s: %.*s\n", field.name_len, field.name,
+				field.value_len, field.value);
 		}
 	}
 	return;
 }
 
-/* This could do with a cleanup */
-static void write_status_file(deb_file_t **deb_file)
+/* Writes out a stanza whose status has changed since we read it, returns
+ * FALSE if it should be copied through unchanged after all */
+static int write_changed_stanza(FILE *new_status_file, deb_file_t **deb_file,
+		const status_stanza_t *entry)
 {
-	FILE *old_status_file = bb_xfopen("/var/lib/dpkg/status", "r");
-	FILE *new_status_file = bb_xfopen("/var/lib/dpkg/status.udeb", "w");
-	char *package_name;
-	char *status_from_file;
-	char *control_buffer = NULL;
-	char *tmp_string;
-	int status_num;
-	int field_start = 0;
-	int write_flag;
-	int i = 0;
+	const char *stanza = status_map + entry->start;
+	const char *end = status_map + entry->end;
+	const int status_num = entry->status_num;
+	const char *package_name = name_hashtable[status_num];
+	const char *status_from_hashtable = name_hashtable[status_hashtable[status_num]->status];
+	const char *state_status = name_hashtable[get_status(status_num, 3)];
+	control_field_t field;
+	int i;
 
-	/* Update previously known packages */
-	while ((control_buffer = fgets_str(old_status_file, "\n\n")) != NULL) {
-		if ((tmp_string = strstr(control_buffer, "Package:")) == NULL) {
-			continue;
+	if ((strcmp("installed", state_status) == 0) ||
+		(strcmp("unpacked", state_status) == 0)) {
+		/* We need to add the control file from the package */
+		for (i = 0; deb_file[i] != NULL; i++) {
+			if (strcmp(package_name, name_hashtable[package_hashtable[deb_file[i]->package]->name]) == 0) {
+				/* Write a status file entry with a modified status */
+				write_buffer_no_status(new_status_file, deb_file[i]->control_file);
+				set_status(status_num, "ok", 2);
+				fprintf(new_status_file, "Status: %s\n\n", name_hashtable[status_hashtable[status_num]->status]);
+				return(TRUE);
+			}
 		}
-
-		tmp_string += 8;
-		tmp_string += strspn(tmp_string, " \n\t");
-		package_name = bb_xstrndup(tmp_string, strcspn(tmp_string, "\n\0"));
-		write_flag = FALSE;
-		tmp_string = strstr(control_buffer, "Status:");
-		if (tmp_string != NULL) {
-			/* Seperate the status value from the control buffer */
-			tmp_string += 7;
-			tmp_string += strspn(tmp_string, " \n\t");
-			status_from_file = bb_xstrndup(tmp_string, strcspn(tmp_string, "\n"));
-		} else {
-			status_from_file = NULL;
+		/* This is temperary, debugging only */
+		bb_error_msg_and_die("ALERT: Couldnt find a control file, your status file may be broken, status may be incorrect for %s", package_name);
+	}
+	else if (strcmp("not-installed", state_status) == 0) {
+		/* Only write the Package, Status, Priority and Section lines */
+		fprintf(new_status_file, "Package: %s\n", package_name);
+		fprintf(new_status_file, "Status: %s\n", status_from_hashtable);
+		while ((stanza = next_control_field(stanza, end, &field)) != NULL) {
+			if (field_is(&field, "Priority") || field_is(&field, "Section")) {
+				fprintf(new_status_file, "%.*s: %.*s\n", field.name_len, field.name,
+					field.value_len, field.value);
+			}
 		}
+		fputs("\n", new_status_file);
+		return(TRUE);
+	}
+	else if (strcmp("config-files", state_status) == 0) {
+		/* only change the status line */
+		while ((stanza = next_control_field(stanza, end, &field)) != NULL) {
+			if (field_is(&field, "Status")) {
+				fprintf(new_status_file, "Status: %s\n", status_from_hashtable);
+			} else {
+				fprintf(new_status_file, "%.*s: %.*s\n", field.name_len, field.name,
+					field.value_len, field.value);
+			}
+		}
+		fputs("\n", new_status_file);
+		return(TRUE);
+	}
+	return(FALSE);
+}
 
-		/* Find this package in the status hashtable */
-		status_num = search_status_hashtable(package_name);
-		if (status_hashtable[status_num] != NULL) {
-			const char *status_from_hashtable = name_hashtable[status_hashtable[status_num]->status];
-			if (strcmp(status_from_file, status_from_hashtable) != 0) {
-				/* New status isnt exactly the same as old status */
-				const int state_status = get_status(status_num, 3);
-				if ((strcmp("installed", name_hashtable[state_status]) == 0) ||
-					(strcmp("unpacked", name_hashtable[state_status]) == 0)) {
-					/* We need to add the control file from the package */
-					i = 0;
-					while(deb_file[i] != NULL) {
-						if (strcmp(package_name, name_hashtable[package_hashtable[deb_file[i]->package]->name]) == 0) {
-							/* Write a status file entry with a modified status */
-							/* remove trailing \n's */
-							write_buffer_no_status(new_status_file, deb_file[i]->control_file);
-							set_status(status_num, "ok", 2);
-							fprintf(new_status_file, "Status: %s\n\n", name_hashtable[status_hashtable[status_num]->status]);
-							write_flag = TRUE;
-							break;
-						}
-						i++;
-					}
-					/* This is temperary, debugging only */
-					if (deb_file[i] == NULL) {
-						bb_error_msg_and_die("ALERT: Couldnt find a control file, your status file may be broken, status may be incorrect for %s", package_name);
-					}
-				}
-				else if (strcmp("not-installed", name_hashtable[state_status]) == 0) {
-					/* Only write the Package, Status, Priority and Section lines */
-					fprintf(new_status_file, "Package: %s\n", package_name);
-					fprintf(new_status_file, "Status: %s\n", status_from_hashtable);
-
-					while (1) {
-						char *field_name;
-						char *field_value;
-						field_start += read_package_field(&control_buffer[field_start], &field_name, &field_value);
-						if (field_name == NULL) {
-							break;
-						}
-						if ((strcmp(field_name, "Priority") == 0) ||
-							(strcmp(field_name, "Section") == 0)) {
-							fprintf(new_status_file, "%s: %s\n", field_name, field_value);
-						}
-					}
-					write_flag = TRUE;
-					fputs("\n", new_status_file);
-				}
-				else if	(strcmp("config-files", name_hashtable[state_status]) == 0) {
-					/* only change the status line */
-					while (1) {
-						char *field_name;
-						char *field_value;
-						field_start += read_package_field(&control_buffer[field_start], &field_name, &field_value);
-						if (field_name == NULL) {
-							break;
-						}
-						/* Setup start point for next field */
-						if (strcmp(field_name, "Status") == 0) {
-							fprintf(new_status_file, "Status: %s\n", status_from_hashtable);
-						} else {
-							fprintf(new_status_file, "%s: %s\n", field_name, field_value);
-						}
-					}
-					write_flag = TRUE;
-					fputs("\n", new_status_file);
-				}
+static void write_status_file(deb_file_t **deb_file)
+{
+	FILE *new_status_file = bb_xfopen("/var/lib/dpkg/status.udeb", "w");
+	unsigned int copy_start = 0;
+	unsigned int copy_end = 0;
+	unsigned int i;
+	int status_num;
+
+	/* Update previously known packages.  Runs of stanzas whose status
+	 * didnt change are copied straight from the old file in one go,
+	 * only the changed ones get taken apart and written again. */
+	for (i = 0; i < status_stanza_count; i++) {
+		const status_stanza_t *entry = &status_stanza[i];
+		int copy = entry->has_package;
+
+		if (copy && entry->status_num != -1
+		 && status_hashtable[entry->status_num] != NULL
+		 && status_hashtable[entry->status_num]->status != entry->status) {
+			/* New status isnt exactly the same as old status */
+			if (copy_end > copy_start) {
+				fwrite(status_map + copy_start, 1, copy_end - copy_start, new_status_file);
+				fputs("\n\n", new_status_file);
 			}
+			copy_start = copy_end = 0;
+			copy = !write_changed_stanza(new_status_file, deb_file, entry);
+		}
+		if (!copy) {
+			continue;
 		}
-		/* If the package from the status file wasnt handle above, do it now*/
-		if (! write_flag) {
-			fprintf(new_status_file, "%s\n\n", control_buffer);
+		if (copy_end == copy_start) {
+			copy_start = entry->start;
+		} else if (copy_end != status_stanza[i - 1].end) {
+			/* Something was dropped in between */
+			fwrite(status_map + copy_start, 1, copy_end - copy_start, new_status_file);
+			fputs("\n\n", new_status_file);
+			copy_start = entry->start;
 		}
-
-		free(status_from_file);
-		free(package_name);
-		free(control_buffer);
+		copy_end = entry->end;
+	}
+	if (copy_end > copy_start) {
+		fwrite(status_map + copy_start, 1, copy_end - copy_start, new_status_file);
+		fputs("\n\n", new_status_file);
 	}
 
 	/* Write any new packages */
@@ -867,9 +1033,9 @@ static void write_status_file(deb_file_t **deb_file)
 			fprintf(new_status_file, "Status: %s\n\n", name_hashtable[status_hashtable[status_num]->status]);
 		}
 	}
-	fclose(old_status_file);
-	fclose(new_status_file);
-
+	if (ferror(new_status_file) | fclose(new_status_file)) {
+		bb_perror_msg_and_die("/var/lib/dpkg/status.udeb");
+	}
 
 	/* Create a separate backfile to dpkg */
 	if (rename("/var/lib/dpkg/status", "/var/lib/dpkg/status.udeb.bak") == -1) {
@@ -885,12 +1051,18 @@ static void write_status_file(deb_file_t **deb_file)
 	}
 }
 
+/* With -i, which status entries belong to the packages of this run:
+ * they will be configured as they go, so one of them can satisfy
+ * another's pre-dependency */
+static char *installing_in_order;
+static unsigned int installing_in_order_count;
+
 /* This function returns TRUE if the given package can satisfy a
  * dependency of type depend_type.
  *
  * A pre-depends is satisfied only if a package is already installed,
- * which a regular depends can be satisfied by a package which we want
- * to install.
+ * (or will be before the one needing it is unpacked), while a regular
+ * depends can be satisfied by a package which we want to install.
  */
 static int package_satisfies_dependency(int package, int depend_type)
 {
@@ -903,7 +1075,12 @@ static int package_satisfies_dependency(int package, int depend_type)
 		return 0;
 
 	switch (depend_type) {
-	case EDGE_PRE_DEPENDS:	return get_status(status_num, 3) == search_name_hashtable("installed");
+	case EDGE_PRE_DEPENDS:
+		if ((unsigned int)status_num < installing_in_order_count
+		 && installing_in_order[status_num]
+		 && get_status(status_num, 2) == search_name_hashtable("reinstreq"))
+			return 1;
+		return get_status(status_num, 3) == search_name_hashtable("installed");
 	case EDGE_DEPENDS:	return get_status(status_num, 1) == search_name_hashtable("install");
 	}
 	return 0;
@@ -942,7 +1119,7 @@ static int check_deps(deb_file_t **deb_file, int deb_start, int dep_max_count)
 					common_node_t *new_node = (common_node_t *) xzalloc(sizeof(common_node_t));
 					new_node->name = package_hashtable[package_num]->edge[j]->name;
 					new_node->version = package_hashtable[package_num]->edge[j]->version;
-					package_hashtable[conflicts_package_num] = new_node;
+					add_package(conflicts_package_num, new_node);
 				}
 				conflicts = xrealloc(conflicts, sizeof(int) * (conflicts_num + 1));
 				conflicts[conflicts_num] = conflicts_package_num;
@@ -994,7 +1171,7 @@ static int check_deps(deb_file_t **deb_file, int deb_start, int dep_max_count)
 
 
 	/* Check dependendcies */
-	for (i = 0; i < PACKAGE_HASH_PRIME; i++) {
+	for (i = 0; i < package_count; i++) {
 		int status_num = 0;
 		int number_of_alternatives = 0;
 		const edge_t * root_of_alternatives = NULL;
@@ -1240,7 +1417,7 @@ static void list_packages(void)
 	printf("+++-==============-==============\n");
 
 	/* go through status hash, dereference package hash and finally strings */
-	for (i=0; i<STATUS_HASH_PRIME+1; i++) {
+	for (i=0; i<name_count; i++) {
 
 	        if (status_hashtable[i]) {
 		        const char *stat_str;  /* status string */
@@ -1442,14 +1619,15 @@ static void data_extract_all_prefix(archive_handle_t *archive_handle)
 	return;
 }
 
-static void unpack_package(deb_file_t *deb_file)
+/* First half of unpacking: get rid of any old version, put the control
+ * files in place and run the preinst */
+static void prepare_package(deb_file_t *deb_file)
 {
 	const char *package_name = name_hashtable[package_hashtable[deb_file->package]->name];
 	const unsigned int status_num = search_status_hashtable(package_name);
 	const unsigned int status_package_num = status_hashtable[status_num]->package;
 	char *info_prefix;
 	archive_handle_t *archive_handle;
-	FILE *out_stream;
 	llist_t *accept_list = NULL;
 	int i = 0;
 
@@ -1486,6 +1664,17 @@ static void unpack_package(deb_file_t *deb_file)
 		/* when preinst returns exit code != 0 then quit installation process */
 		bb_error_msg_and_die("subprocess pre-installation script returned error.");
 	}
+	free(info_prefix);
+}
+
+/* Second half: extract data.tar.gz and record what it contained.  This
+ * touches nothing but the filesystem, so it may run in a worker process */
+static void unpack_package_data(deb_file_t *deb_file)
+{
+	const char *package_name = name_hashtable[package_hashtable[deb_file->package]->name];
+	archive_handle_t *archive_handle;
+	FILE *out_stream;
+	char *list_name;
 
 	/* Extract data.tar.gz to the root directory */
 	archive_handle = init_archive_deb_ar(deb_file->filename);
@@ -1496,21 +1685,18 @@ static void unpack_package(deb_file_t *deb_file)
 	unpack_ar_archive(archive_handle);
 
 	/* Create the list file */
-	strcat(info_prefix, "list");
-	out_stream = bb_xfopen(info_prefix, "w");
+	list_name = bb_xasprintf("/var/lib/dpkg/info/%s.list", package_name);
+	out_stream = bb_xfopen(list_name, "w");
 	while (archive_handle->sub_archive->passed) {
 		/* the leading . has been stripped by data_extract_all_prefix already */
 		fputs(archive_handle->sub_archive->passed->data, out_stream);
 		fputc('\n', out_stream);
 		archive_handle->sub_archive->passed = archive_handle->sub_archive->passed->link;
 	}
-	fclose(out_stream);
-
-	/* change status */
-	set_status(status_num, "install", 1);
-	set_status(status_num, "unpacked", 3);
-
-	free(info_prefix);
+	if (ferror(out_stream) | fclose(out_stream)) {
+		bb_perror_msg_and_die("%s", list_name);
+	}
+	free(list_name);
 }
 
 static void configure_package(deb_file_t *deb_file)
@@ -1531,6 +1717,210 @@ static void configure_package(deb_file_t *deb_file)
 	set_status(status_num, "installed", 3);
 }
 
+/*
+ * Packages given to -i/-u are unpacked in "waves": a package has to wait
+ * for the ones it pre-depends on (they must be configured first) and the
+ * ones it replaces (it must overwrite their files, not race them).
+ * Everything in one wave is independent, so the data.tar.gz extraction of
+ * a wave can run in a pool of worker processes while the maintainer
+ * scripts, and all the bookkeeping, stay here in dependency order.
+ */
+typedef struct unpack_result_s {
+	unsigned int deb;
+	unsigned long usec;
+} unpack_result_t;
+
+static deb_file_t **unpack_deb_file;
+
+static int unpack_job(const char *arg, void *result)
+{
+	unpack_result_t *unpacked = result;
+
+	phase_begin();
+	unpacked->deb = atoi(arg);
+	unpack_package_data(unpack_deb_file[unpacked->deb]);
+	unpacked->usec = phase_usec();
+	return(EXIT_SUCCESS);
+}
+
+static void unpack_job_done(int status, void *result)
+{
+	unpack_result_t *unpacked = result;
+	const char *package_name =
+		name_hashtable[package_hashtable[unpack_deb_file[unpacked->deb]->package]->name];
+	const unsigned int status_num = search_status_hashtable(package_name);
+
+	phase_report("unpacking", package_name, unpacked->usec);
+
+	/* change status */
+	set_status(status_num, "install", 1);
+	set_status(status_num, "unpacked", 3);
+}
+
+/* Depth first, so whatever a package depends on, pre-depends on or
+ * replaces comes out before it.  A cycle is cut where we notice it. */
+static void order_package(deb_file_t **deb_file, const int *deb_by_name,
+		int deb, char *state, int *order, int *order_count)
+{
+	const common_node_t *node = package_hashtable[deb_file[deb]->package];
+	unsigned int j;
+
+	state[deb] = 1;
+	for (j = 0; j < node->num_of_edges; j++) {
+		const edge_t *edge = node->edge[j];
+		int other;
+
+		if (edge->type != EDGE_PRE_DEPENDS && edge->type != EDGE_DEPENDS
+		 && edge->type != EDGE_REPLACES) {
+			continue;
+		}
+		other = deb_by_name[edge->name];
+		if (other >= 0 && state[other] == 0) {
+			order_package(deb_file, deb_by_name, other, state, order, order_count);
+		}
+	}
+	state[deb] = 2;
+	order[(*order_count)++] = deb;
+}
+
+static void install_packages(deb_file_t **deb_file, int deb_count, int configure, int nworkers)
+{
+	int *deb_by_name = xmalloc(name_count * sizeof(int));
+	int *order = xmalloc(deb_count * sizeof(int));
+	int *position = xmalloc(deb_count * sizeof(int));
+	int *wave = xzalloc(deb_count * sizeof(int));
+	char *state = xzalloc(deb_count);
+	int order_count = 0;
+	int waves = 0;
+	int i, w;
+	unsigned int j;
+
+	/* Which of deb_file[] a name refers to, directly or by a provides */
+	for (i = 0; i < (int)name_count; i++) {
+		deb_by_name[i] = -1;
+	}
+	for (i = 0; i < deb_count; i++) {
+		deb_by_name[package_hashtable[deb_file[i]->package]->name] = i;
+	}
+	for (i = 0; i < deb_count; i++) {
+		const common_node_t *node = package_hashtable[deb_file[i]->package];
+		for (j = 0; j < node->num_of_edges; j++) {
+			if (node->edge[j]->type == EDGE_PROVIDES && deb_by_name[node->edge[j]->name] < 0) {
+				deb_by_name[node->edge[j]->name] = i;
+			}
+		}
+	}
+
+	for (i = 0; i < deb_count; i++) {
+		if (state[i] == 0) {
+			order_package(deb_file, deb_by_name, i, state, order, &order_count);
+		}
+	}
+	for (i = 0; i < deb_count; i++) {
+		position[order[i]] = i;
+	}
+
+	/* state[] now tells whether a package has to be configured as soon
+	 * as its wave is unpacked, because a later one pre-depends on it */
+	memset(state, 0, deb_count);
+	for (i = 0; i < deb_count; i++) {
+		const int deb = order[i];
+		const common_node_t *node = package_hashtable[deb_file[deb]->package];
+
+		for (j = 0; j < node->num_of_edges; j++) {
+			const edge_t *edge = node->edge[j];
+			const int other = deb_by_name[edge->name];
+
+			if ((edge->type != EDGE_PRE_DEPENDS && edge->type != EDGE_REPLACES)
+			 || other < 0 || position[other] >= i) {
+				continue;
+			}
+			if (wave[deb] <= wave[other]) {
+				wave[deb] = wave[other] + 1;
+			}
+			if (edge->type == EDGE_PRE_DEPENDS) {
+				state[other] = 1;
+			}
+		}
+		if (waves <= wave[deb]) {
+			waves = wave[deb] + 1;
+		}
+	}
+
+	unpack_deb_file = deb_file;
+	for (w = 0; w < waves; w++) {
+#if ENABLE_FEATURE_DPKG_PARALLEL
+		parallel_jobs_t *jobs = NULL;
+		int in_wave = 0;
+
+		for (i = 0; i < deb_count; i++) {
+			in_wave += (wave[i] == w);
+		}
+		if (in_wave > 1) {
+			fflush(stdout);
+			jobs = parallel_jobs_start(MIN(nworkers, in_wave), unpack_job,
+					unpack_job_done, sizeof(unpack_result_t));
+		}
+#endif
+
+		for (i = 0; i < deb_count; i++) {
+			const int deb = order[i];
+			char arg[sizeof(int) * 3 + 1];
+
+			if (wave[deb] != w) {
+				continue;
+			}
+			phase_begin();
+			prepare_package(deb_file[deb]);
+			phase_end("preparing", name_hashtable[package_hashtable[deb_file[deb]->package]->name]);
+
+			sprintf(arg, "%d", deb);
+#if ENABLE_FEATURE_DPKG_PARALLEL
+			if (jobs) {
+				parallel_jobs_add(jobs, arg);
+				continue;
+			}
+#endif
+			{
+				unpack_result_t unpacked;
+				unpack_job(arg, &unpacked);
+				unpack_job_done(EXIT_SUCCESS, &unpacked);
+			}
+		}
+#if ENABLE_FEATURE_DPKG_PARALLEL
+		if (jobs) {
+			parallel_jobs_finish(jobs);
+		}
+#endif
+
+		/* Pre-dependencies have to be fully installed before the next wave */
+		for (i = 0; configure && i < deb_count; i++) {
+			const int deb = order[i];
+			if (wave[deb] == w && state[deb]) {
+				phase_begin();
+				configure_package(deb_file[deb]);
+				phase_end("configuring", name_hashtable[package_hashtable[deb_file[deb]->package]->name]);
+			}
+		}
+	}
+
+	/* configure installed packages */
+	for (i = 0; configure && i < deb_count; i++) {
+		const int deb = order[i];
+		if (!state[deb]) {
+			phase_begin();
+			configure_package(deb_file[deb]);
+			phase_end("configuring", name_hashtable[package_hashtable[deb_file[deb]->package]->name]);
+		}
+	}
+
+	free(deb_by_name);
+	free(order);
+	free(position);
+	free(wave);
+	free(state);
+}
+
 int dpkg_main(int argc, char **argv)
 {
 	deb_file_t **deb_file = NULL;
@@ -1541,9 +1931,14 @@ int dpkg_main(int argc, char **argv)
 	int deb_count = 0;
 	int state_status;
 	int status_num;
+	int nworkers = 1;
 	int i;
 
-	while ((opt = getopt(argc, argv, "CF:ilPru")) != -1) {
+#if ENABLE_FEATURE_DPKG_PARALLEL
+	nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	while ((opt = getopt(argc, argv, "CF:ilPru" USE_FEATURE_DPKG_TIMING("T")
+			USE_FEATURE_DPKG_PARALLEL("j:"))) != -1) {
 		switch (opt) {
 			case 'C': // equivalent to --configure in official dpkg
 				dpkg_opt |= dpkg_opt_configure;
@@ -1573,6 +1968,16 @@ int dpkg_main(int argc, char **argv)
 				dpkg_opt |= dpkg_opt_unpack;
 				dpkg_opt |= dpkg_opt_filename;
 				break;
+#if ENABLE_FEATURE_DPKG_TIMING
+			case 'T':	/* Report how long each phase took */
+				dpkg_timing = 1;
+				break;
+#endif
+#if ENABLE_FEATURE_DPKG_PARALLEL
+			case 'j':	/* How many packages to unpack at once */
+				nworkers = bb_xgetularg10_bnd(optarg, 1, 256);
+				break;
+#endif
 			default:
 				bb_show_usage();
 		}
@@ -1583,7 +1988,10 @@ int dpkg_main(int argc, char **argv)
 	}
 
 /*	puts("(Reading database ... xxxxx files and directories installed.)"); */
+	search_name_hashtable("");
+	phase_begin();
 	index_status_file("/var/lib/dpkg/status");
+	phase_end("reading status", NULL);
 
 	/* if the list action was given print the installed packages and exit */
 	if (dpkg_opt & dpkg_opt_list_installed) {
@@ -1592,6 +2000,7 @@ int dpkg_main(int argc, char **argv)
 	}
 
 	/* Read arguments and store relevant info in structs */
+	phase_begin();
 	while (optind < argc) {
 		/* deb_count = nb_elem - 1 and we need nb_elem + 1 to allocate terminal node [NULL pointer] */
 		deb_file = xrealloc(deb_file, sizeof(deb_file_t *) * (deb_count + 2));
@@ -1609,7 +2018,8 @@ int dpkg_main(int argc, char **argv)
 				bb_error_msg_and_die("Couldnt extract control file");
 			}
 			deb_file[deb_count]->filename = bb_xstrdup(argv[optind]);
-			package_num = fill_package_struct(deb_file[deb_count]->control_file);
+			package_num = fill_package_struct(deb_file[deb_count]->control_file,
+				strlen(deb_file[deb_count]->control_file), NULL);
 
 			if (package_num == -1) {
 				bb_error_msg("Invalid control file in %s", argv[optind]);
@@ -1668,16 +2078,32 @@ int dpkg_main(int argc, char **argv)
 		optind++;
 	}
 	deb_file[deb_count] = NULL;
+	phase_end("reading packages", NULL);
 
 	/* Check that the deb file arguments are installable */
+	if (dpkg_opt & dpkg_opt_install) {
+		installing_in_order_count = name_count;
+		installing_in_order = xzalloc(name_count);
+		for (i = 0; i < deb_count; i++) {
+			installing_in_order[search_status_hashtable(
+				name_hashtable[package_hashtable[deb_file[i]->package]->name])] = 1;
+		}
+	}
 	if ((dpkg_opt & dpkg_opt_force_ignore_depends) != dpkg_opt_force_ignore_depends) {
+		phase_begin();
 		if (!check_deps(deb_file, 0, deb_count)) {
 			bb_error_msg_and_die("Dependency check failed");
 		}
+		phase_end("checking dependencies", NULL);
 	}
 
-	/* TODO: install or remove packages in the correct dependency order */
+	if (dpkg_opt & (dpkg_opt_unpack | dpkg_opt_install)) {
+		/* packages are configured as they are unpacked, if installing */
+		install_packages(deb_file, deb_count, dpkg_opt & dpkg_opt_install, nworkers);
+	}
+	/* TODO: remove packages in the correct dependency order */
 	for (i = 0; i < deb_count; i++) {
+		phase_begin();
 		/* Remove or purge packages */
 		if (dpkg_opt & dpkg_opt_remove) {
 			remove_package(deb_file[i]->package, 1);
@@ -1685,24 +2111,20 @@ int dpkg_main(int argc, char **argv)
 		else if (dpkg_opt & dpkg_opt_purge) {
 			purge_package(deb_file[i]->package);
 		}
-		else if (dpkg_opt & dpkg_opt_unpack) {
-			unpack_package(deb_file[i]);
-		}
-		else if (dpkg_opt & dpkg_opt_install) {
-			unpack_package(deb_file[i]);
-			/* package is configured in second pass below */
-		}
 		else if (dpkg_opt & dpkg_opt_configure) {
 			configure_package(deb_file[i]);
 		}
-	}
-	/* configure installed packages */
-	if (dpkg_opt & dpkg_opt_install) {
-		for (i = 0; i < deb_count; i++)
-			configure_package(deb_file[i]);
+		else {
+			continue;
+		}
+		phase_end(dpkg_opt & dpkg_opt_remove ? "removing"
+			: dpkg_opt & dpkg_opt_purge ? "purging" : "configuring",
+			name_hashtable[package_hashtable[deb_file[i]->package]->name]);
 	}
 
+	phase_begin();
 	write_status_file(deb_file);
+	phase_end("writing status", NULL);
 
 	for (i = 0; i < deb_count; i++) {
 		free(deb_file[i]->control_file);
@@ -1711,20 +2133,28 @@ int dpkg_main(int argc, char **argv)
 	}
 
 	free(deb_file);
+	free(installing_in_order);
 
-	for (i = 0; i < NAME_HASH_PRIME; i++) {
+	for (i = 0; i < name_count; i++) {
 		free(name_hashtable[i]);
+		free(status_hashtable[i]);
 	}
+	free(name_hashtable);
+	free(status_hashtable);
+	free(name_first_package);
+	free(name_index);
 
-	for (i = 0; i < PACKAGE_HASH_PRIME; i++) {
-		if (package_hashtable[i] != NULL) {
-			free_package(package_hashtable[i]);
-		}
+	for (i = 0; i < package_count; i++) {
+		free_package(package_hashtable[i]);
 	}
+	free(package_hashtable);
 
-	for (i = 0; i < STATUS_HASH_PRIME; i++) {
-		free(status_hashtable[i]);
+	if (status_map_mmapped) {
+		munmap(status_map, status_map_len);
+	} else {
+		free(status_map);
 	}
+	free(status_stanza);
 
 	return(EXIT_SUCCESS);
 }
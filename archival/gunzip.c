@@ -60,6 +60,8 @@ static char *license_msg[] = {
 };
 #endif
 
+#include <errno.h>
+#include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -74,13 +76,203 @@ static char *license_msg[] = {
 #define GUNZIP_OPT_FORCE	2
 #define GUNZIP_OPT_TEST		4
 #define GUNZIP_OPT_DECOMPRESS	8
+#define GUNZIP_OPT_INDEX	16
+#define GUNZIP_OPT_SPAN		32
+#define GUNZIP_OPT_OFFSET	64
+#define GUNZIP_OPT_LENGTH	128
+
+#ifdef CONFIG_FEATURE_GUNZIP_INDEX
+/*
+ * The index is a sidecar file FILE.gz.idx: a header identifying the .gz
+ * it was built from, then fixed size records, one per resume point in
+ * increasing uncompressed offset.  Numbers are stored little endian.
+ */
+#define GZIDX_MAGIC	"BBgzidx1"
+#define GZIDX_HDR	24	/* magic, .gz size, .gz mtime */
+#define GZIDX_REC	(17 + sizeof(((inflate_point_t *)0)->window))
+
+static const struct option gunzip_long_options[] = {
+	{ "stdout",	0,	NULL,	'c' },
+	{ "force",	0,	NULL,	'f' },
+	{ "test",	0,	NULL,	't' },
+	{ "index",	0,	NULL,	'\201' },
+	{ "span",	1,	NULL,	'\202' },
+	{ "offset",	1,	NULL,	'\203' },
+	{ "length",	1,	NULL,	'\204' },
+	{ 0,		0,	0,	0 }
+};
+
+static void gzidx_put(unsigned char *p, uint64_t v)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		p[i] = v >> (i * 8);
+}
+
+static uint64_t gzidx_get(const unsigned char *p)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static off_t gunzip_xatooff(const char *arg)
+{
+	unsigned long long v;
+	char *end;
+
+	errno = 0;
+	v = strtoull(arg, &end, 10);
+	if (errno || end == arg || *end || *arg == '-' || (off_t)v < 0)
+		bb_error_msg_and_die("invalid number '%s'", arg);
+	return v;
+}
+
+static void gzidx_header(unsigned char *hdr, const struct stat *st)
+{
+	memcpy(hdr, GZIDX_MAGIC, 8);
+	gzidx_put(hdr + 8, st->st_size);
+	gzidx_put(hdr + 16, st->st_mtime);
+}
+
+static void gzidx_save(const inflate_point_t *p, void *arg)
+{
+	unsigned char rec[17];
+	int fd = *(int *)arg;
+
+	gzidx_put(rec, p->out);
+	gzidx_put(rec + 8, p->in);
+	rec[16] = p->bits;
+	if (bb_full_write(fd, rec, 17) != 17
+	 || bb_full_write(fd, p->window, sizeof(p->window)) != sizeof(p->window))
+		bb_perror_msg_and_die(bb_msg_write_error);
+}
+
+/* Inflate all of src_fd, writing a resume point every span bytes of
+ * output to path.idx */
+static int gunzip_build_index(int src_fd, const char *path, off_t span)
+{
+	unsigned char hdr[GZIDX_HDR];
+	struct stat st;
+	char *idx_path;
+	int idx_fd, status;
+
+	if (!path)
+		bb_error_msg_and_die("can't index standard input");
+	if (fstat(src_fd, &st) != 0)
+		bb_perror_msg_and_die("fstat");
+	idx_path = bb_xasprintf("%s.idx", path);
+	idx_fd = bb_xopen3(idx_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	gzidx_header(hdr, &st);
+	if (bb_full_write(idx_fd, hdr, GZIDX_HDR) != GZIDX_HDR)
+		bb_perror_msg_and_die(bb_msg_write_error);
+
+	status = inflate_gunzip_index(src_fd, span, gzidx_save, &idx_fd);
+	if (close(idx_fd) != 0)
+		bb_perror_msg_and_die(bb_msg_write_error);
+	if (status != 0)
+		unlink(idx_path);
+	free(idx_path);
+	return status;
+}
+
+/* Find the last point at or before offset in path.idx.  Returns 0 if
+ * there is no usable index, so we have to start from the beginning. */
+static int gzidx_find(int src_fd, const char *path, off_t offset,
+		inflate_point_t *p)
+{
+	unsigned char hdr[GZIDX_HDR], want[GZIDX_HDR], rec[17];
+	struct stat st;
+	char *idx_path;
+	off_t lo, hi, mid, found = -1;
+	int idx_fd;
+
+	if (!path || fstat(src_fd, &st) != 0)
+		return 0;
+	idx_path = bb_xasprintf("%s.idx", path);
+	idx_fd = open(idx_path, O_RDONLY);
+	free(idx_path);
+	if (idx_fd < 0)
+		return 0;
+
+	/* An index of some other (or an older) file is no use */
+	gzidx_header(want, &st);
+	if (fstat(idx_fd, &st) != 0
+	 || pread(idx_fd, hdr, GZIDX_HDR, 0) != GZIDX_HDR
+	 || memcmp(hdr, want, GZIDX_HDR) != 0)
+		goto out;
+
+	/* Binary search the records on their uncompressed offset */
+	lo = 0;
+	hi = (st.st_size - GZIDX_HDR) / GZIDX_REC;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (pread(idx_fd, rec, 17, GZIDX_HDR + mid * GZIDX_REC) != 17)
+			goto out;
+		if ((off_t)gzidx_get(rec) <= offset) {
+			found = mid;
+			lo = mid + 1;
+		} else
+			hi = mid;
+	}
+	if (found < 0)
+		goto out;
+
+	mid = GZIDX_HDR + found * GZIDX_REC;
+	if (pread(idx_fd, rec, 17, mid) != 17
+	 || pread(idx_fd, p->window, sizeof(p->window), mid + 17) != sizeof(p->window))
+		goto out;
+	p->out = gzidx_get(rec);
+	p->in = gzidx_get(rec + 8);
+	p->bits = rec[16] & 7;
+	close(idx_fd);
+	return 1;
+ out:
+	close(idx_fd);
+	return 0;
+}
+
+static int gunzip_range(int src_fd, const char *path, off_t offset,
+		off_t length, int dst_fd)
+{
+	inflate_point_t *p = xmalloc(sizeof(*p));
+	int status;
+
+	status = inflate_gunzip_range(src_fd,
+			gzidx_find(src_fd, path, offset, p) ? p : NULL,
+			offset, length, dst_fd);
+	free(p);
+	return status;
+}
+#endif
 
 int gunzip_main(int argc, char **argv)
 {
 	char status = EXIT_SUCCESS;
 	unsigned long opt;
+#ifdef CONFIG_FEATURE_GUNZIP_INDEX
+	char *span_arg, *offset_arg, *length_arg;
+	off_t span = 4 << 20, offset = 0, length = -1;
 
+	bb_applet_long_options = gunzip_long_options;
+	opt = bb_getopt_ulflags(argc, argv, "cftd",
+			&span_arg, &offset_arg, &length_arg);
+	if (opt & GUNZIP_OPT_SPAN)
+		span = (off_t)bb_xgetularg10_bnd(span_arg, 1, 1 << 20) << 20;
+	if (opt & GUNZIP_OPT_OFFSET)
+		offset = gunzip_xatooff(offset_arg);
+	if (opt & GUNZIP_OPT_LENGTH)
+		length = gunzip_xatooff(length_arg);
+	/* A byte range only makes sense on standard output */
+	if (opt & (GUNZIP_OPT_OFFSET | GUNZIP_OPT_LENGTH))
+		opt |= GUNZIP_OPT_STDOUT;
+#else
 	opt = bb_getopt_ulflags(argc, argv, "cftd");
+#endif
 	/* if called as zcat */
 	if (strcmp(bb_applet_name, "zcat") == 0) {
 		opt |= GUNZIP_OPT_STDOUT;
@@ -113,7 +305,7 @@ int gunzip_main(int argc, char **argv)
 		}
 
 		/* Set output filename and number */
-		if (opt & GUNZIP_OPT_TEST) {
+		if (opt & (GUNZIP_OPT_TEST | GUNZIP_OPT_INDEX)) {
 			dst_fd = bb_xopen(bb_dev_null, O_WRONLY);	/* why does test use filenum 2 ? */
 		} else if (opt & GUNZIP_OPT_STDOUT) {
 			dst_fd = STDOUT_FILENO;
@@ -156,6 +348,16 @@ int gunzip_main(int argc, char **argv)
 #endif
 				if (magic2 == 0x8b) {
 					check_header_gzip(src_fd);
+#ifdef CONFIG_FEATURE_GUNZIP_INDEX
+					if (opt & GUNZIP_OPT_INDEX)
+						status = gunzip_build_index(src_fd,
+								src_fd == STDIN_FILENO ? NULL : old_path, span);
+					else if (opt & (GUNZIP_OPT_OFFSET | GUNZIP_OPT_LENGTH))
+						status = gunzip_range(src_fd,
+								src_fd == STDIN_FILENO ? NULL : old_path,
+								offset, length, dst_fd);
+					else
+#endif
 					status = inflate_gunzip(src_fd, dst_fd);
 					if (status != 0) {
 						bb_error_msg_and_die("Error inflating");
@@ -27,29 +27,317 @@
 #include "libbb.h"
 #include "unarchive.h"
 
+/* With ARCHIVE_DEFER_METADATA the caller promises to call
+ * data_extract_all_finish() once the archive is done.  That lets us keep
+ * the directory entries are being written into open, and create, chown
+ * and chmod them relative to it, instead of having the kernel walk the
+ * whole path again for every one of those calls.  It also lets us hold
+ * back the permissions and times of directories until nothing more will
+ * be written into them: otherwise a read-only directory could not be
+ * filled in and every directory would end up with the time of its last
+ * extracted child. */
+static struct {
+	char *path;		/* directory dir_fd is open on */
+	int fd;
+	struct deferred_dir {
+		char *name;
+		mode_t mode;
+		time_t mtime;
+	} *dirs;
+	int ndirs;
+} extract;
+
+static void extract_drop_dir(void)
+{
+	if (extract.path) {
+		close(extract.fd);
+		free(extract.path);
+		extract.path = NULL;
+	}
+}
+
+static int extract_dir_cached(const char *name, int len)
+{
+	return extract.path && (int)strlen(extract.path) == len
+		&& memcmp(extract.path, name, len) == 0;
+}
+
+/* Return a directory fd, and the name relative to it, to create name with */
+static int extract_dirfd(archive_handle_t *archive_handle, const char *name,
+		const char **base)
+{
+	const char *slash = strrchr(name, '/');
+	int len;
+
+	*base = name;
+	if (!(archive_handle->flags & ARCHIVE_DEFER_METADATA) || !slash || !slash[1])
+		return AT_FDCWD;
+	len = slash - name;
+	if (!extract_dir_cached(name, len)) {
+		extract_drop_dir();
+		extract.path = bb_xstrndup(name, len ? len : 1);
+		extract.fd = open(extract.path, O_RDONLY | O_DIRECTORY);
+		if (extract.fd < 0) {
+			/* Let the path based call below report the trouble */
+			free(extract.path);
+			extract.path = NULL;
+			return AT_FDCWD;
+		}
+	}
+	*base = slash + 1;
+	return extract.fd;
+}
+
+static void extract_defer_dir(file_header_t *file_header)
+{
+	struct deferred_dir *d;
+
+	if (!(extract.ndirs & 63))
+		extract.dirs = xrealloc(extract.dirs,
+				(extract.ndirs + 64) * sizeof(*extract.dirs));
+	d = &extract.dirs[extract.ndirs++];
+	d->name = bb_xstrdup(file_header->name);
+	d->mode = file_header->mode;
+	d->mtime = file_header->mtime;
+}
+
+/* Set the owner, mode and times of a regular file through its fd */
+static void extract_fd_metadata(int fd, const file_header_t *file_header, int flags)
+{
+	if (!(flags & ARCHIVE_NOPRESERVE_OWN)) {
+		fchown(fd, file_header->uid, file_header->gid);
+	}
+	if (!(flags & ARCHIVE_NOPRESERVE_PERM)) {
+		fchmod(fd, file_header->mode);
+	}
+	if (flags & ARCHIVE_PRESERVE_DATE) {
+		struct timespec t[2];
+		t[0].tv_sec = t[1].tv_sec = file_header->mtime;
+		t[0].tv_nsec = t[1].tv_nsec = 0;
+		futimens(fd, t);
+	}
+}
+
+#if ENABLE_FEATURE_TAR_PARALLEL
+/* After data_extract_all_parallel(), small regular files are written by a
+ * pool of worker processes: we still read the archive, in order, and
+ * hand each one's contents over along with its header.  The names handed
+ * out are remembered until the pool is drained, and a later entry of one
+ * of those names, or a hard link to one, drains it first.  Hard links,
+ * everything that isn't a small regular file and the deferred directory
+ * metadata are all still done here, so archive order keeps its meaning. */
+#define EXTRACT_PARALLEL_MAX_SIZE	(64 * 1024)
+
+static struct {
+	int nworkers;
+	int flags;
+	parallel_jobs_t *jobs;
+	char **names;		/* in flight, open addressed */
+	unsigned mask;
+	unsigned count;
+} pool;
+
+static char **extract_inflight_slot(const char *name)
+{
+	unsigned i = 0;
+	const char *p;
+
+	for (p = name; *p; p++)
+		i = i * 31 + (unsigned char)*p;
+	i &= pool.mask;
+	while (pool.names[i] && strcmp(pool.names[i], name) != 0)
+		i = (i + 1) & pool.mask;
+	return &pool.names[i];
+}
+
+static void extract_inflight_add(const char *name)
+{
+	char **slot;
+
+	if ((pool.count + 1) * 2 > pool.mask) {
+		char **old = pool.names;
+		unsigned j, old_mask = pool.mask;
+
+		pool.mask = old ? old_mask * 2 + 1 : 255;
+		pool.names = xzalloc((pool.mask + 1) * sizeof(char *));
+		for (j = 0; old && j <= old_mask; j++) {
+			if (old[j])
+				*extract_inflight_slot(old[j]) = old[j];
+		}
+		free(old);
+	}
+	slot = extract_inflight_slot(name);
+	if (!*slot) {
+		*slot = bb_xstrdup(name);
+		pool.count++;
+	}
+}
+
+static void extract_jobs_drain(void)
+{
+	unsigned i;
+
+	if (pool.jobs) {
+		parallel_jobs_finish(pool.jobs);
+		pool.jobs = NULL;
+	}
+	for (i = 0; pool.count && i <= pool.mask; i++) {
+		free(pool.names[i]);
+		pool.names[i] = NULL;
+	}
+	pool.count = 0;
+}
+
+/* Before anything looks at or writes to name, let the file of that name
+ * that a worker may have in hand land */
+static void extract_inflight_wait(const char *name)
+{
+	if (pool.count && *extract_inflight_slot(name))
+		extract_jobs_drain();
+}
+
+/* Worker side: "size mode uid gid mtime name", a NUL, then the contents */
+static int extract_job(const char *arg, void *result ATTRIBUTE_UNUSED)
+{
+	file_header_t file_header;
+	unsigned long size, uid, gid;
+	unsigned mode;
+	long mtime;
+	int name_at = 0, dst_fd;
+
+	sscanf(arg, "%lu %o %lu %lu %ld%n", &size, &mode, &uid, &gid, &mtime, &name_at);
+	file_header.name = (char *)arg + name_at + 1;
+	file_header.mode = mode;
+	file_header.uid = uid;
+	file_header.gid = gid;
+	file_header.mtime = mtime;
+
+	dst_fd = open(file_header.name, O_WRONLY | O_CREAT | O_EXCL, 0777);
+	if (dst_fd < 0
+	 || bb_full_write(dst_fd, file_header.name + strlen(file_header.name) + 1, size)
+			!= (ssize_t)size)
+		bb_perror_msg_and_die("%s", file_header.name);
+	extract_fd_metadata(dst_fd, &file_header, pool.flags);
+	close(dst_fd);
+	return EXIT_SUCCESS;
+}
+
+/* Try to have a worker write this regular file; 0 if we should do it */
+static int extract_parallel(archive_handle_t *archive_handle)
+{
+	const file_header_t *file_header = archive_handle->file_header;
+	char *arg;
+	int len;
+
+	if (!pool.nworkers || file_header->size > EXTRACT_PARALLEL_MAX_SIZE
+	 || !(archive_handle->flags & ARCHIVE_DEFER_METADATA))
+		return 0;
+	if (!pool.jobs) {
+		pool.flags = archive_handle->flags;
+		pool.jobs = parallel_jobs_start(pool.nworkers, extract_job, NULL, 0);
+		if (!pool.jobs) {
+			/* Can't have workers here, don't keep asking */
+			pool.nworkers = 0;
+			return 0;
+		}
+	}
+	extract_inflight_add(file_header->name);
+
+	arg = xmalloc(sizeof(long) * 3 * 5 + strlen(file_header->name) + 1
+			+ file_header->size);
+	len = sprintf(arg, "%lu %o %lu %lu %ld %s", (unsigned long)file_header->size,
+			(unsigned)file_header->mode, (unsigned long)file_header->uid,
+			(unsigned long)file_header->gid, (long)file_header->mtime,
+			file_header->name) + 1;
+	archive_xread_all(archive_handle, arg + len, file_header->size);
+	parallel_jobs_add_data(pool.jobs, arg, len + file_header->size);
+	free(arg);
+	return 1;
+}
+
+/* Have up to nworkers processes write small regular files from now on.
+ * Only for archives extracted with ARCHIVE_DEFER_METADATA, which makes
+ * data_extract_all_finish() wait for them. */
+void data_extract_all_parallel(int nworkers)
+{
+	pool.nworkers = nworkers;
+}
+#else
+#define extract_jobs_drain() ((void)0)
+#define extract_inflight_wait(name) ((void)0)
+#define extract_parallel(archive_handle) 0
+#endif
+
+void data_extract_all_finish(archive_handle_t *archive_handle)
+{
+	/* No directory is done until every file in it is */
+	extract_jobs_drain();
+
+	/* Deepest last in archive order, so do them backwards: that way no
+	 * directory loses its search permission before its children are done */
+	while (extract.ndirs) {
+		struct deferred_dir *d = &extract.dirs[--extract.ndirs];
+
+		if (!(archive_handle->flags & ARCHIVE_NOPRESERVE_PERM))
+			chmod(d->name, d->mode);
+		if (archive_handle->flags & ARCHIVE_PRESERVE_DATE) {
+			struct utimbuf t;
+			t.actime = t.modtime = d->mtime;
+			utime(d->name, &t);
+		}
+		free(d->name);
+	}
+	free(extract.dirs);
+	extract.dirs = NULL;
+	extract_drop_dir();
+}
+
 void data_extract_all(archive_handle_t *archive_handle)
 {
 	file_header_t *file_header = archive_handle->file_header;
-	int dst_fd;
+	const char *base;
+	int dir_fd;
+	int dst_fd = -1;
 	int res;
 
+	/* An earlier entry of this name, or the file this one links to,
+	 * may still be with a worker */
+	extract_inflight_wait(file_header->name);
+	if (S_ISREG(file_header->mode) && file_header->link_name) {
+		extract_inflight_wait(file_header->link_name);
+	}
+
+	if (extract.path) {
+		/* Don't hang on to a directory this entry is about to replace */
+		int len = strlen(file_header->name);
+		if (strncmp(extract.path, file_header->name, len) == 0
+		 && (extract.path[len] == '\0' || extract.path[len] == '/'))
+			extract_drop_dir();
+	}
+
 	if (archive_handle->flags & ARCHIVE_CREATE_LEADING_DIRS) {
-		char *name = bb_xstrdup(file_header->name);
-		bb_make_directory (dirname(name), -1, FILEUTILS_RECUR);
-		free(name);
+		const char *slash = strrchr(file_header->name, '/');
+
+		/* If we have it open already, it exists */
+		if (!slash || !extract_dir_cached(file_header->name, slash - file_header->name)) {
+			char *name = bb_xstrdup(file_header->name);
+			bb_make_directory (dirname(name), -1, FILEUTILS_RECUR);
+			free(name);
+		}
 	}
+	dir_fd = extract_dirfd(archive_handle, file_header->name, &base);
 
 	/* Check if the file already exists */
 	if (archive_handle->flags & ARCHIVE_EXTRACT_UNCONDITIONAL) {
 		/* Remove the existing entry if it exists */
-		if (((file_header->mode & S_IFMT) != S_IFDIR) && (unlink(file_header->name) == -1) && (errno != ENOENT)) {
+		if (((file_header->mode & S_IFMT) != S_IFDIR) && (unlinkat(dir_fd, base, 0) == -1) && (errno != ENOENT)) {
 			bb_perror_msg_and_die("Couldnt remove old file");
 		}
 	}
 	else if (archive_handle->flags & ARCHIVE_EXTRACT_NEWER) {
 		/* Remove the existing entry if its older than the extracted entry */
 		struct stat statbuf;
-		if (lstat(file_header->name, &statbuf) == -1) {
+		if (fstatat(dir_fd, base, &statbuf, AT_SYMLINK_NOFOLLOW) == -1) {
 			if (errno != ENOENT) {
 				bb_perror_msg_and_die("Couldnt stat old file");
 			}
@@ -61,7 +349,7 @@ void data_extract_all(archive_handle_t *archive_handle)
 			data_skip(archive_handle);
 			return;
 		}
-		else if ((unlink(file_header->name) == -1) && (errno != EISDIR)) {
+		else if ((unlinkat(dir_fd, base, 0) == -1) && (errno != EISDIR)) {
 			bb_perror_msg_and_die("Couldnt remove old file %s", file_header->name);
 		}
 	}
@@ -70,7 +358,7 @@ void data_extract_all(archive_handle_t *archive_handle)
 	 * We identified hard links as regular files of size 0 with a symlink */
 	if (S_ISREG(file_header->mode) && (file_header->link_name) && (file_header->size == 0)) {
 		/* hard link */
-		res = link(file_header->link_name, file_header->name);
+		res = linkat(AT_FDCWD, file_header->link_name, dir_fd, base, 0);
 		if ((res == -1) && !(archive_handle->flags & ARCHIVE_EXTRACT_QUIET)) {
 			bb_perror_msg("Couldnt create hard link");
 		}
@@ -79,20 +367,30 @@ void data_extract_all(archive_handle_t *archive_handle)
 		switch(file_header->mode & S_IFMT) {
 			case S_IFREG: {
 				/* Regular file */
-				dst_fd = bb_xopen(file_header->name, O_WRONLY | O_CREAT | O_EXCL);
+				if (extract_parallel(archive_handle))
+					return;
+				dst_fd = openat(dir_fd, base, O_WRONLY | O_CREAT | O_EXCL, 0777);
+				if (dst_fd < 0)
+					bb_perror_msg_and_die("%s", file_header->name);
 				bb_copyfd_size(archive_handle->src_fd, dst_fd, file_header->size);
-				close(dst_fd);
 				break;
 				}
-			case S_IFDIR:
-				res = mkdir(file_header->name, file_header->mode);
+			case S_IFDIR: {
+				mode_t mode = file_header->mode;
+
+				/* Keep it writable until data_extract_all_finish() */
+				if ((archive_handle->flags & (ARCHIVE_DEFER_METADATA | ARCHIVE_NOPRESERVE_PERM))
+						== ARCHIVE_DEFER_METADATA)
+					mode |= S_IRWXU;
+				res = mkdirat(dir_fd, base, mode);
 				if ((errno != EISDIR) && (res == -1) && !(archive_handle->flags & ARCHIVE_EXTRACT_QUIET)) {
 					bb_perror_msg("extract_archive: %s", file_header->name);
 				}
 				break;
+				}
 			case S_IFLNK:
 				/* Symlink */
-				res = symlink(file_header->link_name, file_header->name);
+				res = symlinkat(file_header->link_name, dir_fd, base);
 				if ((res == -1) && !(archive_handle->flags & ARCHIVE_EXTRACT_QUIET)) {
 					bb_perror_msg("Cannot create symlink from %s to '%s'", file_header->name, file_header->link_name);
 				}
@@ -101,7 +399,7 @@ void data_extract_all(archive_handle_t *archive_handle)
 			case S_IFBLK:
 			case S_IFCHR:
 			case S_IFIFO:
-				res = mknod(file_header->name, file_header->mode, file_header->device);
+				res = mknodat(dir_fd, base, file_header->mode, file_header->device);
 				if ((res == -1) && !(archive_handle->flags & ARCHIVE_EXTRACT_QUIET)) {
 					bb_perror_msg("Cannot create node %s", file_header->name);
 				}
@@ -111,18 +409,30 @@ void data_extract_all(archive_handle_t *archive_handle)
 		}
 	}
 
+	/* A regular file we just wrote is still open: use that */
+	if (dst_fd >= 0) {
+		extract_fd_metadata(dst_fd, file_header, archive_handle->flags);
+		close(dst_fd);
+		return;
+	}
+
 	if (!(archive_handle->flags & ARCHIVE_NOPRESERVE_OWN)) {
-		lchown(file_header->name, file_header->uid, file_header->gid);
+		fchownat(dir_fd, base, file_header->uid, file_header->gid, AT_SYMLINK_NOFOLLOW);
+	}
+	if (S_ISDIR(file_header->mode) && (archive_handle->flags & ARCHIVE_DEFER_METADATA)) {
+		extract_defer_dir(file_header);
+		return;
 	}
 	if (!(archive_handle->flags & ARCHIVE_NOPRESERVE_PERM) &&
 		 (file_header->mode & S_IFMT) != S_IFLNK)
 	{
-		chmod(file_header->name, file_header->mode);
+		fchmodat(dir_fd, base, file_header->mode, 0);
 	}
 
 	if (archive_handle->flags & ARCHIVE_PRESERVE_DATE) {
-		struct utimbuf t;
-		t.actime = t.modtime = file_header->mtime;
-		utime(file_header->name, &t);
+		struct timespec t[2];
+		t[0].tv_sec = t[1].tv_sec = file_header->mtime;
+		t[0].tv_nsec = t[1].tv_nsec = 0;
+		utimensat(dir_fd, base, t, 0);
 	}
 }
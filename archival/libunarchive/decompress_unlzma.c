@@ -9,6 +9,8 @@
  * Licensed under GPLv2 or later, see file LICENSE in this tarball for details.
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "libbb.h"
 #include "unarchive.h"
 
@@ -19,15 +21,19 @@
 #endif
 
 
+/* Compressed input: the rest of a regular file is mapped in one go,
+ * anything else (pipes, mostly) is read in big chunks */
+#define RC_BUFFER_SIZE 0x100000
+
+/* Decoded output is collected in a window at least this big, so that
+ * small dictionaries don't turn into lots of small writes */
+#define LZMA_MIN_WINDOW 0x100000
+
 typedef struct {
 	int fd;
-	uint8_t *ptr;
 	uint8_t *buffer;
 	uint8_t *buffer_end;
-	int buffer_size;
-	uint32_t code;
-	uint32_t range;
-	uint32_t bound;
+	size_t map_size;	/* 0 if buffer is malloc()ed */
 } rc_t;
 
 
@@ -36,125 +42,124 @@ typedef struct {
 #define RC_MODEL_TOTAL_BITS 11
 
 
-/* Called twice: once at startup and once in rc_normalize() */
-static void rc_read(rc_t * rc)
+/* Called when the input runs dry, which is never for a mapped file
+ * unless the stream is truncated */
+static uint8_t *rc_read(rc_t * rc)
 {
-	rc->buffer_size = read(rc->fd, rc->buffer, rc->buffer_size);
-	if (rc->buffer_size <= 0)
+	ssize_t n = 0;
+
+	if (!rc->map_size)
+		n = safe_read(rc->fd, rc->buffer, RC_BUFFER_SIZE);
+	if (n <= 0)
 		bb_error_msg_and_die("unexpected EOF");
-	rc->ptr = rc->buffer;
-	rc->buffer_end = rc->buffer + rc->buffer_size;
+	rc->buffer_end = rc->buffer + n;
+	return rc->buffer;
 }
 
-/* Called once */
-static void rc_init(rc_t * rc, int fd, int buffer_size)
+/* Called once, returns the first unread byte */
+static uint8_t *rc_init(rc_t * rc, int fd)
 {
-	int i;
+	struct stat st;
+	off_t pos, start;
 
 	rc->fd = fd;
-	rc->buffer = xmalloc(buffer_size);
-	rc->buffer_size = buffer_size;
-	rc->buffer_end = rc->buffer + rc->buffer_size;
-	rc->ptr = rc->buffer_end;
-
-	rc->code = 0;
-	rc->range = 0xFFFFFFFF;
-	for (i = 0; i < 5; i++) {
-		if (rc->ptr >= rc->buffer_end)
-			rc_read(rc);
-		rc->code = (rc->code << 8) | *rc->ptr++;
+	rc->map_size = 0;
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+	 && st.st_size > pos
+	) {
+		start = pos & ~(off_t)(getpagesize() - 1);
+		rc->map_size = st.st_size - start;
+		if ((off_t)rc->map_size == st.st_size - start) {
+			rc->buffer = mmap(NULL, rc->map_size, PROT_READ, MAP_PRIVATE,
+					fd, start);
+			if (rc->buffer != MAP_FAILED) {
+				madvise(rc->buffer, rc->map_size, MADV_SEQUENTIAL);
+				rc->buffer_end = rc->buffer + rc->map_size;
+				return rc->buffer + (pos - start);
+			}
+		}
+		rc->map_size = 0;
 	}
+	rc->buffer = xmalloc(RC_BUFFER_SIZE);
+	rc->buffer_end = rc->buffer;
+	return rc->buffer;
 }
 
 /* Called once. TODO: bb_maybe_free() */
 static ATTRIBUTE_ALWAYS_INLINE void rc_free(rc_t * rc)
 {
-	if (ENABLE_FEATURE_CLEAN_UP)
+	if (rc->map_size)
+		munmap(rc->buffer, rc->map_size);
+	else if (ENABLE_FEATURE_CLEAN_UP)
 		free(rc->buffer);
 }
 
-/* Called twice, but one callsite is in speed_inline'd rc_is_bit_0_helper() */
-static void rc_do_normalize(rc_t * rc)
-{
-	if (rc->ptr >= rc->buffer_end)
-		rc_read(rc);
-	rc->range <<= 8;
-	rc->code = (rc->code << 8) | *rc->ptr++;
-}
-static ATTRIBUTE_ALWAYS_INLINE void rc_normalize(rc_t * rc)
-{
-	if (rc->range < (1 << RC_TOP_BITS)) {
-		rc_do_normalize(rc);
-	}
-}
-
-/* Called 9 times */
-/* Why rc_is_bit_0_helper exists?
- * Because we want to always expose (rc->code < rc->bound) to optimizer
- */
-static speed_inline uint32_t rc_is_bit_0_helper(rc_t * rc, uint16_t * p)
-{
-	rc_normalize(rc);
-	rc->bound = *p * (rc->range >> RC_MODEL_TOTAL_BITS);
-	return rc->bound;
-}
-static ATTRIBUTE_ALWAYS_INLINE int rc_is_bit_0(rc_t * rc, uint16_t * p)
-{
-	uint32_t t = rc_is_bit_0_helper(rc, p);
-	return rc->code < t;
-}
-
-/* Called ~10 times, but very small, thus inlined */
-static speed_inline void rc_update_bit_0(rc_t * rc, uint16_t * p)
-{
-	rc->range = rc->bound;
-	*p += ((1 << RC_MODEL_TOTAL_BITS) - *p) >> RC_MOVE_BITS;
-}
-static speed_inline void rc_update_bit_1(rc_t * rc, uint16_t * p)
-{
-	rc->range -= rc->bound;
-	rc->code -= rc->bound;
-	*p -= *p >> RC_MOVE_BITS;
-}
-
-/* Called 4 times in unlzma loop */
-static int rc_get_bit(rc_t * rc, uint16_t * p, int *symbol)
-{
-	if (rc_is_bit_0(rc, p)) {
-		rc_update_bit_0(rc, p);
-		*symbol *= 2;
-		return 0;
-	} else {
-		rc_update_bit_1(rc, p);
-		*symbol = *symbol * 2 + 1;
-		return 1;
+/* The coder state (range, code and the input pointer) lives in locals
+ * of unlzma(), so that it stays in registers; these macros work on them.
+ * Bits the encoder makes predictable (match/rep decisions, length
+ * choices) are decoded with a branch, RC_IF_BIT_0 ... RC_UPDATE_0/1.
+ * Literal and bit-tree bits are close to random, so RC_GET_BIT decodes
+ * them with masks instead of a mispredicted jump for every other bit. */
+#define RC_NORMALIZE() \
+	if (range < (1 << RC_TOP_BITS)) { \
+		if (ptr == end) { \
+			ptr = rc_read(&rc); \
+			end = rc.buffer_end; \
+		} \
+		range <<= 8; \
+		code = (code << 8) | *ptr++; \
 	}
-}
-
-/* Called once */
-static ATTRIBUTE_ALWAYS_INLINE int rc_direct_bit(rc_t * rc)
-{
-	rc_normalize(rc);
-	rc->range >>= 1;
-	if (rc->code >= rc->range) {
-		rc->code -= rc->range;
-		return 1;
-	}
-	return 0;
-}
-
-/* Called twice */
-static speed_inline void
-rc_bit_tree_decode(rc_t * rc, uint16_t * p, int num_levels, int *symbol)
-{
-	int i = num_levels;
-
-	*symbol = 1;
-	while (i--)
-		rc_get_bit(rc, p + *symbol, symbol);
-	*symbol -= 1 << num_levels;
-}
 
+#define RC_IF_BIT_0(p) \
+	ttt = *(p); \
+	RC_NORMALIZE(); \
+	bound = (range >> RC_MODEL_TOTAL_BITS) * ttt; \
+	if (code < bound)
+
+#define RC_UPDATE_0(p) \
+	range = bound; \
+	*(p) = ttt + (((1 << RC_MODEL_TOTAL_BITS) - ttt) >> RC_MOVE_BITS)
+
+#define RC_UPDATE_1(p) \
+	range -= bound; \
+	code -= bound; \
+	*(p) = ttt - (ttt >> RC_MOVE_BITS)
+
+/* mask becomes ~0 for a 1 bit, 0 for a 0 bit */
+#define RC_GET_BIT_MASK(p, symbol, mask) \
+	ttt = *(p); \
+	RC_NORMALIZE(); \
+	bound = (range >> RC_MODEL_TOTAL_BITS) * ttt; \
+	mask = 0 - (uint32_t)(code >= bound); \
+	range = (bound & ~mask) | ((range - bound) & mask); \
+	code -= bound & mask; \
+	*(p) = ttt + ((((1 << RC_MODEL_TOTAL_BITS) - ttt) >> RC_MOVE_BITS) & ~mask) \
+		- ((ttt >> RC_MOVE_BITS) & mask); \
+	symbol = (symbol << 1) + (mask & 1)
+
+#define RC_GET_BIT(p, symbol) do { \
+	uint32_t mask_; \
+	RC_GET_BIT_MASK(p, symbol, mask_); \
+} while (0)
+
+#define RC_BIT_TREE_DECODE(p, num_levels, symbol) do { \
+	int i_ = num_levels; \
+	symbol = 1; \
+	do RC_GET_BIT((p) + symbol, symbol); while (--i_); \
+	symbol -= 1 << (num_levels); \
+} while (0)
+
+/* Fixed-probability bit, also branch-free (code < 2 * range always) */
+#define RC_DIRECT_BIT(symbol) do { \
+	uint32_t t_; \
+	RC_NORMALIZE(); \
+	range >>= 1; \
+	code -= range; \
+	t_ = 0 - (code >> 31); \
+	code += range & t_; \
+	symbol = (symbol << 1) + (t_ + 1); \
+} while (0)
 
 typedef struct {
 	uint8_t pos;
@@ -212,23 +217,64 @@ typedef struct {
 #define LZMA_LITERAL (LZMA_REP_LEN_CODER + LZMA_NUM_LEN_PROBS)
 
 
+/* Called whenever the window fills up, and once at the end */
+static void write_window(int fd, const uint8_t * buffer, size_t len)
+{
+	if (bb_full_write(fd, buffer, len) != (ssize_t) len)
+		bb_perror_msg_and_die(bb_msg_write_error);
+}
+
+/* Append len bytes found dist bytes back, without running past the end
+ * of the (circular) window; dist has been checked against the history */
+static speed_inline void
+copy_match(uint8_t * buffer, uint32_t buffer_size, uint32_t pos,
+		   uint32_t dist, uint32_t len)
+{
+	uint8_t *dst = buffer + pos;
+	const uint8_t *src;
+	uint32_t n;
+
+	if (pos < dist) {
+		/* The source starts near the end of the window: that part is
+		 * always ahead of dst, so a plain forward move is right */
+		n = dist - pos;
+		if (n > len)
+			n = len;
+		memmove(dst, buffer + buffer_size - (dist - pos), n);
+		len -= n;
+		if (!len)
+			return;
+		dst += n;
+	}
+	src = dst - dist;
+	if (dist >= len)
+		memcpy(dst, src, len);
+	else
+		/* Overlapping run: repeat the last dist bytes */
+		while (len--)
+			*dst++ = *src++;
+}
+
+
 int unlzma(int src_fd, int dst_fd)
 {
 	lzma_header_t header;
 	int lc, pb, lp;
 	uint32_t pos_state_mask;
 	uint32_t literal_pos_mask;
-	uint32_t pos;
 	uint16_t *p;
 	uint16_t *prob;
-	uint16_t *prob_lit;
 	int num_bits;
 	int num_probs;
 	rc_t rc;
+	const uint8_t *ptr, *end;
+	uint32_t range, code, bound, ttt;
 	int i, mi;
 	uint8_t *buffer;
+	uint32_t buffer_size;
 	uint8_t previous_byte = 0;
-	size_t buffer_pos = 0, global_pos = 0;
+	uint32_t buffer_pos = 0;
+	uint64_t global_pos = 0;
 	int len = 0;
 	int state = 0;
 	uint32_t rep0 = 1, rep1 = 1, rep2 = 1, rep3 = 1;
@@ -250,8 +296,16 @@ int unlzma(int src_fd, int dst_fd)
 
 	if (header.dict_size == 0)
 		header.dict_size = 1;
+	if (header.dst_size == 0)
+		return 0;
 
-	buffer = xmalloc(MIN(header.dst_size, header.dict_size));
+	/* When the whole output fits in the window it is decoded right into
+	 * place and written in one go; otherwise the window wraps around and
+	 * is written out every time it fills up */
+	buffer_size = MAX(header.dict_size, LZMA_MIN_WINDOW);
+	if (buffer_size > header.dst_size)
+		buffer_size = header.dst_size;
+	buffer = xmalloc(buffer_size);
 
 	num_probs = LZMA_BASE_SIZE + (LZMA_LIT_SIZE << (lc + lp));
 	p = xmalloc(num_probs * sizeof(*p));
@@ -259,53 +313,58 @@ int unlzma(int src_fd, int dst_fd)
 	for (i = 0; i < num_probs; i++)
 		p[i] = (1 << RC_MODEL_TOTAL_BITS) >> 1;
 
-	rc_init(&rc, src_fd, 0x10000);
+	ptr = rc_init(&rc, src_fd);
+	end = rc.buffer_end;
+	range = 0xFFFFFFFF;
+	code = 0;
+	for (i = 0; i < 5; i++) {
+		if (ptr == end) {
+			ptr = rc_read(&rc);
+			end = rc.buffer_end;
+		}
+		code = (code << 8) | *ptr++;
+	}
 
 	while (global_pos + buffer_pos < header.dst_size) {
-		int pos_state = (buffer_pos + global_pos) & pos_state_mask;
+		uint32_t pos_state = (buffer_pos + (uint32_t) global_pos) & pos_state_mask;
+		int offset;
+		uint16_t *prob_len;
 
 		prob =
 			p + LZMA_IS_MATCH + (state << LZMA_NUM_POS_BITS_MAX) + pos_state;
-		if (rc_is_bit_0(&rc, prob)) {
-			mi = 1;
-			rc_update_bit_0(&rc, prob);
+		RC_IF_BIT_0(prob) {
+			RC_UPDATE_0(prob);
 			prob = (p + LZMA_LITERAL + (LZMA_LIT_SIZE
-					* ((((buffer_pos + global_pos) & literal_pos_mask) << lc)
+					* ((((buffer_pos + (uint32_t) global_pos) & literal_pos_mask) << lc)
 					+ (previous_byte >> (8 - lc)))));
 
+			mi = 1;
 			if (state >= LZMA_NUM_LIT_STATES) {
-				int match_byte;
+				/* The byte at rep0 selects the probabilities for as
+				 * long as the decoded bits agree with it; offs drops
+				 * to 0 at the first disagreement */
+				uint32_t match_byte, offs = 0x100, bit, mask;
 
-				pos = buffer_pos - rep0;
-				while (pos >= header.dict_size)
-					pos += header.dict_size;
-				match_byte = buffer[pos];
+				match_byte = buffer[buffer_pos >= rep0 ? buffer_pos - rep0
+								: buffer_pos - rep0 + buffer_size];
 				do {
-					int bit;
-
 					match_byte <<= 1;
-					bit = match_byte & 0x100;
-					prob_lit = prob + 0x100 + bit + mi;
-					if (rc_get_bit(&rc, prob_lit, &mi)) {
-						if (!bit)
-							break;
-					} else {
-						if (bit)
-							break;
-					}
+					bit = match_byte & offs;
+					RC_GET_BIT_MASK(prob + offs + bit + mi, mi, mask);
+					offs &= ~(bit ^ mask);
 				} while (mi < 0x100);
-			}
-			while (mi < 0x100) {
-				prob_lit = prob + mi;
-				rc_get_bit(&rc, prob_lit, &mi);
+			} else {
+				do
+					RC_GET_BIT(prob + mi, mi);
+				while (mi < 0x100);
 			}
 			previous_byte = (uint8_t) mi;
 
 			buffer[buffer_pos++] = previous_byte;
-			if (buffer_pos == header.dict_size) {
+			if (buffer_pos == buffer_size) {
+				write_window(dst_fd, buffer, buffer_size);
+				global_pos += buffer_size;
 				buffer_pos = 0;
-				global_pos += header.dict_size;
-				write(dst_fd, buffer, header.dict_size);
 			}
 			if (state < 4)
 				state = 0;
@@ -313,159 +372,172 @@ int unlzma(int src_fd, int dst_fd)
 				state -= 3;
 			else
 				state -= 6;
+			continue;
+		}
+
+		RC_UPDATE_1(prob);
+		prob = p + LZMA_IS_REP + state;
+		RC_IF_BIT_0(prob) {
+			RC_UPDATE_0(prob);
+			rep3 = rep2;
+			rep2 = rep1;
+			rep1 = rep0;
+			state = state < LZMA_NUM_LIT_STATES ? 0 : 3;
+			prob = p + LZMA_LEN_CODER;
 		} else {
-			int offset;
-			uint16_t *prob_len;
-
-			rc_update_bit_1(&rc, prob);
-			prob = p + LZMA_IS_REP + state;
-			if (rc_is_bit_0(&rc, prob)) {
-				rc_update_bit_0(&rc, prob);
-				rep3 = rep2;
-				rep2 = rep1;
-				rep1 = rep0;
-				state = state < LZMA_NUM_LIT_STATES ? 0 : 3;
-				prob = p + LZMA_LEN_CODER;
-			} else {
-				rc_update_bit_1(&rc, prob);
-				prob = p + LZMA_IS_REP_G0 + state;
-				if (rc_is_bit_0(&rc, prob)) {
-					rc_update_bit_0(&rc, prob);
-					prob = (p + LZMA_IS_REP_0_LONG
-							+ (state << LZMA_NUM_POS_BITS_MAX) + pos_state);
-					if (rc_is_bit_0(&rc, prob)) {
-						rc_update_bit_0(&rc, prob);
-
-						state = state < LZMA_NUM_LIT_STATES ? 9 : 11;
-						pos = buffer_pos - rep0;
-						while (pos >= header.dict_size)
-							pos += header.dict_size;
-						previous_byte = buffer[pos];
-						buffer[buffer_pos++] = previous_byte;
-						if (buffer_pos == header.dict_size) {
-							buffer_pos = 0;
-							global_pos += header.dict_size;
-							write(dst_fd, buffer, header.dict_size);
-						}
-						continue;
-					} else {
-						rc_update_bit_1(&rc, prob);
+			RC_UPDATE_1(prob);
+			prob = p + LZMA_IS_REP_G0 + state;
+			RC_IF_BIT_0(prob) {
+				RC_UPDATE_0(prob);
+				prob = (p + LZMA_IS_REP_0_LONG
+						+ (state << LZMA_NUM_POS_BITS_MAX) + pos_state);
+				RC_IF_BIT_0(prob) {
+					RC_UPDATE_0(prob);
+
+					if (!global_pos && rep0 > buffer_pos)
+						break;
+					state = state < LZMA_NUM_LIT_STATES ? 9 : 11;
+					previous_byte = buffer[buffer_pos >= rep0
+								? buffer_pos - rep0
+								: buffer_pos - rep0 + buffer_size];
+					buffer[buffer_pos++] = previous_byte;
+					if (buffer_pos == buffer_size) {
+						write_window(dst_fd, buffer, buffer_size);
+						global_pos += buffer_size;
+						buffer_pos = 0;
 					}
+					continue;
 				} else {
-					uint32_t distance;
+					RC_UPDATE_1(prob);
+				}
+			} else {
+				uint32_t distance;
 
-					rc_update_bit_1(&rc, prob);
-					prob = p + LZMA_IS_REP_G1 + state;
-					if (rc_is_bit_0(&rc, prob)) {
-						rc_update_bit_0(&rc, prob);
-						distance = rep1;
+				RC_UPDATE_1(prob);
+				prob = p + LZMA_IS_REP_G1 + state;
+				RC_IF_BIT_0(prob) {
+					RC_UPDATE_0(prob);
+					distance = rep1;
+				} else {
+					RC_UPDATE_1(prob);
+					prob = p + LZMA_IS_REP_G2 + state;
+					RC_IF_BIT_0(prob) {
+						RC_UPDATE_0(prob);
+						distance = rep2;
 					} else {
-						rc_update_bit_1(&rc, prob);
-						prob = p + LZMA_IS_REP_G2 + state;
-						if (rc_is_bit_0(&rc, prob)) {
-							rc_update_bit_0(&rc, prob);
-							distance = rep2;
-						} else {
-							rc_update_bit_1(&rc, prob);
-							distance = rep3;
-							rep3 = rep2;
-						}
-						rep2 = rep1;
+						RC_UPDATE_1(prob);
+						distance = rep3;
+						rep3 = rep2;
 					}
-					rep1 = rep0;
-					rep0 = distance;
+					rep2 = rep1;
 				}
-				state = state < LZMA_NUM_LIT_STATES ? 8 : 11;
-				prob = p + LZMA_REP_LEN_CODER;
+				rep1 = rep0;
+				rep0 = distance;
 			}
+			state = state < LZMA_NUM_LIT_STATES ? 8 : 11;
+			prob = p + LZMA_REP_LEN_CODER;
+		}
 
-			prob_len = prob + LZMA_LEN_CHOICE;
-			if (rc_is_bit_0(&rc, prob_len)) {
-				rc_update_bit_0(&rc, prob_len);
-				prob_len = (prob + LZMA_LEN_LOW
-							+ (pos_state << LZMA_LEN_NUM_LOW_BITS));
-				offset = 0;
-				num_bits = LZMA_LEN_NUM_LOW_BITS;
+		prob_len = prob + LZMA_LEN_CHOICE;
+		RC_IF_BIT_0(prob_len) {
+			RC_UPDATE_0(prob_len);
+			prob_len = (prob + LZMA_LEN_LOW
+						+ (pos_state << LZMA_LEN_NUM_LOW_BITS));
+			offset = 0;
+			RC_BIT_TREE_DECODE(prob_len, LZMA_LEN_NUM_LOW_BITS, len);
+		} else {
+			RC_UPDATE_1(prob_len);
+			prob_len = prob + LZMA_LEN_CHOICE_2;
+			RC_IF_BIT_0(prob_len) {
+				RC_UPDATE_0(prob_len);
+				prob_len = (prob + LZMA_LEN_MID
+							+ (pos_state << LZMA_LEN_NUM_MID_BITS));
+				offset = 1 << LZMA_LEN_NUM_LOW_BITS;
+				RC_BIT_TREE_DECODE(prob_len, LZMA_LEN_NUM_MID_BITS, len);
 			} else {
-				rc_update_bit_1(&rc, prob_len);
-				prob_len = prob + LZMA_LEN_CHOICE_2;
-				if (rc_is_bit_0(&rc, prob_len)) {
-					rc_update_bit_0(&rc, prob_len);
-					prob_len = (prob + LZMA_LEN_MID
-								+ (pos_state << LZMA_LEN_NUM_MID_BITS));
-					offset = 1 << LZMA_LEN_NUM_LOW_BITS;
-					num_bits = LZMA_LEN_NUM_MID_BITS;
+				RC_UPDATE_1(prob_len);
+				prob_len = prob + LZMA_LEN_HIGH;
+				offset = ((1 << LZMA_LEN_NUM_LOW_BITS)
+						  + (1 << LZMA_LEN_NUM_MID_BITS));
+				RC_BIT_TREE_DECODE(prob_len, LZMA_LEN_NUM_HIGH_BITS, len);
+			}
+		}
+		len += offset;
+
+		if (state < 4) {
+			int pos_slot;
+
+			state += LZMA_NUM_LIT_STATES;
+			prob =
+				p + LZMA_POS_SLOT +
+				((len <
+				  LZMA_NUM_LEN_TO_POS_STATES ? len :
+				  LZMA_NUM_LEN_TO_POS_STATES - 1)
+				 << LZMA_NUM_POS_SLOT_BITS);
+			RC_BIT_TREE_DECODE(prob, LZMA_NUM_POS_SLOT_BITS, pos_slot);
+			if (pos_slot >= LZMA_START_POS_MODEL_INDEX) {
+				uint32_t mask;
+
+				num_bits = (pos_slot >> 1) - 1;
+				rep0 = 2 | (pos_slot & 1);
+				if (pos_slot < LZMA_END_POS_MODEL_INDEX) {
+					rep0 <<= num_bits;
+					prob = p + LZMA_SPEC_POS + rep0 - pos_slot - 1;
 				} else {
-					rc_update_bit_1(&rc, prob_len);
-					prob_len = prob + LZMA_LEN_HIGH;
-					offset = ((1 << LZMA_LEN_NUM_LOW_BITS)
-							  + (1 << LZMA_LEN_NUM_MID_BITS));
-					num_bits = LZMA_LEN_NUM_HIGH_BITS;
+					num_bits -= LZMA_NUM_ALIGN_BITS;
+					while (num_bits--)
+						RC_DIRECT_BIT(rep0);
+					prob = p + LZMA_ALIGN;
+					rep0 <<= LZMA_NUM_ALIGN_BITS;
+					num_bits = LZMA_NUM_ALIGN_BITS;
 				}
-			}
-			rc_bit_tree_decode(&rc, prob_len, num_bits, &len);
-			len += offset;
-
-			if (state < 4) {
-				int pos_slot;
-
-				state += LZMA_NUM_LIT_STATES;
-				prob =
-					p + LZMA_POS_SLOT +
-					((len <
-					  LZMA_NUM_LEN_TO_POS_STATES ? len :
-					  LZMA_NUM_LEN_TO_POS_STATES - 1)
-					 << LZMA_NUM_POS_SLOT_BITS);
-				rc_bit_tree_decode(&rc, prob, LZMA_NUM_POS_SLOT_BITS,
-								   &pos_slot);
-				if (pos_slot >= LZMA_START_POS_MODEL_INDEX) {
-					num_bits = (pos_slot >> 1) - 1;
-					rep0 = 2 | (pos_slot & 1);
-					if (pos_slot < LZMA_END_POS_MODEL_INDEX) {
-						rep0 <<= num_bits;
-						prob = p + LZMA_SPEC_POS + rep0 - pos_slot - 1;
-					} else {
-						num_bits -= LZMA_NUM_ALIGN_BITS;
-						while (num_bits--)
-							rep0 = (rep0 << 1) | rc_direct_bit(&rc);
-						prob = p + LZMA_ALIGN;
-						rep0 <<= LZMA_NUM_ALIGN_BITS;
-						num_bits = LZMA_NUM_ALIGN_BITS;
-					}
-					i = 1;
-					mi = 1;
-					while (num_bits--) {
-						if (rc_get_bit(&rc, prob + mi, &mi))
-							rep0 |= i;
-						i <<= 1;
-					}
-				} else
-					rep0 = pos_slot;
-				if (++rep0 == 0)
-					break;
-			}
-
-			len += LZMA_MATCH_MIN_LEN;
-
-			do {
-				pos = buffer_pos - rep0;
-				while (pos >= header.dict_size)
-					pos += header.dict_size;
-				previous_byte = buffer[pos];
-				buffer[buffer_pos++] = previous_byte;
-				if (buffer_pos == header.dict_size) {
-					buffer_pos = 0;
-					global_pos += header.dict_size;
-					write(dst_fd, buffer, header.dict_size);
+				i = 1;
+				mi = 1;
+				while (num_bits--) {
+					RC_GET_BIT_MASK(prob + mi, mi, mask);
+					rep0 |= i & mask;
+					i <<= 1;
 				}
-				len--;
-			} while (len != 0 && buffer_pos < header.dst_size);
+			} else
+				rep0 = pos_slot;
+			if (++rep0 == 0)
+				break;
 		}
+
+		/* Never reach back past what has been decoded, nor write past
+		 * the size the header promised */
+		if (rep0 > (global_pos ? buffer_size : buffer_pos))
+			break;
+		len += LZMA_MATCH_MIN_LEN;
+		if (len > header.dst_size - (global_pos + buffer_pos))
+			len = header.dst_size - (global_pos + buffer_pos);
+
+		do {
+			uint32_t n = buffer_size - buffer_pos;
+
+			if (n > (uint32_t) len)
+				n = len;
+			copy_match(buffer, buffer_size, buffer_pos, rep0, n);
+			buffer_pos += n;
+			len -= n;
+			previous_byte = buffer[buffer_pos - 1];
+			if (buffer_pos == buffer_size) {
+				write_window(dst_fd, buffer, buffer_size);
+				global_pos += buffer_size;
+				buffer_pos = 0;
+			}
+		} while (len);
 	}
 
-	write(dst_fd, buffer, buffer_pos);
+	/* Only the end marker (rep0 wrapped to 0) may stop us early */
+	if (rep0 && global_pos + buffer_pos < header.dst_size)
+		bb_error_msg_and_die("corrupted data");
+
+	write_window(dst_fd, buffer, buffer_pos);
 	rc_free(&rc);
+	if (ENABLE_FEATURE_CLEAN_UP) {
+		free(p);
+		free(buffer);
+	}
 	return 0;
 }
-
-/* vi:set ts=4: */
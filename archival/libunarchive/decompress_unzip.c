@@ -30,10 +30,16 @@
  *
  * See the file algorithm.doc for the compression algorithms and file formats.
  * 
+ * All decoder state lives in an inflate_state_t, so that several members
+ * of one zip file can be inflated independently.  Between deflate blocks
+ * that state shrinks to an input bit position and the last 32K of output,
+ * which is what an inflate_point_t records so gunzip can resume there.
+ *
  * Licensed under GPLv2 or later, see file LICENSE in this tarball for details.
  */
 
 #include "libbb.h"
+#include <errno.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include "unarchive.h"
@@ -47,31 +53,64 @@ typedef struct huft_s {
 	} v;
 } huft_t;
 
-static int gunzip_src_fd;
-unsigned int gunzip_bytes_out;	/* number of output bytes */
-static unsigned int gunzip_outbuf_count;	/* bytes in output buffer */
-
 /* gunzip_window size--must be a power of two, and
  *  at least 32K for zip's deflate method */
 enum { gunzip_wsize = 0x8000 };
-static unsigned char *gunzip_window;
-
-static uint32_t *gunzip_crc_table;
-uint32_t gunzip_crc;
 
 /* If BMAX needs to be larger than 16, then h and x[] should be ulg. */
 #define BMAX 16	/* maximum bit length of any code (16 for explode) */
 #define N_MAX 288	/* maximum number of codes in any set */
 
-/* bitbuffer */
-static unsigned int gunzip_bb;	/* bit buffer */
-static unsigned char gunzip_bk;	/* bits in bit buffer */
-
-/* These control the size of the bytebuffer */
-static unsigned int bytebuffer_max = 0x8000;
-static unsigned char *bytebuffer = NULL;
-static unsigned int bytebuffer_offset = 0;
-static unsigned int bytebuffer_size = 0;
+typedef struct inflate_state_s {
+	int src_fd;
+	off_t src_pos;		/* pread() from here, or read() if -1 */
+	off_t src_left;		/* compressed bytes left to read, or -1 */
+
+	off_t in_start;		/* file offset of the first compressed byte */
+	off_t in_read;		/* compressed bytes fetched so far */
+
+	unsigned int bytes_out;	/* number of output bytes */
+	off_t out_total;	/* same, without wrapping at 4G */
+	unsigned int outbuf_count;	/* bytes in output buffer */
+	unsigned char *window;
+
+	uint32_t *crc_table;
+	uint32_t crc;
+
+	/* bitbuffer */
+	unsigned int bb;	/* bit buffer */
+	unsigned char bk;	/* bits in bit buffer */
+
+	/* These control the size of the bytebuffer */
+	unsigned int bytebuffer_max;
+	unsigned char *bytebuffer;
+	unsigned int bytebuffer_offset;
+	unsigned int bytebuffer_size;
+
+	/* inflate_codes() state between output windows */
+	huft_t *tl, *td;
+	unsigned int bl, bd;
+	unsigned int codes_n, codes_d;
+	unsigned int codes_b, codes_k, codes_w;
+	int resume_copy;
+
+	/* inflate_stored() state between output windows */
+	unsigned int stored_n, stored_b, stored_k, stored_w;
+
+	/* inflate_get_next_window() */
+	int method;		/* -1 for stored, -2 for codes */
+	int last_block;
+	int need_another_block;
+
+	/* inflate_gunzip_index(): save a point every span output bytes */
+	void (*save_point)(const inflate_point_t *, void *);
+	void *save_arg;
+	inflate_point_t *point;
+	off_t span, next_point;
+
+	/* inflate_gunzip_range(): only write output bytes [skip, stop) */
+	off_t skip, stop;
+} inflate_state_t;
 
 static const unsigned short mask_bits[] = {
 	0x0000, 0x0001, 0x0003, 0x0007, 0x000f, 0x001f, 0x003f, 0x007f, 0x00ff,
@@ -109,21 +148,44 @@ static const unsigned char border[] = {
 	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
 };
 
-static unsigned int fill_bitbuffer(unsigned int bitbuffer, unsigned int *current, const unsigned int required)
+static void refill_bytebuffer(inflate_state_t *s)
+{
+	size_t want = s->bytebuffer_max - 8;
+	ssize_t got;
+
+	/* Never read past the end of this member's data */
+	if (s->src_left >= 0 && s->src_left < (off_t)want)
+		want = s->src_left;
+	/* Leave the first 4 bytes empty so we can always unwind the bitbuffer
+	 * to the front of the bytebuffer, leave 4 bytes free at end of tail
+	 * so we can easily top up buffer in check_trailer_gzip() */
+	if (s->src_pos < 0) {
+		got = want ? bb_xread(s->src_fd, &s->bytebuffer[4], want) : 0;
+	} else {
+		do
+			got = want ? pread(s->src_fd, &s->bytebuffer[4], want, s->src_pos) : 0;
+		while (got < 0 && errno == EINTR);
+		if (got < 0)
+			bb_perror_msg_and_die(bb_msg_read_error);
+		s->src_pos += got;
+	}
+	if (!got) {
+		bb_error_msg_and_die("unexpected end of file");
+	}
+	if (s->src_left >= 0)
+		s->src_left -= got;
+	s->in_read += got;
+	s->bytebuffer_size = got + 4;
+	s->bytebuffer_offset = 4;
+}
+
+static inline unsigned int fill_bitbuffer(inflate_state_t *s, unsigned int bitbuffer, unsigned int *current, const unsigned int required)
 {
 	while (*current < required) {
-		if (bytebuffer_offset >= bytebuffer_size) {
-			/* Leave the first 4 bytes empty so we can always unwind the bitbuffer
-			 * to the front of the bytebuffer, leave 4 bytes free at end of tail
-			 * so we can easily top up buffer in check_trailer_gzip() */
-			if (!(bytebuffer_size = bb_xread(gunzip_src_fd, &bytebuffer[4], bytebuffer_max - 8))) {
-				bb_error_msg_and_die("unexpected end of file");
-			}
-			bytebuffer_size += 4;
-			bytebuffer_offset = 4;
-		}
-		bitbuffer |= ((unsigned int) bytebuffer[bytebuffer_offset]) << *current;
-		bytebuffer_offset++;
+		if (s->bytebuffer_offset >= s->bytebuffer_size)
+			refill_bytebuffer(s);
+		bitbuffer |= ((unsigned int) s->bytebuffer[s->bytebuffer_offset]) << *current;
+		s->bytebuffer_offset++;
 		*current += 8;
 	}
 	return(bitbuffer);
@@ -339,39 +401,46 @@ int huft_build(unsigned int *b, const unsigned int n,
  * tl, td: literal/length and distance decoder tables
  * bl, bd: number of bits decoded by tl[] and td[]
  */
-static int inflate_codes(huft_t * my_tl, huft_t * my_td, const unsigned int my_bl, const unsigned int my_bd, int setup)
+static int inflate_codes(inflate_state_t *s, huft_t * my_tl, huft_t * my_td, const unsigned int my_bl, const unsigned int my_bd, int setup)
 {
-	static unsigned int e;	/* table entry flag/number of extra bits */
-	static unsigned int n, d;	/* length and index for copy */
-	static unsigned int w;	/* current gunzip_window position */
-	static huft_t *t;			/* pointer to table entry */
-	static unsigned int ml, md;	/* masks for bl and bd bits */
-	static unsigned int b;	/* bit buffer */
-	static unsigned int k;			/* number of bits in bit buffer */
-	static huft_t *tl, *td;
-	static unsigned int bl, bd;
-	static int resumeCopy = 0;
+	unsigned int e;	/* table entry flag/number of extra bits */
+	unsigned int n, d;	/* length and index for copy */
+	unsigned int w;	/* current gunzip_window position */
+	huft_t *t;			/* pointer to table entry */
+	unsigned int ml, md;	/* masks for bl and bd bits */
+	unsigned int b;	/* bit buffer */
+	unsigned int k;			/* number of bits in bit buffer */
+	huft_t *tl, *td;
+	unsigned char *gunzip_window = s->window;
 
 	if (setup) { // 1st time we are called, copy in variables
-		tl = my_tl;
-		td = my_td;
-		bl = my_bl;
-		bd = my_bd;
+		s->tl = my_tl;
+		s->td = my_td;
+		s->bl = my_bl;
+		s->bd = my_bd;
 		/* make local copies of globals */
-		b = gunzip_bb;				/* initialize bit buffer */
-		k = gunzip_bk;
-		w = gunzip_outbuf_count;			/* initialize gunzip_window position */
-
-		/* inflate the coded data */
-		ml = mask_bits[bl];	/* precompute masks for speed */
-		md = mask_bits[bd];
+		s->codes_b = s->bb;			/* initialize bit buffer */
+		s->codes_k = s->bk;
+		s->codes_w = s->outbuf_count;	/* initialize gunzip_window position */
+		s->resume_copy = 0;
 		return 0; // Don't actually do anything the first time
 	}
 
-	if (resumeCopy) goto do_copy;
+	/* Work on locals, and put them back whenever we return */
+	tl = s->tl;
+	td = s->td;
+	ml = mask_bits[s->bl];	/* precompute masks for speed */
+	md = mask_bits[s->bd];
+	b = s->codes_b;
+	k = s->codes_k;
+	w = s->codes_w;
+	n = s->codes_n;
+	d = s->codes_d;
+
+	if (s->resume_copy) goto do_copy;
 
 	while (1) {			/* do until end of block */
-		b = fill_bitbuffer(b, &k, bl);
+		b = fill_bitbuffer(s, b, &k, s->bl);
 		if ((e = (t = tl + ((unsigned) b & ml))->e) > 16)
 			do {
 				if (e == 99) {
@@ -380,7 +449,7 @@ static int inflate_codes(huft_t * my_tl, huft_t * my_td, const unsigned int my_b
 				b >>= t->b;
 				k -= t->b;
 				e -= 16;
-				b = fill_bitbuffer(b, &k, e);
+				b = fill_bitbuffer(s, b, &k, e);
 			} while ((e =
 					  (t = t->v.t + ((unsigned) b & mask_bits[e]))->e) > 16);
 		b >>= t->b;
@@ -388,9 +457,11 @@ static int inflate_codes(huft_t * my_tl, huft_t * my_td, const unsigned int my_b
 		if (e == 16) {	/* then it's a literal */
 			gunzip_window[w++] = (unsigned char) t->v.n;
 			if (w == gunzip_wsize) {
-				gunzip_outbuf_count = (w);
+				s->outbuf_count = (w);
 				//flush_gunzip_window();
-				w = 0;
+				s->codes_w = 0;
+				s->codes_b = b;
+				s->codes_k = k;
 				return 1; // We have a block to read
 			}
 		} else {		/* it's an EOB or a length */
@@ -401,13 +472,13 @@ static int inflate_codes(huft_t * my_tl, huft_t * my_td, const unsigned int my_b
 			}
 
 			/* get length of block to copy */
-			b = fill_bitbuffer(b, &k, e);
+			b = fill_bitbuffer(s, b, &k, e);
 			n = t->v.n + ((unsigned) b & mask_bits[e]);
 			b >>= e;
 			k -= e;
 
 			/* decode distance of block to copy */
-			b = fill_bitbuffer(b, &k, bd);
+			b = fill_bitbuffer(s, b, &k, s->bd);
 			if ((e = (t = td + ((unsigned) b & md))->e) > 16)
 				do {
 					if (e == 99)
@@ -415,13 +486,13 @@ static int inflate_codes(huft_t * my_tl, huft_t * my_td, const unsigned int my_b
 					b >>= t->b;
 					k -= t->b;
 					e -= 16;
-					b = fill_bitbuffer(b, &k, e);
+					b = fill_bitbuffer(s, b, &k, e);
 				} while ((e =
 						  (t =
 						   t->v.t + ((unsigned) b & mask_bits[e]))->e) > 16);
 			b >>= t->b;
 			k -= t->b;
-			b = fill_bitbuffer(b, &k, e);
+			b = fill_bitbuffer(s, b, &k, e);
 			d = w - t->v.n - ((unsigned) b & mask_bits[e]);
 			b >>= e;
 			k -= e;
@@ -444,22 +515,25 @@ do_copy:		do {
 					} while (--e);
 				}
 				if (w == gunzip_wsize) {
-					gunzip_outbuf_count = (w);
-					if (n) resumeCopy = 1;
-					else resumeCopy = 0;
+					s->outbuf_count = (w);
+					s->resume_copy = (n != 0);
 					//flush_gunzip_window();
-					w = 0;
+					s->codes_w = 0;
+					s->codes_b = b;
+					s->codes_k = k;
+					s->codes_n = n;
+					s->codes_d = d;
 					return 1;
 				}
 			} while (n);
-			resumeCopy = 0;
+			s->resume_copy = 0;
 		}
 	}
 
 	/* restore the globals from the locals */
-	gunzip_outbuf_count = w;			/* restore global gunzip_window pointer */
-	gunzip_bb = b;				/* restore global bit buffer */
-	gunzip_bk = k;
+	s->outbuf_count = w;			/* restore global gunzip_window pointer */
+	s->bb = b;				/* restore global bit buffer */
+	s->bk = k;
 
 	/* normally just after call to inflate_codes, but save code by putting it here */
 	/* free the decoding tables, return */
@@ -470,27 +544,33 @@ do_copy:		do {
 	return 0;
 }
 
-static int inflate_stored(int my_n, int my_b_stored, int my_k_stored, int setup)
+static int inflate_stored(inflate_state_t *s, int my_n, int my_b_stored, int my_k_stored, int setup)
 {
-	static unsigned int n, b_stored, k_stored, w;
+	unsigned int n, b_stored, k_stored, w;
+
 	if (setup) {
-		n = my_n;
-		b_stored = my_b_stored;
-		k_stored = my_k_stored;
-		w = gunzip_outbuf_count;		/* initialize gunzip_window position */
+		s->stored_n = my_n;
+		s->stored_b = my_b_stored;
+		s->stored_k = my_k_stored;
+		s->stored_w = s->outbuf_count;	/* initialize gunzip_window position */
 		return 0; // Don't do anything first time
 	}
+	n = s->stored_n;
+	b_stored = s->stored_b;
+	k_stored = s->stored_k;
+	w = s->stored_w;
 
 	/* read and output the compressed data */
 	while (n--) {
-		b_stored = fill_bitbuffer(b_stored, &k_stored, 8);
-		gunzip_window[w++] = (unsigned char) b_stored;
+		b_stored = fill_bitbuffer(s, b_stored, &k_stored, 8);
+		s->window[w++] = (unsigned char) b_stored;
 		if (w == gunzip_wsize) {
-			gunzip_outbuf_count = (w);
+			s->outbuf_count = (w);
 			//flush_gunzip_window();
-			w = 0;
-			b_stored >>= 8;
-			k_stored -= 8;
+			s->stored_w = 0;
+			s->stored_n = n;
+			s->stored_b = b_stored >> 8;
+			s->stored_k = k_stored - 8;
 			return 1; // We have a block
 		}
 		b_stored >>= 8;
@@ -498,9 +578,9 @@ static int inflate_stored(int my_n, int my_b_stored, int my_k_stored, int setup)
 	}
 
 	/* restore the globals from the locals */
-	gunzip_outbuf_count = w;		/* restore global gunzip_window pointer */
-	gunzip_bb = b_stored;	/* restore global bit buffer */
-	gunzip_bk = k_stored;
+	s->outbuf_count = w;		/* restore global gunzip_window pointer */
+	s->bb = b_stored;	/* restore global bit buffer */
+	s->bk = k_stored;
 	return 0; // Finished
 }
 
@@ -511,7 +591,7 @@ static int inflate_stored(int my_n, int my_b_stored, int my_k_stored, int setup)
  * GLOBAL VARIABLES: bb, kk,
  */
  // Return values: -1 = inflate_stored, -2 = inflate_codes
-static int inflate_block(int *e)
+static int inflate_block(inflate_state_t *s, int *e)
 {
 	unsigned t;			/* block type */
 	register unsigned int b;	/* bit buffer */
@@ -519,24 +599,24 @@ static int inflate_block(int *e)
 
 	/* make local bit buffer */
 
-	b = gunzip_bb;
-	k = gunzip_bk;
+	b = s->bb;
+	k = s->bk;
 
 	/* read in last block bit */
-	b = fill_bitbuffer(b, &k, 1);
+	b = fill_bitbuffer(s, b, &k, 1);
 	*e = (int) b & 1;
 	b >>= 1;
 	k -= 1;
 
 	/* read in block type */
-	b = fill_bitbuffer(b, &k, 2);
+	b = fill_bitbuffer(s, b, &k, 2);
 	t = (unsigned) b & 3;
 	b >>= 2;
 	k -= 2;
 
 	/* restore the global bit buffer */
-	gunzip_bb = b;
-	gunzip_bk = k;
+	s->bb = b;
+	s->bk = k;
 
 	/* inflate that block type */
 	switch (t) {
@@ -547,8 +627,8 @@ static int inflate_block(int *e)
 		unsigned int k_stored;	/* number of bits in bit buffer */
 
 		/* make local copies of globals */
-		b_stored = gunzip_bb;	/* initialize bit buffer */
-		k_stored = gunzip_bk;
+		b_stored = s->bb;	/* initialize bit buffer */
+		k_stored = s->bk;
 
 		/* go to byte boundary */
 		n = k_stored & 7;
@@ -556,19 +636,19 @@ static int inflate_block(int *e)
 		k_stored -= n;
 
 		/* get the length and its complement */
-		b_stored = fill_bitbuffer(b_stored, &k_stored, 16);
+		b_stored = fill_bitbuffer(s, b_stored, &k_stored, 16);
 		n = ((unsigned) b_stored & 0xffff);
 		b_stored >>= 16;
 		k_stored -= 16;
 
-		b_stored = fill_bitbuffer(b_stored, &k_stored, 16);
+		b_stored = fill_bitbuffer(s, b_stored, &k_stored, 16);
 		if (n != (unsigned) ((~b_stored) & 0xffff)) {
 			return 1;	/* error in compressed data */
 		}
 		b_stored >>= 16;
 		k_stored -= 16;
 
-		inflate_stored(n, b_stored, k_stored, 1); // Setup inflate_stored
+		inflate_stored(s, n, b_stored, k_stored, 1); // Setup inflate_stored
 		return -1;
 	}
 	case 1:			/* Inflate fixed
@@ -613,7 +693,7 @@ static int inflate_block(int *e)
 		}
 
 		/* decompress until an end-of-block code */
-		inflate_codes(tl, td, bl, bd, 1); // Setup inflate_codes
+		inflate_codes(s, tl, td, bl, bd, 1); // Setup inflate_codes
 
 		/* huft_free code moved into inflate_codes */
 
@@ -642,21 +722,21 @@ static int inflate_block(int *e)
 		unsigned int k_dynamic;	/* number of bits in bit buffer */
 
 		/* make local bit buffer */
-		b_dynamic = gunzip_bb;
-		k_dynamic = gunzip_bk;
+		b_dynamic = s->bb;
+		k_dynamic = s->bk;
 
 		/* read in table lengths */
-		b_dynamic = fill_bitbuffer(b_dynamic, &k_dynamic, 5);
+		b_dynamic = fill_bitbuffer(s, b_dynamic, &k_dynamic, 5);
 		nl = 257 + ((unsigned int) b_dynamic & 0x1f);	/* number of literal/length codes */
 
 		b_dynamic >>= 5;
 		k_dynamic -= 5;
-		b_dynamic = fill_bitbuffer(b_dynamic, &k_dynamic, 5);
+		b_dynamic = fill_bitbuffer(s, b_dynamic, &k_dynamic, 5);
 		nd = 1 + ((unsigned int) b_dynamic & 0x1f);	/* number of distance codes */
 
 		b_dynamic >>= 5;
 		k_dynamic -= 5;
-		b_dynamic = fill_bitbuffer(b_dynamic, &k_dynamic, 4);
+		b_dynamic = fill_bitbuffer(s, b_dynamic, &k_dynamic, 4);
 		nb = 4 + ((unsigned int) b_dynamic & 0xf);	/* number of bit length codes */
 
 		b_dynamic >>= 4;
@@ -667,7 +747,7 @@ static int inflate_block(int *e)
 
 		/* read in bit-length-code lengths */
 		for (j = 0; j < nb; j++) {
-			b_dynamic = fill_bitbuffer(b_dynamic, &k_dynamic, 3);
+			b_dynamic = fill_bitbuffer(s, b_dynamic, &k_dynamic, 3);
 			ll[border[j]] = (unsigned int) b_dynamic & 7;
 			b_dynamic >>= 3;
 			k_dynamic -= 3;
@@ -691,7 +771,7 @@ static int inflate_block(int *e)
 		m = mask_bits[bl];
 		i = l = 0;
 		while ((unsigned int) i < n) {
-			b_dynamic = fill_bitbuffer(b_dynamic, &k_dynamic, (unsigned int)bl);
+			b_dynamic = fill_bitbuffer(s, b_dynamic, &k_dynamic, (unsigned int)bl);
 			j = (td = tl + ((unsigned int) b_dynamic & m))->b;
 			b_dynamic >>= j;
 			k_dynamic -= j;
@@ -699,7 +779,7 @@ static int inflate_block(int *e)
 			if (j < 16) {	/* length of code in bits (0..15) */
 				ll[i++] = l = j;	/* save last length in l */
 			} else if (j == 16) {	/* repeat last length 3 to 6 times */
-				b_dynamic = fill_bitbuffer(b_dynamic, &k_dynamic, 2);
+				b_dynamic = fill_bitbuffer(s, b_dynamic, &k_dynamic, 2);
 				j = 3 + ((unsigned int) b_dynamic & 3);
 				b_dynamic >>= 2;
 				k_dynamic -= 2;
@@ -710,7 +790,7 @@ static int inflate_block(int *e)
 					ll[i++] = l;
 				}
 			} else if (j == 17) {	/* 3 to 10 zero length codes */
-				b_dynamic = fill_bitbuffer(b_dynamic, &k_dynamic, 3);
+				b_dynamic = fill_bitbuffer(s, b_dynamic, &k_dynamic, 3);
 				j = 3 + ((unsigned int) b_dynamic & 7);
 				b_dynamic >>= 3;
 				k_dynamic -= 3;
@@ -722,7 +802,7 @@ static int inflate_block(int *e)
 				}
 				l = 0;
 			} else {	/* j == 18: 11 to 138 zero length codes */
-				b_dynamic = fill_bitbuffer(b_dynamic, &k_dynamic, 7);
+				b_dynamic = fill_bitbuffer(s, b_dynamic, &k_dynamic, 7);
 				j = 11 + ((unsigned int) b_dynamic & 0x7f);
 				b_dynamic >>= 7;
 				k_dynamic -= 7;
@@ -740,8 +820,8 @@ static int inflate_block(int *e)
 		huft_free(tl);
 
 		/* restore the global bit buffer */
-		gunzip_bb = b_dynamic;
-		gunzip_bk = k_dynamic;
+		s->bb = b_dynamic;
+		s->bk = k_dynamic;
 
 		/* build the decoding tables for literal/length and distance codes */
 		bl = lbits;
@@ -765,7 +845,7 @@ static int inflate_block(int *e)
 		}
 
 		/* decompress until an end-of-block code */
-		inflate_codes(tl, td, bl, bd, 1); // Setup inflate_codes
+		inflate_codes(s, tl, td, bl, bd, 1); // Setup inflate_codes
 
 		/* huft_free code moved into inflate_codes */
 
@@ -777,146 +857,279 @@ static int inflate_block(int *e)
 	}
 }
 
-static void calculate_gunzip_crc(void)
+static void calculate_gunzip_crc(inflate_state_t *s)
 {
+	uint32_t crc = s->crc;
 	int n;
-	for (n = 0; n < gunzip_outbuf_count; n++) {
-		gunzip_crc = gunzip_crc_table[((int) gunzip_crc ^ (gunzip_window[n])) & 0xff] ^ (gunzip_crc >> 8);
+
+	for (n = 0; n < s->outbuf_count; n++) {
+		crc = s->crc_table[((int) crc ^ (s->window[n])) & 0xff] ^ (crc >> 8);
 	}
-	gunzip_bytes_out += gunzip_outbuf_count;
+	s->crc = crc;
+	s->bytes_out += s->outbuf_count;
+	s->out_total += s->outbuf_count;
 }
 
-static int inflate_get_next_window(void)
+/* Called between blocks, when the bit buffer and the window are all the
+ * state there is */
+static void inflate_save_point(inflate_state_t *s)
 {
-	static int method = -1; // Method == -1 for stored, -2 for codes
-	static int e = 0;
-	static int needAnotherBlock = 1;
+	inflate_point_t *p = s->point;
+	unsigned int w = s->outbuf_count;
+	off_t bit;
+
+	/* Bytes fetched but not yet in the bit buffer, then the bits that are */
+	bit = s->in_start + s->in_read
+		- ((off_t)s->bytebuffer_size - s->bytebuffer_offset);
+	bit = bit * 8 - s->bk;
+	p->in = bit >> 3;
+	p->bits = bit & 7;
+	p->out = s->out_total + w;
+
+	/* The window is circular: the oldest byte follows the newest one */
+	memcpy(p->window, s->window + w, gunzip_wsize - w);
+	memcpy(p->window + gunzip_wsize - w, s->window, w);
+
+	s->save_point(p, s->save_arg);
+	s->next_point = p->out + s->span;
+}
 
-	gunzip_outbuf_count = 0;
+static int inflate_get_next_window(inflate_state_t *s)
+{
+	s->outbuf_count = 0;
 
 	while(1) {
 		int ret;
 
-		if (needAnotherBlock) {
-			if(e) {
-				calculate_gunzip_crc();
-				e = 0;
-				needAnotherBlock = 1;
+		if (s->need_another_block) {
+			if(s->last_block) {
+				calculate_gunzip_crc(s);
+				s->last_block = 0;
+				s->need_another_block = 1;
 				return 0;
 			} // Last block
-			method = inflate_block(&e);
-			needAnotherBlock = 0;
+			if (ENABLE_FEATURE_GUNZIP_INDEX && s->save_point
+			 && s->out_total + s->outbuf_count >= s->next_point)
+				inflate_save_point(s);
+			s->method = inflate_block(s, &s->last_block);
+			s->need_another_block = 0;
 		}
 
-		switch (method) {
-			case -1:	ret = inflate_stored(0,0,0,0);
+		switch (s->method) {
+			case -1:	ret = inflate_stored(s, 0,0,0,0);
 					break;
-			case -2:	ret = inflate_codes(0,0,0,0,0);
+			case -2:	ret = inflate_codes(s, 0,0,0,0,0);
 					break;
-			default:	bb_error_msg_and_die("inflate error %d", method);
+			default:	bb_error_msg_and_die("inflate error %d", s->method);
 		}
 
 		if (ret == 1) {
-			calculate_gunzip_crc();
+			calculate_gunzip_crc(s);
 			return 1; // More data left
-		} else needAnotherBlock = 1; // End of that block
+		} else s->need_another_block = 1; // End of that block
 	}
 	/* Doesnt get here */
 }
 
-/* Initialise bytebuffer, be careful not to overfill the buffer */
-void inflate_init(unsigned int bufsize)
+static void inflate_state_init(inflate_state_t *s, int in, off_t pos, off_t len)
 {
-	/* Set the bytebuffer size, default is same as gunzip_wsize */
-	bytebuffer_max = bufsize + 8;
-	bytebuffer_offset = 4;
-	bytebuffer_size = 0;
+	memset(s, 0, sizeof(*s));
+	s->src_fd = in;
+	s->src_pos = pos;
+	s->src_left = len;
+	s->method = -1;
+	s->need_another_block = 1;
+	s->stop = -1;
+
+	/* Allocate all global buffers (for DYN_ALLOC option).  The window
+	 * is cleared so saved points never contain stale heap contents */
+	s->window = xzalloc(gunzip_wsize);
+
+	/* Create the crc table */
+	s->crc_table = bb_crc32_filltable(0);
+	s->crc = ~0;
+
+	/* Allocate space for buffer */
+	s->bytebuffer_max = 0x8000;
+	s->bytebuffer = xmalloc(s->bytebuffer_max);
+	s->bytebuffer_offset = 4;
 }
 
-void inflate_cleanup(void)
+/* Write the part of the window that falls inside [skip, stop) */
+static ssize_t inflate_write(inflate_state_t *s, int out)
 {
-	free(bytebuffer);
+	off_t start = s->out_total - s->outbuf_count;	/* offset of window[0] */
+	off_t from = 0, to = s->outbuf_count;
+
+	if (s->skip > start)
+		from = s->skip - start < to ? s->skip - start : to;
+	if (s->stop >= 0 && s->stop < s->out_total)
+		to = s->stop - start > from ? s->stop - start : from;
+	return bb_full_write(out, s->window + from, to - from);
 }
 
-int inflate_unzip(int in, int out)
+/* Returns 1 if we stopped early because the rest of the output is not
+ * wanted, 0 at the end of the stream, -1 on a write error */
+static int inflate_run(inflate_state_t *s, int out)
 {
-	ssize_t nwrote;
-	typedef void (*sig_type) (int);
-
-	/* Allocate all global buffers (for DYN_ALLOC option) */
-	gunzip_window = xmalloc(gunzip_wsize);
-	gunzip_outbuf_count = 0;
-	gunzip_bytes_out = 0;
-	gunzip_src_fd = in;
-
-	/* initialize gunzip_window, bit buffer */
-	gunzip_bk = 0;
-	gunzip_bb = 0;
-
-	/* Create the crc table */
-	gunzip_crc_table = bb_crc32_filltable(0);
-	gunzip_crc = ~0;
-	
-	/* Allocate space for buffer */
-	bytebuffer = xmalloc(bytebuffer_max);
+	int ret;
 
 	while(1) {
-		int ret = inflate_get_next_window();
-		nwrote = bb_full_write(out, gunzip_window, gunzip_outbuf_count);
-		if (nwrote == -1) {
+		ret = inflate_get_next_window(s);
+		if (out >= 0 && inflate_write(s, out) == -1) {
 			bb_perror_msg("write");
 			return -1;
 		}
+		if (s->stop >= 0 && s->out_total >= s->stop) {
+			ret = !!ret;
+			break;
+		}
 		if (ret == 0) break;
 	}
 
 	/* Cleanup */
-	free(gunzip_window);
-	free(gunzip_crc_table);
+	free(s->window);
+	free(s->crc_table);
 
 	/* Store unused bytes in a global buffer so calling applets can access it */
-	if (gunzip_bk >= 8) {
+	if (s->bk >= 8) {
 		/* Undo too much lookahead. The next read will be byte aligned
 		 * so we can discard unused bits in the last meaningful byte. */
-		bytebuffer_offset--;
-		bytebuffer[bytebuffer_offset] = gunzip_bb & 0xff;
-		gunzip_bb >>= 8;
-		gunzip_bk -= 8;
+		s->bytebuffer_offset--;
+		s->bytebuffer[s->bytebuffer_offset] = s->bb & 0xff;
+		s->bb >>= 8;
+		s->bk -= 8;
 	}
-	return 0;
+	return ret;
 }
 
-int inflate_gunzip(int in, int out)
+/* Inflate the len bytes of raw deflate data at offset pos of in (or at
+ * the current position, reading no further, if pos is -1) to out.
+ * Reading with pread() leaves the file position alone, so independent
+ * members of one file may be inflated at the same time. */
+int inflate_unzip(int in, off_t pos, off_t len, int out,
+		uint32_t *crc, unsigned int *bytes_out)
+{
+	inflate_state_t s;
+	int ret;
+
+	inflate_state_init(&s, in, pos, len);
+	ret = inflate_run(&s, out);
+	free(s.bytebuffer);
+	*crc = ~s.crc;
+	*bytes_out = s.bytes_out;
+	return ret;
+}
+
+/* Check the crc and length in the gzip trailer following the data */
+static int check_trailer_gzip(inflate_state_t *s)
 {
 	uint32_t stored_crc = 0;
 	unsigned int count;
 
-	inflate_unzip(in, out);
-
 	/* top up the input buffer with the rest of the trailer */
-	count = bytebuffer_size - bytebuffer_offset;
+	count = s->bytebuffer_size - s->bytebuffer_offset;
 	if (count < 8) {
-		bb_xread_all(in, &bytebuffer[bytebuffer_size], 8 - count);
-		bytebuffer_size += 8 - count;
+		bb_xread_all(s->src_fd, &s->bytebuffer[s->bytebuffer_size], 8 - count);
+		s->bytebuffer_size += 8 - count;
 	}
 	for (count = 0; count != 4; count++) {
-		stored_crc |= (bytebuffer[bytebuffer_offset] << (count * 8));
-		bytebuffer_offset++;
+		stored_crc |= (s->bytebuffer[s->bytebuffer_offset] << (count * 8));
+		s->bytebuffer_offset++;
 	}
 
 	/* Validate decompression - crc */
-	if (stored_crc != (~gunzip_crc)) {
+	if (stored_crc != (~s->crc)) {
 		bb_error_msg("crc error");
 		return -1;
 	}
 
 	/* Validate decompression - size */
-	if (gunzip_bytes_out !=
-		(bytebuffer[bytebuffer_offset] | (bytebuffer[bytebuffer_offset+1] << 8) |
-		(bytebuffer[bytebuffer_offset+2] << 16) | (bytebuffer[bytebuffer_offset+3] << 24))) {
+	if (s->bytes_out !=
+		(s->bytebuffer[s->bytebuffer_offset] | (s->bytebuffer[s->bytebuffer_offset+1] << 8) |
+		(s->bytebuffer[s->bytebuffer_offset+2] << 16) | (s->bytebuffer[s->bytebuffer_offset+3] << 24))) {
 		bb_error_msg("Incorrect length");
 		return -1;
 	}
-
 	return 0;
 }
+
+int inflate_gunzip(int in, int out)
+{
+	inflate_state_t s;
+	int ret;
+
+	inflate_state_init(&s, in, -1, -1);
+	ret = inflate_run(&s, out);
+	if (ret == 0)
+		ret = check_trailer_gzip(&s);
+	free(s.bytebuffer);
+	return ret;
+}
+
+#ifdef CONFIG_FEATURE_GUNZIP_INDEX
+/* Inflate the rest of in (positioned just past the gzip header) without
+ * writing anything, handing save() a resume point at the first block
+ * boundary after every span bytes of output. */
+int inflate_gunzip_index(int in, off_t span,
+		void (*save)(const inflate_point_t *, void *), void *arg)
+{
+	inflate_state_t s;
+	int ret;
+
+	inflate_state_init(&s, in, -1, -1);
+	s.in_start = lseek(in, 0, SEEK_CUR);
+	if (s.in_start < 0)
+		bb_perror_msg_and_die("lseek");
+	s.save_point = save;
+	s.save_arg = arg;
+	s.point = xmalloc(sizeof(*s.point));
+	s.span = s.next_point = span;
+
+	ret = inflate_run(&s, -1);
+	if (ret == 0)
+		ret = check_trailer_gzip(&s);
+	free(s.point);
+	free(s.bytebuffer);
+	return ret;
+}
+
+/* Write len bytes (or everything, if len is -1) of uncompressed data from
+ * offset skip on.  Decoding resumes at point if there is one (in must be
+ * seekable then), otherwise it starts from in's current position, just
+ * past the gzip header.  The trailer is only checked when the whole
+ * stream has been decoded from the start. */
+int inflate_gunzip_range(int in, const inflate_point_t *point,
+		off_t skip, off_t len, int out)
+{
+	inflate_state_t s;
+	int ret;
+
+	if (point) {
+		inflate_state_init(&s, in, point->in, -1);
+		if (point->bits) {
+			unsigned char c;
+
+			if (pread(in, &c, 1, point->in) != 1)
+				bb_error_msg_and_die("unexpected end of file");
+			s.bb = c >> point->bits;
+			s.bk = 8 - point->bits;
+			s.src_pos++;
+		}
+		memcpy(s.window, point->window, gunzip_wsize);
+		s.out_total = point->out;
+	} else
+		inflate_state_init(&s, in, -1, -1);
+	s.skip = skip;
+	if (len >= 0)
+		s.stop = skip + len;
+
+	ret = inflate_run(&s, out);
+	if (ret == 1 || (ret == 0 && point))
+		ret = 0;
+	else if (ret == 0)
+		ret = check_trailer_gzip(&s);
+	free(s.bytebuffer);
+	return ret;
+}
+#endif
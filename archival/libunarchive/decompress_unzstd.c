@@ -0,0 +1,1083 @@
+/* vi:set ts=4: */
+/*
+ * Small zstd decompression implementation.
+ *
+ * Decodes zstd frames as described in RFC 8878: raw, RLE and compressed
+ * blocks, Huffman coded literals and FSE coded sequences, with the
+ * optional XXH64 content checksum.  Skippable frames are skipped and
+ * concatenated frames are decoded one after the other.  Dictionaries
+ * are not supported.
+ *
+ * Copyright (C) 2006 by BusyBox developers
+ *
+ * Licensed under GPLv2 or later, see file LICENSE in this tarball for details.
+ */
+
+#include "libbb.h"
+#include "unarchive.h"
+
+#define ZSTD_MAGIC				0xFD2FB528
+#define ZSTD_SKIPPABLE_MAGIC	0x184D2A50	/* low nibble is free */
+#define ZSTD_BLOCK_MAX			(128 * 1024)
+#define ZSTD_WINDOW_MAX			((uint64_t)1 << 31)
+
+/* Decoded output is kept in a buffer holding the window plus this much
+ * (or the window again, if bigger), so that history only has to be
+ * moved down every so often */
+#define ZSTD_MIN_SLIDE			(1024 * 1024)
+
+/* Literal and match copies are done in 16 byte chunks and may run this
+ * far past the end; every buffer they touch has room for it */
+#define WILDCOPY_SLACK			32
+
+#define IN_BUFSIZE				(2 * ZSTD_BLOCK_MAX + 1024)
+
+#define HUF_MAX_BITS			11
+#define HUF_MAX_SYMBOLS			256
+
+#define LL_MAX_LOG				9
+#define ML_MAX_LOG				9
+#define OF_MAX_LOG				8
+#define LL_MAX_SYMBOL			35
+#define ML_MAX_SYMBOL			52
+#define OF_MAX_SYMBOL			31
+
+static void corrupted(void) ATTRIBUTE_NORETURN;
+static void corrupted(void)
+{
+	bb_error_msg_and_die("corrupted data");
+}
+
+static uint32_t get_le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return SWAP_LE32(v);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, 8);
+	return SWAP_LE64(v);
+}
+
+static int highbit32(uint32_t v)
+{
+	return 31 - __builtin_clz(v);
+}
+
+
+/* Buffered input.  Blocks are at most ZSTD_BLOCK_MAX bytes, so a whole
+ * block is always made available in one piece. */
+typedef struct {
+	int fd;
+	uint8_t *buf;
+	size_t pos, end;
+} zin_t;
+
+/* Make sure len bytes are buffered; 0 if the input ends first */
+static int in_fill(zin_t *in, size_t len)
+{
+	ssize_t n;
+
+	if (in->end - in->pos >= len)
+		return 1;
+	memmove(in->buf, in->buf + in->pos, in->end - in->pos);
+	in->end -= in->pos;
+	in->pos = 0;
+	while (in->end < len) {
+		n = safe_read(in->fd, in->buf + in->end, IN_BUFSIZE - in->end);
+		if (n < 0)
+			bb_perror_msg_and_die(bb_msg_read_error);
+		if (n == 0)
+			return 0;
+		in->end += n;
+	}
+	return 1;
+}
+
+static const uint8_t *in_need(zin_t *in, size_t len)
+{
+	const uint8_t *p;
+
+	if (!in_fill(in, len))
+		bb_error_msg_and_die("unexpected EOF");
+	p = in->buf + in->pos;
+	in->pos += len;
+	return p;
+}
+
+
+/* XXH64, for the optional content checksum */
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+typedef struct {
+	uint64_t v[4];
+	uint64_t total;
+	uint8_t mem[32];
+	unsigned memsize;
+} xxh64_t;
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+static void xxh64_init(xxh64_t *x)
+{
+	memset(x, 0, sizeof(*x));
+	x->v[0] = PRIME64_1 + PRIME64_2;
+	x->v[1] = PRIME64_2;
+	x->v[3] = -PRIME64_1;
+}
+
+static void xxh64_stripes(xxh64_t *x, const uint8_t *p, size_t len)
+{
+	uint64_t v0 = x->v[0], v1 = x->v[1], v2 = x->v[2], v3 = x->v[3];
+
+	for (; len >= 32; p += 32, len -= 32) {
+		v0 = xxh64_round(v0, get_le64(p));
+		v1 = xxh64_round(v1, get_le64(p + 8));
+		v2 = xxh64_round(v2, get_le64(p + 16));
+		v3 = xxh64_round(v3, get_le64(p + 24));
+	}
+	x->v[0] = v0;
+	x->v[1] = v1;
+	x->v[2] = v2;
+	x->v[3] = v3;
+}
+
+static void xxh64_update(xxh64_t *x, const uint8_t *p, size_t len)
+{
+	size_t n;
+
+	x->total += len;
+	if (x->memsize) {
+		n = MIN(len, 32 - x->memsize);
+		memcpy(x->mem + x->memsize, p, n);
+		x->memsize += n;
+		p += n;
+		len -= n;
+		if (x->memsize < 32)
+			return;
+		xxh64_stripes(x, x->mem, 32);
+		x->memsize = 0;
+	}
+	n = len & ~(size_t)31;
+	xxh64_stripes(x, p, n);
+	memcpy(x->mem, p + n, len - n);
+	x->memsize = len - n;
+}
+
+static uint64_t xxh64_digest(const xxh64_t *x)
+{
+	const uint8_t *p = x->mem;
+	unsigned len = x->memsize;
+	uint64_t h;
+
+	if (x->total >= 32) {
+		h = rotl64(x->v[0], 1) + rotl64(x->v[1], 7)
+			+ rotl64(x->v[2], 12) + rotl64(x->v[3], 18);
+		h = xxh64_merge(h, x->v[0]);
+		h = xxh64_merge(h, x->v[1]);
+		h = xxh64_merge(h, x->v[2]);
+		h = xxh64_merge(h, x->v[3]);
+	} else
+		h = x->v[2] + PRIME64_5;
+	h += x->total;
+
+	for (; len >= 8; p += 8, len -= 8) {
+		h ^= xxh64_round(0, get_le64(p));
+		h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+	}
+	if (len >= 4) {
+		h ^= (uint64_t)get_le32(p) * PRIME64_1;
+		h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+		len -= 4;
+	}
+	while (len--) {
+		h ^= *p++ * PRIME64_5;
+		h = rotl64(h, 11) * PRIME64_1;
+	}
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+
+/* Backward bit stream: Huffman and FSE streams are written forwards
+ * and read from the last byte back.  The highest set bit of the last
+ * byte marks where the data starts.  Reading past the beginning yields
+ * zeroes; br_overflowed()/br_finished() tell the callers about it. */
+typedef struct {
+	uint64_t bits;
+	unsigned consumed;
+	const uint8_t *ptr, *start;
+} bitrev_t;
+
+static void br_init(bitrev_t *br, const uint8_t *src, size_t len)
+{
+	size_t i;
+
+	if (len == 0 || src[len - 1] == 0)
+		corrupted();
+	br->start = src;
+	br->consumed = 0;
+	if (len >= 8) {
+		br->ptr = src + len - 8;
+		br->bits = get_le64(br->ptr);
+	} else {
+		br->ptr = src;
+		br->bits = 0;
+		for (i = 0; i < len; i++)
+			br->bits |= (uint64_t)src[i] << (8 * i);
+		br->consumed = (8 - len) * 8;
+	}
+	br->consumed += 8 - highbit32(src[len - 1]);
+}
+
+#define BR_PEEK(br, n) \
+	((uint32_t)((((br)->bits << ((br)->consumed & 63)) >> 1) >> (63 - (n))))
+
+static ATTRIBUTE_ALWAYS_INLINE uint32_t br_read(bitrev_t *br, int n)
+{
+	uint32_t v = BR_PEEK(br, n);
+
+	br->consumed += n;
+	return v;
+}
+
+/* Refill so that at least 57 bits can be read (unless near the start) */
+static ATTRIBUTE_ALWAYS_INLINE void br_reload(bitrev_t *br)
+{
+	unsigned n;
+
+	if (br->consumed > 64)
+		return;
+	if (br->ptr >= br->start + 8) {
+		br->ptr -= br->consumed >> 3;
+		br->consumed &= 7;
+	} else if (br->ptr == br->start) {
+		return;
+	} else {
+		n = br->consumed >> 3;
+		if (n > (unsigned)(br->ptr - br->start))
+			n = br->ptr - br->start;
+		br->ptr -= n;
+		br->consumed -= n * 8;
+	}
+	br->bits = get_le64(br->ptr);
+}
+
+static int br_overflowed(bitrev_t *br)
+{
+	br_reload(br);
+	return br->ptr == br->start && br->consumed > 64;
+}
+
+static int br_finished(bitrev_t *br)
+{
+	br_reload(br);
+	return br->ptr == br->start && br->consumed == 64;
+}
+
+
+/* FSE tables */
+typedef struct {
+	uint8_t symbol;
+	uint8_t nbits;
+	uint16_t base;
+} fse_entry_t;
+
+typedef struct {
+	int log;
+	fse_entry_t t[1 << LL_MAX_LOG];
+} fse_table_t;
+
+/* The predefined distributions of RFC 8878 */
+static const int16_t ll_default_norm[LL_MAX_SYMBOL + 1] = {
+	4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+	-1, -1, -1, -1
+};
+static const int16_t ml_default_norm[ML_MAX_SYMBOL + 1] = {
+	1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+	-1, -1, -1, -1, -1
+};
+static const int16_t of_default_norm[29] = {
+	1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+};
+
+static void fse_build(fse_table_t *f, const int16_t *norm, int nsym, int log)
+{
+	uint16_t next[HUF_MAX_SYMBOLS];
+	unsigned size = 1 << log;
+	unsigned high = size, mask = size - 1;
+	unsigned step = (size >> 1) + (size >> 3) + 3;
+	unsigned pos = 0, i;
+	int s, n;
+
+	/* "Less than 1" symbols go to the end of the table */
+	for (s = 0; s < nsym; s++) {
+		if (norm[s] == -1) {
+			if (high == 0)
+				corrupted();
+			f->t[--high].symbol = s;
+			next[s] = 1;
+		}
+	}
+	for (s = 0; s < nsym; s++) {
+		if (norm[s] <= 0)
+			continue;
+		next[s] = norm[s];
+		for (n = 0; n < norm[s]; n++) {
+			f->t[pos].symbol = s;
+			do
+				pos = (pos + step) & mask;
+			while (pos >= high);
+		}
+	}
+	if (pos != 0)
+		corrupted();
+	for (i = 0; i < size; i++) {
+		unsigned state = next[f->t[i].symbol]++;
+
+		f->t[i].nbits = log - highbit32(state);
+		f->t[i].base = (state << f->t[i].nbits) - size;
+	}
+	f->log = log;
+}
+
+static void fse_build_rle(fse_table_t *f, uint8_t symbol)
+{
+	f->log = 0;
+	f->t[0].symbol = symbol;
+	f->t[0].nbits = 0;
+	f->t[0].base = 0;
+}
+
+/* Forward (little endian) bits, only used for the table descriptions */
+static uint32_t read_bits_fwd(const uint8_t *src, size_t len, size_t *bitpos, int n)
+{
+	uint32_t v = 0;
+	size_t b;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		b = *bitpos + i;
+		if ((b >> 3) >= len)
+			corrupted();
+		v |= (uint32_t)((src[b >> 3] >> (b & 7)) & 1) << i;
+	}
+	*bitpos += n;
+	return v;
+}
+
+/* Read a normalized distribution and build its table; returns bytes used */
+static size_t fse_read_table(fse_table_t *f, const uint8_t *src, size_t len,
+		int max_log, int max_symbol)
+{
+	int16_t norm[HUF_MAX_SYMBOLS];
+	size_t bitpos = 0;
+	int log, remaining, nsym = 0;
+
+	log = read_bits_fwd(src, len, &bitpos, 4) + 5;
+	if (log > max_log)
+		corrupted();
+	remaining = 1 << log;
+	while (remaining > 0) {
+		int bits = highbit32(remaining + 1) + 1;
+		uint32_t val = read_bits_fwd(src, len, &bitpos, bits);
+		uint32_t lower_mask = (1 << (bits - 1)) - 1;
+		uint32_t threshold = (1 << bits) - 1 - (remaining + 1);
+		int proba;
+
+		if (nsym > max_symbol)
+			corrupted();
+		/* Small values are one bit shorter */
+		if ((val & lower_mask) < threshold) {
+			bitpos--;
+			val &= lower_mask;
+		} else if (val > lower_mask)
+			val -= threshold;
+		proba = (int)val - 1;
+		remaining -= proba < 0 ? -proba : proba;
+		norm[nsym++] = proba;
+		if (proba == 0) {
+			/* Followed by 2 bit counts of further zeroes, 3 meaning
+			 * "and another count follows" */
+			int repeat, i;
+
+			do {
+				repeat = read_bits_fwd(src, len, &bitpos, 2);
+				if (nsym + repeat > max_symbol + 1)
+					corrupted();
+				for (i = 0; i < repeat; i++)
+					norm[nsym++] = 0;
+			} while (repeat == 3);
+		}
+	}
+	if (remaining != 0)
+		corrupted();
+	fse_build(f, norm, nsym, log);
+	return (bitpos + 7) >> 3;
+}
+
+
+typedef struct {
+	uint16_t huf[1 << HUF_MAX_BITS];	/* symbol | code length << 8 */
+	int huf_bits;						/* 0 until a table is read */
+	fse_table_t ll, of, ml;				/* log < 0 until one is read */
+	uint32_t rep[3];
+	uint8_t lit[ZSTD_BLOCK_MAX + WILDCOPY_SLACK];
+} zstd_t;
+
+/* Huffman table description: code lengths as weights, either packed
+ * as nibbles or FSE compressed; the last weight is implied.  Returns
+ * bytes used. */
+static size_t huf_read_table(zstd_t *z, const uint8_t *src, size_t len)
+{
+	uint8_t w[HUF_MAX_SYMBOLS + 2];
+	unsigned rank_count[HUF_MAX_BITS + 1];
+	unsigned rank_idx[HUF_MAX_BITS + 1];
+	unsigned nw, i, b, sum, left, max_bits;
+	size_t used;
+
+	if (len < 1)
+		corrupted();
+	if (src[0] < 128) {
+		fse_table_t f;
+		bitrev_t br;
+		unsigned s1, s2;
+		size_t n;
+
+		used = 1 + src[0];
+		if (used > len)
+			corrupted();
+		n = fse_read_table(&f, src + 1, src[0], 6, HUF_MAX_BITS);
+		if (n >= src[0])
+			corrupted();
+		br_init(&br, src + 1 + n, src[0] - n);
+		s1 = br_read(&br, f.log);
+		s2 = br_read(&br, f.log);
+		/* Two interleaved states, until the stream runs out */
+		nw = 0;
+		for (;;) {
+			w[nw++] = f.t[s1].symbol;
+			s1 = f.t[s1].base + br_read(&br, f.t[s1].nbits);
+			if (br_overflowed(&br)) {
+				w[nw++] = f.t[s2].symbol;
+				break;
+			}
+			w[nw++] = f.t[s2].symbol;
+			s2 = f.t[s2].base + br_read(&br, f.t[s2].nbits);
+			if (br_overflowed(&br)) {
+				w[nw++] = f.t[s1].symbol;
+				break;
+			}
+			if (nw >= HUF_MAX_SYMBOLS)
+				corrupted();
+		}
+	} else {
+		nw = src[0] - 127;
+		used = 1 + (nw + 1) / 2;
+		if (used > len)
+			corrupted();
+		for (i = 0; i < nw; i++)
+			w[i] = (src[1 + i / 2] >> (i & 1 ? 0 : 4)) & 15;
+	}
+	if (nw > HUF_MAX_SYMBOLS - 1)
+		corrupted();
+
+	sum = 0;
+	for (i = 0; i < nw; i++) {
+		if (w[i] > HUF_MAX_BITS)
+			corrupted();
+		if (w[i])
+			sum += 1 << (w[i] - 1);
+	}
+	if (!sum)
+		corrupted();
+	max_bits = highbit32(sum) + 1;
+	if (max_bits > HUF_MAX_BITS)
+		corrupted();
+	left = (1 << max_bits) - sum;
+	if (left & (left - 1))
+		corrupted();
+	w[nw++] = highbit32(left) + 1;
+
+	/* Longest codes first, symbols in order within a length */
+	memset(rank_count, 0, sizeof(rank_count));
+	for (i = 0; i < nw; i++) {
+		if (w[i])
+			w[i] = max_bits + 1 - w[i];
+		rank_count[w[i]]++;
+	}
+	rank_idx[max_bits] = 0;
+	for (b = max_bits; b >= 1; b--)
+		rank_idx[b - 1] = rank_idx[b] + rank_count[b] * (1 << (max_bits - b));
+	for (i = 0; i < nw; i++) {
+		unsigned code, n, e;
+
+		b = w[i];
+		if (!b)
+			continue;
+		code = rank_idx[b];
+		n = 1 << (max_bits - b);
+		e = i | (b << 8);
+		rank_idx[b] += n;
+		while (n--)
+			z->huf[code++] = e;
+	}
+	z->huf_bits = max_bits;
+	return used;
+}
+
+#define HUF_DECODE_SYMBOL(br, dst) do { \
+	unsigned e_ = t[BR_PEEK(&(br), mb)]; \
+	*(dst)++ = e_; \
+	(br).consumed += e_ >> 8; \
+} while (0)
+
+/* Finish one stream, which must end exactly where its data does */
+static void huf_decode_tail(const zstd_t *z, bitrev_t *br, uint8_t *dst, uint8_t *end)
+{
+	const uint16_t *t = z->huf;
+	const int mb = z->huf_bits;
+
+	while (end - dst >= 4) {
+		HUF_DECODE_SYMBOL(*br, dst);
+		HUF_DECODE_SYMBOL(*br, dst);
+		HUF_DECODE_SYMBOL(*br, dst);
+		HUF_DECODE_SYMBOL(*br, dst);
+		br_reload(br);
+	}
+	while (dst < end)
+		HUF_DECODE_SYMBOL(*br, dst);
+	if (!br_finished(br))
+		corrupted();
+}
+
+static void huf_decode1(const zstd_t *z, uint8_t *dst, size_t n,
+		const uint8_t *src, size_t len)
+{
+	bitrev_t br;
+
+	br_init(&br, src, len);
+	huf_decode_tail(z, &br, dst, dst + n);
+}
+
+/* Four streams, each a quarter of the literals (the last one gets what
+ * is left).  They are independent, so decoding them in lockstep keeps
+ * four table lookups in flight instead of one. */
+static void huf_decode4(const zstd_t *z, uint8_t *dst, size_t n,
+		const uint8_t *src, size_t len)
+{
+	const uint16_t *t = z->huf;
+	const int mb = z->huf_bits;
+	size_t size[4], seg = (n + 3) / 4, i, k;
+	uint8_t *d[4];
+	bitrev_t br[4];
+
+	if (len < 6)
+		corrupted();
+	size[0] = get_le16(src);
+	size[1] = get_le16(src + 2);
+	size[2] = get_le16(src + 4);
+	if (6 + size[0] + size[1] + size[2] > len || 3 * seg > n)
+		corrupted();
+	size[3] = len - 6 - size[0] - size[1] - size[2];
+	src += 6;
+	for (i = 0; i < 4; i++) {
+		br_init(&br[i], src, size[i]);
+		src += size[i];
+		d[i] = dst + i * seg;
+	}
+
+	for (k = (n - 3 * seg) / 4; k; k--) {
+		for (i = 0; i < 4; i++) {
+			HUF_DECODE_SYMBOL(br[i], d[i]);
+			HUF_DECODE_SYMBOL(br[i], d[i]);
+			HUF_DECODE_SYMBOL(br[i], d[i]);
+			HUF_DECODE_SYMBOL(br[i], d[i]);
+			br_reload(&br[i]);
+		}
+	}
+	for (i = 0; i < 3; i++)
+		huf_decode_tail(z, &br[i], d[i], dst + (i + 1) * seg);
+	huf_decode_tail(z, &br[3], d[3], dst + n);
+}
+#undef HUF_DECODE_SYMBOL
+
+/* Literals section: sets *lit to the (possibly still compressed-input
+ * resident) literals and returns the bytes used */
+static size_t decode_literals(zstd_t *z, const uint8_t *src, size_t len,
+		const uint8_t **lit, size_t *lit_size)
+{
+	unsigned type, fmt, hsize;
+	size_t regen, comp;
+	uint32_t h;
+
+	if (len < 1)
+		corrupted();
+	type = src[0] & 3;
+	fmt = (src[0] >> 2) & 3;
+
+	if (type < 2) {
+		/* Raw or RLE */
+		hsize = fmt == 1 ? 2 : fmt == 3 ? 3 : 1;
+		if (hsize >= len)
+			corrupted();
+		if (hsize == 1)
+			regen = src[0] >> 3;
+		else if (hsize == 2)
+			regen = (src[0] >> 4) + (src[1] << 4);
+		else
+			regen = (src[0] >> 4) + (src[1] << 4) + (src[2] << 12);
+		if (regen > ZSTD_BLOCK_MAX)
+			corrupted();
+		*lit_size = regen;
+		if (type == 0) {
+			if (hsize + regen > len)
+				corrupted();
+			*lit = src + hsize;
+			return hsize + regen;
+		}
+		memset(z->lit, src[hsize], regen);
+		*lit = z->lit;
+		return hsize + 1;
+	}
+
+	/* Huffman coded, with a new table or the previous one */
+	hsize = fmt < 2 ? 3 : fmt + 2;
+	if (hsize > len)
+		corrupted();
+	if (fmt < 2) {
+		h = src[0] | (src[1] << 8) | (src[2] << 16);
+		regen = (h >> 4) & 0x3FF;
+		comp = (h >> 14) & 0x3FF;
+	} else if (fmt == 2) {
+		h = get_le32(src);
+		regen = (h >> 4) & 0x3FFF;
+		comp = h >> 18;
+	} else {
+		h = get_le32(src);
+		regen = (h >> 4) & 0x3FFFF;
+		comp = (h >> 22) | ((size_t)src[4] << 10);
+	}
+	if (regen > ZSTD_BLOCK_MAX || hsize + comp > len)
+		corrupted();
+	*lit = z->lit;
+	*lit_size = regen;
+	len = hsize + comp;
+	src += hsize;
+
+	if (type == 2) {
+		size_t n = huf_read_table(z, src, comp);
+
+		src += n;
+		comp -= n;
+	} else if (!z->huf_bits)
+		corrupted();
+
+	if (fmt == 0)
+		huf_decode1(z, z->lit, regen, src, comp);
+	else
+		huf_decode4(z, z->lit, regen, src, comp);
+	return len;
+}
+
+
+static const uint32_t ll_base[LL_MAX_SYMBOL + 1] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096,
+	8192, 16384, 32768, 65536
+};
+static const uint8_t ll_bits[LL_MAX_SYMBOL + 1] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12,
+	13, 14, 15, 16
+};
+static const uint32_t ml_base[ML_MAX_SYMBOL + 1] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+	19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+	35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051,
+	4099, 8195, 16387, 32771, 65539
+};
+static const uint8_t ml_bits[ML_MAX_SYMBOL + 1] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+	12, 13, 14, 15, 16
+};
+
+/* Pick the table for one of the sequence fields; returns bytes used */
+static size_t seq_table(fse_table_t *f, int mode, const uint8_t *src, size_t len,
+		const int16_t *def_norm, int def_nsym, int def_log,
+		int max_log, int max_symbol)
+{
+	switch (mode) {
+	case 0:
+		fse_build(f, def_norm, def_nsym, def_log);
+		return 0;
+	case 1:
+		if (len < 1 || src[0] > max_symbol)
+			corrupted();
+		fse_build_rle(f, src[0]);
+		return 1;
+	case 2:
+		return fse_read_table(f, src, len, max_log, max_symbol);
+	}
+	/* Repeat the previous block's table */
+	if (f->log < 0)
+		corrupted();
+	return 0;
+}
+
+/* Copies in 16 byte steps, so it may write up to 15 bytes past dst+len */
+static ATTRIBUTE_ALWAYS_INLINE void wildcopy(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	uint8_t *end = dst + len;
+
+	do {
+		memcpy(dst, src, 16);
+		dst += 16;
+		src += 16;
+	} while (dst < end);
+}
+
+/* Sequences section: decode each (literal length, offset, match length)
+ * and carry it out right away.  out is the start of the frame's
+ * history, [op, oend) where this block may go.  Returns bytes made. */
+static size_t decode_sequences(zstd_t *z, const uint8_t *src, size_t len,
+		const uint8_t *lit, size_t lit_size,
+		uint8_t *out, uint8_t *op, uint8_t *oend)
+{
+	const uint8_t *lit_end = lit + lit_size;
+	uint8_t *op_start = op;
+	unsigned nseq, modes, ll_state, of_state, ml_state;
+	size_t used, n;
+	bitrev_t br;
+
+	if (len < 1)
+		corrupted();
+	nseq = src[0];
+	used = 1;
+	if (nseq == 255) {
+		if (len < 3)
+			corrupted();
+		nseq = get_le16(src + 1) + 0x7F00;
+		used = 3;
+	} else if (nseq >= 128) {
+		if (len < 2)
+			corrupted();
+		nseq = ((nseq - 128) << 8) + src[1];
+		used = 2;
+	}
+
+	if (nseq) {
+		if (used >= len)
+			corrupted();
+		modes = src[used++];
+		if (modes & 3)
+			corrupted();
+		used += seq_table(&z->ll, modes >> 6, src + used, len - used,
+				ll_default_norm, LL_MAX_SYMBOL + 1, 6, LL_MAX_LOG, LL_MAX_SYMBOL);
+		used += seq_table(&z->of, (modes >> 4) & 3, src + used, len - used,
+				of_default_norm, 29, 5, OF_MAX_LOG, OF_MAX_SYMBOL);
+		used += seq_table(&z->ml, (modes >> 2) & 3, src + used, len - used,
+				ml_default_norm, ML_MAX_SYMBOL + 1, 6, ML_MAX_LOG, ML_MAX_SYMBOL);
+		if (used >= len)
+			corrupted();
+
+		br_init(&br, src + used, len - used);
+		ll_state = br_read(&br, z->ll.log);
+		of_state = br_read(&br, z->of.log);
+		ml_state = br_read(&br, z->ml.log);
+		br_reload(&br);
+
+		while (nseq--) {
+			const fse_entry_t *lle = &z->ll.t[ll_state];
+			const fse_entry_t *ofe = &z->of.t[of_state];
+			const fse_entry_t *mle = &z->ml.t[ml_state];
+			uint32_t offset, ll, ml;
+			const uint8_t *match;
+
+			offset = ((uint32_t)1 << ofe->symbol) + br_read(&br, ofe->symbol);
+			br_reload(&br);
+			ml = ml_base[mle->symbol] + br_read(&br, ml_bits[mle->symbol]);
+			ll = ll_base[lle->symbol] + br_read(&br, ll_bits[lle->symbol]);
+			br_reload(&br);
+
+			/* Offset values 1-3 pick one of the last three offsets
+			 * (shifted by one when there are no literals) */
+			if (offset > 3) {
+				offset -= 3;
+				z->rep[2] = z->rep[1];
+				z->rep[1] = z->rep[0];
+				z->rep[0] = offset;
+			} else {
+				unsigned idx = offset - 1 + (ll == 0);
+
+				if (idx == 0)
+					offset = z->rep[0];
+				else {
+					offset = idx == 3 ? z->rep[0] - 1 : z->rep[idx];
+					if (idx != 1)
+						z->rep[2] = z->rep[1];
+					z->rep[1] = z->rep[0];
+					z->rep[0] = offset;
+				}
+			}
+
+			if (nseq) {
+				ll_state = lle->base + br_read(&br, lle->nbits);
+				ml_state = mle->base + br_read(&br, mle->nbits);
+				of_state = ofe->base + br_read(&br, ofe->nbits);
+				br_reload(&br);
+			}
+
+			if (ll > (size_t)(lit_end - lit) || ll + ml > (size_t)(oend - op))
+				corrupted();
+			wildcopy(op, lit, ll);
+			op += ll;
+			lit += ll;
+
+			if (offset == 0 || offset > (size_t)(op - out))
+				corrupted();
+			match = op - offset;
+			if (offset >= 16)
+				wildcopy(op, match, ml);
+			else if (offset >= 8) {
+				uint8_t *d = op, *e = op + ml;
+
+				do {
+					memcpy(d, match, 8);
+					d += 8;
+					match += 8;
+				} while (d < e);
+			} else {
+				uint32_t i;
+
+				for (i = 0; i < ml; i++)
+					op[i] = match[i];
+			}
+			op += ml;
+		}
+		if (!br_finished(&br))
+			corrupted();
+	} else if (used != len)
+		corrupted();
+
+	n = lit_end - lit;
+	if (n > (size_t)(oend - op))
+		corrupted();
+	memcpy(op, lit, n);
+	op += n;
+	return op - op_start;
+}
+
+/* Called whenever a block has been decoded */
+static void write_out(int fd, const uint8_t *buf, size_t len)
+{
+	if (bb_full_write(fd, buf, len) != (ssize_t) len)
+		bb_perror_msg_and_die(bb_msg_write_error);
+}
+
+/* One frame, from just after its magic number */
+static void decode_frame(zstd_t *z, zin_t *in, int dst_fd)
+{
+	static const uint8_t dict_id_size[4] = { 0, 1, 2, 4 };
+	static const uint8_t fcs_size[4] = { 0, 2, 4, 8 };
+	xxh64_t xxh;
+	const uint8_t *p;
+	unsigned fhd, n, i;
+	int last;
+	uint64_t window = 0, fcs = 0, total = 0;
+	size_t block_max, out_size, out_pos, written;
+	uint8_t *out;
+
+	fhd = *in_need(in, 1);
+	if (fhd & 0x08)
+		corrupted();
+	if (!(fhd & 0x20)) {
+		/* Window descriptor */
+		n = *in_need(in, 1);
+		window = (uint64_t)1 << (10 + (n >> 3));
+		window += (window >> 3) * (n & 7);
+	}
+	n = dict_id_size[fhd & 3];
+	p = in_need(in, n);
+	for (i = 0; i < n; i++)
+		if (p[i])
+			bb_error_msg_and_die("dictionaries are not supported");
+	n = fcs_size[fhd >> 6];
+	if (!n && (fhd & 0x20))
+		n = 1;
+	p = in_need(in, n);
+	for (i = n; i--;)
+		fcs = (fcs << 8) | p[i];
+	if (n == 2)
+		fcs += 256;
+	if (fhd & 0x20)
+		window = fcs;
+	if (window > ZSTD_WINDOW_MAX)
+		bb_error_msg_and_die("window too large");
+
+	/* History plus room to decode ahead; just the content if we
+	 * know it and it is no bigger than that */
+	block_max = MIN(window, ZSTD_BLOCK_MAX);
+	out_size = window + MAX(window, ZSTD_MIN_SLIDE);
+	if (n && fcs < out_size)
+		out_size = fcs;
+	out = xmalloc(out_size + WILDCOPY_SLACK);
+	out_pos = written = 0;
+
+	z->huf_bits = 0;
+	z->ll.log = z->of.log = z->ml.log = -1;
+	z->rep[0] = 1;
+	z->rep[1] = 4;
+	z->rep[2] = 8;
+	if (fhd & 0x04)
+		xxh64_init(&xxh);
+
+	do {
+		uint32_t hdr, type, bsize;
+		size_t need, made;
+
+		p = in_need(in, 3);
+		hdr = p[0] | (p[1] << 8) | (p[2] << 16);
+		last = hdr & 1;
+		type = (hdr >> 1) & 3;
+		bsize = hdr >> 3;
+
+		need = block_max;
+		if (n && need > fcs - total)
+			need = fcs - total;
+		if (type != 2 && bsize < need)
+			need = bsize;
+		if (out_pos + need > out_size) {
+			/* Out of room: keep just the window */
+			size_t keep = MIN(out_pos, window);
+
+			write_out(dst_fd, out + written, out_pos - written);
+			memmove(out, out + out_pos - keep, keep);
+			out_pos = written = keep;
+		}
+
+		switch (type) {
+		case 0:
+			if (bsize > need)
+				corrupted();
+			memcpy(out + out_pos, in_need(in, bsize), bsize);
+			made = bsize;
+			break;
+		case 1:
+			if (bsize > need)
+				corrupted();
+			memset(out + out_pos, *in_need(in, 1), bsize);
+			made = bsize;
+			break;
+		case 2: {
+			const uint8_t *lit;
+			size_t lit_size, used;
+
+			if (bsize > block_max)
+				corrupted();
+			p = in_need(in, bsize);
+			used = decode_literals(z, p, bsize, &lit, &lit_size);
+			made = decode_sequences(z, p + used, bsize - used, lit, lit_size,
+					out, out + out_pos, out + out_pos + need);
+			break;
+		}
+		default:
+			corrupted();
+		}
+
+		if (fhd & 0x04)
+			xxh64_update(&xxh, out + out_pos, made);
+		out_pos += made;
+		total += made;
+		write_out(dst_fd, out + written, out_pos - written);
+		written = out_pos;
+	} while (!last);
+
+	if (n && total != fcs)
+		corrupted();
+	if (fhd & 0x04) {
+		if (get_le32(in_need(in, 4)) != (uint32_t)xxh64_digest(&xxh))
+			bb_error_msg_and_die("checksum error");
+	}
+	free(out);
+}
+
+int unzstd(int src_fd, int dst_fd)
+{
+	zstd_t *z = xmalloc(sizeof(*z));
+	zin_t in;
+	uint32_t magic, n;
+	int first = 1;
+
+	in.fd = src_fd;
+	in.buf = xmalloc(IN_BUFSIZE + WILDCOPY_SLACK);
+	in.pos = in.end = 0;
+
+	/* Any number of frames, back to back */
+	while (in_fill(&in, 1) || first) {
+		if (!in_fill(&in, 4))
+			bb_error_msg_and_die("invalid magic");
+		magic = get_le32(in_need(&in, 4));
+		if ((magic & ~0xF) == ZSTD_SKIPPABLE_MAGIC) {
+			uint32_t skip = get_le32(in_need(&in, 4));
+
+			while (skip) {
+				n = MIN(skip, IN_BUFSIZE);
+				in_need(&in, n);
+				skip -= n;
+			}
+			continue;
+		}
+		if (magic != ZSTD_MAGIC)
+			bb_error_msg_and_die("invalid magic");
+		decode_frame(z, &in, dst_fd);
+		first = 0;
+	}
+
+	if (ENABLE_FEATURE_CLEAN_UP) {
+		free(in.buf);
+		free(z);
+	}
+	return 0;
+}
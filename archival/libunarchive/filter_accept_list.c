@@ -13,7 +13,8 @@
  */
 char filter_accept_list(archive_handle_t *archive_handle)
 {
-	if (find_list_entry(archive_handle->accept, archive_handle->file_header->name)) {
+	if (find_list_entry_indexed(archive_handle->accept, &archive_handle->accept_index,
+			archive_handle->file_header->name)) {
 		return(EXIT_SUCCESS);
 	} else {
 		return(EXIT_FAILURE);
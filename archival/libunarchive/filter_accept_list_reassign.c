@@ -31,7 +31,8 @@
 char filter_accept_list_reassign(archive_handle_t *archive_handle)
 {
 	/* Check the file entry is in the accept list */
-	if (find_list_entry(archive_handle->accept, archive_handle->file_header->name)) {
+	if (find_list_entry_indexed(archive_handle->accept, &archive_handle->accept_index,
+			archive_handle->file_header->name)) {
 		const char *name_ptr;
 
 		/* Extract the last 2 extensions */
@@ -7,6 +7,7 @@
 
 #include <fnmatch.h>
 #include <stdlib.h>
+#include <string.h>
 #include "unarchive.h"
 
 /* Find a string in a list */
@@ -20,3 +21,161 @@ const llist_t *find_list_entry(const llist_t *list, const char *filename)
 	}
 	return(NULL);
 }
+
+/*
+ * A compiled list of patterns, for when there are too many of them to
+ * fnmatch() each one against every archive member.
+ *
+ * Patterns without wildcards go into a hash table under their full text:
+ * since they can only match the name itself or one of its leading
+ * directories, looking those up is all it takes.  Patterns with wildcards
+ * are filed under the literal text before their first wildcard, and only
+ * those whose prefix the name starts with are handed to fnmatch().
+ */
+struct pattern_ent {
+	const llist_t *node;
+	const char *key;
+	int keylen;
+	int glob;
+	int next;		/* next entry in the same bucket, or -1 */
+};
+
+struct pattern_index_s {
+	const llist_t *list;	/* what we were compiled from */
+	void *list_data;
+	int flags;
+	unsigned mask;
+	int *bucket;
+	struct pattern_ent *ent;
+	int *prefix_len;	/* distinct glob prefix lengths, ascending */
+	int nprefix;
+};
+
+static unsigned pattern_hash(const char *s, int len)
+{
+	unsigned h = 2166136261U;
+
+	while (len--)
+		h = (h ^ (unsigned char)*s++) * 16777619U;
+	return h;
+}
+
+static int int_cmp(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+pattern_index_t *compile_list_patterns(const llist_t *list, int flags)
+{
+	pattern_index_t *index = xzalloc(sizeof(*index));
+	const llist_t *l;
+	int n, i;
+
+	index->list = list;
+	index->list_data = list ? list->data : NULL;
+	index->flags = flags;
+	for (n = 0, l = list; l; l = l->link)
+		n++;
+	for (index->mask = 15; index->mask < (unsigned)n * 2; index->mask = index->mask * 2 + 1)
+		continue;
+	index->bucket = xmalloc((index->mask + 1) * sizeof(int));
+	memset(index->bucket, 0xff, (index->mask + 1) * sizeof(int));
+	index->ent = xmalloc((n + 1) * sizeof(*index->ent));
+	index->prefix_len = xmalloc((n + 1) * sizeof(int));
+
+	for (i = 0, l = list; l; l = l->link, i++) {
+		struct pattern_ent *e = &index->ent[i];
+		unsigned h;
+
+		e->node = l;
+		e->key = l->data;
+		e->keylen = strcspn(e->key, "*?[\\");
+		e->glob = e->key[e->keylen] != '\0';
+		if (e->glob)
+			index->prefix_len[index->nprefix++] = e->keylen;
+		h = pattern_hash(e->key, e->keylen) & index->mask;
+		e->next = index->bucket[h];
+		index->bucket[h] = i;
+	}
+
+	/* Weed out repeated prefix lengths */
+	qsort(index->prefix_len, index->nprefix, sizeof(int), int_cmp);
+	for (n = i = 0; i < index->nprefix; i++)
+		if (!n || index->prefix_len[n - 1] != index->prefix_len[i])
+			index->prefix_len[n++] = index->prefix_len[i];
+	index->nprefix = n;
+
+	return index;
+}
+
+void free_list_patterns(pattern_index_t *index)
+{
+	if (index) {
+		free(index->bucket);
+		free(index->ent);
+		free(index->prefix_len);
+		free(index);
+	}
+}
+
+/* Look for entries filed under the first len chars of filename */
+static const llist_t *probe_patterns(const pattern_index_t *index,
+		const char *filename, int len, int glob)
+{
+	int i = index->bucket[pattern_hash(filename, len) & index->mask];
+
+	for (; i >= 0; i = index->ent[i].next) {
+		const struct pattern_ent *e = &index->ent[i];
+
+		if (e->glob != glob || e->keylen != len
+		 || memcmp(e->key, filename, len) != 0)
+			continue;
+		if (!glob || fnmatch(e->key, filename, index->flags) == 0)
+			return e->node;
+	}
+	return NULL;
+}
+
+const llist_t *find_pattern_entry(const pattern_index_t *index, const char *filename)
+{
+	const llist_t *found;
+	int len = strlen(filename);
+	int i;
+
+	/* Literal patterns: the whole name, or any of its leading dirs */
+	found = probe_patterns(index, filename, len, 0);
+	if (!found && (index->flags & FNM_LEADING_DIR)) {
+		for (i = 0; i < len && !found; i++)
+			if (filename[i] == '/')
+				found = probe_patterns(index, filename, i, 0);
+	}
+
+	for (i = 0; i < index->nprefix && !found; i++) {
+		if (index->prefix_len[i] > len)
+			break;
+		found = probe_patterns(index, filename, index->prefix_len[i], 1);
+	}
+	return found;
+}
+
+/* Like find_list_entry(), compiling long lists into *cache on first use.
+ * Only a new list head is noticed, so don't append to a cached list. */
+const llist_t *find_list_entry_indexed(const llist_t *list,
+		pattern_index_t **cache, const char *filename)
+{
+	const llist_t *l;
+	int n;
+
+	if (*cache && (*cache)->list == list && list && (*cache)->list_data == list->data)
+		return find_pattern_entry(*cache, filename);
+
+	/* A handful of patterns isn't worth compiling */
+	for (n = 0, l = list; l && n < 16; l = l->link)
+		n++;
+	if (n < 16)
+		return find_list_entry(list, filename);
+
+	free_list_patterns(*cache);
+	*cache = compile_list_patterns(list, FNM_LEADING_DIR);
+	return find_pattern_entry(*cache, filename);
+}
@@ -19,6 +19,9 @@ int open_transformer(int src_fd, int (*transformer)(int src_fd, int dst_fd))
 		bb_perror_msg_and_die("Can't create pipe");
 	}
 
+	/* The child exits through exit(), don't let it repeat our output */
+	fflush(stdout);
+
 	pid = fork();
 	if (pid == -1) {
 		bb_perror_msg_and_die("Fork failed");
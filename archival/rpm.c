@@ -20,6 +20,7 @@
 #include "busybox.h"
 #include "unarchive.h"
 
+#define RPM_MAGIC "\355\253\356\333"
 #define RPM_HEADER_MAGIC "\216\255\350"
 #define RPM_CHAR_TYPE		1
 #define RPM_INT8_TYPE		2
@@ -76,25 +77,95 @@ typedef struct {
 	uint32_t count; /* 4 byte count */
 } rpm_index;
 
-static void *map;
-static rpm_index **mytags;
-static int tagcount;
-
-void extract_cpio_gz(int fd);
-rpm_index **rpm_gettags(int fd, int *num_tags);
-int bsearch_rpmtag(const void *key, const void *item);
-char *rpm_getstring(int tag, int itemindex);
-int rpm_getint(int tag, int itemindex);
-int rpm_getcount(int tag);
-void exec_script(int progtag, int datatag, char *prefix);
-void fileaction_dobackup(char *filename, int fileref);
-void fileaction_setowngrp(char *filename, int fileref);
-void fileaction_list(char *filename, int itemno);
-void loop_through_files(int filetag, void (*fileaction)(char *filename, int fileref));
+/* Tags we look up are indexed directly, tag - RPMTAG_NAME */
+#define RPMTAG_COUNT	(RPMTAG_DIRNAMES - RPMTAG_NAME + 1)
+
+/* The whole package is mapped; index entries and data are used in place */
+static const unsigned char *map;
+static size_t mapsize;
+static const unsigned char *store;
+static uint32_t storesize;
+static size_t payload;
+static const rpm_index *tagtab[RPMTAG_COUNT];
+/* String arrays split into pointers on first use, so lists stay linear */
+static const char **strtab[RPMTAG_COUNT];
+
+static int rpm_gettags(int fd);
+static void rpm_freetags(void);
+static void extract_cpio_gz(int fd);
+static const char *rpm_getstring(int tag, int itemindex);
+static int rpm_getint(int tag, int itemindex);
+static int rpm_getcount(int tag);
+static void fileaction_dobackup(char *filename, int fileref);
+static void fileaction_setowngrp(char *filename, int fileref);
+static void loop_through_files(int filetag, void (*fileaction)(char *filename, int fileref));
+
+static int rpm_package(const char *filename, int func)
+{
+	int rpm_fd;
+
+	rpm_fd = open(filename, O_RDONLY);
+	if (rpm_fd < 0) {
+		bb_perror_msg("%s", filename);
+		return EXIT_FAILURE;
+	}
+	if (rpm_gettags(rpm_fd) != 0) {
+		bb_error_msg("%s: error reading rpm header", filename);
+		rpm_freetags();
+		close(rpm_fd);
+		return EXIT_FAILURE;
+	}
+	if (func & rpm_install) {
+		loop_through_files(RPMTAG_BASENAMES, fileaction_dobackup); /* Backup any config files */
+		extract_cpio_gz(rpm_fd); // Extact the archive
+		loop_through_files(RPMTAG_BASENAMES, fileaction_setowngrp); /* Set the correct file uid/gid's */
+	} else if (func & rpm_query && func & rpm_query_package) {
+		if (!((func & rpm_query_info) || (func & rpm_query_list))) { // If just a straight query, just give package name
+			printf("%s-%s-%s\n", rpm_getstring(RPMTAG_NAME, 0), rpm_getstring(RPMTAG_VERSION, 0), rpm_getstring(RPMTAG_RELEASE, 0));
+		}
+		if (func & rpm_query_info) {
+			/* Do the nice printout */
+			time_t bdate_time;
+			struct tm *bdate;
+			char bdatestring[50];
+			const char *prefix = rpm_getstring(RPMTAG_PREFIXS, 0);
+			const char *vendor = rpm_getstring(RPMTAG_VENDOR, 0);
+			printf("Name        : %-29sRelocations: %s\n", rpm_getstring(RPMTAG_NAME, 0), prefix ? prefix : "(not relocateable)");
+			printf("Version     : %-34sVendor: %s\n", rpm_getstring(RPMTAG_VERSION, 0), vendor ? vendor : "(none)");
+			bdate_time = rpm_getint(RPMTAG_BUILDTIME, 0);
+			bdate = localtime((time_t *) &bdate_time);
+			strftime(bdatestring, 50, "%a %d %b %Y %T %Z", bdate);
+			printf("Release     : %-30sBuild Date: %s\n", rpm_getstring(RPMTAG_RELEASE, 0), bdatestring);
+			printf("Install date: %-30sBuild Host: %s\n", "(not installed)", rpm_getstring(RPMTAG_BUILDHOST, 0));
+			printf("Group       : %-30sSource RPM: %s\n", rpm_getstring(RPMTAG_GROUP, 0), rpm_getstring(RPMTAG_SOURCERPM, 0));
+			printf("Size        : %-33dLicense: %s\n", rpm_getint(RPMTAG_SIZE, 0), rpm_getstring(RPMTAG_LICENSE, 0));
+			printf("URL         : %s\n", rpm_getstring(RPMTAG_URL, 0));
+			printf("Summary     : %s\n", rpm_getstring(RPMTAG_SUMMARY, 0));
+			printf("Description :\n%s\n", rpm_getstring(RPMTAG_DESCRIPTION, 0));
+		}
+		if (func & rpm_query_list) {
+			int count, it, flags;
+			count = rpm_getcount(RPMTAG_BASENAMES);
+			for (it = 0; it < count; it++) {
+				flags = rpm_getint(RPMTAG_FILEFLAGS, it);
+				switch ((func & rpm_query_list_doc) + (func & rpm_query_list_config))
+				{
+					case rpm_query_list_doc: if (!(flags & RPMFILE_DOC)) continue; break;
+					case rpm_query_list_config: if (!(flags & RPMFILE_CONFIG)) continue; break;
+					case rpm_query_list_doc + rpm_query_list_config: if (!((flags & RPMFILE_CONFIG) || (flags & RPMFILE_DOC))) continue; break;
+				}
+				printf("%s%s\n", rpm_getstring(RPMTAG_DIRNAMES, rpm_getint(RPMTAG_DIRINDEXES, it)), rpm_getstring(RPMTAG_BASENAMES, it));
+			}
+		}
+	}
+	rpm_freetags();
+	close(rpm_fd);
+	return EXIT_SUCCESS;
+}
 
 int rpm_main(int argc, char **argv)
 {
-	int opt = 0, func = 0, rpm_fd, offset;
+	int opt = 0, func = 0, status = EXIT_SUCCESS;
 
 	while ((opt = getopt(argc, argv, "iqpldc")) != -1) {
 		switch (opt) {
@@ -127,61 +198,23 @@ int rpm_main(int argc, char **argv)
 
 	if (optind == argc) bb_show_usage();
 	while (optind < argc) {
-		rpm_fd = bb_xopen(argv[optind], O_RDONLY);
-		mytags = rpm_gettags(rpm_fd, (int *) &tagcount);
-		offset = lseek(rpm_fd, 0, SEEK_CUR);
-		if (!mytags) { printf("Error reading rpm header\n"); exit(-1); }
-		map = mmap(0, offset > getpagesize() ? (offset + offset % getpagesize()) : getpagesize(), PROT_READ, MAP_PRIVATE, rpm_fd, 0); // Mimimum is one page
-		if (func & rpm_install) {
-			loop_through_files(RPMTAG_BASENAMES, fileaction_dobackup); /* Backup any config files */
-			extract_cpio_gz(rpm_fd); // Extact the archive
-			loop_through_files(RPMTAG_BASENAMES, fileaction_setowngrp); /* Set the correct file uid/gid's */
-		} else if (func & rpm_query && func & rpm_query_package) {
-			if (!((func & rpm_query_info) || (func & rpm_query_list))) { // If just a straight query, just give package name
-				printf("%s-%s-%s\n", rpm_getstring(RPMTAG_NAME, 0), rpm_getstring(RPMTAG_VERSION, 0), rpm_getstring(RPMTAG_RELEASE, 0));
-			}
-			if (func & rpm_query_info) {
-				/* Do the nice printout */
-				time_t bdate_time;
-				struct tm *bdate;
-				char bdatestring[50];
-				printf("Name        : %-29sRelocations: %s\n", rpm_getstring(RPMTAG_NAME, 0), rpm_getstring(RPMTAG_PREFIXS, 0) ? rpm_getstring(RPMTAG_PREFIXS, 0) : "(not relocateable)");
-				printf("Version     : %-34sVendor: %s\n", rpm_getstring(RPMTAG_VERSION, 0), rpm_getstring(RPMTAG_VENDOR, 0) ? rpm_getstring(RPMTAG_VENDOR, 0) : "(none)");
-				bdate_time = rpm_getint(RPMTAG_BUILDTIME, 0);
-				bdate = localtime((time_t *) &bdate_time);
-				strftime(bdatestring, 50, "%a %d %b %Y %T %Z", bdate);
-				printf("Release     : %-30sBuild Date: %s\n", rpm_getstring(RPMTAG_RELEASE, 0), bdatestring);
-				printf("Install date: %-30sBuild Host: %s\n", "(not installed)", rpm_getstring(RPMTAG_BUILDHOST, 0));
-				printf("Group       : %-30sSource RPM: %s\n", rpm_getstring(RPMTAG_GROUP, 0), rpm_getstring(RPMTAG_SOURCERPM, 0));
-				printf("Size        : %-33dLicense: %s\n", rpm_getint(RPMTAG_SIZE, 0), rpm_getstring(RPMTAG_LICENSE, 0));
-				printf("URL         : %s\n", rpm_getstring(RPMTAG_URL, 0));
-				printf("Summary     : %s\n", rpm_getstring(RPMTAG_SUMMARY, 0));
-				printf("Description :\n%s\n", rpm_getstring(RPMTAG_DESCRIPTION, 0));
-			}
-			if (func & rpm_query_list) {
-				int count, it, flags;
-				count = rpm_getcount(RPMTAG_BASENAMES);
-				for (it = 0; it < count; it++) {
-					flags = rpm_getint(RPMTAG_FILEFLAGS, it);
-					switch ((func & rpm_query_list_doc) + (func & rpm_query_list_config))
-					{
-						case rpm_query_list_doc: if (!(flags & RPMFILE_DOC)) continue; break;
-						case rpm_query_list_config: if (!(flags & RPMFILE_CONFIG)) continue; break;
-						case rpm_query_list_doc + rpm_query_list_config: if (!((flags & RPMFILE_CONFIG) || (flags & RPMFILE_DOC))) continue; break;
-					}
-					printf("%s%s\n", rpm_getstring(RPMTAG_DIRNAMES, rpm_getint(RPMTAG_DIRINDEXES, it)), rpm_getstring(RPMTAG_BASENAMES, it));
-				}
+		if (strcmp(argv[optind], "-") == 0) {
+			/* Batch mode: one package file name per line */
+			char *line;
+			while ((line = bb_get_chomped_line_from_file(stdin)) != NULL) {
+				if (*line)
+					status |= rpm_package(line, func);
+				free(line);
 			}
-		}
+		} else
+			status |= rpm_package(argv[optind], func);
 		optind++;
-		free (mytags);
 	}
-	return 0;
+	return status;
 }
 
-void extract_cpio_gz(int fd) {
+static void extract_cpio_gz(int fd) {
 	archive_handle_t *archive_handle;
-	unsigned char magic[2];
 
 	/* Initialise */
 	archive_handle = init_handle();
@@ -193,108 +226,197 @@ void extract_cpio_gz(int fd) {
 	archive_handle->src_fd = fd;
 	archive_handle->offset = 0;
 
-	bb_xread_all(archive_handle->src_fd, &magic, 2);
-	if ((magic[0] != 0x1f) || (magic[1] != 0x8b)) {
+	/* The magic is checked in the map, the fd only has to skip it */
+	if (mapsize - payload < 2 || map[payload] != 0x1f || map[payload + 1] != 0x8b) {
 		bb_error_msg_and_die("Invalid gzip magic");
 	}
+	lseek(fd, payload + 2, SEEK_SET);
 	check_header_gzip(archive_handle->src_fd);
 	bb_xchdir("/"); // Install RPM's to root
 
 	archive_handle->src_fd = open_transformer(archive_handle->src_fd, inflate_gunzip);
 	archive_handle->offset = 0;
 	while (get_header_cpio(archive_handle) == EXIT_SUCCESS);
+	close(archive_handle->src_fd);
+}
+
+static uint32_t rpm_be32(const unsigned char *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
 }
 
+/* Check the header at pos fits in the map, return the offset past its store */
+static size_t rpm_header(size_t pos, uint32_t *entries, uint32_t *size)
+{
+	const unsigned char *header = map + pos;
+
+	if (mapsize - pos < 16 || memcmp(header, RPM_HEADER_MAGIC, 3) != 0)
+		return 0; /* Invalid magic */
+	if (header[3] != 1)
+		return 0; /* This program only supports v1 headers */
+	*entries = rpm_be32(header + 8);
+	*size = rpm_be32(header + 12);
+	pos += 16;
+	if (*entries > (mapsize - pos) / 16)
+		return 0;
+	pos += *entries * 16;
+	if (*size > mapsize - pos)
+		return 0;
+	return pos + *size;
+}
 
-rpm_index **rpm_gettags(int fd, int *num_tags)
+static int rpm_gettags(int fd)
 {
-	rpm_index **tags = xzalloc(200 * sizeof(struct rpmtag *)); /* We should never need mode than 200, and realloc later */
-	int pass, tagindex = 0;
-	lseek(fd, 96, SEEK_CUR); /* Seek past the unused lead */
-
-	for (pass = 0; pass < 2; pass++) { /* 1st pass is the signature headers, 2nd is the main stuff */
-		struct {
-			char magic[3]; /* 3 byte magic: 0x8e 0xad 0xe8 */
-			uint8_t version; /* 1 byte version number */
-			uint32_t reserved; /* 4 bytes reserved */
-			uint32_t entries; /* Number of entries in header (4 bytes) */
-			uint32_t size; /* Size of store (4 bytes) */
-		} header;
-		rpm_index *tmpindex;
-		int storepos;
-
-		read(fd, &header, sizeof(header));
-		if (strncmp((char *) &header.magic, RPM_HEADER_MAGIC, 3) != 0) return NULL; /* Invalid magic */
-		if (header.version != 1) return NULL; /* This program only supports v1 headers */
-		header.size = ntohl(header.size);
-		header.entries = ntohl(header.entries);
-		storepos = lseek(fd,0,SEEK_CUR) + header.entries * 16;
-
-		while (header.entries--) {
-			tmpindex = tags[tagindex++] = xmalloc(sizeof(rpm_index));
-			read(fd, tmpindex, sizeof(rpm_index));
-			tmpindex->tag = ntohl(tmpindex->tag); tmpindex->type = ntohl(tmpindex->type); tmpindex->count = ntohl(tmpindex->count);
-			tmpindex->offset = storepos + ntohl(tmpindex->offset);
-			if (pass==0) tmpindex->tag -= 743;
-		}
-		lseek(fd, header.size, SEEK_CUR); /* Seek past store */
-		if (pass==0) lseek(fd, (8 - (lseek(fd,0,SEEK_CUR) % 8)) % 8, SEEK_CUR); /* Skip padding to 8 byte boundary after reading signature headers */
+	const rpm_index *index;
+	struct stat st;
+	uint32_t entries, size, tag;
+	size_t pos;
+
+	if (fstat(fd, &st) != 0 || st.st_size < 96 || (size_t) st.st_size != st.st_size)
+		return -1;
+	mapsize = st.st_size;
+	/* Only the pages of the headers are ever touched, never the payload */
+	map = mmap(0, mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		map = NULL;
+		return -1;
+	}
+	if (memcmp(map, RPM_MAGIC, 4) != 0)
+		return -1;
+
+	/* Skip the unused lead and the signature header, padded to 8 bytes */
+	pos = rpm_header(96, &entries, &size);
+	if (!pos)
+		return -1;
+	pos = (pos + 7) & ~7;
+	payload = rpm_header(pos, &entries, &size);
+	if (!payload)
+		return -1;
+	index = (const rpm_index *) (map + pos + 16);
+	store = (const unsigned char *) (index + entries);
+	storesize = size;
+
+	/* Walk backwards so the first of any duplicate tags wins */
+	while (entries--) {
+		tag = ntohl(index[entries].tag) - RPMTAG_NAME;
+		if (tag < RPMTAG_COUNT && ntohl(index[entries].offset) < storesize)
+			tagtab[tag] = &index[entries];
+	}
+	return 0; /* All done, payload is the offset of the gzipped cpio archive */
+}
+
+static void rpm_freetags(void)
+{
+	int tag;
+
+	for (tag = 0; tag < RPMTAG_COUNT; tag++) {
+		free(strtab[tag]);
+		strtab[tag] = NULL;
+		tagtab[tag] = NULL;
 	}
-	tags = realloc(tags, tagindex * sizeof(struct rpmtag *)); /* realloc tags to save space */
-	*num_tags = tagindex;
-	return tags; /* All done, leave the file at the start of the gzipped cpio archive */
+	if (map)
+		munmap((void *) map, mapsize);
+	map = NULL;
 }
 
-int bsearch_rpmtag(const void *key, const void *item)
+static const rpm_index *rpm_gettag(int tag, int itemindex)
 {
-	int *tag = (int *)key;
-	rpm_index **tmp = (rpm_index **) item;
-	return (*tag - tmp[0]->tag);
+	const rpm_index *found;
+
+	tag -= RPMTAG_NAME;
+	if (tag < 0 || tag >= RPMTAG_COUNT || itemindex < 0)
+		return NULL;
+	found = tagtab[tag];
+	if (!found || (uint32_t) itemindex >= ntohl(found->count))
+		return NULL;
+	return found;
 }
 
-int rpm_getcount(int tag)
+/* A count that can't be true of the store (a corrupted header) reads as 0 */
+static int rpm_getcount(int tag)
 {
-	rpm_index **found;
-	found = bsearch(&tag, mytags, tagcount, sizeof(struct rpmtag *), bsearch_rpmtag);
+	const rpm_index *found = rpm_gettag(tag, 0);
+	uint32_t count, room;
+
 	if (!found) return 0;
-	else return found[0]->count;
+	count = ntohl(found->count);
+	room = storesize - ntohl(found->offset);
+	switch (ntohl(found->type)) {
+	case RPM_INT32_TYPE: room /= 4; break;
+	case RPM_INT16_TYPE: room /= 2; break;
+	case RPM_STRING_TYPE:
+	case RPM_I18NSTRING_TYPE: room = 1; break;
+	}
+	if (count > room) return 0;
+	/* Every string of an array is at least its NUL, but see they're there */
+	if (ntohl(found->type) == RPM_STRING_ARRAY_TYPE && count
+	 && !rpm_getstring(tag, count - 1))
+		return 0;
+	return count;
 }
 
-char *rpm_getstring(int tag, int itemindex)
+static const char *rpm_getstring(int tag, int itemindex)
 {
-	rpm_index **found;
-	found = bsearch(&tag, mytags, tagcount, sizeof(struct rpmtag *), bsearch_rpmtag);
-	if (!found || itemindex >= found[0]->count) return NULL;
-	if (found[0]->type == RPM_STRING_TYPE || found[0]->type == RPM_I18NSTRING_TYPE || found[0]->type == RPM_STRING_ARRAY_TYPE) {
-		int n;
-		char *tmpstr = (char *) (map + found[0]->offset);
-		for (n=0; n < itemindex; n++) tmpstr = tmpstr + strlen(tmpstr) + 1;
-		return tmpstr;
-	} else return NULL;
+	const rpm_index *found = rpm_gettag(tag, itemindex);
+	const char **strings;
+	uint32_t offset, count, n;
+
+	if (!found) return NULL;
+	offset = ntohl(found->offset);
+	switch (ntohl(found->type)) {
+	case RPM_STRING_TYPE:
+	case RPM_I18NSTRING_TYPE:
+		if (itemindex) return NULL;
+		/* fall through */
+	case RPM_STRING_ARRAY_TYPE:
+		break;
+	default:
+		return NULL;
+	}
+	if (itemindex == 0) {
+		if (!memchr(store + offset, 0, storesize - offset)) return NULL;
+		return (const char *) store + offset;
+	}
+
+	strings = strtab[tag - RPMTAG_NAME];
+	if (!strings) {
+		const unsigned char *end;
+
+		count = ntohl(found->count);
+		if (count > storesize - offset) return NULL; /* Can't all fit */
+		strings = strtab[tag - RPMTAG_NAME] = xzalloc(count * sizeof(char *));
+		for (n = 0; n < count && offset < storesize; n++) {
+			end = memchr(store + offset, 0, storesize - offset);
+			if (!end) break;
+			strings[n] = (const char *) store + offset;
+			offset = end + 1 - store;
+		}
+	}
+	return strings[itemindex];
 }
 
-int rpm_getint(int tag, int itemindex)
+static int rpm_getint(int tag, int itemindex)
 {
-	rpm_index **found;
-	int n, *tmpint;
-	/* gcc throws warnings here when sizeof(void*)!=sizeof(int) ...
-	 * it's ok to ignore it because tag won't be used as a pointer */
-	found = bsearch(&tag, mytags, tagcount, sizeof(struct rpmtag *), bsearch_rpmtag);
-	if (!found || itemindex >= found[0]->count) return -1;
-	tmpint = (int *) (map + found[0]->offset);
-	if (found[0]->type == RPM_INT32_TYPE) {
-		for (n=0; n<itemindex; n++) tmpint = (int *) ((void *) tmpint + 4);
-		return ntohl(*tmpint);
-	} else if (found[0]->type == RPM_INT16_TYPE) {
-		for (n=0; n<itemindex; n++) tmpint = (int *) ((void *) tmpint + 2);
-		return ntohs(*tmpint);
-	} else if (found[0]->type == RPM_INT8_TYPE) {
-		for (n=0; n<itemindex; n++) tmpint = (int *) ((void *) tmpint + 1);
-		return ntohs(*tmpint);
-	} else return -1;
+	const rpm_index *found = rpm_gettag(tag, itemindex);
+	const unsigned char *p;
+	uint32_t width;
+
+	if (!found) return -1;
+	switch (ntohl(found->type)) {
+	case RPM_INT32_TYPE: width = 4; break;
+	case RPM_INT16_TYPE: width = 2; break;
+	case RPM_INT8_TYPE: width = 1; break;
+	default: return -1;
+	}
+	if ((storesize - ntohl(found->offset)) / width <= (uint32_t) itemindex)
+		return -1;
+	p = store + ntohl(found->offset) + itemindex * width;
+	if (width == 4) return rpm_be32(p);
+	if (width == 2) return (p[0] << 8) | p[1];
+	return *p;
 }
 
-void fileaction_dobackup(char *filename, int fileref)
+static void fileaction_dobackup(char *filename, int fileref)
 {
 	struct stat oldfile;
 	int stat_res;
@@ -311,7 +433,7 @@ void fileaction_dobackup(char *filename, int fileref)
 	}
 }
 
-void fileaction_setowngrp(char *filename, int fileref)
+static void fileaction_setowngrp(char *filename, int fileref)
 {
 	int uid, gid;
 	uid = bb_xgetpwnam(rpm_getstring(RPMTAG_FILEUSERNAME, fileref));
@@ -319,12 +441,7 @@ void fileaction_setowngrp(char *filename, int fileref)
 	chown (filename, uid, gid);
 }
 
-void fileaction_list(char *filename, int ATTRIBUTE_UNUSED fileref)
-{
-	printf("%s\n", filename);
-}
-
-void loop_through_files(int filetag, void (*fileaction)(char *filename, int fileref))
+static void loop_through_files(int filetag, void (*fileaction)(char *filename, int fileref))
 {
 	int count = 0;
 	while (rpm_getstring(filetag, count)) {
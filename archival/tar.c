@@ -45,6 +45,14 @@
 
 #define TAR_BLOCK_SIZE		512
 
+/* The archive is written through a buffer of this size */
+#define TAR_BUFSIZE			(64 * 1024)
+
+/* How far ahead of the entry being written files are opened, and how
+ * much of them we ask the kernel to start reading in the meantime */
+#define TAR_PREFETCH_FILES	(ENABLE_FEATURE_TAR_PREFETCH ? 32 : 1)
+#define TAR_PREFETCH_BYTES	(8 * 1024 * 1024)
+
 /* POSIX tar Header Block, from POSIX 1003.1-1990  */
 #define NAME_SIZE			100
 struct TarHeader {		/* byte offset */
@@ -82,6 +90,16 @@ struct HardLinkInfo {
 	char name[1];		/* Start of filename (must be last) */
 };
 
+/* Something that has been looked at (and, if it is a regular file,
+ * opened) but not yet written to the archive */
+typedef struct TarEntry {
+	char *fileName;			/* Name on disk */
+	int headerOffset;		/* Start of the member name in fileName */
+	struct stat statBuf;
+	HardLinkInfo *hlInfo;	/* Earlier link to the same inode, if any */
+	int fd;					/* Open regular file, or -1 */
+} TarEntry;
+
 /* Some info to be carried along when creating a new tarball */
 struct TarBallInfo {
 	char *fileName;			/* File name of the tarball */
@@ -93,8 +111,18 @@ struct TarBallInfo {
 							   to include the tarball into itself */
 	int verboseFlag;		/* Whether to print extra stuff or not */
 	const llist_t *excludeList;	/* List of files to not include */
+	pattern_index_t *excludeAbs;	/* excludeList compiled, if it's long: */
+	pattern_index_t *excludeRel;	/* '/' anchored and floating patterns */
+	llist_t *excludeSplit[2];	/* the lists those were compiled from */
 	HardLinkInfo *hlInfoHead;	/* Hard Link Tracking Information */
 	HardLinkInfo *hlInfo;	/* Hard Link Info for the current file */
+	char *buf;				/* Archive output buffer */
+	unsigned bufUsed;
+	TarEntry *queue;		/* Entries waiting to be written, oldest */
+	int queueHead;			/* at queueHead, in the order they were */
+	int queueLen;			/* found */
+	off_t queueBytes;		/* Size of the regular files queued */
+	int queueError;			/* Writing a queued entry failed */
 };
 typedef struct TarBallInfo TarBallInfo;
 
@@ -193,6 +221,33 @@ static int putOctal(char *cp, int len, long value)
 	return TRUE;
 }
 
+static void tarFlush(TarBallInfo *tbInfo)
+{
+	if (tbInfo->bufUsed && bb_full_write(tbInfo->tarFd, tbInfo->buf,
+				tbInfo->bufUsed) != tbInfo->bufUsed)
+		bb_perror_msg_and_die(bb_msg_write_error);
+	tbInfo->bufUsed = 0;
+}
+
+static void tarWrite(TarBallInfo *tbInfo, const void *data, size_t len)
+{
+	while (len) {
+		size_t n = TAR_BUFSIZE - tbInfo->bufUsed;
+
+		if (n > len)
+			n = len;
+		if (data) {
+			memcpy(tbInfo->buf + tbInfo->bufUsed, data, n);
+			data = (const char *) data + n;
+		} else
+			memset(tbInfo->buf + tbInfo->bufUsed, 0, n);
+		tbInfo->bufUsed += n;
+		len -= n;
+		if (tbInfo->bufUsed == TAR_BUFSIZE)
+			tarFlush(tbInfo);
+	}
+}
+
 /* Write out a tar header for the specified file/directory/whatever */
 static inline int writeTarHeader(struct TarBallInfo *tbInfo,
 		const char *header_name, const char *real_name, struct stat *statbuf)
@@ -268,17 +323,9 @@ static inline int writeTarHeader(struct TarBallInfo *tbInfo,
 		chksum += *cp++;
 	putOctal(header.chksum, 7, chksum);
 
-	/* Now write the header out to disk */
-	if ((size =
-		 bb_full_write(tbInfo->tarFd, (char *) &header,
-					sizeof(struct TarHeader))) < 0) {
-		bb_error_msg(bb_msg_io_error, real_name);
-		return (FALSE);
-	}
-	/* Pad the header up to the tar block size */
-	for (; size < TAR_BLOCK_SIZE; size++) {
-		write(tbInfo->tarFd, "\0", 1);
-	}
+	/* Now write the header out (it is exactly one tar block) */
+	tarWrite(tbInfo, &header, sizeof(struct TarHeader));
+
 	/* Now do the verbose thing (or not) */
 
 	if (tbInfo->verboseFlag) {
@@ -294,8 +341,44 @@ static inline int writeTarHeader(struct TarBallInfo *tbInfo,
 }
 
 # ifdef CONFIG_FEATURE_TAR_FROM
-static inline int exclude_file(const llist_t *excluded_files, const char *file)
+/* Split the exclude list by anchoring and compile both halves */
+static void compile_excludes(TarBallInfo *tbInfo)
 {
+	const llist_t *l;
+	int n = 0;
+
+	/* A handful of patterns is quicker to just try one by one */
+	for (l = tbInfo->excludeList; l && n < 16; l = l->link)
+		n++;
+	if (n < 16)
+		return;
+
+	/* The indexes hand back nodes of these, so they stay until the end */
+	for (l = tbInfo->excludeList; l; l = l->link)
+		llist_add_to(&tbInfo->excludeSplit[l->data[0] != '/'], l->data);
+	tbInfo->excludeAbs = compile_list_patterns(tbInfo->excludeSplit[0],
+			FNM_PATHNAME | FNM_LEADING_DIR);
+	tbInfo->excludeRel = compile_list_patterns(tbInfo->excludeSplit[1],
+			FNM_PATHNAME | FNM_LEADING_DIR);
+}
+
+static inline int exclude_file(const TarBallInfo *tbInfo, const char *file)
+{
+	const llist_t *excluded_files = tbInfo->excludeList;
+
+	if (tbInfo->excludeAbs) {
+		const char *p;
+
+		if (find_pattern_entry(tbInfo->excludeAbs, file))
+			return 1;
+		for (p = file; p[0] != '\0'; p++) {
+			if ((p == file || p[-1] == '/') && p[0] != '/' &&
+				find_pattern_entry(tbInfo->excludeRel, p))
+				return 1;
+		}
+		return 0;
+	}
+
 	while (excluded_files) {
 		if (excluded_files->data[0] == '/') {
 			if (fnmatch(excluded_files->data, file,
@@ -317,14 +400,68 @@ static inline int exclude_file(const llist_t *excluded_files, const char *file)
 	return 0;
 }
 # else
-#define exclude_file(excluded_files, file) 0
+#define compile_excludes(tbInfo) ((void)0)
+#define exclude_file(tbInfo, file) 0
 # endif
 
+/* Copy exactly the size the header promised, whatever happened to the
+ * file since, and pad it up to the tar block size */
+static int writeFileBody(TarBallInfo *tbInfo, TarEntry *entry)
+{
+	off_t left = entry->statBuf.st_size;
+	ssize_t n = 0;
+
+	while (left > 0) {
+		size_t room = TAR_BUFSIZE - tbInfo->bufUsed;
+
+		if (room > left)
+			room = left;
+		n = safe_read(entry->fd, tbInfo->buf + tbInfo->bufUsed, room);
+		if (n <= 0)
+			break;
+		tbInfo->bufUsed += n;
+		left -= n;
+		if (tbInfo->bufUsed == TAR_BUFSIZE)
+			tarFlush(tbInfo);
+	}
+	if (n < 0)
+		bb_perror_msg("%s", entry->fileName);
+	else if (left)
+		bb_error_msg("%s: file shrank by %lld bytes; padding with zeros",
+				entry->fileName, (long long) left);
+	tarWrite(tbInfo, NULL,
+			left + (-entry->statBuf.st_size & (TAR_BLOCK_SIZE - 1)));
+	return left == 0;
+}
+
+/* Write the oldest queued entry to the archive */
+static void writeQueuedEntry(TarBallInfo *tbInfo)
+{
+	TarEntry *entry = &tbInfo->queue[tbInfo->queueHead];
+
+	tbInfo->hlInfo = entry->hlInfo;
+	if (writeTarHeader(tbInfo, entry->fileName + entry->headerOffset,
+				entry->fileName, &entry->statBuf) == FALSE)
+		tbInfo->queueError = TRUE;
+	else if (entry->fd >= 0 && !writeFileBody(tbInfo, entry))
+		tbInfo->queueError = TRUE;
+
+	if (entry->fd >= 0) {
+		close(entry->fd);
+		tbInfo->queueBytes -= entry->statBuf.st_size;
+	}
+	free(entry->fileName);
+	tbInfo->queueHead = (tbInfo->queueHead + 1) % TAR_PREFETCH_FILES;
+	tbInfo->queueLen--;
+}
+
 static int writeFileToTarball(const char *fileName, struct stat *statbuf,
 							  void *userData)
 {
 	struct TarBallInfo *tbInfo = (struct TarBallInfo *) userData;
 	const char *header_name;
+	HardLinkInfo *hlInfo;
+	TarEntry *entry;
 	int inputFileFd = -1;
 
 	/*
@@ -334,10 +471,10 @@ static int writeFileToTarball(const char *fileName, struct stat *statbuf,
 	   ** treating any additional occurances as hard links.  This is done
 	   ** by adding the file information to the HardLinkInfo linked list.
 	 */
-	tbInfo->hlInfo = NULL;
+	hlInfo = NULL;
 	if (statbuf->st_nlink > 1) {
-		tbInfo->hlInfo = findHardLinkInfo(tbInfo->hlInfoHead, statbuf);
-		if (tbInfo->hlInfo == NULL)
+		hlInfo = findHardLinkInfo(tbInfo->hlInfoHead, statbuf);
+		if (hlInfo == NULL)
 			addHardLinkInfo(&tbInfo->hlInfoHead, statbuf, fileName);
 	}
 
@@ -376,37 +513,45 @@ static int writeFileToTarball(const char *fileName, struct stat *statbuf,
 		return TRUE;
 
 	if (ENABLE_FEATURE_TAR_FROM &&
-			exclude_file(tbInfo->excludeList, header_name)) {
+			exclude_file(tbInfo, header_name)) {
 		return SKIP;
 	}
 
 	/* Is this a regular file? */
-	if ((tbInfo->hlInfo == NULL) && (S_ISREG(statbuf->st_mode))) {
+	if ((hlInfo == NULL) && (S_ISREG(statbuf->st_mode))) {
 
 		/* open the file we want to archive, and make sure all is well */
 		if ((inputFileFd = open(fileName, O_RDONLY)) < 0) {
 			bb_perror_msg("%s: Cannot open", fileName);
 			return (FALSE);
 		}
+#if ENABLE_FEATURE_TAR_PREFETCH && defined(POSIX_FADV_WILLNEED)
+		/* Have the kernel start reading it while we write out the
+		 * entries queued before it */
+		if (statbuf->st_size)
+			posix_fadvise(inputFileFd, 0,
+					statbuf->st_size < TAR_PREFETCH_BYTES
+						? statbuf->st_size : TAR_PREFETCH_BYTES,
+					POSIX_FADV_WILLNEED);
+#endif
 	}
 
-	/* Add an entry to the tarball */
-	if (writeTarHeader(tbInfo, header_name, fileName, statbuf) == FALSE) {
-		return (FALSE);
-	}
-
-	/* If it was a regular file, write out the body */
-	if (inputFileFd >= 0 ) {
-		ssize_t readSize = 0;
-
-		/* write the file to the archive */
-		readSize = bb_copyfd_eof(inputFileFd, tbInfo->tarFd);
-		close(inputFileFd);
-
-		/* Pad the file up to the tar block size */
-		for (; (readSize % TAR_BLOCK_SIZE) != 0; readSize++)
-			write(tbInfo->tarFd, "\0", 1);
-	}
+	/* Queue it, so that entries keep their order in the archive */
+	entry = &tbInfo->queue[(tbInfo->queueHead + tbInfo->queueLen)
+			% TAR_PREFETCH_FILES];
+	entry->fileName = bb_xstrdup(fileName);
+	entry->headerOffset = header_name - fileName;
+	entry->statBuf = *statbuf;
+	entry->hlInfo = hlInfo;
+	entry->fd = inputFileFd;
+	tbInfo->queueLen++;
+	if (inputFileFd >= 0)
+		tbInfo->queueBytes += statbuf->st_size;
+
+	/* Write out entries until the lookahead is back within bounds */
+	while (tbInfo->queueLen == TAR_PREFETCH_FILES
+			|| (tbInfo->queueLen && tbInfo->queueBytes > TAR_PREFETCH_BYTES))
+		writeQueuedEntry(tbInfo);
 
 	return (TRUE);
 }
@@ -418,10 +563,9 @@ static inline int writeTarFile(const int tar_fd, const int verboseFlag,
 	pid_t gzipPid = 0;
 
 	int errorFlag = FALSE;
-	ssize_t size;
 	struct TarBallInfo tbInfo;
 
-	tbInfo.hlInfoHead = NULL;
+	memset(&tbInfo, 0, sizeof(tbInfo));
 
 	fchmod(tar_fd, 0644);
 	tbInfo.tarFd = tar_fd;
@@ -432,11 +576,39 @@ static inline int writeTarFile(const int tar_fd, const int verboseFlag,
 	if (fstat(tbInfo.tarFd, &tbInfo.statBuf) < 0)
 		bb_perror_msg_and_die("Couldnt stat tar file");
 
-	if ((ENABLE_FEATURE_TAR_GZIP || ENABLE_FEATURE_TAR_BZIP2) && gzip) {
+#ifdef CONFIG_GZIP
+	if (ENABLE_FEATURE_TAR_GZIP && gzip == 1) {
+		/* Compress with our own gzip in a child, no exec needed */
+		int gzipDataPipe[2];
+		char *gzip_argv[] = { "gzip", "-f", NULL };
+
+		if (pipe(gzipDataPipe) < 0)
+			bb_perror_msg_and_die("create pipe");
+
+		signal(SIGPIPE, SIG_IGN);	/* we only want EPIPE on errors */
+
+		gzipPid = fork();
+		if (gzipPid == 0) {
+			dup2(gzipDataPipe[0], 0);
+			close(gzipDataPipe[0]);
+			close(gzipDataPipe[1]);
+			if (tbInfo.tarFd != 1)
+				dup2(tbInfo.tarFd, 1);
+			bb_applet_name = "gzip";
+			optind = 0;
+			exit(gzip_main(2, gzip_argv));
+		} else if (gzipPid < 0)
+			bb_perror_msg_and_die("fork");
+		close(gzipDataPipe[0]);
+		tbInfo.tarFd = gzipDataPipe[1];
+	} else
+#endif
+	if ((ENABLE_FEATURE_TAR_GZIP || ENABLE_FEATURE_TAR_BZIP2
+			|| ENABLE_FEATURE_TAR_ZSTD) && gzip) {
 		int gzipDataPipe[2] = { -1, -1 };
 		int gzipStatusPipe[2] = { -1, -1 };
 		volatile int vfork_exec_errno = 0;
-		char *zip_exec = (gzip == 1) ? "gzip" : "bzip2";
+		char *zip_exec = (gzip == 1) ? "gzip" : (gzip == 2) ? "bzip2" : "zstd";
 
 
 		if (pipe(gzipDataPipe) < 0 || pipe(gzipStatusPipe) < 0)
@@ -491,6 +663,9 @@ static inline int writeTarFile(const int tar_fd, const int verboseFlag,
 	}
 
 	tbInfo.excludeList = exclude;
+	compile_excludes(&tbInfo);
+	tbInfo.buf = xmalloc(TAR_BUFSIZE);
+	tbInfo.queue = xmalloc(TAR_PREFETCH_FILES * sizeof(TarEntry));
 
 	/* Read the directory/files and iterate over them one at a time */
 	while (include) {
@@ -501,9 +676,14 @@ static inline int writeTarFile(const int tar_fd, const int verboseFlag,
 		}
 		include = include->link;
 	}
+	while (tbInfo.queueLen)
+		writeQueuedEntry(&tbInfo);
+	if (tbInfo.queueError)
+		errorFlag = TRUE;
+
 	/* Write two empty blocks to the end of the archive */
-	for (size = 0; size < (2 * TAR_BLOCK_SIZE); size++)
-		write(tbInfo.tarFd, "\0", 1);
+	tarWrite(&tbInfo, NULL, 2 * TAR_BLOCK_SIZE);
+	tarFlush(&tbInfo);
 
 	/* To be pedantically correct, we would check if the tarball
 	 * is smaller than 20 tar blocks, and pad it if it was smaller,
@@ -514,8 +694,15 @@ static inline int writeTarFile(const int tar_fd, const int verboseFlag,
 	close(tbInfo.tarFd);
 
 	/* Hang up the tools, close up shop, head home */
-	if (ENABLE_FEATURE_CLEAN_UP)
+	if (ENABLE_FEATURE_CLEAN_UP) {
 		freeHardLinkInfo(&tbInfo.hlInfoHead);
+		free(tbInfo.queue);
+		free(tbInfo.buf);
+		free_list_patterns(tbInfo.excludeAbs);
+		free_list_patterns(tbInfo.excludeRel);
+		llist_free(tbInfo.excludeSplit[0], NULL);
+		llist_free(tbInfo.excludeSplit[1], NULL);
+	}
 
 	if (errorFlag)
 		bb_error_msg("Error exit delayed from previous errors");
@@ -579,6 +766,40 @@ static char get_header_tar_Z(archive_handle_t *archive_handle)
 #define get_header_tar_Z	0
 #endif
 
+#ifdef CONFIG_FEATURE_TAR_AUTODETECT
+typedef char (*get_header_func_t)(archive_handle_t *);
+
+/* No compression option given: go by the magic number, as long as
+ * we can rewind the archive after peeking at it */
+static get_header_func_t detect_compression(int fd)
+{
+	unsigned char magic[4];
+	off_t pos;
+	ssize_t n;
+
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos < 0)
+		return get_header_tar;
+	n = bb_full_read(fd, magic, sizeof(magic));
+	if (lseek(fd, pos, SEEK_SET) != pos)
+		bb_perror_msg_and_die("lseek");
+	if (n != sizeof(magic))
+		return get_header_tar;
+
+	if (ENABLE_FEATURE_TAR_GZIP && magic[0] == 0x1f && magic[1] == 0x8b)
+		return get_header_tar_gz;
+	if (ENABLE_FEATURE_TAR_BZIP2 && !memcmp(magic, "BZh", 3))
+		return get_header_tar_bz2;
+	if (ENABLE_FEATURE_TAR_COMPRESS && magic[0] == 0x1f && magic[1] == 0x9d)
+		return get_header_tar_Z;
+	if (ENABLE_FEATURE_TAR_ZSTD && !memcmp(magic, "\x28\xb5\x2f\xfd", 4))
+		return get_header_tar_zst;
+	return get_header_tar;
+}
+#else
+#define detect_compression(fd)	get_header_tar
+#endif
+
 #define CTX_TEST                          (1 << 0)
 #define CTX_EXTRACT                       (1 << 1)
 #define TAR_OPT_BASEDIR                   (1 << 2)
@@ -651,6 +872,15 @@ static char get_header_tar_Z(archive_handle_t *archive_handle)
 #define TAR_OPT_STR_NOPRESERVE            "\203\213"
 #define TAR_OPT_AFTER_NOPRESERVE          TAR_OPT_AFTER_COMPRESS + 2
 
+#define TAR_OPT_ZSTD                      (1 << (TAR_OPT_AFTER_NOPRESERVE))
+#ifdef CONFIG_FEATURE_TAR_ZSTD
+# define TAR_OPT_STR_ZSTD                 "\204"
+# define TAR_OPT_AFTER_ZSTD               TAR_OPT_AFTER_NOPRESERVE + 1
+#else
+# define TAR_OPT_STR_ZSTD                 ""
+# define TAR_OPT_AFTER_ZSTD               TAR_OPT_AFTER_NOPRESERVE
+#endif
+
 static const char tar_options[]="txC:f:Opvk" \
 	TAR_OPT_STR_CREATE \
 	TAR_OPT_STR_BZIP2 \
@@ -658,7 +888,8 @@ static const char tar_options[]="txC:f:Opvk" \
 	TAR_OPT_STR_FROM \
 	TAR_OPT_STR_GZIP \
 	TAR_OPT_STR_COMPRESS \
-	TAR_OPT_STR_NOPRESERVE;
+	TAR_OPT_STR_NOPRESERVE \
+	TAR_OPT_STR_ZSTD;
 
 #ifdef CONFIG_FEATURE_TAR_LONG_OPTIONS
 static const struct option tar_long_options[] = {
@@ -692,6 +923,12 @@ static const struct option tar_long_options[] = {
 # endif
 # ifdef CONFIG_FEATURE_TAR_COMPRESS
 	{ "compress",			0,	NULL,	'Z' },
+# endif
+# ifdef CONFIG_FEATURE_TAR_ZSTD
+	{ "zstd",				0,	NULL,	'\204' },
+# endif
+# ifdef CONFIG_FEATURE_TAR_PARALLEL
+	{ "jobs",				1,	NULL,	'\205' },
 # endif
 	{ 0,					0, 0, 0 }
 };
@@ -707,10 +944,14 @@ int tar_main(int argc, char **argv)
 	const char *tar_filename = "-";
 	unsigned long opt;
 	llist_t *excludes = NULL;
+#if ENABLE_FEATURE_TAR_PARALLEL
+	char *jobs = NULL;
+#endif
 
 	/* Initialise default values */
 	tar_handle = init_handle();
-	tar_handle->flags = ARCHIVE_CREATE_LEADING_DIRS | ARCHIVE_PRESERVE_DATE | ARCHIVE_EXTRACT_UNCONDITIONAL;
+	tar_handle->flags = ARCHIVE_CREATE_LEADING_DIRS | ARCHIVE_PRESERVE_DATE | ARCHIVE_EXTRACT_UNCONDITIONAL
+		| ARCHIVE_DEFER_METADATA;
 
 	/* Prepend '-' to the first argument if required */
 	bb_opt_complementally = ENABLE_FEATURE_TAR_CREATE ?
@@ -726,6 +967,7 @@ int tar_main(int argc, char **argv)
 				&(tar_handle->reject),
 				&excludes
 #endif
+				USE_FEATURE_TAR_PARALLEL(, &jobs)
 				);
 
 	if (opt & CTX_TEST) {
@@ -741,6 +983,13 @@ int tar_main(int argc, char **argv)
 	if (opt & TAR_OPT_2STDOUT)
 		tar_handle->action_data = data_extract_to_stdout;
 
+#if ENABLE_FEATURE_TAR_PARALLEL
+	/* Small files are written by one worker process per CPU */
+	if (tar_handle->action_data == data_extract_all)
+		data_extract_all_parallel(jobs ? bb_xgetularg10_bnd(jobs, 1, 256)
+				: sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+
 	if (opt & TAR_OPT_VERBOSE) {
 		if ((tar_handle->action_header == header_list) ||
 			(tar_handle->action_header == header_verbose_list))
@@ -770,6 +1019,9 @@ int tar_main(int argc, char **argv)
 	if (ENABLE_FEATURE_TAR_COMPRESS && (opt & TAR_OPT_UNCOMPRESS))
 		get_header_ptr = get_header_tar_Z;
 
+	if (ENABLE_FEATURE_TAR_ZSTD && (opt & TAR_OPT_ZSTD))
+		get_header_ptr = get_header_tar_zst;
+
 	if (ENABLE_FEATURE_TAR_FROM) {
 		tar_handle->reject = append_file_list_to_list(tar_handle->reject);
 		/* Append excludes to reject */
@@ -840,6 +1092,8 @@ int tar_main(int argc, char **argv)
 			zipMode = 1;
 		if (ENABLE_FEATURE_TAR_BZIP2 && get_header_ptr == get_header_tar_bz2)
 			zipMode = 2;
+		if (ENABLE_FEATURE_TAR_ZSTD && get_header_ptr == get_header_tar_zst)
+			zipMode = 3;
 
 		if ((tar_handle->action_header == header_list) ||
 				(tar_handle->action_header == header_verbose_list))
@@ -850,17 +1104,28 @@ int tar_main(int argc, char **argv)
 				tar_handle->accept,
 			tar_handle->reject, zipMode);
 	} else {
+		pattern_index_t *passed_index = NULL;
+
+		if (ENABLE_FEATURE_TAR_AUTODETECT && get_header_ptr == get_header_tar)
+			get_header_ptr = detect_compression(tar_handle->src_fd);
 		while (get_header_ptr(tar_handle) == EXIT_SUCCESS);
+		/* Directory permissions and times were held back until now */
+		if (tar_handle->action_data == data_extract_all)
+			data_extract_all_finish(tar_handle);
 
 		/* Check that every file that should have been extracted was */
 		while (tar_handle->accept) {
-			if (!find_list_entry(tar_handle->reject, tar_handle->accept->data)
-				&& !find_list_entry(tar_handle->passed, tar_handle->accept->data))
+			if (!find_list_entry_indexed(tar_handle->reject,
+					&tar_handle->reject_index, tar_handle->accept->data)
+				&& !find_list_entry_indexed(tar_handle->passed,
+					&passed_index, tar_handle->accept->data))
 			{
 				bb_error_msg_and_die("%s: Not found in archive", tar_handle->accept->data);
 			}
 			tar_handle->accept = tar_handle->accept->link;
 		}
+		if (ENABLE_FEATURE_CLEAN_UP)
+			free_list_patterns(passed_index);
 	}
 
 	if (ENABLE_FEATURE_CLEAN_UP && tar_handle->src_fd != STDIN_FILENO)
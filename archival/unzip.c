@@ -20,8 +20,8 @@
  * Zip64 + other methods
  * Improve handling of zip format, ie.
  * - deferred CRC, comp. & uncomp. lengths (zip header flags bit 3)
+ *   when reading from a pipe
  * - unix file permissions, etc.
- * - central directory
  */
 
 #include <fcntl.h>
@@ -55,8 +55,9 @@ __swap32(uint32_t x) {
 #define ZIP_CDS_END_MAGIC		__swap32(0x06054b50)
 #define ZIP_DD_MAGIC			__swap32(0x08074b50)
 
-extern unsigned int gunzip_crc;
-extern unsigned int gunzip_bytes_out;
+/* Little endian fields of the central directory, wherever they sit */
+#define ZIP_GET16(p)	((p)[0] | ((p)[1] << 8))
+#define ZIP_GET32(p)	(ZIP_GET16(p) | ((uint32_t)ZIP_GET16((p) + 2) << 16))
 
 typedef union {
 	unsigned char raw[26];
@@ -74,6 +75,123 @@ typedef union {
 	} formated ATTRIBUTE_PACKED;
 } zip_header_t;
 
+/* Where we are in the central directory, when we could read it */
+typedef struct {
+	unsigned char *buf;
+	unsigned char *pos, *end;
+	unsigned int entries;
+	off_t local_offset;	/* local header of the current member */
+} zip_cdir_t;
+
+static void unzip_pread(int fd, void *buf, size_t count, off_t offset)
+{
+	if (pread(fd, buf, count, offset) != (ssize_t)count) {
+		bb_error_msg_and_die(bb_msg_read_error);
+	}
+}
+
+/* Load the central directory of a seekable archive, so members can be
+ * listed without reading their data and extracted by seeking straight
+ * to them.  Returns 0 if there is none we can use (pipe, zip64, junk
+ * in front of the archive), and we read the archive front to back. */
+static int unzip_read_central_dir(int fd, zip_cdir_t *cdir)
+{
+	struct stat st;
+	unsigned char *tail, *p;
+	off_t tail_len, eocd;
+	uint32_t cd_size, cd_offset;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 22)
+		return 0;
+
+	/* The end record is the last thing in the file, save a comment */
+	tail_len = MIN(st.st_size, 22 + 0xffff);
+	tail = xmalloc(tail_len);
+	unzip_pread(fd, tail, tail_len, st.st_size - tail_len);
+	for (p = tail + tail_len - 22; p >= tail; p--) {
+		if (ZIP_GET32(p) == 0x06054b50)
+			break;
+	}
+	if (p < tail) {
+		free(tail);
+		return 0;
+	}
+	cdir->entries = ZIP_GET16(p + 10);
+	cd_size = ZIP_GET32(p + 12);
+	cd_offset = ZIP_GET32(p + 16);
+	/* The directory ends where the end record starts (or the zip64 one,
+	 * if its locator is there), unless something was put in front of
+	 * the archive and every offset is off by that */
+	eocd = st.st_size - tail_len + (p - tail);
+	if (p - tail >= 20 && ZIP_GET32(p - 20) == 0x07064b50) {
+		unsigned char magic[4];
+
+		eocd = ZIP_GET32(p - 12);
+		if (ZIP_GET32(p - 8) != 0 || eocd + 4 > st.st_size)
+			eocd = -1;
+		else {
+			unzip_pread(fd, magic, 4, eocd);
+			if (ZIP_GET32(magic) != 0x06064b50)
+				eocd = -1;
+		}
+	}
+	free(tail);
+	if (cd_offset == 0xffffffff || (off_t)cd_offset + cd_size != eocd)
+		return 0;
+
+	cdir->buf = xmalloc(cd_size + 1);
+	unzip_pread(fd, cdir->buf, cd_size, cd_offset);
+	cdir->pos = cdir->buf;
+	cdir->end = cdir->buf + cd_size;
+	return 1;
+}
+
+/* Fill in the next member's header and name from the central directory */
+static int unzip_next_central(zip_cdir_t *cdir, zip_header_t *zip_header, char **name)
+{
+	unsigned char *p = cdir->pos;
+	unsigned int name_len;
+
+	if (!cdir->entries)
+		return 0;
+	if (p + 46 > cdir->end || ZIP_GET32(p) != 0x02014b50) {
+		bb_error_msg_and_die("Invalid zip magic %08X", p + 4 <= cdir->end ? ZIP_GET32(p) : 0);
+	}
+	zip_header->formated.version = ZIP_GET16(p + 6);
+	zip_header->formated.flags = ZIP_GET16(p + 8);
+	zip_header->formated.method = ZIP_GET16(p + 10);
+	zip_header->formated.modtime = ZIP_GET16(p + 12);
+	zip_header->formated.moddate = ZIP_GET16(p + 14);
+	zip_header->formated.crc32 = ZIP_GET32(p + 16);
+	zip_header->formated.cmpsize = ZIP_GET32(p + 20);
+	zip_header->formated.ucmpsize = ZIP_GET32(p + 24);
+	zip_header->formated.filename_len = name_len = ZIP_GET16(p + 28);
+	zip_header->formated.extra_len = ZIP_GET16(p + 30);
+	cdir->local_offset = ZIP_GET32(p + 42);
+
+	cdir->pos = p + 46 + name_len + zip_header->formated.extra_len + ZIP_GET16(p + 32);
+	if (cdir->pos > cdir->end) {
+		bb_error_msg_and_die("Invalid zip central directory");
+	}
+	free(*name);
+	*name = bb_xstrndup((char *)p + 46, name_len);
+	cdir->entries--;
+	return 1;
+}
+
+/* Where the current member's data starts: just past its local header,
+ * whose name and extra field needn't be the same size as the central ones */
+static off_t unzip_data_offset(int fd, zip_cdir_t *cdir)
+{
+	unsigned char local[30];
+
+	unzip_pread(fd, local, 30, cdir->local_offset);
+	if (ZIP_GET32(local) != 0x04034b50) {
+		bb_error_msg_and_die("Invalid zip magic %08X", ZIP_GET32(local));
+	}
+	return cdir->local_offset + 30 + ZIP_GET16(local + 26) + ZIP_GET16(local + 28);
+}
+
 static void unzip_skip(int fd, off_t skip)
 {
 	if (lseek(fd, skip, SEEK_CUR) == (off_t)-1) {
@@ -100,27 +218,43 @@ static void unzip_create_leading_dirs(char *fn)
 	free(name);
 }
 
-static int unzip_extract(zip_header_t *zip_header, int src_fd, int dst_fd)
+/* Extract a member whose data is at offset of src_fd (-1: right here) */
+static int unzip_extract(zip_header_t *zip_header, int src_fd, off_t offset, int dst_fd)
 {
 	if (zip_header->formated.method == 0) {
 		/* Method 0 - stored (not compressed) */
 		int size = zip_header->formated.ucmpsize;
-		if (size && (bb_copyfd_size(src_fd, dst_fd, size) != size)) {
+		if (offset >= 0) {
+			RESERVE_CONFIG_BUFFER(buffer, BUFSIZ);
+
+			while (size > 0) {
+				int n = MIN(size, BUFSIZ);
+				unzip_pread(src_fd, buffer, n, offset);
+				if (bb_full_write(dst_fd, buffer, n) != n) {
+					bb_error_msg_and_die("Cannot complete extraction");
+				}
+				offset += n;
+				size -= n;
+			}
+			RELEASE_CONFIG_BUFFER(buffer);
+		} else if (size && (bb_copyfd_size(src_fd, dst_fd, size) != size)) {
 			bb_error_msg_and_die("Cannot complete extraction");
 		}
 
 	} else {
 		/* Method 8 - inflate */
-		inflate_init(zip_header->formated.cmpsize);
-		inflate_unzip(src_fd, dst_fd);
-		inflate_cleanup();
+		uint32_t crc;
+		unsigned int bytes_out;
+
+		inflate_unzip(src_fd, offset, zip_header->formated.cmpsize, dst_fd,
+				&crc, &bytes_out);
 		/* Validate decompression - crc */
-		if (zip_header->formated.crc32 != (gunzip_crc ^ 0xffffffffL)) {
+		if (zip_header->formated.crc32 != crc) {
 			bb_error_msg("Invalid compressed data--crc error");
 			return 1;
 		}
 		/* Validate decompression - size */
-		if (zip_header->formated.ucmpsize != gunzip_bytes_out) {
+		if (zip_header->formated.ucmpsize != bytes_out) {
 			bb_error_msg("Invalid compressed data--length error");
 			return 1;
 		}
@@ -128,6 +262,149 @@ static int unzip_extract(zip_header_t *zip_header, int src_fd, int dst_fd)
 	return 0;
 }
 
+#if ENABLE_FEATURE_UNZIP_PARALLEL
+/*
+ * Members are independent, so with the central directory in hand we can
+ * inflate several at once: the main process still decides, in archive
+ * order, what to extract (and asks about overwriting), then hands the
+ * bigger members to a pool of workers, which pread() their data from the
+ * shared archive fd.  Names handed out are remembered until the pool
+ * is drained, and any later member with one of them, big or small,
+ * drains it before its file is even looked at, so the last one wins.
+ */
+#define UNZIP_PARALLEL_MIN	(64 * 1024)
+
+static int unzip_src_fd;
+static int unzip_failed;
+static parallel_jobs_t *unzip_jobs;
+static char **unzip_inflight;
+static unsigned unzip_inflight_mask;
+static unsigned unzip_inflight_count;
+
+static unsigned unzip_name_hash(const char *name)
+{
+	unsigned h = 0;
+
+	while (*name)
+		h = h * 31 + (unsigned char)*name++;
+	return h;
+}
+
+/* Slot of name in the in-flight set, or the empty one it would go in */
+static char **unzip_inflight_slot(const char *name)
+{
+	unsigned i = unzip_name_hash(name) & unzip_inflight_mask;
+
+	while (unzip_inflight[i] && strcmp(unzip_inflight[i], name) != 0)
+		i = (i + 1) & unzip_inflight_mask;
+	return &unzip_inflight[i];
+}
+
+/* Remember name as in flight; returns 0 if it already was */
+static int unzip_inflight_add(const char *name)
+{
+	char **slot;
+
+	if ((unzip_inflight_count + 1) * 2 > unzip_inflight_mask) {
+		char **old = unzip_inflight;
+		unsigned j, old_mask = unzip_inflight_mask;
+
+		unzip_inflight_mask = old ? old_mask * 2 + 1 : 255;
+		unzip_inflight = xzalloc((unzip_inflight_mask + 1) * sizeof(char *));
+		for (j = 0; old && j <= old_mask; j++) {
+			if (old[j])
+				*unzip_inflight_slot(old[j]) = old[j];
+		}
+		free(old);
+	}
+	slot = unzip_inflight_slot(name);
+	if (*slot)
+		return 0;
+	*slot = bb_xstrdup(name);
+	unzip_inflight_count++;
+	return 1;
+}
+
+static void unzip_jobs_drain(void)
+{
+	unsigned i;
+
+	if (unzip_jobs) {
+		parallel_jobs_finish(unzip_jobs);
+		unzip_jobs = NULL;
+	}
+	for (i = 0; unzip_inflight && i <= unzip_inflight_mask; i++) {
+		free(unzip_inflight[i]);
+		unzip_inflight[i] = NULL;
+	}
+	unzip_inflight_count = 0;
+}
+
+/* Worker side: "offset method crc cmpsize ucmpsize name" */
+static int unzip_job(const char *arg, void *result)
+{
+	zip_header_t zip_header;
+	long long offset;
+	unsigned method, crc, cmpsize, ucmpsize;
+	int name_at = 0, dst_fd, ret;
+
+	sscanf(arg, "%lld %u %u %u %u %n", &offset, &method, &crc, &cmpsize,
+			&ucmpsize, &name_at);
+	zip_header.formated.method = method;
+	zip_header.formated.crc32 = crc;
+	zip_header.formated.cmpsize = cmpsize;
+	zip_header.formated.ucmpsize = ucmpsize;
+	dst_fd = bb_xopen(arg + name_at, O_WRONLY | O_CREAT | O_TRUNC);
+	ret = unzip_extract(&zip_header, unzip_src_fd, offset, dst_fd);
+	close(dst_fd);
+	return ret;
+}
+
+static void unzip_job_done(int status, void *result)
+{
+	if (status)
+		unzip_failed = 1;
+}
+
+/* Before anything looks at or writes to name, let an earlier member
+ * of that name land */
+static void unzip_inflight_wait(const char *name)
+{
+	if (unzip_inflight_count && *unzip_inflight_slot(name))
+		unzip_jobs_drain();
+}
+
+/* Try to have a worker extract this member; 0 if we should do it */
+static int unzip_extract_parallel(zip_header_t *zip_header, int src_fd,
+		off_t offset, const char *name)
+{
+	char *arg;
+
+	if (zip_header->formated.cmpsize < UNZIP_PARALLEL_MIN)
+		return 0;
+	unzip_inflight_wait(name);
+	unzip_inflight_add(name);
+	if (!unzip_jobs) {
+		unzip_src_fd = src_fd;
+		unzip_jobs = parallel_jobs_start(sysconf(_SC_NPROCESSORS_ONLN),
+				unzip_job, unzip_job_done, 0);
+		if (!unzip_jobs)
+			return 0;
+	}
+	arg = bb_xasprintf("%lld %u %u %u %u %s", (long long)offset,
+			zip_header->formated.method, zip_header->formated.crc32,
+			zip_header->formated.cmpsize, zip_header->formated.ucmpsize, name);
+	parallel_jobs_add(unzip_jobs, arg);
+	free(arg);
+	return 1;
+}
+#else
+#define unzip_failed 0
+#define unzip_jobs_drain() ((void)0)
+#define unzip_inflight_wait(name) ((void)0)
+#define unzip_extract_parallel(zip_header, src_fd, offset, name) 0
+#endif
+
 int unzip_main(int argc, char **argv)
 {
 	zip_header_t zip_header;
@@ -136,8 +413,12 @@ int unzip_main(int argc, char **argv)
 	unsigned int total_size = 0;
 	unsigned int total_entries = 0;
 	int src_fd = -1, dst_fd = -1;
+	zip_cdir_t cdir;
+	int use_cdir;
+	off_t data_offset = -1;
 	char *src_fn = NULL, *dst_fn = NULL;
 	llist_t *zaccept = NULL;
+	pattern_index_t *zaccept_index = NULL, *zreject_index = NULL;
 	llist_t *zreject = NULL;
 	char *base_dir = NULL;
 	int failed, i, opt, opt_range = 0, list_header_done = 0;
@@ -243,10 +524,20 @@ int unzip_main(int argc, char **argv)
 		printf("Archive:  %s\n", src_fn);
 
 	failed = 0;
+	use_cdir = unzip_read_central_dir(src_fd, &cdir);
 
 	while (1) {
 		unsigned int magic;
 
+		if (use_cdir) {
+			if (!unzip_next_central(&cdir, &zip_header, &dst_fn))
+				break;
+			if ((zip_header.formated.method != 0) && (zip_header.formated.method != 8)) {
+				bb_error_msg_and_die("Unsupported compression method %d", zip_header.formated.method);
+			}
+			goto got_header;
+		}
+
 		/* Check magic number */
 		unzip_read(src_fd, &magic, 4);
 		if (magic == ZIP_CDS_MAGIC) {
@@ -281,6 +572,7 @@ int unzip_main(int argc, char **argv)
 		/* Skip extra header bytes */
 		unzip_skip(src_fd, zip_header.formated.extra_len);
 
+ got_header:
 		if ((verbosity == v_list) && !list_header_done){
 			printf("  Length     Date   Time    Name\n"
 				   " --------    ----   ----    ----\n");
@@ -288,8 +580,8 @@ int unzip_main(int argc, char **argv)
 		}
 
 		/* Filter zip entries */
-		if (find_list_entry(zreject, dst_fn) ||
-			(zaccept && !find_list_entry(zaccept, dst_fn))) { /* Skip entry */
+		if (find_list_entry_indexed(zreject, &zreject_index, dst_fn) ||
+			(zaccept && !find_list_entry_indexed(zaccept, &zaccept_index, dst_fn))) { /* Skip entry */
 			i = 'n';
 
 		} else { /* Extract entry */
@@ -332,6 +624,7 @@ int unzip_main(int argc, char **argv)
 
 			} else {  /* Extract file */
 			_check_file:
+				unzip_inflight_wait(dst_fn);
 				if (stat(dst_fn, &stat_buf) == -1) { /* File does not exist */
 					if (errno != ENOENT) {
 						bb_perror_msg_and_die("Cannot stat '%s'",dst_fn);
@@ -365,12 +658,24 @@ int unzip_main(int argc, char **argv)
 			overwrite = o_always;
 		case 'y': /* Open file and fall into unzip */
 			unzip_create_leading_dirs(dst_fn);
-			dst_fd = bb_xopen(dst_fn, O_WRONLY | O_CREAT);
+			if (use_cdir) {
+				data_offset = unzip_data_offset(src_fd, &cdir);
+				if (unzip_extract_parallel(&zip_header, src_fd, data_offset, dst_fn)) {
+					if (verbosity == v_normal) {
+						printf("  inflating: %s\n", dst_fn);
+					}
+					break;
+				}
+			}
+			dst_fd = bb_xopen(dst_fn, O_WRONLY | O_CREAT | O_TRUNC);
 		case -1: /* Unzip */
 			if (verbosity == v_normal) {
 				printf("  inflating: %s\n", dst_fn);
 			}
-			if (unzip_extract(&zip_header, src_fd, dst_fd)) {
+			if (use_cdir && i == -1) {
+				data_offset = unzip_data_offset(src_fd, &cdir);
+			}
+			if (unzip_extract(&zip_header, src_fd, use_cdir ? data_offset : -1, dst_fd)) {
 			    failed = 1;
 			}
 			if (dst_fd != STDOUT_FILENO) {
@@ -383,7 +688,9 @@ int unzip_main(int argc, char **argv)
 			overwrite = o_never;
 		case 'n':
 			/* Skip entry data */
-			unzip_skip(src_fd, zip_header.formated.cmpsize);
+			if (!use_cdir) {
+				unzip_skip(src_fd, zip_header.formated.cmpsize);
+			}
 			break;
 
 		case 'r':
@@ -403,12 +710,17 @@ int unzip_main(int argc, char **argv)
 		}
 
 		/* Data descriptor section */
-		if (zip_header.formated.flags & 4) {
+		if (!use_cdir && (zip_header.formated.flags & 4)) {
 			/* skip over duplicate crc, compressed size and uncompressed size */
 			unzip_skip(src_fd, 12);
 		}
 	}
 
+	unzip_jobs_drain();
+	if (unzip_failed) {
+		failed = 1;
+	}
+
 	if (verbosity == v_list) {
 		printf(" --------                   -------\n"
 		       "%9d                   %d files\n", total_size, total_entries);
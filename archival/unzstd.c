@@ -0,0 +1,72 @@
+/*
+ * zstd decompression applet, using the decoder in libunarchive.
+ *
+ * Copyright (C) 2006 by BusyBox developers
+ *
+ * Licensed under GPLv2 or later, see file LICENSE in this tarball for details.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "busybox.h"
+#include "unarchive.h"
+
+#define UNZSTD_OPT_STDOUT	1
+#define UNZSTD_OPT_FORCE	2
+
+int unzstd_main(int argc, char **argv)
+{
+	char *filename;
+	unsigned long opt;
+	int status, src_fd, dst_fd;
+
+	opt = bb_getopt_ulflags(argc, argv, "cf");
+
+	/* Set input filename and number */
+	filename = argv[optind];
+	if (filename && strcmp(filename, "-") != 0) {
+		/* Open input file */
+		src_fd = bb_xopen(filename, O_RDONLY);
+	} else {
+		src_fd = STDIN_FILENO;
+		filename = 0;
+	}
+
+	/* if called as zstdcat force the stdout flag */
+	if ((opt & UNZSTD_OPT_STDOUT) || bb_applet_name[0] == 'z')
+		filename = 0;
+
+	/* Check that the input is sane.  */
+	if (isatty(src_fd) && (opt & UNZSTD_OPT_FORCE) == 0) {
+		bb_error_msg_and_die("Compressed data not read from terminal.  Use -f to force it.");
+	}
+
+	if (filename) {
+		struct stat stat_buf;
+		char *extension = filename + strlen(filename) - 4;
+
+		if (extension < filename || strcmp(extension, ".zst") != 0) {
+			bb_error_msg_and_die("Invalid extension");
+		}
+		xstat(filename, &stat_buf);
+		*extension = 0;
+		dst_fd = bb_xopen3(filename, O_WRONLY | O_CREAT | O_TRUNC, stat_buf.st_mode);
+	} else
+		dst_fd = STDOUT_FILENO;
+	status = unzstd(src_fd, dst_fd);
+	if (filename) {
+		if (!status)
+			filename[strlen(filename)] = '.';
+		if (unlink(filename) < 0) {
+			bb_error_msg_and_die("Couldn't remove %s", filename);
+		}
+	}
+
+	return status;
+}
+
+/* vi:set ts=4: */
@@ -33,6 +33,8 @@
 #include <selinux/selinux.h>
 #endif
 
+#define CP_OPT_j	(1 << (10 + 2*ENABLE_SELINUX))
+
 int cp_main(int argc, char **argv)
 {
 	struct stat source_stat;
@@ -46,11 +48,17 @@ int cp_main(int argc, char **argv)
 #ifdef CONFIG_SELINUX
 	char *context_str=NULL;
 #endif
+#if ENABLE_FEATURE_CP_PARALLEL
+	char *jopt;
+#endif
 
 #ifdef CONFIG_SELINUX
-	flags = bb_getopt_ulflags(argc, argv, "pdRfiarPHLcZ:",&context_str);
+	flags = bb_getopt_ulflags(argc, argv, "pdRfiarPHLcZ:"
+			USE_FEATURE_CP_PARALLEL("j:"), &context_str
+			USE_FEATURE_CP_PARALLEL(, &jopt));
 #else
-	flags = bb_getopt_ulflags(argc, argv, "pdRfiarPHL");
+	flags = bb_getopt_ulflags(argc, argv, "pdRfiarPHL"
+			USE_FEATURE_CP_PARALLEL("j:", &jopt));
 #endif
 
 	if (flags & 32) {
@@ -103,6 +111,13 @@ int cp_main(int argc, char **argv)
 		bb_show_usage();
 	}
 
+#if ENABLE_FEATURE_CP_PARALLEL
+	if (flags & CP_OPT_j) {
+		flags &= ~CP_OPT_j;
+		copy_file_parallel_start(bb_xgetularg10_bnd(jopt, 1, 256), flags);
+	}
+#endif
+
 	last = argv[argc - 1];
 	argv += optind;
 
@@ -138,5 +153,10 @@ int cp_main(int argc, char **argv)
 		free((void *) dest);
 	} while (1);
 
+#if ENABLE_FEATURE_CP_PARALLEL
+	if (copy_file_parallel_finish() < 0) {
+		status = 1;
+	}
+#endif
 	exit(status);
 }
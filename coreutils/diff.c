@@ -29,6 +29,7 @@
 #include <stddef.h>
 #include <paths.h>
 #include <dirent.h>
+#include <sys/mman.h>
 #include "busybox.h"
 
 #define FSIZE_MAX 32768
@@ -90,6 +91,7 @@ struct stat stb1, stb2;
 char **dl;
 int dl_count = 0;
 
+#if !ENABLE_FEATURE_DIFF_MYERS
 struct cand {
 	int x;
 	int y;
@@ -100,6 +102,7 @@ struct line {
 	int serial;
 	int value;
 } *file[2];
+#endif
 
 /*
  * The following struct is used to record change information
@@ -114,19 +117,21 @@ struct context_vec {
 };
 
 static int *J;			/* will be overlaid on class */
-static int *class;		/* will be overlaid on file[0] */
-static int *klist;		/* will be overlaid on file[0] after class */
-static int *member;		/* will be overlaid on file[1] */
-static int clen;
 static int len[2];
 static int pref, suff;	/* length of prefix and suffix */
 static int slen[2];
 static int anychange;
 static long *ixnew;		/* will be overlaid on file[1] */
 static long *ixold;		/* will be overlaid on klist */
+#if !ENABLE_FEATURE_DIFF_MYERS
+static int *class;		/* will be overlaid on file[0] */
+static int *klist;		/* will be overlaid on file[0] after class */
+static int *member;		/* will be overlaid on file[1] */
+static int clen;
 static struct cand *clist;	/* merely a free storage pot for candidates */
 static int clistlen;	/* the length of clist */
 static struct line *sfile[2];	/* shortened by pruning common prefix/suffix */
+#endif
 static struct context_vec *context_vec_start;
 static struct context_vec *context_vec_end;
 static struct context_vec *context_vec_ptr;
@@ -185,6 +190,7 @@ static void print_status(int val, char *path1, char *path2, char *entry)
 	}
 }
 
+#if !ENABLE_FEATURE_DIFF_MYERS
 /*
  * Hash function taken from Robert Sedgewick, Algorithms in C, 3d ed., p 578.
  */
@@ -344,6 +350,7 @@ static void equiv(struct line *a, int n, struct line *b, int m, int *c)
 	}
 	c[j] = -1;
 }
+#endif
 
 static int isqrt(int n)
 {
@@ -362,6 +369,7 @@ static int isqrt(int n)
 	return (x);
 }
 
+#if !ENABLE_FEATURE_DIFF_MYERS
 static int newcand(int x, int y, int pred)
 {
 	struct cand *q;
@@ -610,6 +618,7 @@ static void sort(struct line *a, int n)
 		}
 	}
 }
+#endif
 
 
 static void uni_range(int a, int b)
@@ -622,6 +631,7 @@ static void uni_range(int a, int b)
 		printf("%d,0", b);
 }
 
+#if !ENABLE_FEATURE_DIFF_MYERS
 static int fetch(long *f, int a, int b, FILE * lb, int ch)
 {
 	int i, j, c, lastc, col, nc;
@@ -676,6 +686,459 @@ static int asciifile(FILE * f)
 #endif
 	return (1);
 }
+#else /* ENABLE_FEATURE_DIFF_MYERS */
+
+/*
+ * Myers' O(ND) difference algorithm, in the linear space variant from
+ * E. Myers, "An O(ND) Difference Algorithm and Its Variations",
+ * Algorithmica 1 (1986).
+ *
+ * Both files are mapped (or, for pipes, read) into memory once.  After
+ * the common prefix and suffix are trimmed, every remaining line is
+ * interned in a hash table that compares real line contents, so the
+ * search below only compares small integers and, unlike the readhash()
+ * scheme, never finds spurious matches that have to be checked and
+ * broken afterwards.  The result is the same J vector and ixold/ixnew
+ * line index the Hunt-McIlroy code builds, so output() is shared.
+ */
+
+static char *text[2];		/* contents of the two files */
+static long text_len[2];
+static int text_mapped[2];
+static int *eqv[2];		/* equivalence class of each line in the trimmed range */
+static char *changed[2];	/* line is not part of the common subsequence */
+static int *fdiag, *bdiag;	/* furthest reaching D-paths, indexed by diagonal */
+static int too_expensive;
+
+static void load_file(int n, FILE * f)
+{
+	struct stat st;
+	size_t size = 0, alloc = 0;
+	char *p = NULL;
+	size_t cnt;
+
+	text_mapped[n] = 0;
+	if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+		if (p != MAP_FAILED) {
+			text[n] = p;
+			text_len[n] = st.st_size;
+			text_mapped[n] = 1;
+			return;
+		}
+		p = NULL;
+	}
+
+	do {
+		if (size == alloc) {
+			alloc = alloc * 2 + BUFSIZ;
+			p = xrealloc(p, alloc);
+		}
+		cnt = fread(p + size, 1, alloc - size, f);
+		size += cnt;
+	} while (cnt);
+	if (ferror(f))
+		bb_perror_msg_and_die(bb_msg_read_error);
+	text[n] = p;
+	text_len[n] = size;
+}
+
+static void unload_files(void)
+{
+	int n;
+
+	for (n = 0; n < 2; n++) {
+		if (text_mapped[n])
+			munmap(text[n], text_len[n]);
+		else
+			free(text[n]);
+		text[n] = NULL;
+		text_len[n] = 0;
+		text_mapped[n] = 0;
+	}
+}
+
+static int asciitext(int n)
+{
+#if ENABLE_FEATURE_DIFF_BINARY
+	const unsigned char *buf = (unsigned char *) text[n];
+	long i, cnt = MIN(text_len[n], BUFSIZ);
+
+	if (cmd_flags & FLAG_a)
+		return (1);
+	for (i = 0; i < cnt; i++) {
+		if (!isprint(buf[i]) && !isspace(buf[i])) {
+			return (0);
+		}
+	}
+#endif
+	return (1);
+}
+
+/*
+ * Build the line index: line i of file n is text[n][ix[i - 1]] up to
+ * ix[i].  Like check(), a last line without a newline ends one past
+ * the end of the file, which is how fetch() knows to say so.
+ */
+static void split_lines(int n)
+{
+	const char *p = text[n];
+	const long size = text_len[n];
+	long *ix, off = 0;
+	int l = 0, alloc = 1024;
+	char *nl;
+
+	ix = xmalloc(alloc * sizeof(long));
+	ix[0] = 0;
+	while (off < size) {
+		if (l + 2 >= alloc) {
+			alloc *= 2;
+			ix = xrealloc(ix, alloc * sizeof(long));
+		}
+		nl = memchr(p + off, '\n', size - off);
+		off = nl ? nl - p + 1 : size + 1;
+		ix[++l] = off;
+	}
+	len[n] = l;
+	if (n == 0) {
+		free(ixold);
+		ixold = ix;
+	} else {
+		free(ixnew);
+		ixnew = ix;
+	}
+}
+
+static const char *line_start(int n, int i, const char **end)
+{
+	const long *ix = n ? ixnew : ixold;
+
+	*end = text[n] + MIN(ix[i], text_len[n]);
+	return text[n] + ix[i - 1];
+}
+
+/*
+ * Return the next character of a line as -b, -w and -i see it, or EOF.
+ * With -b or -w the newline counts as white space, so trailing blanks
+ * and a missing newline at end of file are ignored, as GNU diff does.
+ */
+static int line_getc(const char **pp, const char *end)
+{
+	const char *p = *pp;
+	int c;
+
+	if (cmd_flags & (FLAG_b | FLAG_w)) {
+		const char *s = p;
+
+		while (p < end && isspace(*p))
+			p++;
+		if (p == end) {
+			*pp = p;
+			return EOF;
+		}
+		if (p != s && !(cmd_flags & FLAG_w)) {
+			*pp = p;
+			return ' ';
+		}
+	}
+	if (p == end)
+		return EOF;
+	c = (unsigned char) *p++;
+	if (cmd_flags & FLAG_i)
+		c = tolower(c);
+	*pp = p;
+	return c;
+}
+
+static unsigned line_hash(const char *p, const char *end)
+{
+	unsigned h = 5381;
+	int c;
+
+	if (!(cmd_flags & (FLAG_b | FLAG_i | FLAG_w))) {
+		while (p < end)
+			h = h * 33 + (unsigned char) *p++;
+	} else {
+		while ((c = line_getc(&p, end)) != EOF)
+			h = h * 33 + c;
+	}
+	return h;
+}
+
+static int lines_equal(int n1, int i1, int n2, int i2)
+{
+	const char *e1, *e2;
+	const char *p1 = line_start(n1, i1, &e1);
+	const char *p2 = line_start(n2, i2, &e2);
+	int c;
+
+	if (!(cmd_flags & (FLAG_b | FLAG_i | FLAG_w)))
+		return e1 - p1 == e2 - p2 && memcmp(p1, p2, e1 - p1) == 0;
+	do {
+		c = line_getc(&p1, e1);
+		if (c != line_getc(&p2, e2))
+			return 0;
+	} while (c != EOF);
+	return 1;
+}
+
+/* Give every line of the trimmed ranges a number unique to its contents */
+static void classify(void)
+{
+	struct eqclass {
+		unsigned hash;
+		int file;
+		int line;
+	} *cls;
+	const char *p, *e;
+	unsigned hash, size, h;
+	int *bucket;
+	int n, i, nclass = 0;
+
+	for (size = 64; size < 2U * (slen[0] + slen[1]); size <<= 1)
+		continue;
+	bucket = xzalloc(size * sizeof(int));
+	cls = xmalloc((slen[0] + slen[1] + 1) * sizeof(*cls));
+
+	for (n = 0; n < 2; n++) {
+		eqv[n] = xmalloc((slen[n] + 1) * sizeof(int));
+		for (i = 0; i < slen[n]; i++) {
+			p = line_start(n, pref + i + 1, &e);
+			hash = line_hash(p, e);
+			for (h = hash & (size - 1); bucket[h]; h = (h + 1) & (size - 1)) {
+				struct eqclass *c = &cls[bucket[h] - 1];
+
+				if (c->hash == hash
+				 && lines_equal(c->file, c->line, n, pref + i + 1))
+					break;
+			}
+			if (!bucket[h]) {
+				cls[nclass].hash = hash;
+				cls[nclass].file = n;
+				cls[nclass].line = pref + i + 1;
+				bucket[h] = ++nclass;
+			}
+			eqv[n][i] = bucket[h];
+		}
+	}
+	free(cls);
+	free(bucket);
+}
+
+/*
+ * Find the midpoint of the shortest edit script for x[xoff..xlim) and
+ * y[yoff..ylim) by running the search from both ends until the paths
+ * overlap.  If that takes too long, settle for the point that got
+ * furthest, which gives a good but not necessarily minimal diff.
+ */
+static void diag(int xoff, int xlim, int yoff, int ylim, int *px, int *py)
+{
+	const int *const xv = eqv[0];
+	const int *const yv = eqv[1];
+	int *const fd = fdiag;
+	int *const bd = bdiag;
+	const int dmin = xoff - ylim;
+	const int dmax = xlim - yoff;
+	const int fmid = xoff - yoff;
+	const int bmid = xlim - ylim;
+	const int odd = (fmid - bmid) & 1;
+	int fmin = fmid, fmax = fmid;
+	int bmin = bmid, bmax = bmid;
+	int c, d, x, y;
+
+	fd[fmid] = xoff;
+	bd[bmid] = xlim;
+	for (c = 1;; c++) {
+		/* Extend the forward paths by one edit */
+		if (fmin > dmin)
+			fd[--fmin - 1] = -1;
+		else
+			fmin++;
+		if (fmax < dmax)
+			fd[++fmax + 1] = -1;
+		else
+			fmax--;
+		for (d = fmax; d >= fmin; d -= 2) {
+			x = fd[d - 1] >= fd[d + 1] ? fd[d - 1] + 1 : fd[d + 1];
+			y = x - d;
+			while (x < xlim && y < ylim && xv[x] == yv[y])
+				x++, y++;
+			fd[d] = x;
+			if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+				*px = x;
+				*py = y;
+				return;
+			}
+		}
+
+		/* And the backward ones */
+		if (bmin > dmin)
+			bd[--bmin - 1] = INT_MAX;
+		else
+			bmin++;
+		if (bmax < dmax)
+			bd[++bmax + 1] = INT_MAX;
+		else
+			bmax--;
+		for (d = bmax; d >= bmin; d -= 2) {
+			x = bd[d - 1] < bd[d + 1] ? bd[d - 1] : bd[d + 1] - 1;
+			y = x - d;
+			while (x > xoff && y > yoff && xv[x - 1] == yv[y - 1])
+				x--, y--;
+			bd[d] = x;
+			if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+				*px = x;
+				*py = y;
+				return;
+			}
+		}
+
+		if (c >= too_expensive) {
+			int fxybest = -1, fxbest = 0;
+			int bxybest = INT_MAX, bxbest = 0;
+
+			for (d = fmax; d >= fmin; d -= 2) {
+				x = MIN(fd[d], xlim);
+				y = x - d;
+				if (ylim < y)
+					x = ylim + d, y = ylim;
+				if (fxybest < x + y) {
+					fxybest = x + y;
+					fxbest = x;
+				}
+			}
+			for (d = bmax; d >= bmin; d -= 2) {
+				x = MAX(xoff, bd[d]);
+				y = x - d;
+				if (y < yoff)
+					x = yoff + d, y = yoff;
+				if (x + y < bxybest) {
+					bxybest = x + y;
+					bxbest = x;
+				}
+			}
+			if ((xlim + ylim) - bxybest < fxybest - (xoff + yoff)) {
+				*px = fxbest;
+				*py = fxybest - fxbest;
+			} else {
+				*px = bxbest;
+				*py = bxybest - bxbest;
+			}
+			return;
+		}
+	}
+}
+
+static void compareseq(int xoff, int xlim, int yoff, int ylim)
+{
+	const int *const xv = eqv[0];
+	const int *const yv = eqv[1];
+	int x, y;
+
+	while (xoff < xlim && yoff < ylim && xv[xoff] == yv[yoff])
+		xoff++, yoff++;
+	while (xlim > xoff && ylim > yoff && xv[xlim - 1] == yv[ylim - 1])
+		xlim--, ylim--;
+
+	if (xoff == xlim)
+		memset(changed[1] + yoff, 1, ylim - yoff);
+	else if (yoff == ylim)
+		memset(changed[0] + xoff, 1, xlim - xoff);
+	else {
+		diag(xoff, xlim, yoff, ylim, &x, &y);
+		compareseq(xoff, x, yoff, y);
+		compareseq(x, xlim, y, ylim);
+	}
+}
+
+/* Fill in len[], ixold/ixnew and the match vector J */
+static void myers_diff(void)
+{
+	int *diags;
+	int i, j, ndiags;
+
+	split_lines(0);
+	split_lines(1);
+
+	for (pref = 0; pref < len[0] && pref < len[1]
+		 && lines_equal(0, pref + 1, 1, pref + 1); pref++)
+		continue;
+	for (suff = 0; suff < len[0] - pref && suff < len[1] - pref
+		 && lines_equal(0, len[0] - suff, 1, len[1] - suff); suff++)
+		continue;
+	slen[0] = len[0] - pref - suff;
+	slen[1] = len[1] - pref - suff;
+
+	classify();
+	changed[0] = xzalloc(slen[0] + 1);
+	changed[1] = xzalloc(slen[1] + 1);
+	ndiags = slen[0] + slen[1] + 3;
+	diags = xmalloc(2 * ndiags * sizeof(int));
+	fdiag = diags + slen[1] + 1;
+	bdiag = fdiag + ndiags;
+#if ENABLE_FEATURE_DIFF_MINIMAL
+	too_expensive = (cmd_flags & FLAG_d) ? INT_MAX : MAX(4096, 2 * isqrt(ndiags));
+#else
+	too_expensive = MAX(4096, 2 * isqrt(ndiags));
+#endif
+	compareseq(0, slen[0], 0, slen[1]);
+	free(diags);
+	free(eqv[0]);
+	free(eqv[1]);
+
+	J = xrealloc(J, (len[0] + 2) * sizeof(int));
+	for (i = 0; i <= pref; i++)
+		J[i] = i;
+	for (i = j = 0; i < slen[0]; i++) {
+		if (changed[0][i]) {
+			J[pref + i + 1] = 0;
+			continue;
+		}
+		while (changed[1][j])
+			j++;
+		J[pref + i + 1] = pref + ++j;
+	}
+	for (i = len[0] - suff + 1; i <= len[0]; i++)
+		J[i] = i + len[1] - len[0];
+	free(changed[0]);
+	free(changed[1]);
+}
+
+static int fetch(long *f, int a, int b, FILE * lb, int ch)
+{
+	const int n = (f == ixnew);
+	const char *p, *end;
+	int i, col;
+
+	for (i = a; i <= b; i++) {
+		if (ch != '\0') {
+			putchar(ch);
+			if (cmd_flags & FLAG_T)
+				putchar('\t');
+		}
+		p = line_start(n, i, &end);
+		if (!(cmd_flags & FLAG_t))
+			fwrite(p, 1, end - p, stdout);
+		else {
+			for (col = 0; p < end; p++) {
+				if (*p == '\t') {
+					do {
+						putchar(' ');
+					} while (++col & 7);
+				} else {
+					putchar(*p);
+					col++;
+				}
+			}
+		}
+		if (f[i] > text_len[n]) {
+			puts("\n\\ No newline at end of file");
+			return (0);
+		}
+	}
+	return (0);
+}
+#endif /* ENABLE_FEATURE_DIFF_MYERS */
 
 /* dump accumulated "unified" diff changes */
 static void dump_unified_vec(FILE * f1, FILE * f2)
@@ -924,7 +1387,9 @@ static int diffreg(char *ofile1, char *ofile2, int flags)
 	FILE *f1 = NULL;
 	FILE *f2 = NULL;
 	int rval = D_SAME;
+#if !ENABLE_FEATURE_DIFF_MYERS
 	int i;
+#endif
 
 	anychange = 0;
 	context_vec_ptr = context_vec_start - 1;
@@ -952,6 +1417,21 @@ static int diffreg(char *ofile1, char *ofile2, int flags)
 			f2 = bb_xfopen(file2, "r");
 	}
 
+#if ENABLE_FEATURE_DIFF_MYERS
+	load_file(0, f1);
+	load_file(1, f2);
+	if (text_len[0] == text_len[1]
+	 && memcmp(text[0], text[1], text_len[0]) == 0)
+		goto closem;
+
+	if (!asciitext(0) || !asciitext(1)) {
+		rval = D_BINARY;
+		status |= 1;
+		goto closem;
+	}
+
+	myers_diff();
+#else
 	if ((i = files_differ(f1, f2, flags)) == 0)
 		goto closem;
 	else if (i != 1) {	/* 1 == ok */
@@ -996,6 +1476,7 @@ static int diffreg(char *ofile1, char *ofile2, int flags)
 	ixold = xrealloc(ixold, (len[0] + 2) * sizeof(long));
 	ixnew = xrealloc(ixnew, (len[1] + 2) * sizeof(long));
 	check(f1, f2);
+#endif
 	output(file1, f1, file2, f2);
 
   closem:
@@ -1004,6 +1485,9 @@ static int diffreg(char *ofile1, char *ofile2, int flags)
 		if (rval == D_SAME)
 			rval = D_DIFFER;
 	}
+#if ENABLE_FEATURE_DIFF_MYERS
+	unload_files();
+#endif
 	if (f1 != NULL)
 		fclose(f1);
 	if (f2 != NULL)
@@ -23,8 +23,6 @@
  *
  * NON-OPTIMAL BEHAVIOUR:
  * 1. autowidth reads directories twice
- * 2. if you do a short directory listing without filetype characters
- *    appended, there's no need to stat each one
  * PORTABILITY:
  * 1. requires lstat (BSD) - how do you do it without?
  */
@@ -155,21 +153,41 @@ static const struct option ls_color_opt[] =
 struct dnode {			/* the basic node */
 	char *name;		/* the dir entry name */
 	char *fullname;		/* the dir entry name */
-	int   allocated;
-	struct stat dstat;	/* the file stat info */
+	struct stat dstat;	/* the file stat info, or just st_mode and
+				 * st_ino from the dirent if need_stat is 0 */
 #ifdef CONFIG_SELINUX
 	security_context_t sid;
 #endif
-	struct dnode *next;	/* point at the next node */
 };
 typedef struct dnode dnode_t;
 
-static struct dnode **list_dir(const char *);
+/*
+ * dnodes and their names are carved out of big chunks, one arena per
+ * directory being listed, and all freed at once when we are done with it
+ */
+struct dn_arena {
+	char *cur, *end;
+	void *chunks;
+};
+
+#define ARENA_CHUNK	(64 * 1024)
+#define ARENA_HDR	16	/* chunk list link, keeps 8 byte alignment */
+
+static struct dnode **list_dir(const char *, struct dn_arena *, int *);
 static struct dnode **dnalloc(int);
 static int list_single(struct dnode *);
 
 static unsigned int all_fmt;
 
+/* Does the listing need more than the names and types readdir gives? */
+static int need_stat;
+#ifdef CONFIG_FEATURE_LS_SORTFILES
+/* -U/-f: list in directory order, printing one-per-line output as we go */
+static int unsorted;
+#else
+#define unsorted 0
+#endif
+
 #ifdef CONFIG_FEATURE_AUTOWIDTH
 static int terminal_width = TERMINAL_WIDTH;
 static unsigned short tabstops = COLUMN_GAP;
@@ -180,7 +198,46 @@ static unsigned short tabstops = COLUMN_GAP;
 
 static int status = EXIT_SUCCESS;
 
-static struct dnode *my_stat(char *fullname, char *name)
+static void *arena_alloc(struct dn_arena *a, size_t size)
+{
+	char *p;
+
+	size = (size + 7) & ~7;
+	if (size > (size_t)(a->end - a->cur)) {
+		size_t chunk = MAX(size + ARENA_HDR, ARENA_CHUNK);
+		void **c = xmalloc(chunk);
+
+		*c = a->chunks;
+		a->chunks = c;
+		a->cur = (char *) c + ARENA_HDR;
+		a->end = (char *) c + chunk;
+	}
+	p = a->cur;
+	a->cur += size;
+	return p;
+}
+
+/* Give back p and everything allocated after it, if it is in the
+ * current chunk */
+static void arena_release(struct dn_arena *a, void *p)
+{
+	if ((char *) p >= (char *) a->chunks + ARENA_HDR && (char *) p <= a->cur)
+		a->cur = p;
+}
+
+static void arena_free(struct dn_arena *a)
+{
+	void **c, **next;
+
+	for (c = a->chunks; c; c = next) {
+		next = *c;
+		free(c);
+	}
+	a->cur = a->end = NULL;
+	a->chunks = NULL;
+}
+
+static struct dnode *my_stat(struct dn_arena *arena, char *fullname, char *name)
 {
 	struct stat dstat;
 	struct dnode *cur;
@@ -215,7 +272,7 @@ static struct dnode *my_stat(char *fullname, char *name)
 		}
 	}
 
-	cur = (struct dnode *) xmalloc(sizeof(struct dnode));
+	cur = arena_alloc(arena, sizeof(struct dnode));
 	cur->fullname = fullname;
 	cur->name = name;
 	cur->dstat = dstat;
@@ -286,20 +343,6 @@ static int count_dirs(struct dnode **dn, int nfiles, int notsubdirs)
 	return (dirs);
 }
 
-static int countfiles(struct dnode **dnp)
-{
-	int nfiles;
-	struct dnode *cur;
-
-	if (dnp == NULL)
-		return (0);
-	nfiles = 0;
-	for (cur = dnp[0]; cur->next != NULL; cur = cur->next)
-		nfiles++;
-	nfiles++;
-	return (nfiles);
-}
-
 /* get memory to hold an array of pointers */
 static struct dnode **dnalloc(int num)
 {
@@ -312,25 +355,11 @@ static struct dnode **dnalloc(int num)
 	return (p);
 }
 
-#ifdef CONFIG_FEATURE_LS_RECURSIVE
-static void dfree(struct dnode **dnp, int nfiles)
+static void dfree(struct dnode **dnp, struct dn_arena *arena)
 {
-	int i;
-
-	if (dnp == NULL)
-		return;
-
-	for (i = 0; i < nfiles; i++) {
-		struct dnode *cur = dnp[i];
-		if(cur->allocated)
-			free(cur->fullname);	/* free the filename */
-		free(cur);		/* free the dnode */
-	}
 	free(dnp);			/* free the array holding the dnode pointers */
+	arena_free(arena);	/* and the dnodes and names themselves */
 }
-#else
-#define dfree(...)
-#endif
 
 static struct dnode **splitdnarray(struct dnode **dn, int nfiles, int which)
 {
@@ -373,32 +402,28 @@ static struct dnode **splitdnarray(struct dnode **dn, int nfiles, int which)
 
 /*----------------------------------------------------------------------*/
 #ifdef CONFIG_FEATURE_LS_SORTFILES
+/* What qsort() shuffles: the sort key pulled out of the stat info up
+ * front, so comparisons don't have to chase every dnode */
+struct sort_key {
+	long long key;		/* bigger sorts first */
+	const char *name;
+	struct dnode *dn;
+};
+
 static int sortcmp(const void *a, const void *b)
 {
-	struct dnode *d1 = *(struct dnode **)a;
-	struct dnode *d2 = *(struct dnode **)b;
-	unsigned int sort_opts = all_fmt & SORT_MASK;
+	const struct sort_key *k1 = a;
+	const struct sort_key *k2 = b;
 	int dif;
 
 	dif = 0;			/* assume SORT_NAME */
-	if (sort_opts == SORT_SIZE) {
-		dif = (int) (d2->dstat.st_size - d1->dstat.st_size);
-	} else if (sort_opts == SORT_ATIME) {
-		dif = (int) (d2->dstat.st_atime - d1->dstat.st_atime);
-	} else if (sort_opts == SORT_CTIME) {
-		dif = (int) (d2->dstat.st_ctime - d1->dstat.st_ctime);
-	} else if (sort_opts == SORT_MTIME) {
-		dif = (int) (d2->dstat.st_mtime - d1->dstat.st_mtime);
-	} else if (sort_opts == SORT_DIR) {
-		dif = S_ISDIR(d2->dstat.st_mode) - S_ISDIR(d1->dstat.st_mode);
-		/* } else if (sort_opts == SORT_VERSION) { */
-		/* } else if (sort_opts == SORT_EXT) { */
-	}
+	if (k1->key != k2->key)
+		dif = (k2->key > k1->key) ? 1 : -1;
 
 	if (dif == 0) {
 		/* sort by name- may be a tie_breaker for time or size cmp */
-		if (ENABLE_LOCALE_SUPPORT) dif = strcoll(d1->name, d2->name);
-		else dif = strcmp(d1->name, d2->name);
+		if (ENABLE_LOCALE_SUPPORT) dif = strcoll(k1->name, k2->name);
+		else dif = strcmp(k1->name, k2->name);
 	}
 
 	if (all_fmt & SORT_ORDER_REVERSE) {
@@ -410,7 +435,37 @@ static int sortcmp(const void *a, const void *b)
 /*----------------------------------------------------------------------*/
 static void dnsort(struct dnode **dn, int size)
 {
-	qsort(dn, size, sizeof *dn, sortcmp);
+	unsigned int sort_opts = all_fmt & SORT_MASK;
+	struct sort_key *keys;
+	int i;
+
+	if (unsorted || size < 2)
+		return;
+	keys = xmalloc(size * sizeof(*keys));
+	for (i = 0; i < size; i++) {
+		struct stat *st = &dn[i]->dstat;
+
+		keys[i].key = 0;
+		if (sort_opts == SORT_SIZE) {
+			keys[i].key = st->st_size;
+		} else if (sort_opts == SORT_ATIME) {
+			keys[i].key = st->st_atime;
+		} else if (sort_opts == SORT_CTIME) {
+			keys[i].key = st->st_ctime;
+		} else if (sort_opts == SORT_MTIME) {
+			keys[i].key = st->st_mtime;
+		} else if (sort_opts == SORT_DIR) {
+			keys[i].key = S_ISDIR(st->st_mode);
+			/* } else if (sort_opts == SORT_VERSION) { */
+			/* } else if (sort_opts == SORT_EXT) { */
+		}
+		keys[i].name = dn[i]->name;
+		keys[i].dn = dn[i];
+	}
+	qsort(keys, size, sizeof(*keys), sortcmp);
+	for (i = 0; i < size; i++)
+		dn[i] = keys[i].dn;
+	free(keys);
 }
 #else
 #define sortcmp(a, b) 0
@@ -491,15 +546,20 @@ static void showdirs(struct dnode **dn, int ndirs, int first)
 		return;
 
 	for (i = 0; i < ndirs; i++) {
+		struct dn_arena arena = { NULL, NULL, NULL };
+
 		if (all_fmt & (DISP_DIRNAME | DISP_RECURSIVE)) {
 			if (!first)
 				printf("\n");
 			first = 0;
 			printf("%s:\n", dn[i]->fullname);
 		}
-		subdnp = list_dir(dn[i]->fullname);
-		nfiles = countfiles(subdnp);
-		if (nfiles > 0) {
+		subdnp = list_dir(dn[i]->fullname, &arena, &nfiles);
+		if (unsorted && (all_fmt & STYLE_ONE_RECORD_FLAG)) {
+			/* already printed; what came back are the subdirs */
+			if (ENABLE_FEATURE_LS_RECURSIVE && nfiles > 0)
+				showdirs(subdnp, nfiles, 0);
+		} else if (nfiles > 0) {
 			/* list all files at this level */
 			if (ENABLE_FEATURE_LS_SORTFILES) dnsort(subdnp, nfiles);
 			showfiles(subdnp, nfiles);
@@ -515,33 +575,79 @@ static void showdirs(struct dnode **dn, int ndirs, int first)
 						free(dnd);
 					}
 				}
-				/* free the dnodes and the fullname mem */
-				dfree(subdnp, nfiles);
 			}
 		}
+		/* free the dnodes and the fullname mem */
+		dfree(subdnp, &arena);
 	}
 }
 
+/* Fill in the stat info of a directory entry, from the dirent alone
+ * when that is all the listing needs */
+static int dn_stat(struct dnode *cur, int dir_fd, struct dirent *entry)
+{
+#ifdef CONFIG_SELINUX
+	cur->sid = NULL;
+#endif
+#ifdef DT_UNKNOWN
+	if (!need_stat && entry->d_type != DT_UNKNOWN
+		&& !(entry->d_type == DT_REG && (all_fmt & LIST_EXEC))
+	) {
+		memset(&cur->dstat, 0, sizeof(cur->dstat));
+		cur->dstat.st_mode = DTTOIF(entry->d_type);
+		cur->dstat.st_ino = entry->d_ino;
+		return 1;
+	}
+#endif
+#ifdef CONFIG_SELINUX
+	if ((all_fmt & LIST_CONTEXT) && is_selinux_enabled()) {
+		if (ENABLE_FEATURE_LS_FOLLOWLINKS && (all_fmt & FOLLOW_LINKS))
+			getfilecon(cur->fullname, &cur->sid);
+		else
+			lgetfilecon(cur->fullname, &cur->sid);
+	}
+#endif
+	if (fstatat(dir_fd, entry->d_name, &cur->dstat,
+#ifdef CONFIG_FEATURE_LS_FOLLOWLINKS
+			(all_fmt & FOLLOW_LINKS) ? 0 :
+#endif
+			AT_SYMLINK_NOFOLLOW)) {
+		bb_perror_msg("%s", cur->fullname);
+		status = EXIT_FAILURE;
+		return 0;
+	}
+	return 1;
+}
+
 /*----------------------------------------------------------------------*/
-static struct dnode **list_dir(const char *path)
+/* Read a directory into dnodes allocated from arena.  In unsorted
+ * one-per-line mode each entry is printed as soon as it is read, and
+ * only the subdirectories (for -R) are kept and returned. */
+static struct dnode **list_dir(const char *path, struct dn_arena *arena,
+		int *nfiles)
 {
-	struct dnode *dn, *cur, **dnp;
+	struct dnode *cur, **dnp;
 	struct dirent *entry;
 	DIR *dir;
-	int i, nfiles;
+	int n, alloc, plen, slash;
+	int stream = unsorted && (all_fmt & STYLE_ONE_RECORD_FLAG);
 
+	*nfiles = 0;
 	if (path == NULL)
 		return (NULL);
 
-	dn = NULL;
-	nfiles = 0;
 	dir = bb_opendir(path);
 	if (dir == NULL) {
 		status = EXIT_FAILURE;
 		return (NULL);	/* could not open the dir */
 	}
+	plen = strlen(path);
+	slash = (plen && path[plen - 1] != '/');
+	dnp = NULL;
+	n = alloc = 0;
 	while ((entry = readdir(dir)) != NULL) {
 		char *fullname;
+		int len;
 
 		/* are we going to list the file- it may be . or .. or a hidden file */
 		if (entry->d_name[0] == '.') {
@@ -553,28 +659,37 @@ static struct dnode **list_dir(const char *path)
 			if (!(all_fmt & DISP_HIDDEN))
 			continue;
 		}
-		fullname = concat_path_file(path, entry->d_name);
-		cur = my_stat(fullname, strrchr(fullname, '/') + 1);
-		if (!cur)
+		len = strlen(entry->d_name);
+		cur = arena_alloc(arena, sizeof(*cur) + plen + slash + len + 1);
+		fullname = (char *) (cur + 1);
+		memcpy(fullname, path, plen);
+		fullname[plen] = '/';
+		memcpy(fullname + plen + slash, entry->d_name, len + 1);
+		cur->fullname = fullname;
+		cur->name = fullname + plen + slash;
+		if (!dn_stat(cur, dirfd(dir), entry)) {
+			arena_release(arena, cur);
 			continue;
-		cur->allocated = 1;
-		cur->next = dn;
-		dn = cur;
-		nfiles++;
+		}
+		if (stream) {
+			list_single(cur);
+			putchar('\n');
+			if (!(ENABLE_FEATURE_LS_RECURSIVE && (all_fmt & DISP_RECURSIVE)
+				&& countsubdirs(&cur, 1))
+			) {
+				arena_release(arena, cur);
+				continue;
+			}
+		}
+		if (n == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			dnp = xrealloc(dnp, alloc * sizeof(*dnp));
+		}
+		dnp[n++] = cur;
 	}
 	closedir(dir);
 
-	/* now that we know how many files there are
-	   ** allocate memory for an array to hold dnode pointers
-	 */
-	if (dn == NULL)
-		return (NULL);
-	dnp = dnalloc(nfiles);
-	for (i = 0, cur = dn; i < nfiles; i++) {
-		dnp[i] = cur;	/* save pointer to node in array */
-		cur = cur->next;
-	}
-
+	*nfiles = n;
 	return (dnp);
 }
 
@@ -817,7 +932,8 @@ static const char ls_options[]="Cadil1gnsxA" \
 	LS_STR_RECURSIVE \
 	LS_STR_HUMAN_READABLE \
 	LS_STR_SELINUX \
-	LS_STR_AUTOWIDTH;
+	LS_STR_AUTOWIDTH \
+	USE_FEATURE_LS_SORTFILES("fU");
 
 #define LIST_MASK_TRIGGER	0
 #define STYLE_MASK_TRIGGER	STYLE_MASK
@@ -866,6 +982,10 @@ static const unsigned opt_flags[] = {
 #endif
 #ifdef CONFIG_FEATURE_AUTOWIDTH
        0, 0,                    /* T, w - ignored */
+#endif
+#ifdef CONFIG_FEATURE_LS_SORTFILES
+	DISP_HIDDEN | DISP_DOT,		/* f - see also below */
+	0,							/* U - see below */
 #endif
 	(1U<<31)
 };
@@ -878,8 +998,8 @@ int ls_main(int argc, char **argv)
 	struct dnode **dnd;
 	struct dnode **dnf;
 	struct dnode **dnp;
-	struct dnode *dn;
 	struct dnode *cur;
+	struct dn_arena arena = { NULL, NULL, NULL };
 	long opt;
 	int nfiles = 0;
 	int dnfiles;
@@ -961,6 +1081,18 @@ int ls_main(int argc, char **argv)
 		}
 	}
 
+#ifdef CONFIG_FEATURE_LS_SORTFILES
+	/* -U lists in directory order; -f is -aU without -l, -s or color */
+	if (opt & (3 << (i - 2))) {
+		unsorted = 1;
+		if (opt & (1 << (i - 2))) {
+			all_fmt &= ~(LIST_BLOCKS | (LIST_LONG & ~LIST_FILENAME));
+			if ((all_fmt & STYLE_MASK) == STYLE_LONG)
+				all_fmt &= ~STYLE_MASK;
+		}
+	}
+#endif
+
 #ifdef CONFIG_FEATURE_LS_COLOR
 	{
 		/* find color bit value - last position for short getopt */
@@ -984,6 +1116,10 @@ int ls_main(int argc, char **argv)
 			else if (color_opt != NULL && strcmp("auto", color_opt) == 0 && isatty(STDOUT_FILENO))
 				show_color = 1;
 		}
+#ifdef CONFIG_FEATURE_LS_SORTFILES
+		if (opt & (1 << (i - 2)))	/* -f */
+			show_color = 0;
+#endif
 	}
 #endif
 
@@ -1009,6 +1145,18 @@ int ls_main(int argc, char **argv)
 	if (!(all_fmt & STYLE_MASK))
 		all_fmt |= (isatty(STDOUT_FILENO) ? STYLE_COLUMNS : STYLE_SINGLE);
 
+	/* Only stat what we print or sort by; names and types come from readdir */
+	need_stat = (all_fmt & (LIST_MASK & ~(LIST_FILENAME | LIST_SYMLINK
+				| LIST_FILETYPE | LIST_EXEC)))
+#ifdef CONFIG_FEATURE_LS_FOLLOWLINKS
+		|| (all_fmt & FOLLOW_LINKS)
+#endif
+		|| (ENABLE_FEATURE_LS_SORTFILES && !unsorted
+			&& (all_fmt & SORT_MASK) != SORT_NAME
+			&& (all_fmt & SORT_MASK) != SORT_DIR
+			&& (all_fmt & SORT_MASK) != SORT_EXT
+			&& (all_fmt & SORT_MASK) != SORT_VERSION);
+
 	/*
 	 * when there are no cmd line args we have to supply a default "." arg.
 	 * we will create a second argv array, "av" that will hold either
@@ -1031,24 +1179,12 @@ int ls_main(int argc, char **argv)
 		all_fmt |= DISP_DIRNAME;	/* 2 or more items? label directories */
 
 	/* stuff the command line file names into an dnode array */
-	dn = NULL;
+	dnp = dnalloc(ac);
 	for (oi = 0; oi < ac; oi++) {
-		cur = my_stat(av[oi], av[oi]);
+		cur = my_stat(&arena, av[oi], av[oi]);
 		if (!cur)
 			continue;
-		cur->allocated = 0;
-		cur->next = dn;
-		dn = cur;
-		nfiles++;
-	}
-
-	/* now that we know how many files there are
-	   ** allocate memory for an array to hold dnode pointers
-	 */
-	dnp = dnalloc(nfiles);
-	for (i = 0, cur = dn; i < nfiles; i++) {
-		dnp[i] = cur;	/* save pointer to node in array */
-		cur = cur->next;
+		dnp[nfiles++] = cur;
 	}
 
 	if (all_fmt & DISP_NOLIST) {
@@ -1074,6 +1210,6 @@ int ls_main(int argc, char **argv)
 		}
 	}
 	if (ENABLE_FEATURE_CLEAN_UP)
-		dfree(dnp, nfiles);
+		dfree(dnp, &arena);
 	return (status);
 }
@@ -30,6 +30,7 @@ int pwd_main(int argc, char **argv)
 
 	if ((buf = xgetcwd(NULL)) != NULL) {
 		puts(buf);
+		free(buf);
 		bb_fflush_stdout_and_exit(EXIT_SUCCESS);
 	}
 
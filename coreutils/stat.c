@@ -201,8 +201,7 @@ static void print_stat(char *pformat, size_t buf_len, char m,
 {
 #define TYPE_SIGNED(t) (! ((t) 0 < (t) -1))
 	struct stat *statbuf = (struct stat *) data;
-	struct passwd *pw_ent;
-	struct group *gw_ent;
+	char *ug_name;
 
 	switch (m) {
 	case 'n':
@@ -263,9 +262,8 @@ static void print_stat(char *pformat, size_t buf_len, char m,
 		break;
 	case 'U':
 		strncat(pformat, "s", buf_len);
-		setpwent();
-		pw_ent = getpwuid(statbuf->st_uid);
-		printf(pformat, (pw_ent != 0L) ? pw_ent->pw_name : "UNKNOWN");
+		ug_name = bb_getpwuid(NULL, statbuf->st_uid, 0);
+		printf(pformat, ug_name ? ug_name : "UNKNOWN");
 		break;
 	case 'g':
 		strncat(pformat, "lu", buf_len);
@@ -273,9 +271,8 @@ static void print_stat(char *pformat, size_t buf_len, char m,
 		break;
 	case 'G':
 		strncat(pformat, "s", buf_len);
-		setgrent();
-		gw_ent = getgrgid(statbuf->st_gid);
-		printf(pformat, (gw_ent != 0L) ? gw_ent->gr_name : "UNKNOWN");
+		ug_name = bb_getgrgid(NULL, statbuf->st_gid, 0);
+		printf(pformat, ug_name ? ug_name : "UNKNOWN");
 		break;
 	case 't':
 		strncat(pformat, "lx", buf_len);
@@ -613,12 +610,10 @@ static int do_stat(char const *filename, char const *format)
 	} else {
 		char *linkname = NULL;
 
-		struct passwd *pw_ent;
-		struct group *gw_ent;
-		setgrent();
-		gw_ent = getgrgid(statbuf.st_gid);
-		setpwent();
-		pw_ent = getpwuid(statbuf.st_uid);
+		char *pw_name, *gr_name;
+
+		gr_name = bb_getgrgid(NULL, statbuf.st_gid, 0);
+		pw_name = bb_getpwuid(NULL, statbuf.st_uid, 0);
 
 		if (S_ISLNK(statbuf.st_mode))
 			linkname = xreadlink(filename);
@@ -647,9 +642,9 @@ static int do_stat(char const *filename, char const *format)
 		       (unsigned long int) (statbuf.st_mode & (S_ISUID|S_ISGID|S_ISVTX|S_IRWXU|S_IRWXG|S_IRWXO)),
 		       bb_mode_string(statbuf.st_mode),
 		       (unsigned long int) statbuf.st_uid,
-		       (pw_ent != 0L) ? pw_ent->pw_name : "UNKNOWN",
+		       pw_name ? pw_name : "UNKNOWN",
 		       (unsigned long int) statbuf.st_gid,
-		       (gw_ent != 0L) ? gw_ent->gr_name : "UNKNOWN");
+		       gr_name ? gr_name : "UNKNOWN");
 #ifdef CONFIG_SELINUX
 		printf("   S_Context: %lc\n", *scontext);
 #endif
@@ -32,6 +32,11 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include "busybox.h"
+#if ENABLE_FEATURE_TAIL_INOTIFY
+#include <libgen.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
 
 static const struct suffix_mult tail_suffixes[] = {
 	{ "b", 512 },
@@ -42,6 +47,18 @@ static const struct suffix_mult tail_suffixes[] = {
 
 static int status;
 
+/* What -f follows */
+static int *fds;
+static char **names;
+static int nfiles;
+static int header_threshhold = 1;
+static int last_shown = -1;	/* file whose data was written out last */
+#if ENABLE_FEATURE_FANCY_TAIL
+static int follow_name;		/* -F: reopen the file when it is replaced */
+#else
+#define follow_name 0
+#endif
+
 static void tail_xprint_header(const char *fmt, const char *filename)
 {
 	/* If we get an output error, there is really no sense in continuing. */
@@ -80,19 +97,182 @@ static ssize_t tail_read(int fd, char *buf, size_t count)
 static const char tail_opts[] =
 	"fn:c:"
 #if ENABLE_FEATURE_FANCY_TAIL
-	"qs:v"
+	"qs:vF"
 #endif
 	;
 
 static const char header_fmt[] = "\n==> %s <==\n";
 
+/* Write out whatever has been appended to file i since we last looked */
+static void tail_follow_read(int i, char *buf)
+{
+	ssize_t nread;
+
+	while (fds[i] >= 0 && (nread = tail_read(fds[i], buf, BUFSIZ)) > 0) {
+		if (i != last_shown && nfiles > header_threshhold) {
+			tail_xprint_header(header_fmt, names[i]);
+		}
+		last_shown = i;
+		tail_xbb_full_write(buf, nread);
+	}
+}
+
+#if ENABLE_FEATURE_TAIL_INOTIFY
+static int inotify_fd = -1;
+static int *file_wd;		/* watch on the file itself */
+static int *dir_wd;		/* -F: watch on its directory, to see it come back */
+static char *pending;
+
+#define PENDING_READ	1
+#define PENDING_CHECK	2
+
+static void tail_watch(int i)
+{
+	char *dir;
+
+	if (inotify_fd < 0 || fds[i] == STDIN_FILENO) {
+		return;
+	}
+	file_wd[i] = -1;
+	if (fds[i] >= 0) {
+		file_wd[i] = inotify_add_watch(inotify_fd, names[i], IN_MODIFY
+				| (follow_name ? IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF : 0));
+	}
+	if (follow_name && dir_wd[i] < 0) {
+		dir = bb_xstrdup(names[i]);
+		dir_wd[i] = inotify_add_watch(inotify_fd, dirname(dir),
+				IN_CREATE | IN_MOVED_TO);
+		free(dir);
+	}
+}
+
+/* Names of one file get the same watch descriptor: only the last of them
+ * to stop following it may remove the watch */
+static void tail_unwatch(int i)
+{
+	int j;
+
+	if (file_wd[i] < 0) {
+		return;
+	}
+	for (j = 0; j < nfiles; j++) {
+		if (j != i && file_wd[j] == file_wd[i]) {
+			break;
+		}
+	}
+	if (j == nfiles) {
+		inotify_rm_watch(inotify_fd, file_wd[i]);
+	}
+	file_wd[i] = -1;
+}
+#else
+#define tail_watch(i) ((void)0)
+#define tail_unwatch(i) ((void)0)
+#endif
+
+/* -F: if the name now refers to a different file, switch over to it */
+static void tail_check_replaced(int i, char *buf)
+{
+	struct stat now, cur;
+	int fd;
+
+	if (fds[i] == STDIN_FILENO || stat(names[i], &now) < 0) {
+		/* Gone for now: keep reading what we have until it is back */
+		return;
+	}
+	if (fds[i] >= 0 && fstat(fds[i], &cur) == 0
+	 && cur.st_dev == now.st_dev && cur.st_ino == now.st_ino) {
+		return;
+	}
+	if ((fd = open(names[i], O_RDONLY)) < 0) {
+		return;
+	}
+	if (fds[i] >= 0) {
+		/* Don't lose the last lines written before the rotation */
+		tail_follow_read(i, buf);
+		close(fds[i]);
+		tail_unwatch(i);
+		bb_error_msg("%s has been replaced; following new file", names[i]);
+	} else {
+		bb_error_msg("%s has appeared; following new file", names[i]);
+	}
+	fds[i] = fd;
+	tail_watch(i);
+}
+
+#if ENABLE_FEATURE_TAIL_INOTIFY
+/* Sleep until the kernel says something happened to one of the files,
+ * and deal with it.  Returns 0 if the caller should look at every file
+ * instead: inotify is unavailable, some file cannot be watched and it is
+ * time to poll it, or events were lost. */
+static int tail_wait_inotify(unsigned int sleep_period, char *buf)
+{
+	char ebuf[4 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+	struct inotify_event *ev;
+	struct pollfd pfd;
+	int timeout = -1;
+	ssize_t n, off;
+	int i;
+
+	if (inotify_fd < 0) {
+		sleep(sleep_period);
+		return 0;
+	}
+
+	for (i = 0; i < nfiles; i++) {
+		if (file_wd[i] < 0 && (!follow_name || dir_wd[i] < 0)) {
+			timeout = sleep_period < INT_MAX / 1000
+					? sleep_period * 1000 : INT_MAX;
+			break;
+		}
+	}
+	pfd.fd = inotify_fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, timeout) <= 0) {
+		return 0;
+	}
+	n = safe_read(inotify_fd, ebuf, sizeof(ebuf));
+	if (n <= 0) {
+		return 0;
+	}
+
+	for (off = 0; off < n; off += sizeof(*ev) + ev->len) {
+		ev = (struct inotify_event *)(ebuf + off);
+		if (ev->mask & IN_Q_OVERFLOW) {
+			return 0;
+		}
+		for (i = 0; i < nfiles; i++) {
+			if (ev->wd == file_wd[i]) {
+				pending[i] |= PENDING_READ;
+				if (ev->mask & ~IN_MODIFY) {
+					pending[i] |= PENDING_CHECK;
+				}
+			}
+			if (follow_name && ev->wd == dir_wd[i]) {
+				pending[i] |= PENDING_CHECK;
+			}
+		}
+	}
+
+	for (i = 0; i < nfiles; i++) {
+		if (pending[i] & PENDING_CHECK) {
+			tail_check_replaced(i, buf);
+		}
+		if (pending[i]) {
+			tail_follow_read(i, buf);
+		}
+		pending[i] = 0;
+	}
+	return 1;
+}
+#endif
+
 int tail_main(int argc, char **argv)
 {
 	long count = 10;
 	unsigned int sleep_period = 1;
 	int from_top = 0;
 	int follow = 0;
-	int header_threshhold = 1;
 	int count_bytes = 0;
 
 	char *tailbuf;
@@ -100,7 +280,7 @@ int tail_main(int argc, char **argv)
 	int taillen = 0;
 	int newline = 0;
 
-	int *fds, nfiles, nread, nwrite, seen, i, opt;
+	int nread, nwrite, seen, i, opt;
 	char *s, *buf;
 	const char *fmt;
 
@@ -149,6 +329,10 @@ int tail_main(int argc, char **argv)
 			case 'v':
 				header_threshhold = 0;
 				break;
+			case 'F':
+				follow = 1;
+				follow_name = 1;
+				break;
 #endif
 			default:
 				bb_show_usage();
@@ -179,7 +363,10 @@ int tail_main(int argc, char **argv)
 		} else if ((fds[nfiles] = open(argv[i], O_RDONLY)) < 0) {
 			bb_perror_msg("%s", argv[i]);
 			status = EXIT_FAILURE;
-			continue;
+			if (!follow_name) {
+				continue;
+			}
+			/* -F: keep the name, it may show up later */
 		}
 		argv[nfiles] = argv[i];
 		++nfiles;
@@ -188,6 +375,7 @@ int tail_main(int argc, char **argv)
 	if (!nfiles) {
 		bb_error_msg_and_die("no files");
 	}
+	names = argv;
 
 	tailbufsize = BUFSIZ;
 
@@ -209,6 +397,9 @@ int tail_main(int argc, char **argv)
 		 * starting file position may not be the beginning of the file.
 		 * Beware of backing up too far.  See example in wc.c.
 		 */
+		if (fds[i] < 0) {
+			continue;
+		}
 		if ((!(count|from_top)) && (lseek(fds[i], 0, SEEK_END) >= 0)) {
 			continue;
 		}
@@ -217,6 +408,7 @@ int tail_main(int argc, char **argv)
 			tail_xprint_header(fmt, argv[i]);
 			fmt = header_fmt;
 		}
+		last_shown = i;
 
 		buf = tailbuf;
 		taillen = 0;
@@ -300,22 +492,33 @@ int tail_main(int argc, char **argv)
 
 	buf = xrealloc(tailbuf, BUFSIZ);
 
-	fmt = NULL;
+#if ENABLE_FEATURE_TAIL_INOTIFY
+	if (follow) {
+		inotify_fd = inotify_init();
+		file_wd = xmalloc(nfiles * sizeof(int));
+		dir_wd = xmalloc(nfiles * sizeof(int));
+		pending = xzalloc(nfiles);
+		for (i = 0; i < nfiles; i++) {
+			file_wd[i] = dir_wd[i] = -1;
+			tail_watch(i);
+		}
+	}
+#endif
 
 	while (follow) {
+#if ENABLE_FEATURE_TAIL_INOTIFY
+		if (tail_wait_inotify(sleep_period, buf)) {
+			continue;
+		}
+#else
 		sleep(sleep_period);
+#endif
 		i = 0;
 		do {
-			if (nfiles > header_threshhold) {
-				fmt = header_fmt;
-			}
-			while ((nread = tail_read(fds[i], buf, sizeof(buf))) > 0) {
-				if (fmt) {
-					tail_xprint_header(fmt, argv[i]);
-					fmt = NULL;
-				}
-				tail_xbb_full_write(buf, nread);
+			if (follow_name) {
+				tail_check_replaced(i, buf);
 			}
+			tail_follow_read(i, buf);
 		} while (++i < nfiles);
 	}
 
@@ -52,12 +52,21 @@
  *      (dd ibs=1k skip=1 count=0 &> /dev/null ; wc -c) < /tmp/testfile
  *
  * for which 'wc -c' should output '0'.
+ *
+ * wc -c on a regular file now does exactly that: size minus position,
+ * and never less than zero.  Everything else is counted from large
+ * blocks read straight from the descriptor.  Without -L, runs of plain
+ * ASCII text are classified a machine word at a time: newlines are found
+ * with the usual "has zero byte" trick, and words are counted as word
+ * characters immediately followed by a blank.  Anything else (-L, bytes
+ * above 0x7e, control characters) goes through a per-byte table.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include "busybox.h"
 
 #ifdef CONFIG_LOCALE_SUPPORT
@@ -79,148 +88,322 @@ enum {
 	WC_LENGTH	= 3
 };
 
-/* Note: If this changes, remember to change the initialization of
- *       'name' in wc_main.  It needs to point to the terminating nul. */
-static const char wc_opts[] = "lwcL";	/* READ THE WARNING ABOVE! */
+/* Bit n of the option flags is count n above */
+static const char wc_opts[] = "lwcL" USE_FEATURE_WC_PARALLEL("j:");
+
+#define WC_OPT_j	(1 << 4)
 
+/* Byte classes for the general counting loop */
 enum {
-	OP_INC_LINE	= 1, /* OP_INC_LINE must be 1. */
-	OP_SPACE	= 2,
-	OP_NEWLINE	= 4,
-	OP_TAB		= 8,
-	OP_NUL		= 16,
+	C_OTHER = 0,	/* doesn't start or end a word */
+	C_WORD,
+	C_SPACE,
+	C_TAB,
+	C_NEWLINE,
+	C_EOL,			/* \r and \f: end the line but don't count it */
+	C_VTAB,
 };
 
-/* Note: If fmt_str changes, the offsets to 's' in the OUTPUT section
- *       will need to be updated. */
-static const char fmt_str[] = " %7u\0 %s\n";
-static const char total_str[] = "total";
+typedef unsigned long long wc_count_t;
 
-int wc_main(int argc, char **argv)
-{
-	FILE *fp;
-	const char *s;
-	unsigned int *pcounts;
-	unsigned int counts[4];
-	unsigned int totals[4];
+struct wc_state {
+	wc_count_t counts[4];
 	unsigned int linepos;
-	unsigned int u;
-	int num_files = 0;
-	int c;
-	char status = EXIT_SUCCESS;
-	char in_word;
-	char print_type;
+	int in_word;
+};
 
-	print_type = bb_getopt_ulflags(argc, argv, wc_opts);
+#define WC_BUFSIZ	(64 * 1024)
 
-	if (print_type == 0) {
-		print_type = (1 << WC_LINES) | (1 << WC_WORDS) | (1 << WC_CHARS);
-	}
+static unsigned char wc_class[256];
+static unsigned int print_type;
+static wc_count_t totals[4];
+static int status = EXIT_SUCCESS;
 
-	argv += optind;
-	if (!*argv) {
-		*--argv = (char *) bb_msg_standard_input;
-	}
+/* Word-at-a-time helpers.  All of them leave 0x80 set in every byte of
+ * the result for which the condition holds, and 0 elsewhere. */
+#define ONES			(~0UL / 0xff)
+#define HIGHS			(ONES * 0x80)
+#define ZERO_BYTES(x)	(~((((x) & ~HIGHS) + ONES * 0x7f) | (x)) & HIGHS)
+/* Only valid if no byte of x has the high bit set */
+#define BYTES_GE(x, n)	(((x) + ONES * (0x80 - (n))) & HIGHS)
+#if BB_BIG_ENDIAN
+# define NEXT_BYTE(m)	((m) >> 8)
+# define FIRST_BYTE		(0x80UL << (sizeof(long) * 8 - 8))
+# define LAST_BYTE		0x80UL
+#else
+# define NEXT_BYTE(m)	((m) << 8)
+# define FIRST_BYTE		0x80UL
+# define LAST_BYTE		(0x80UL << (sizeof(long) * 8 - 8))
+#endif
 
-	memset(totals, 0, sizeof(totals));
+/* Add up the bytes of acc */
+static wc_count_t wc_sum_bytes(unsigned long acc)
+{
+	const unsigned long lo = ~0UL / 0xffff * 0xff;
 
-	pcounts = counts;
+	acc = (acc & lo) + ((acc >> 8) & lo);
+	return (acc * (~0UL / 0xffff)) >> (sizeof(long) * 8 - 16);
+}
 
-	do {
-		++num_files;
-		if (!(fp = bb_wfopen_input(*argv))) {
-			status = EXIT_FAILURE;
-			continue;
+static void wc_init_classes(void)
+{
+	int c;
+
+	for (c = 0; c < 256; c++) {
+		if (isprint(c)) {
+			wc_class[c] = isspace_given_isprint(c) ? C_SPACE : C_WORD;
+		} else if (c == '\t') {
+			wc_class[c] = C_TAB;
+		} else if (c == '\n') {
+			wc_class[c] = C_NEWLINE;
+		} else if (c == '\v') {
+			wc_class[c] = C_VTAB;
+		} else if (c == '\r' || c == '\f') {
+			wc_class[c] = C_EOL;
 		}
+	}
+}
 
-		memset(counts, 0, sizeof(counts));
-		linepos = 0;
-		in_word = 0;
+static void wc_bytes(struct wc_state *st, const unsigned char *p, size_t n)
+{
+	wc_count_t *counts = st->counts;
+	unsigned int linepos = st->linepos;
+	int in_word = st->in_word;
+	int c;
 
-		do {
-			++counts[WC_CHARS];
-			c = getc(fp);
-			if (isprint(c)) {
-				++linepos;
-				if (!isspace_given_isprint(c)) {
-					in_word = 1;
-					continue;
-				}
-			} else if (((unsigned int)(c - 9)) <= 4) {
-				/* \t  9
-				 * \n 10
-				 * \v 11
-				 * \f 12
-				 * \r 13
-				 */
-				if (c == '\t') {
-					linepos = (linepos | 7) + 1;
-				} else {			/* '\n', '\r', '\f', or '\v' */
-				DO_EOF:
-					if (linepos > counts[WC_LENGTH]) {
-						counts[WC_LENGTH] = linepos;
-					}
-					if (c == '\n') {
-						++counts[WC_LINES];
-					}
-					if (c != '\v') {
-						linepos = 0;
-					}
-				}
-			} else if (c == EOF) {
-				if (ferror(fp)) {
-					bb_perror_msg("%s", *argv);
-					status = EXIT_FAILURE;
-				}
-				--counts[WC_CHARS];
-				goto DO_EOF;		/* Treat an EOF as '\r'. */
-			} else {
-				continue;
+	while (n--) {
+		c = wc_class[*p++];
+		if (c == C_WORD) {
+			++linepos;
+			in_word = 1;
+			continue;
+		}
+		if (c == C_OTHER) {
+			continue;
+		}
+		if (c == C_SPACE) {
+			++linepos;
+		} else if (c == C_TAB) {
+			linepos = (linepos | 7) + 1;
+		} else {			/* '\n', '\r', '\f', or '\v' */
+			if (linepos > counts[WC_LENGTH]) {
+				counts[WC_LENGTH] = linepos;
 			}
-
-			counts[WC_WORDS] += in_word;
-			in_word = 0;
-			if (c == EOF) {
-				break;
+			if (c == C_NEWLINE) {
+				++counts[WC_LINES];
+			}
+			if (c != C_VTAB) {
+				linepos = 0;
 			}
-		} while (1);
+		}
+		counts[WC_WORDS] += in_word;
+		in_word = 0;
+	}
+	st->linepos = linepos;
+	st->in_word = in_word;
+}
 
-		if (totals[WC_LENGTH] < counts[WC_LENGTH]) {
-			totals[WC_LENGTH] = counts[WC_LENGTH];
+/* Lines and words, without -L */
+static void wc_words(struct wc_state *st, const unsigned char *p, size_t n)
+{
+	unsigned long lines = 0, words = 0;
+	unsigned long w, is_word, is_blank;
+	int batch = 0;
+
+	for (; n >= sizeof(long); p += sizeof(long), n -= sizeof(long)) {
+		memcpy(&w, p, sizeof(w));
+		if (w & HIGHS) {
+			goto SLOW;
+		}
+		is_word = BYTES_GE(w, 0x21) & ~BYTES_GE(w, 0x7f);
+		is_blank = (BYTES_GE(w, '\t') & ~BYTES_GE(w, '\r' + 1))
+				| ZERO_BYTES(w ^ (ONES * ' '));
+		if ((is_word | is_blank) != HIGHS) {
+		SLOW:
+			wc_bytes(st, p, sizeof(long));
+			continue;
 		}
-		totals[WC_LENGTH] -= counts[WC_LENGTH];
+		/* A word ends wherever a blank follows a word character */
+		words += ((NEXT_BYTE(is_word) | (st->in_word ? FIRST_BYTE : 0))
+				& is_blank) >> 7;
+		lines += ZERO_BYTES(w ^ (ONES * '\n')) >> 7;
+		st->in_word = (is_word & LAST_BYTE) != 0;
+		if (++batch == 255) {
+			st->counts[WC_WORDS] += wc_sum_bytes(words);
+			st->counts[WC_LINES] += wc_sum_bytes(lines);
+			words = lines = batch = 0;
+		}
+	}
+	st->counts[WC_WORDS] += wc_sum_bytes(words);
+	st->counts[WC_LINES] += wc_sum_bytes(lines);
+	wc_bytes(st, p, n);
+}
 
-		bb_fclose_nonstdin(fp);
+/* Just lines */
+static void wc_lines(struct wc_state *st, const unsigned char *p, size_t n)
+{
+	unsigned long lines = 0, w;
+	int batch = 0;
+
+	for (; n >= sizeof(long); p += sizeof(long), n -= sizeof(long)) {
+		memcpy(&w, p, sizeof(w));
+		lines += ZERO_BYTES(w ^ (ONES * '\n')) >> 7;
+		if (++batch == 255) {
+			st->counts[WC_LINES] += wc_sum_bytes(lines);
+			lines = batch = 0;
+		}
+	}
+	st->counts[WC_LINES] += wc_sum_bytes(lines);
+	for (; n; n--) {
+		st->counts[WC_LINES] += (*p++ == '\n');
+	}
+}
 
-	OUTPUT:
-		s = fmt_str + 1;			/* Skip the leading space on 1st pass. */
-		u = 0;
-		do {
-			if (print_type & (1 << u)) {
-				bb_printf(s, pcounts[u]);
-				s = fmt_str;		/* Ok... restore the leading space. */
+/* Returns -1 if the file could not be opened (and nothing is printed
+ * for it), otherwise the exit status for it. */
+static int wc_file(const char *name, wc_count_t *counts)
+{
+	struct wc_state st;
+	struct stat sb;
+	unsigned char *buf;
+	FILE *fp;
+	off_t pos;
+	ssize_t n;
+	int fd, ret = EXIT_SUCCESS;
+
+	if (!(fp = bb_wfopen_input(name))) {
+		return -1;
+	}
+	fd = fileno(fp);
+	memset(&st, 0, sizeof(st));
+
+	if (print_type == (1 << WC_CHARS) && fstat(fd, &sb) == 0
+	 && S_ISREG(sb.st_mode) && (pos = lseek(fd, 0, SEEK_CUR)) >= 0
+	) {
+		st.counts[WC_CHARS] = sb.st_size > pos ? sb.st_size - pos : 0;
+	} else {
+		buf = xmalloc(WC_BUFSIZ);
+		while ((n = safe_read(fd, buf, WC_BUFSIZ)) > 0) {
+			st.counts[WC_CHARS] += n;
+			if (print_type & (1 << WC_LENGTH)) {
+				wc_bytes(&st, buf, n);
+			} else if (print_type & (1 << WC_WORDS)) {
+				wc_words(&st, buf, n);
+			} else if (print_type & (1 << WC_LINES)) {
+				wc_lines(&st, buf, n);
 			}
-			totals[u] += pcounts[u];
-		} while (++u < 4);
+		}
+		if (n < 0) {
+			bb_perror_msg("%s", name);
+			ret = EXIT_FAILURE;
+		}
+		free(buf);
+		/* Treat an EOF as '\r'. */
+		wc_bytes(&st, (const unsigned char *)"\r", 1);
+	}
+
+	bb_fclose_nonstdin(fp);
+	memcpy(counts, st.counts, sizeof(st.counts));
+	return ret;
+}
 
-		s += 8;						/* Set the format to the empty string. */
+static void wc_print(const wc_count_t *counts, const char *name)
+{
+	const char *fmt = "%7llu";
+	int u;
 
-		if (*argv != bb_msg_standard_input) {
-			s -= 3;					/* We have a name, so do %s conversion. */
+	for (u = 0; u < 4; u++) {
+		if (print_type & (1 << u)) {
+			bb_printf(fmt, counts[u]);
+			fmt = " %7llu";
 		}
-		bb_printf(s, *argv);
+	}
+	if (name != bb_msg_standard_input) {
+		bb_printf(" %s", name);
+	}
+	bb_printf("\n");
+}
+
+static int wc_job(const char *name, void *result)
+{
+	int ret = wc_file(name, result);
+
+	if (ret >= 0) {
+		wc_print(result, name);
+	}
+	return ret;
+}
+
+static void wc_job_done(int ret, void *result)
+{
+	const wc_count_t *counts = result;
+	int u;
+
+	if (ret < 0) {
+		status = EXIT_FAILURE;
+		return;
+	}
+	if (ret) {
+		status = ret;
+	}
+	for (u = 0; u < 3; u++) {
+		totals[u] += counts[u];
+	}
+	if (totals[WC_LENGTH] < counts[WC_LENGTH]) {
+		totals[WC_LENGTH] = counts[WC_LENGTH];
+	}
+}
+
+int wc_main(int argc, char **argv)
+{
+	wc_count_t counts[4];
+	int num_files = 0;
+#if ENABLE_FEATURE_WC_PARALLEL
+	parallel_jobs_t *jobs;
+	char *jopt;
+	int i = 0;
+#endif
+
+	print_type = bb_getopt_ulflags(argc, argv, wc_opts
+			USE_FEATURE_WC_PARALLEL(, &jopt));
+
+#if ENABLE_FEATURE_WC_PARALLEL
+	if ((print_type & WC_OPT_j) && argc - optind > 1) {
+		i = bb_xgetularg10_bnd(jopt, 1, 256);
+	}
+#endif
+	print_type &= (1 << 4) - 1;
+	if (print_type == 0) {
+		print_type = (1 << WC_LINES) | (1 << WC_WORDS) | (1 << WC_CHARS);
+	}
+	wc_init_classes();
+#if ENABLE_FEATURE_WC_PARALLEL
+	jobs = parallel_jobs_start(i, wc_job, wc_job_done, sizeof(counts));
+#endif
 
+	argv += optind;
+	if (!*argv) {
+		*--argv = (char *) bb_msg_standard_input;
+	}
+
+	do {
+		++num_files;
+#if ENABLE_FEATURE_WC_PARALLEL
+		if (jobs) {
+			parallel_jobs_add(jobs, *argv);
+			continue;
+		}
+#endif
+		wc_job_done(wc_job(*argv, counts), counts);
 	} while (*++argv);
+#if ENABLE_FEATURE_WC_PARALLEL
+	if (jobs) {
+		parallel_jobs_finish(jobs);
+	}
+#endif
 
-	/* If more than one file was processed, we want the totals.  To save some
-	 * space, we set the pcounts ptr to the totals array.  This has the side
-	 * effect of trashing the totals array after outputting it, but that's
-	 * irrelavent since we no longer need it. */
 	if (num_files > 1) {
-		num_files = 0;				/* Make sure we don't get here again. */
-		*--argv = (char *) total_str;
-		pcounts = totals;
-		goto OUTPUT;
+		wc_print(totals, "total");
 	}
 
 	bb_fflush_stdout_and_exit(status);
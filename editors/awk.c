@@ -21,9 +21,14 @@
 #include "xregex.h"
 #include "busybox.h"
 
+#ifdef CONFIG_LOCALE_SUPPORT
+#include <locale.h>
+#endif
+
 
 #define	MAXVARFMT	240
 #define	MINNVBLOCK	64
+#define	NRECACHE	8
 
 /* variable flags */
 #define	VF_NUMBER	0x0001	/* 1 = primary type is number */
@@ -130,6 +135,13 @@ typedef struct tsplitter_s {
 	regex_t re[2];
 } tsplitter;
 
+/* compiled dynamic regexp */
+typedef struct recache_s {
+	regex_t re;
+	int icase;
+	char pattern[1];
+} recache;
+
 /* simple token classes */
 /* Order and hex values are very important!!!  See next_token() */
 #define	TC_SEQSTART	 1				/* ( */
@@ -411,11 +423,13 @@ static int is_f0_split;
 static int nfields;
 static var *Fields;
 static tsplitter fsplitter, rsplitter;
+static recache *recache_tab[NRECACHE];
 static nvblock *cb;
 static char *pos;
 static char *buf;
 static int icase;
 static int exiting;
+static char decimal_point = '.';
 
 static struct {
 	uint32_t tclass;
@@ -715,15 +729,54 @@ static char *getvar_s(var *v)
 	return (v->string == NULL) ? "" : v->string;
 }
 
+/* convert plain decimals like "-12.50" without strtod(): with at most
+ * 15 digits both the digits and the power of ten are exact doubles, so
+ * one division rounds exactly as strtod() would. Return NULL if s has to
+ * go the slow way, otherwise ptr to the first unconverted char
+ */
+static char *fast_strtod(char *s, double *d)
+{
+	static const double p10[16] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6,
+		1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+	unsigned long long m = 0;
+	int nd = 0, nf = -1, neg = FALSE;
+
+	while (isspace(*s)) s++;
+	if (*s == '-' || *s == '+')
+		neg = (*s++ == '-');
+
+	for (;; s++) {
+		if (isdigit(*s)) {
+			if (++nd > 15) return NULL;
+			m = m * 10 + (*s - '0');
+			if (nf >= 0) nf++;
+		} else if (*s == decimal_point && nf < 0) {
+			nf = 0;
+		} else {
+			break;
+		}
+	}
+	/* exponents, hex and inf/nan are left to strtod() */
+	if (nd == 0 || (*s | 0x20) == 'e' || (*s | 0x20) == 'x')
+		return NULL;
+
+	*d = (nf > 0) ? (double)m / p10[nf] : (double)m;
+	if (neg) *d = -*d;
+	return s;
+}
+
 static double getvar_i(var *v)
 {
-	char *s;
+	char *s, *e;
 
 	if ((v->type & (VF_NUMBER | VF_CACHED)) == 0) {
 		v->number = 0;
 		s = v->string;
 		if (s && *s) {
-			v->number = strtod(s, &s);
+			if ((e = fast_strtod(s, &v->number)) != NULL)
+				s = e;
+			else
+				v->number = strtod(s, &s);
 			if (v->type & VF_USER) {
 				skip_spaces(&s);
 				if (*s != '\0')
@@ -1361,7 +1414,7 @@ static node *mk_splitter(char *s, tsplitter *spl)
 	re = &spl->re[0];
 	ire = &spl->re[1];
 	n = &spl->n;
-	if ((n->info && OPCLSMASK) == OC_REGEXP) {
+	if ((n->info & OPCLSMASK) == OC_REGEXP) {
 		regfree(re);
 		regfree(ire);
 	}
@@ -1374,23 +1427,52 @@ static node *mk_splitter(char *s, tsplitter *spl)
 	return n;
 }
 
-/* use node as a regular expression. Supplied with node ptr and regex_t
- * storage space. Return ptr to regex (if result points to preg, it should
- * be later regfree'd manually
+/* compile string as a regular expression. The NRECACHE most recently
+ * used ones are kept, so a pattern held in a variable is compiled once
+ * and not for every record. Result is valid until NRECACHE other
+ * patterns have been compiled
  */
-static regex_t *as_regex(node *op, regex_t *preg)
+static regex_t *re_cached(const char *s)
+{
+	recache *rc;
+	int i;
+
+	for (i=0; i<NRECACHE && (rc = recache_tab[i]); i++) {
+		if (rc->icase == icase && strcmp(rc->pattern, s) == 0)
+			goto found;
+	}
+
+	rc = (recache *)xmalloc(sizeof(recache) + strlen(s));
+	xregcomp(&rc->re, s, icase ? REG_EXTENDED | REG_ICASE : REG_EXTENDED);
+	rc->icase = icase;
+	strcpy(rc->pattern, s);
+	if (i == NRECACHE) {
+		i--;
+		regfree(&recache_tab[i]->re);
+		free(recache_tab[i]);
+	}
+
+found:
+	memmove(recache_tab+1, recache_tab, i * sizeof(recache *));
+	recache_tab[0] = rc;
+	return &rc->re;
+}
+
+/* use node as a regular expression. Return ptr to regex, dynamic
+ * ones come from re_cached() and must not be regfree'd
+ */
+static regex_t *as_regex(node *op)
 {
 	var *v;
-	char *s;
+	regex_t *re;
 
 	if ((op->info & OPCLSMASK) == OC_REGEXP) {
 		return icase ? op->r.ire : op->l.re;
 	} else {
 		v = nvalloc(1);
-		s = getvar_s(evaluate(op, v));
-		xregcomp(preg, s, icase ? REG_EXTENDED | REG_ICASE : REG_EXTENDED);
+		re = re_cached(getvar_s(evaluate(op, v)));
 		nvfree(v);
-		return preg;
+		return re;
 	}
 }
 
@@ -1802,9 +1884,9 @@ static int awk_sub(node *rn, char *repl, int nm, var *src, var *dest, int ex)
 	char *sp, *s;
 	int c, i, j, di, rl, so, eo, nbs, n, dssize;
 	regmatch_t pmatch[10];
-	regex_t sreg, *re;
+	regex_t *re;
 
-	re = as_regex(rn, &sreg);
+	re = as_regex(rn);
 	if (! src) src = V[F0];
 	if (! dest) dest = V[F0];
 
@@ -1858,7 +1940,6 @@ static int awk_sub(node *rn, char *repl, int nm, var *src, var *dest, int ex)
 	qrealloc(&ds, di + strlen(sp), &dssize);
 	strcpy(ds + di, sp);
 	setvar_p(dest, ds);
-	if (re == &sreg) regfree(re);
 	return i;
 }
 
@@ -1870,9 +1951,8 @@ static var *exec_builtin(node *op, var *res)
 	var  *av[4];
 	char *as[4];
 	regmatch_t pmatch[2];
-	regex_t sreg, *re;
-	static tsplitter tspl;
-	node *spl;
+	regex_t *re;
+	node tspl, *spl;
 	uint32_t isr, info;
 	int nargs;
 	time_t tt;
@@ -1907,8 +1987,18 @@ static var *exec_builtin(node *op, var *res)
 
 	  case B_sp:
 		if (nargs > 2) {
-			spl = (an[2]->info & OPCLSMASK) == OC_REGEXP ?
-				an[2] : mk_splitter(getvar_s(evaluate(an[2], &tv[2])), &tspl);
+			spl = an[2];
+			if ((spl->info & OPCLSMASK) != OC_REGEXP) {
+				/* like mk_splitter(), but regex is from the cache */
+				s = getvar_s(evaluate(an[2], &tv[2]));
+				spl = &tspl;
+				if (strlen(s) > 1) {
+					spl->info = OC_REGEXP;
+					spl->l.re = spl->r.ire = re_cached(s);
+				} else {
+					spl->info = (uint32_t) *s;
+				}
+			}
 		} else {
 			spl = &fsplitter.n;
 		}
@@ -1984,7 +2074,7 @@ lo_cont:
 		break;
 
 	  case B_ma:
-		re = as_regex(an[1], &sreg);
+		re = as_regex(an[1]);
 		n = regexec(re, as[0], 1, pmatch, 0);
 		if (n == 0) {
 			pmatch[0].rm_so++;
@@ -1996,7 +2086,6 @@ lo_cont:
 		setvar_i(newvar("RSTART"), pmatch[0].rm_so);
 		setvar_i(newvar("RLENGTH"), pmatch[0].rm_eo - pmatch[0].rm_so);
 		setvar_i(res, pmatch[0].rm_so);
-		if (re == &sreg) regfree(re);
 		break;
 
 	  case B_ge:
@@ -2027,7 +2116,6 @@ static var *evaluate(node *op, var *res)
 	/* This procedure is recursive so we should count every byte */
 	static var *fnargs = NULL;
 	static unsigned int seed = 1;
-	static regex_t sreg;
 	node *op1;
 	var *v1;
 	union {
@@ -2216,9 +2304,8 @@ v_cont:
 		  case XC( OC_MATCH ):
 			op1 = op->r.n;
 re_cont:
-			X.re = as_regex(op1, &sreg);
+			X.re = as_regex(op1);
 			R.i = regexec(X.re, L.s, 0, NULL, 0);
-			if (X.re == &sreg) regfree(X.re);
 			setvar_i(res, (R.i == 0 ? 1 : 0) ^ (opn == '!' ? 1 : 0));
 			break;
 
@@ -2628,6 +2715,10 @@ int awk_main(int argc, char **argv)
 	/* allocate global buffer */
 	buf = xmalloc(MAXVARFMT+1);
 
+#ifdef CONFIG_LOCALE_SUPPORT
+	decimal_point = *localeconv()->decimal_point;
+#endif
+
 	vhash = hash_init();
 	ahash = hash_init();
 	fdhash = hash_init();
@@ -75,6 +75,9 @@ typedef struct sed_cmd_s {
     FILE *file;			/* File (sw) command writes to, -1 for none. */
     char *string;		/* Data string for (saicytb) commands. */
 
+    /* Regexes that are plain strings, matched with strstr() instead */
+    char *beg_literal, *end_literal, *sub_literal;
+
     unsigned short which_match;		/* (s) Which match to replace (0 for all) */
 
     /* Bitfields (gcc won't group them if we don't) */
@@ -117,8 +120,18 @@ struct sed_globals
 		int idx;	/* Space used */
 		int len;	/* Space allocated */
 	} pipeline;
+
+	/* Input is read a block at a time; lines are cut out of in_buf */
+	char *in_buf;
+	int in_pos, in_end;
+
+	/* A finished pattern space, kept to hold the next line read */
+	char *spare_line;
+	int spare_size;
 } bbg;
 
+#define SED_BLOCK_SIZE (64*1024)
+
 
 void sed_free_and_close_stuff(void);
 #if ENABLE_FEATURE_CLEAN_UP
@@ -146,11 +159,18 @@ void sed_free_and_close_stuff(void)
 			regfree(sed_cmd->sub_match);
 			free(sed_cmd->sub_match);
 		}
+		free(sed_cmd->beg_literal);
+		free(sed_cmd->end_literal);
+		free(sed_cmd->sub_literal);
 		free(sed_cmd->string);
 		free(sed_cmd);
 		sed_cmd = sed_cmd_next;
 	}
 
+	free(bbg.pipeline.buf);
+	free(bbg.in_buf);
+	free(bbg.spare_line);
+
 	if(bbg.hold_space) free(bbg.hold_space);
 
     while(bbg.current_input_file<bbg.input_file_count)
@@ -257,10 +277,40 @@ static int parse_regex_delim(char *cmdstr, char **match, char **replace)
 	return ((cmdstr_ptr - cmdstr) + idx);
 }
 
+/* If a regex can only ever match itself, return a copy to strstr() for. */
+static char *literal_regex(const char *re, int cflags)
+{
+	if (!*re || (cflags & REG_ICASE) || re[strcspn(re, "\\.[]*^$+?(){}|")])
+		return NULL;
+	return bb_xstrdup(re);
+}
+
+/* regexec(), or strstr() when literal_regex() found a plain string */
+static int sed_regexec(regex_t *regex, const char *literal, const char *str,
+		size_t nmatch, regmatch_t *pmatch)
+{
+	const char *found;
+	size_t i;
+
+	if (!literal)
+		return regexec(regex, str, nmatch, pmatch, 0);
+	found = strstr(str, literal);
+	if (!found)
+		return REG_NOMATCH;
+	for (i = 0; i < nmatch; i++)
+		pmatch[i].rm_so = pmatch[i].rm_eo = -1;
+	if (nmatch) {
+		pmatch[0].rm_so = found - str;
+		pmatch[0].rm_eo = pmatch[0].rm_so + strlen(literal);
+	}
+	return 0;
+}
+
 /*
  * returns the index in the string just past where the address ends.
  */
-static int get_address(char *my_str, int *linenum, regex_t ** regex)
+static int get_address(char *my_str, int *linenum, regex_t ** regex,
+		char **literal)
 {
 	char *pos = my_str;
 
@@ -281,6 +331,7 @@ static int get_address(char *my_str, int *linenum, regex_t ** regex)
 		temp = copy_parsing_escapes(pos,next);
 		*regex = (regex_t *) xmalloc(sizeof(regex_t));
 		xregcomp(*regex, temp, bbg.regex_type|REG_NEWLINE);
+		*literal = literal_regex(temp, bbg.regex_type);
 		free(temp);
 		/* Move position to next character after last delimiter */
 		pos += (next+1);
@@ -381,6 +432,7 @@ out:
 		/* If match is empty, we use last regex used at runtime */
 		sed_cmd->sub_match = (regex_t *) xmalloc(sizeof(regex_t));
 		xregcomp(sed_cmd->sub_match, match, cflags);
+		sed_cmd->sub_literal = literal_regex(match, cflags);
 	}
 	free(match);
 
@@ -504,14 +556,16 @@ static void add_cmd(char *cmdstr)
 		sed_cmd = xzalloc(sizeof(sed_cmd_t));
 
 		/* first part (if present) is an address: either a '$', a number or a /regex/ */
-		cmdstr += get_address(cmdstr, &sed_cmd->beg_line, &sed_cmd->beg_match);
+		cmdstr += get_address(cmdstr, &sed_cmd->beg_line,
+				&sed_cmd->beg_match, &sed_cmd->beg_literal);
 
 		/* second part (if present) will begin with a comma */
 		if (*cmdstr == ',') {
 			int idx;
 
 			cmdstr++;
-			idx = get_address(cmdstr, &sed_cmd->end_line, &sed_cmd->end_match);
+			idx = get_address(cmdstr, &sed_cmd->end_line,
+					&sed_cmd->end_match, &sed_cmd->end_literal);
 			if (!idx) bb_error_msg_and_die("no address after comma\n");
 			cmdstr += idx;
 		}
@@ -547,41 +601,51 @@ static void add_cmd(char *cmdstr)
 
 #define PIPE_GROW 64
 
-static void pipe_putc(char c)
+static void pipe_puts(const char *s, int n)
 {
-	if(bbg.pipeline.idx==bbg.pipeline.len) {
-		bbg.pipeline.buf = xrealloc(bbg.pipeline.buf,
-								bbg.pipeline.len + PIPE_GROW);
-		bbg.pipeline.len+=PIPE_GROW;
+	if(bbg.pipeline.idx + n > bbg.pipeline.len) {
+		bbg.pipeline.len = 2*bbg.pipeline.len + n + PIPE_GROW;
+		bbg.pipeline.buf = xrealloc(bbg.pipeline.buf, bbg.pipeline.len);
 	}
-	bbg.pipeline.buf[bbg.pipeline.idx++] = c;
+	memcpy(bbg.pipeline.buf + bbg.pipeline.idx, s, n);
+	bbg.pipeline.idx += n;
+}
+
+static void pipe_putc(char c)
+{
+	pipe_puts(&c, 1);
 }
 
 static void do_subst_w_backrefs(char *line, char *replace)
 {
-	int i,j;
+	int i;
 
 	/* go through the replacement string */
 	for (i = 0; replace[i]; i++) {
+		int plain = strcspn(replace + i, "\\&");
+
+		/* copy literal text up to the next special character in one go */
+		if (plain) {
+			pipe_puts(replace + i, plain);
+			i += plain - 1;
+		}
+
 		/* if we find a backreference (\1, \2, etc.) print the backref'ed * text */
-		if (replace[i] == '\\' && replace[i+1]>='0' && replace[i+1]<='9') {
+		else if (replace[i] == '\\' && replace[i+1]>='0' && replace[i+1]<='9') {
 			int backref=replace[++i]-'0';
 
 			/* print out the text held in bbg.regmatch[backref] */
 			if(bbg.regmatch[backref].rm_so != -1)
-				for (j = bbg.regmatch[backref].rm_so;
-					j < bbg.regmatch[backref].rm_eo; j++) pipe_putc(line[j]);
+				pipe_puts(line + bbg.regmatch[backref].rm_so,
+					bbg.regmatch[backref].rm_eo - bbg.regmatch[backref].rm_so);
 		}
 
 		/* if we find a backslash escaped character, print the character */
 		else if (replace[i] == '\\') pipe_putc(replace[++i]);
 
 		/* if we find an unescaped '&' print out the whole matched text. */
-		else if (replace[i] == '&')
-			for (j = bbg.regmatch[0].rm_so; j < bbg.regmatch[0].rm_eo; j++)
-				pipe_putc(line[j]);
-		/* Otherwise just output the character. */
-		else pipe_putc(replace[i]);
+		else pipe_puts(line + bbg.regmatch[0].rm_so,
+				bbg.regmatch[0].rm_eo - bbg.regmatch[0].rm_so);
 	}
 }
 
@@ -591,6 +655,7 @@ static int do_subst_command(sed_cmd_t *sed_cmd, char **line)
 	int altered = 0;
 	int match_count=0;
 	regex_t *current_regex;
+	char *literal = sed_cmd->sub_literal;
 
 	/* Handle empty regex. */
 	if (sed_cmd->sub_match == NULL) {
@@ -600,12 +665,10 @@ static int do_subst_command(sed_cmd_t *sed_cmd, char **line)
 	} else bbg.previous_regex_ptr = current_regex = sed_cmd->sub_match;
 
 	/* Find the first match */
-	if(REG_NOMATCH==regexec(current_regex, oldline, 10, bbg.regmatch, 0))
+	if(REG_NOMATCH==sed_regexec(current_regex, literal, oldline, 10, bbg.regmatch))
 		return 0;
 
-	/* Initialize temporary output buffer. */
-	bbg.pipeline.buf=xmalloc(PIPE_GROW);
-	bbg.pipeline.len=PIPE_GROW;
+	/* Start over in the (reused) output buffer. */
 	bbg.pipeline.idx=0;
 
 	/* Now loop through, substituting for matches */
@@ -626,13 +689,14 @@ static int do_subst_command(sed_cmd_t *sed_cmd, char **line)
 		/* If we aren't interested in this match, output old line to
 		   end of match and continue */
 		if(sed_cmd->which_match && sed_cmd->which_match!=match_count) {
-			for(i=0;i<bbg.regmatch[0].rm_eo;i++)
-				pipe_putc(*(oldline++));
+			i = bbg.regmatch[0].rm_eo;
+			pipe_puts(oldline, i);
+			oldline += i;
 			continue;
 		}
 
 		/* print everything before the match */
-		for (i = 0; i < bbg.regmatch[0].rm_so; i++) pipe_putc(oldline[i]);
+		pipe_puts(oldline, bbg.regmatch[0].rm_so);
 
 		/* then print the substitution string */
 		do_subst_w_backrefs(oldline, sed_cmd->string);
@@ -644,15 +708,17 @@ static int do_subst_command(sed_cmd_t *sed_cmd, char **line)
 
 		/* if we're not doing this globally, get out now */
 		if (sed_cmd->which_match) break;
-	} while (*oldline && (regexec(current_regex, oldline, 10, bbg.regmatch, 0) != REG_NOMATCH));
+	} while (*oldline && (sed_regexec(current_regex, literal, oldline, 10, bbg.regmatch) != REG_NOMATCH));
 
 	/* Copy rest of string into output pipeline */
 
-	while(*oldline) pipe_putc(*(oldline++));
-	pipe_putc(0);
+	pipe_puts(oldline, strlen(oldline) + 1);
 
-	free(*line);
+	/* Swap buffers: the old line becomes the next output buffer */
+	oldline = *line;
 	*line = bbg.pipeline.buf;
+	bbg.pipeline.buf = oldline;
+	bbg.pipeline.len = strlen(oldline) + 1;
 	return altered;
 }
 
@@ -692,26 +758,82 @@ static void add_input_file(FILE *file)
 	bbg.input_file_list[bbg.input_file_count++] = file;
 }
 
+/* Hang on to a line we are done with, to read the next one into. */
+static void recycle_line(char *line)
+{
+	int size = strlen(line) + 1;
+
+	if (bbg.spare_line) {
+		if (bbg.spare_size >= size) {
+			free(line);
+			return;
+		}
+		free(bbg.spare_line);
+	}
+	bbg.spare_line = line;
+	bbg.spare_size = size;
+}
+
 /* Get next line of input from bbg.input_file_list, flushing append buffer and
  * noting if we ran out of files without a newline on the last line we read.
+ *
+ * Input is read in large blocks and each line is cut out of the block, much
+ * like bb_get_chunk_from_file() would (a NUL byte also ends a chunk), but
+ * without going through getc() for every byte.
  */
 static char *get_next_line(int *no_newline)
 {
-	char *temp=NULL;
-	int len;
+	char *line = bbg.spare_line;
+	int size = bbg.spare_size, len = 0, done = 0;
 
+	bbg.spare_line = NULL;
+	bbg.spare_size = 0;
 	flush_append();
-	while (bbg.current_input_file<bbg.input_file_count) {
-		temp = bb_get_chunk_from_file(bbg.input_file_list[bbg.current_input_file],&len);
-		if (temp) {
-			*no_newline = !(len && temp[len-1]=='\n');
-			if (!*no_newline) temp[len-1] = 0;
-			break;
-		// Close this file and advance to next one
-		} else fclose(bbg.input_file_list[bbg.current_input_file++]);
+	if (!bbg.in_buf) bbg.in_buf = xmalloc(SED_BLOCK_SIZE);
+	while (!done && bbg.current_input_file<bbg.input_file_count) {
+		char *start, *stop;
+		int n;
+
+		if (bbg.in_pos == bbg.in_end) {
+			n = safe_read(fileno(bbg.input_file_list[bbg.current_input_file]),
+					bbg.in_buf, SED_BLOCK_SIZE);
+			if (n <= 0) {
+				// Close this file and advance to next one
+				fclose(bbg.input_file_list[bbg.current_input_file++]);
+				bbg.in_pos = bbg.in_end = 0;
+				if (len) break;
+				continue;
+			}
+			bbg.in_pos = 0;
+			bbg.in_end = n;
+		}
+
+		start = bbg.in_buf + bbg.in_pos;
+		n = bbg.in_end - bbg.in_pos;
+		stop = memchr(start, '\n', n);
+		if (stop) n = stop - start + 1;
+		stop = memchr(start, 0, n);
+		if (stop) n = stop - start + 1;
+		done = (start[n-1] == '\n' || !start[n-1]);
+
+		if (len + n >= size) {
+			size = len + n + 80;
+			line = xrealloc(line, size);
+		}
+		memcpy(line + len, start, n);
+		len += n;
+		bbg.in_pos += n;
 	}
 
-	return temp;
+	if (!len) {
+		bbg.spare_line = line;
+		bbg.spare_size = size;
+		return NULL;
+	}
+	line[len] = 0;
+	*no_newline = (line[len-1] != '\n');
+	if (!*no_newline) line[len-1] = 0;
+	return line;
 }
 
 /* Output line of text.  missing_newline means the last line output did not
@@ -781,7 +903,8 @@ restart:
 
 			/* Or does this line match our begin address regex? */
 			        || (sed_cmd->beg_match &&
-				    !regexec(sed_cmd->beg_match, pattern_space, 0, NULL, 0))
+				    !sed_regexec(sed_cmd->beg_match, sed_cmd->beg_literal,
+						pattern_space, 0, NULL))
 
 			/* Or did we match last line of input? */
 				|| (sed_cmd->beg_line == -1 && next_line == NULL);
@@ -801,7 +924,7 @@ restart:
 							: sed_cmd->end_line<=linenum
 						: !sed_cmd->end_match)
 					/* or does this line matches our last address regex */
-					|| (sed_cmd->end_match && old_matched && (regexec(sed_cmd->end_match, pattern_space, 0, NULL, 0) == 0))
+					|| (sed_cmd->end_match && old_matched && (sed_regexec(sed_cmd->end_match, sed_cmd->end_literal, pattern_space, 0, NULL) == 0))
 				);
 			}
 
@@ -1062,7 +1185,7 @@ discard_commands:
 		/* Delete and such jump here. */
 discard_line:
 		flush_append();
-		free(pattern_space);
+		recycle_line(pattern_space);
 	}
 }
 
@@ -1177,6 +1300,7 @@ int sed_main(int argc, char **argv)
 						if(-1==(nonstdoutfd=mkstemp(bbg.outname)))
 							bb_error_msg_and_die("no temp file");
 						bbg.nonstdout=fdopen(nonstdoutfd,"w");
+						setvbuf(bbg.nonstdout, NULL, _IOFBF, SED_BLOCK_SIZE);
 
 						/* Set permissions of output file */
 
@@ -27,7 +27,7 @@
 
 /* options */
 static unsigned long opt;
-#define GREP_OPTS "lnqvscFiHhe:f:L"
+#define GREP_OPTS "lnqvscFiHhe:f:Lr"
 #define GREP_OPT_l (1<<0)
 #define PRINT_FILES_WITH_MATCHES (opt & GREP_OPT_l)
 #define GREP_OPT_n (1<<1)
@@ -50,24 +50,33 @@ static invert_search_t invert_search;
 #define GREP_OPT_f (1<<11)
 #define GREP_OPT_L (1<<12)
 #define PRINT_FILES_WITHOUT_MATCHES ((opt & GREP_OPT_L) != 0)
+#define GREP_OPT_r (1<<13)
 #if ENABLE_FEATURE_GREP_CONTEXT
-#define GREP_OPT_CONTEXT "A:B:C"
-#define GREP_OPT_A (1<<13)
-#define GREP_OPT_B (1<<14)
-#define GREP_OPT_C (1<<15)
-#define GREP_OPT_E (1<<16)
+#define GREP_OPT_CONTEXT "A:B:C:"
+#define GREP_OPT_A (1<<14)
+#define GREP_OPT_B (1<<15)
+#define GREP_OPT_C (1<<16)
+#define GREP_OPT_E (1<<17)
 #else
 #define GREP_OPT_CONTEXT ""
 #define GREP_OPT_A (0)
 #define GREP_OPT_B (0)
 #define GREP_OPT_C (0)
-#define GREP_OPT_E (1<<13)
+#define GREP_OPT_E (1<<14)
 #endif
 #if ENABLE_FEATURE_GREP_EGREP_ALIAS
 # define OPT_EGREP "E"
 #else
 # define OPT_EGREP ""
 #endif
+/* -j comes last so that its argument is the last one bb_getopt_ulflags
+ * consumes, and its bit follows E whether or not E is compiled in */
+#if ENABLE_FEATURE_GREP_PARALLEL
+# define OPT_PARALLEL "j:"
+#else
+# define OPT_PARALLEL ""
+#endif
+#define GREP_OPT_j (GREP_OPT_E << ENABLE_FEATURE_GREP_EGREP_ALIAS)
 
 static int reflags;
 static int print_filename;
@@ -82,6 +91,16 @@ static int last_line_printed;
 /* globals used internally */
 static llist_t *pattern_head;   /* growable list of patterns to match */
 static char *cur_file;          /* the current file we are reading */
+static int matched;
+static int error_open_count;
+#if ENABLE_FEATURE_GREP_PARALLEL
+static parallel_jobs_t *jobs;
+#else
+#define jobs 0
+#endif
+
+/* grep_named_file() result when the file could not be opened */
+#define GREP_OPEN_FAILED (-2)
 
 typedef struct GREP_LIST_DATA {
 	char *pattern;
@@ -280,12 +299,75 @@ static void load_regexes_from_file(llist_t *fopt)
 }
 
 
-int grep_main(int argc, char **argv)
+/* Grep one file given by name ("-" or NULL is stdin) */
+static int grep_named_file(const char *name)
 {
 	FILE *file;
-	int matched;
+	int n;
+
+	if (!name || (*name == '-' && !name[1])) {
+		cur_file = "(standard input)";
+		file = stdin;
+	} else {
+		cur_file = (char *)name;
+		file = fopen(name, "r");
+	}
+	if (file == NULL) {
+		if (!SUPPRESS_ERR_MSGS)
+			bb_perror_msg("%s", cur_file);
+		return GREP_OPEN_FAILED;
+	}
+	n = grep_file(file);
+	if (file != stdin)
+		fclose(file);
+	return n;
+}
+
+static void grep_job_done(int status, void *unused)
+{
+	if (status == GREP_OPEN_FAILED)
+		error_open_count++;
+	else if (matched >= 0)
+		/* a negative result means -q found a match: stop here and
+		 * return success */
+		matched = (status < 0) ? status : matched + status;
+}
+
+#if ENABLE_FEATURE_GREP_PARALLEL
+static int grep_job(const char *name, void *unused)
+{
+	return grep_named_file(name);
+}
+#endif
+
+static void grep_or_queue(const char *name)
+{
+	if (ENABLE_FEATURE_GREP_PARALLEL && jobs)
+		parallel_jobs_add(jobs, name ? name : "-");
+	else
+		grep_job_done(grep_named_file(name), NULL);
+}
+
+static int grep_file_action(const char *fileName, struct stat *statbuf,
+		void *junk)
+{
+	struct stat target;
+
+	/* Don't hang on fifos and devices met while walking the tree, nor
+	 * go round a symlink to a directory: only look at regular files */
+	if (S_ISLNK(statbuf->st_mode) && stat(fileName, &target) == 0)
+		statbuf = &target;
+	if (matched >= 0 && S_ISREG(statbuf->st_mode))
+		grep_or_queue(fileName);
+	return TRUE;
+}
+
+int grep_main(int argc, char **argv)
+{
 	llist_t *fopt = NULL;
-	int error_open_count = 0;
+#if ENABLE_FEATURE_GREP_PARALLEL
+	char *jopt;
+#endif
 
 	/* do normal option parsing */
 #if ENABLE_FEATURE_GREP_CONTEXT
@@ -297,9 +379,10 @@ int grep_main(int argc, char **argv)
 
 	bb_opt_complementally = "H-h:e::f::C-AB";
 	opt = bb_getopt_ulflags(argc, argv,
-		GREP_OPTS GREP_OPT_CONTEXT OPT_EGREP,
+		GREP_OPTS GREP_OPT_CONTEXT OPT_EGREP OPT_PARALLEL,
 		&pattern_head, &fopt,
-		&slines_after, &slines_before, &Copt);
+		&slines_after, &slines_before, &Copt
+		USE_FEATURE_GREP_PARALLEL(, &jopt));
 
 	if(opt & GREP_OPT_C) {
 		/* C option unseted A and B options, but next -A or -B
@@ -331,8 +414,8 @@ int grep_main(int argc, char **argv)
 #else
 	/* with auto sanity checks */
 	bb_opt_complementally = "H-h:e::f::c-n:q-n:l-n";
-	opt = bb_getopt_ulflags(argc, argv, GREP_OPTS OPT_EGREP,
-		&pattern_head, &fopt);
+	opt = bb_getopt_ulflags(argc, argv, GREP_OPTS OPT_EGREP OPT_PARALLEL,
+		&pattern_head, &fopt USE_FEATURE_GREP_PARALLEL(, &jopt));
 #endif
 	invert_search = (opt & GREP_OPT_v) != 0;        /* 0 | 1 */
 
@@ -380,7 +463,8 @@ int grep_main(int argc, char **argv)
 
 	/* argv[(optind)..(argc-1)] should be names of file to grep through. If
 	 * there is more than one file to grep, we will print the filenames */
-	if (argc > 1) {
+	if (argc > 1 || ((opt & GREP_OPT_r) && argc == 1
+			&& is_directory(*argv, TRUE, NULL))) {
 		print_filename++;
 
 	/* If no files were specified, or '-' was specified, take input from
@@ -388,29 +472,40 @@ int grep_main(int argc, char **argv)
 	} else if (argc == 0) {
 		argc++;
 	}
-	matched = 0;
-	while (argc--) {
-		cur_file = *argv++;
-		if(!cur_file || (*cur_file == '-' && !cur_file[1])) {
-			cur_file = "(standard input)";
-			file = stdin;
-		} else {
-			file = fopen(cur_file, "r");
-		}
-		if (file == NULL) {
-			if (!SUPPRESS_ERR_MSGS)
-				bb_perror_msg("%s", cur_file);
-			error_open_count++;
-		} else {
-			matched += grep_file(file);
-			if(matched < 0) {
-				/* we found a match but were told to be quiet, stop here and
-				* return success */
-				break;
-			}
-			fclose(file);
+#if ENABLE_FEATURE_GREP_PARALLEL
+	if (opt & GREP_OPT_j) {
+		int nworkers = bb_xgetularg10_bnd(jopt, 1, 256);
+		llist_t *cur;
+
+		/* Compile up front: a bad regex should be reported once,
+		 * not by every worker */
+		for (cur = pattern_head; cur && !FGREP_FLAG; cur = cur->link) {
+			grep_list_data_t *gl = (grep_list_data_t *)cur->data;
+
+			gl->flg_mem_alocated_compiled |= COMPILED;
+			xregcomp(&(gl->preg), gl->pattern, reflags);
 		}
+		jobs = parallel_jobs_start(nworkers, grep_job, grep_job_done, 0);
+	}
+#endif
+
+	while (argc-- && matched >= 0) {
+		cur_file = *argv++;
+		if ((opt & GREP_OPT_r) && cur_file
+		 && is_directory(cur_file, TRUE, NULL)
+		) {
+			/* With a trailing slash lstat() looks through a symlink,
+			 * so one named here is followed */
+			char *dir = concat_path_file(cur_file, "");
+
+			recursive_action(dir, TRUE, FALSE, FALSE,
+					grep_file_action, NULL, NULL);
+			free(dir);
+		} else
+			grep_or_queue(cur_file);
 	}
+	if (ENABLE_FEATURE_GREP_PARALLEL && jobs)
+		parallel_jobs_finish(jobs);
 
 	/* destroy all the elments in the pattern list */
 	if (ENABLE_FEATURE_CLEAN_UP) {
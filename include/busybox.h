@@ -26,15 +26,23 @@ enum SUIDRoot {
 	_BB_SUID_ALWAYS
 };
 
+enum Mode {
+	_BB_MODE_EXEC = 0,
+	_BB_MODE_NOEXEC,
+	_BB_MODE_NOFORK
+};
+
 struct BB_applet {
 	const char *name;
 	int (*main) (int argc, char **argv);
 	__extension__ enum Location location:4;
 	__extension__ enum SUIDRoot need_suid:4;
+	__extension__ enum Mode mode:2;
 };
 
 /* From busybox.c */
 extern const struct BB_applet applets[];
+extern struct BB_applet *applet_using;
 
 /* Automagically pull in all the applet function prototypes and
  * applet usage strings.  These are all of the form:
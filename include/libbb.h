@@ -19,6 +19,7 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <netdb.h>
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -136,6 +137,8 @@ extern DIR *bb_xopendir(const char *path);
 
 extern int remove_file(const char *path, int flags);
 extern int copy_file(const char *source, const char *dest, int flags);
+extern void copy_file_parallel_start(int nworkers, int flags);
+extern int copy_file_parallel_finish(void);
 extern ssize_t safe_read(int fd, void *buf, size_t count);
 extern ssize_t bb_full_read(int fd, void *buf, size_t len);
 extern ssize_t safe_write(int fd, const void *buf, size_t count);
@@ -146,6 +149,14 @@ extern int recursive_action(const char *fileName, int recurse,
 	  int (*dirAction) (const char *fileName, struct stat* statbuf, void* userData),
 	  void* userData);
 
+typedef struct parallel_jobs_s parallel_jobs_t;
+extern parallel_jobs_t *parallel_jobs_start(int nworkers,
+	  int (*job)(const char *arg, void *result),
+	  void (*done)(int status, void *result), int result_size);
+extern void parallel_jobs_add(parallel_jobs_t *pj, const char *arg);
+extern void parallel_jobs_add_data(parallel_jobs_t *pj, const char *arg, int len);
+extern void parallel_jobs_finish(parallel_jobs_t *pj);
+
 extern int bb_parse_mode( const char* s, mode_t* theMode);
 extern long bb_xgetlarg(const char *arg, int base, long lower, long upper);
 
@@ -158,6 +169,7 @@ extern int get_console_fd(void);
 extern struct mntent *find_mount_point(const char *name, const char *table);
 extern void erase_mtab(const char * name);
 extern long *find_pid_by_name( const char* pidName);
+extern long **find_pids_by_names(char **names, int count);
 extern long *pidlist_reverse(long *pidList);
 extern char *find_block_device(char *path);
 extern char *bb_get_line_from_file(FILE *file);
@@ -175,6 +187,8 @@ extern FILE *bb_xfopen(const char *path, const char *mode);
 
 extern int   bb_fclose_nonstdin(FILE *f);
 extern void  bb_fflush_stdout_and_exit(int retval) ATTRIBUTE_NORETURN;
+extern jmp_buf *bb_die_jmp;
+extern void bb_xfunc_exit(int retval) ATTRIBUTE_NORETURN;
 
 extern void xstat(const char *filename, struct stat *buf);
 extern int  bb_xsocket(int domain, int type, int protocol);
@@ -268,6 +282,8 @@ extern long bb_xgetgrnam(const char *name);
 extern char * bb_getug(char *buffer, char *idname, long id, int bufsize, char prefix);
 extern char * bb_getpwuid(char *name, long uid, int bufsize);
 extern char * bb_getgrgid(char *group, long gid, int bufsize);
+extern int bb_ug_cache_lookup(char prefix, long id, char **name);
+extern void bb_ug_cache_store(char prefix, long id, const char *name);
 extern char *bb_askpass(int timeout, const char * prompt);
 
 extern int device_open(const char *device, int mode);
@@ -496,6 +512,7 @@ extern unsigned char bb_xread_char(int fd);
 #endif
 typedef struct {
 	int pid;
+	uid_t uid;
 	char user[9];
 	char state[4];
 	unsigned long rss;
@@ -505,6 +522,7 @@ typedef struct {
 	unsigned pscpu;
 	unsigned long stime, utime;
 #endif
+	/* command line, owned by procps_scan() or the snapshot */
 	char *cmd;
 
 	/* basename of executable file in call to exec(2),
@@ -512,7 +530,38 @@ typedef struct {
 	char short_cmd[COMM_LEN];
 } procps_status_t;
 
-extern procps_status_t * procps_scan(int save_user_arg0);
+/* What procps_scan() should fill in; the pid is always there */
+enum {
+	PSSCAN_PPID	= 1 << 0,
+	PSSCAN_STATE	= 1 << 1,
+	PSSCAN_RSS	= 1 << 2,
+	PSSCAN_UTIME	= 1 << 3,	/* utime and stime */
+	PSSCAN_COMM	= 1 << 4,	/* short_cmd */
+	PSSCAN_UID	= 1 << 5,
+	PSSCAN_USER	= 1 << 6,	/* uid and user name */
+	PSSCAN_CMD	= 1 << 7,
+};
+
+/* Walk /proc one process at a time:
+ *	procps_status_t *p = NULL;
+ *	while ((p = procps_scan(p, PSSCAN_COMM)) != NULL) ...
+ * Only one scan can be in progress at a time.  Call free_procps() when
+ * leaving the loop early. */
+extern procps_status_t *procps_scan(procps_status_t *sp, int flags);
+extern void free_procps(procps_status_t *sp);
+
+/* All processes at once, with lookup by pid */
+typedef struct {
+	procps_status_t *proc;
+	int count;
+	int *hash;
+	unsigned hash_mask;
+} procps_snapshot_t;
+
+extern procps_snapshot_t *procps_snapshot(int flags);
+extern procps_status_t *procps_snapshot_find(const procps_snapshot_t *snap, int pid);
+extern void procps_snapshot_free(procps_snapshot_t *snap);
+
 extern int compare_string_array(const char * const string_array[], const char *key);
 
 extern int my_query_module(const char *name, int which, void **buf, size_t *bufsize, size_t *ret);
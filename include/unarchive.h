@@ -9,11 +9,14 @@
 #define ARCHIVE_EXTRACT_NEWER           16
 #define ARCHIVE_NOPRESERVE_OWN          32
 #define ARCHIVE_NOPRESERVE_PERM         64
+#define ARCHIVE_DEFER_METADATA          128
 
 #include <sys/types.h>
 #include <stdio.h>
 #include "libbb.h"
 
+typedef struct pattern_index_s pattern_index_t;
+
 typedef struct file_headers_s {
 	char *name;
 	char *link_name;
@@ -33,6 +36,9 @@ typedef struct archive_handle_s {
 	llist_t *reject;
 	/* List of files that have successfully been worked on */
 	llist_t *passed;
+	/* accept and reject compiled by the filters, if they are long */
+	pattern_index_t *accept_index;
+	pattern_index_t *reject_index;
 
 	/* Contains the processed header entry */
 	file_header_t *file_header;
@@ -66,6 +72,15 @@ typedef struct archive_handle_s {
 
 } archive_handle_t;
 
+/* Where inflate can pick up again: the next compressed bit and the 32K
+ * of output before it */
+typedef struct inflate_point_s {
+	off_t in;		/* file offset of the byte holding the next bit */
+	unsigned char bits;	/* bits of that byte already used */
+	off_t out;		/* uncompressed offset */
+	unsigned char window[0x8000];
+} inflate_point_t;
+
 extern archive_handle_t *init_handle(void);
 
 extern char filter_accept_all(archive_handle_t *archive_handle);
@@ -77,6 +92,8 @@ extern void unpack_ar_archive(archive_handle_t *ar_archive);
 
 extern void data_skip(archive_handle_t *archive_handle);
 extern void data_extract_all(archive_handle_t *archive_handle);
+extern void data_extract_all_finish(archive_handle_t *archive_handle);
+extern void data_extract_all_parallel(int nworkers);
 extern void data_extract_to_stdout(archive_handle_t *archive_handle);
 extern void data_extract_to_buffer(archive_handle_t *archive_handle);
 
@@ -92,6 +109,7 @@ extern char get_header_tar(archive_handle_t *archive_handle);
 extern char get_header_tar_bz2(archive_handle_t *archive_handle);
 extern char get_header_tar_lzma(archive_handle_t *archive_handle);
 extern char get_header_tar_gz(archive_handle_t *archive_handle);
+extern char get_header_tar_zst(archive_handle_t *archive_handle);
 
 extern void seek_by_jump(const archive_handle_t *archive_handle, const unsigned int amount);
 extern void seek_by_char(const archive_handle_t *archive_handle, const unsigned int amount);
@@ -101,13 +119,20 @@ extern ssize_t archive_xread_all_eof(archive_handle_t *archive_handle, unsigned
 
 extern void data_align(archive_handle_t *archive_handle, const unsigned short boundary);
 extern const llist_t *find_list_entry(const llist_t *list, const char *filename);
+extern const llist_t *find_list_entry_indexed(const llist_t *list, pattern_index_t **cache, const char *filename);
+extern pattern_index_t *compile_list_patterns(const llist_t *list, int flags);
+extern const llist_t *find_pattern_entry(const pattern_index_t *index, const char *filename);
+extern void free_list_patterns(pattern_index_t *index);
 
 extern int uncompressStream(int src_fd, int dst_fd);
-extern void inflate_init(unsigned int bufsize);
-extern void inflate_cleanup(void);
-extern int inflate_unzip(int in, int out);
+extern int inflate_unzip(int in, off_t pos, off_t len, int out, uint32_t *crc, unsigned int *bytes_out);
 extern int inflate_gunzip(int in, int out);
+extern int inflate_gunzip_index(int in, off_t span,
+		void (*save)(const inflate_point_t *, void *), void *arg);
+extern int inflate_gunzip_range(int in, const inflate_point_t *point,
+		off_t skip, off_t len, int out);
 extern int unlzma(int src_fd, int dst_fd);
+extern int unzstd(int src_fd, int dst_fd);
 
 extern int open_transformer(int src_fd, int (*transformer)(int src_fd, int dst_fd));
 
@@ -286,6 +286,7 @@
 	"\t-f\tforce (implied; ignored) - always set\n" \
 	"\t-i\tinteractive, prompt before overwrite\n" \
 	"\t-R,-r\tCopies directories recursively" \
+	USE_FEATURE_CP_PARALLEL("\n\t-j N\tCopy small files in N processes") \
 	USAGE_SELINUX("\n\t-Z CONTEXT\tset security context of copy to CONTEXT")
 
 #define cpio_trivial_usage \
@@ -524,7 +525,8 @@ USE_FEATURE_DATE_ISOFMT( \
 	"\t-d\toutput will be in DOS format"
 
 #define dpkg_trivial_usage \
-	"[-ilCPru] [-F option] package_name"
+	"[-ilCPru" USE_FEATURE_DPKG_TIMING("T") "] [-F option]" \
+	USE_FEATURE_DPKG_PARALLEL(" [-j jobs]") " package_name"
 #define dpkg_full_usage \
 	"dpkg is a utility to install, remove and manage Debian packages.\n\n" \
 	"Options:\n" \
@@ -534,7 +536,11 @@ USE_FEATURE_DATE_ISOFMT( \
 	"\t-F depends\tIgnore dependency problems\n" \
 	"\t-P\t\tPurge all files of a package\n" \
 	"\t-r\t\tRemove all but the configuration files for a package\n" \
-	"\t-u\t\tUnpack a package, but don't configure it"
+	"\t-u\t\tUnpack a package, but don't configure it" \
+	USE_FEATURE_DPKG_PARALLEL( \
+	"\n\t-j jobs\t\tUnpack up to this many packages at once") \
+	USE_FEATURE_DPKG_TIMING( \
+	"\n\t-T\t\tReport how long each phase took")
 
 #define dpkg_deb_trivial_usage \
 	"[-cefxX] FILE [argument]"
@@ -944,10 +950,10 @@ USE_FEATURE_DATE_ISOFMT( \
 	"-a	Show all SELinux booleans."
 
 #define grep_trivial_usage \
-	"[-ihHnqvs" \
+	"[-ihHnqvsr" \
 	USE_FEATURE_GREP_EGREP_ALIAS("E") \
 	USE_FEATURE_GREP_CONTEXT("ABC") \
-	"] PATTERN [FILEs...]"
+	"] " USE_FEATURE_GREP_PARALLEL("[-j N] ") "PATTERN [FILEs...]"
 #define grep_full_usage \
 	"Search for PATTERN in each FILE or standard input.\n\n" \
 	"Options:\n" \
@@ -958,6 +964,7 @@ USE_FEATURE_DATE_ISOFMT( \
 	"\t-L\tlist names of files that do not match\n" \
 	"\t-n\tprint line number with output lines\n" \
 	"\t-q\tbe quiet. Returns 0 if PATTERN was found, 1 otherwise\n" \
+	"\t-r\trecurse into directories\n" \
 	"\t-v\tselect non-matching lines\n" \
 	"\t-s\tsuppress file open/read error messages\n" \
 	"\t-c\tonly print count of matching lines\n" \
@@ -967,7 +974,8 @@ USE_FEATURE_DATE_ISOFMT( \
 	USE_FEATURE_GREP_EGREP_ALIAS("\n\t-E\tPATTERN is an extended regular expression") \
 	USE_FEATURE_GREP_CONTEXT("\n\t-A\tprint NUM lines of trailing context") \
 	USE_FEATURE_GREP_CONTEXT("\n\t-B\tprint NUM lines of leading context") \
-	USE_FEATURE_GREP_CONTEXT("\n\t-C\tprint NUM lines of output context")
+	USE_FEATURE_GREP_CONTEXT("\n\t-C\tprint NUM lines of output context") \
+	USE_FEATURE_GREP_PARALLEL("\n\t-j\tgrep N files at a time")
 
 #define grep_example_usage \
 	"$ grep root /etc/passwd\n" \
@@ -982,7 +990,12 @@ USE_FEATURE_DATE_ISOFMT( \
 	"Options:\n" \
 	"\t-c\tWrite output to standard output\n" \
 	"\t-f\tForce read when source is a terminal\n" \
-	"\t-t\tTest compressed file integrity"
+	"\t-t\tTest compressed file integrity" \
+	USE_FEATURE_GUNZIP_INDEX( \
+	"\n\t--index\tWrite a seek index to FILE.idx\n" \
+	"\t--span=MB\tDistance between index points (4)\n" \
+	"\t--offset=N\tStart output at uncompressed byte N\n" \
+	"\t--length=N\tStop after N bytes of output")
 #define gunzip_example_usage \
 	"$ ls -la /tmp/BusyBox*\n" \
 	"-rw-rw-r--    1 andersen andersen   557009 Apr 11 10:55 /tmp/BusyBox-0.43.tar.gz\n" \
@@ -1685,7 +1698,7 @@ USE_FEATURE_DATE_ISOFMT( \
 #endif
 
 #define ls_trivial_usage \
-	"[-1Aa" USAGE_LS_TIMESTAMPS("c") "Cd" USAGE_LS_TIMESTAMPS("e") USAGE_LS_FILETYPES("F") "iln" USAGE_LS_FILETYPES("p") USAGE_LS_FOLLOWLINKS("L") USAGE_LS_RECURSIVE("R") USAGE_LS_SORTFILES("rS") "s" USAGE_AUTOWIDTH("T") USAGE_LS_TIMESTAMPS("tu") USAGE_LS_SORTFILES("v") USAGE_AUTOWIDTH("w") "x" USAGE_LS_SORTFILES("X") USE_FEATURE_HUMAN_READABLE("h") USAGE_SELINUX("Z") "] [filenames...]"
+	"[-1Aa" USAGE_LS_TIMESTAMPS("c") "Cd" USAGE_LS_TIMESTAMPS("e") USAGE_LS_SORTFILES("f") USAGE_LS_FILETYPES("F") "iln" USAGE_LS_FILETYPES("p") USAGE_LS_FOLLOWLINKS("L") USAGE_LS_RECURSIVE("R") USAGE_LS_SORTFILES("rS") "s" USAGE_AUTOWIDTH("T") USAGE_LS_TIMESTAMPS("tu") USAGE_LS_SORTFILES("Uv") USAGE_AUTOWIDTH("w") "x" USAGE_LS_SORTFILES("X") USE_FEATURE_HUMAN_READABLE("h") USAGE_SELINUX("Z") "] [filenames...]"
 #define ls_full_usage \
 	"List directory contents\n\n" \
 	"Options:\n" \
@@ -1697,6 +1710,7 @@ USE_FEATURE_DATE_ISOFMT( \
 	USAGE_LS_COLOR("\t--color[={always,never,auto}]\tto control coloring\n") \
 	"\t-d\tlist directory entries instead of contents\n" \
 	USAGE_LS_TIMESTAMPS("\t-e\tlist both full date and full time\n") \
+	USAGE_LS_SORTFILES("\t-f\tsame as -aU, without -l or -s\n") \
 	USAGE_LS_FILETYPES("\t-F\tappend indicator (one of */=@|) to entries\n") \
 	"\t-i\tlist the i-node for each file\n" \
 	"\t-l\tuse a long listing format\n" \
@@ -1710,6 +1724,7 @@ USE_FEATURE_DATE_ISOFMT( \
 	USAGE_AUTOWIDTH("\t-T NUM\tassume Tabstop every NUM columns\n") \
 	USAGE_LS_TIMESTAMPS("\t-t\twith -l: show modification time\n") \
 	USAGE_LS_TIMESTAMPS("\t-u\twith -l: show access time\n") \
+	USAGE_LS_SORTFILES("\t-U\tdo not sort; list entries in directory order\n") \
 	USAGE_LS_SORTFILES("\t-v\tsort the listing by version\n") \
 	USAGE_AUTOWIDTH("\t-w NUM\tassume the terminal is NUM columns wide\n") \
 	"\t-x\tlist entries by lines instead of by columns\n" \
@@ -2574,9 +2589,10 @@ USE_FEATURE_MDEV_CONFIG( \
 	"\t-A inet" USAGE_ROUTE_IPV6("{6}") "\tSelect address family"
 
 #define rpm_trivial_usage \
-	"-i -q[ildc]p package.rpm"
+	"-i -q[ildc]p package.rpm..."
 #define rpm_full_usage \
-	"Manipulates RPM packages" \
+	"Manipulates RPM packages; a package of - reads package names, " \
+	"one per line, from stdin" \
 	"\n\nOptions:" \
 	"\n\t-i Install package" \
 	"\n\t-q Query package" \
@@ -3083,7 +3099,9 @@ USE_FEATURE_START_STOP_DAEMON_FANCY( \
 	USAGE_UNSIMPLE_TAIL("\t-c N[kbm]\toutput the last N bytes\n") \
 	"\t-n N[kbm]\tprint last N lines instead of last 10\n" \
 	"\t-f\t\toutput data as the file grows" \
-	USAGE_UNSIMPLE_TAIL( "\n\t-q\t\tnever output headers giving file names\n" \
+	USAGE_UNSIMPLE_TAIL( "\n\t-F\t\tsame as -f, but keep retrying and reopen the file\n" \
+	"\t\t\twhen it is replaced (rotated)\n" \
+	"\t-q\t\tnever output headers giving file names\n" \
 	"\t-s SEC\t\twait SEC seconds between reads with -f\n" \
 	"\t-v\t\talways output headers giving file names\n\n" \
 	"If the first character of N (bytes or lines) is a '+', output begins with \n" \
@@ -3123,6 +3141,21 @@ USE_FEATURE_START_STOP_DAEMON_FANCY( \
 #else
 #  define USAGE_TAR_COMPRESS(a)
 #endif
+#ifdef CONFIG_FEATURE_TAR_ZSTD
+#  define USAGE_TAR_ZSTD(a) a
+#else
+#  define USAGE_TAR_ZSTD(a)
+#endif
+#ifdef CONFIG_FEATURE_TAR_PARALLEL
+#  define USAGE_TAR_PARALLEL(a) a
+#else
+#  define USAGE_TAR_PARALLEL(a)
+#endif
+#ifdef CONFIG_FEATURE_TAR_AUTODETECT
+#  define USAGE_TAR_AUTODETECT(a) a
+#else
+#  define USAGE_TAR_AUTODETECT(a)
+#endif
 
 #define tar_trivial_usage \
 	"-[" USAGE_TAR_CREATE("c") USAGE_TAR_GZIP("z") USAGE_TAR_BZIP2("j") USAGE_TAR_LZMA("a") USAGE_TAR_COMPRESS("Z") "xtvO] " \
@@ -3139,6 +3172,8 @@ USE_FEATURE_START_STOP_DAEMON_FANCY( \
 	USAGE_TAR_BZIP2("\tj\t\tFilter the archive through bzip2\n") \
 	USAGE_TAR_LZMA("\ta\t\tFilter the archive through lzma\n") \
 	USAGE_TAR_COMPRESS("\tZ\t\tFilter the archive through compress\n") \
+	USAGE_TAR_ZSTD("\tzstd\t\tFilter the archive through zstd\n") \
+	USAGE_TAR_AUTODETECT("\t\t\t(detected by itself when reading a file)\n") \
 	"\nFile selection:\n" \
 	"\tf\t\tname of TARFILE or \"-\" for stdin\n" \
 	"\tO\t\textract to stdout\n" \
@@ -3147,6 +3182,7 @@ USE_FEATURE_START_STOP_DAEMON_FANCY( \
 	 "\tX\t\tfile with names to exclude\n" \
 	) \
 	"\tC\t\tchange to directory DIR before operation\n" \
+	USAGE_TAR_PARALLEL("\tjobs N\t\textract small files with N processes\n") \
 	"\tv\t\tverbosely list files processed"
 #define tar_example_usage \
 	"$ zcat /tmp/tarball.tar.gz | tar -xf -\n" \
@@ -3466,6 +3502,14 @@ USE_FEATURE_START_STOP_DAEMON_FANCY( \
 	"\t-x\texclude these files\n" \
 	"\t-d\textract files into this directory"
 
+#define unzstd_trivial_usage \
+	"[OPTION]... [FILE]"
+#define unzstd_full_usage \
+	"Uncompress FILE (or standard input if FILE is '-' or omitted).\n\n" \
+	"Options:\n" \
+	"\t-c\tWrite output to standard output\n" \
+	"\t-f\tForce"
+
 #define uptime_trivial_usage \
 	""
 #define uptime_full_usage \
@@ -3553,7 +3597,7 @@ USE_FEATURE_START_STOP_DAEMON_FANCY( \
 	"\t-F\tStay in the foreground and don't fork"
 
 #define wc_trivial_usage \
-	"[OPTION]... [FILE]..."
+	"[OPTION]... " USE_FEATURE_WC_PARALLEL("[-j N] ") "[FILE]..."
 #define wc_full_usage \
 	"Print line, word, and byte counts for each FILE, and a total line if\n" \
 	"more than one FILE is specified.  With no FILE, read standard input.\n\n" \
@@ -3561,7 +3605,9 @@ USE_FEATURE_START_STOP_DAEMON_FANCY( \
 	"\t-c\tprint the byte counts\n" \
 	"\t-l\tprint the newline counts\n" \
 	"\t-L\tprint the length of the longest line\n" \
-	"\t-w\tprint the word counts"
+	"\t-w\tprint the word counts" \
+	USE_FEATURE_WC_PARALLEL( \
+	"\n\t-j N\tcount N files at a time in parallel")
 #define wc_example_usage \
 	"$ wc /etc/passwd\n" \
 	"     31      46    1365 /etc/passwd\n"
@@ -3633,9 +3679,13 @@ USE_FEATURE_START_STOP_DAEMON_FANCY( \
 	"Repeatedly outputs a line with all specified STRING(s), or 'y'."
 
 #define zcat_trivial_usage \
-	"FILE"
+	USE_FEATURE_GUNZIP_INDEX("[--offset=N] [--length=N] ") "FILE"
 #define zcat_full_usage \
-	"Uncompress to stdout."
+	"Uncompress to stdout." \
+	USE_FEATURE_GUNZIP_INDEX( \
+	"\n\nOptions:\n" \
+	"\t--offset=N\tStart output at uncompressed byte N\n" \
+	"\t--length=N\tStop after N bytes of output")
 
 #define zcip_trivial_usage \
 	"[OPTIONS] ifname script"
@@ -3647,4 +3697,9 @@ USE_FEATURE_START_STOP_DAEMON_FANCY( \
 	"\t-r 169.254.x.x  request this address first\n" \
 	"\t-v              verbose"
 
+#define zstdcat_trivial_usage \
+	"FILE"
+#define zstdcat_full_usage \
+	"Uncompress to stdout."
+
 #endif /* __BB_USAGE_H__ */
@@ -32,10 +32,16 @@
 /* gets a groupname given a gid */
 char * bb_getgrgid(char *group, long gid, int bufsize)
 {
-	struct group *mygroup = getgrgid(gid);
+	struct group *mygroup;
+	char *idname;
 
-	return  bb_getug(group, (mygroup) ?
-			mygroup->gr_name : (char *)mygroup, gid, bufsize, 'g');
+	if (!ENABLE_FEATURE_UG_NAME_CACHE || !bb_ug_cache_lookup('g', gid, &idname)) {
+		mygroup = getgrgid(gid);
+		idname = (mygroup) ? mygroup->gr_name : NULL;
+		if (ENABLE_FEATURE_UG_NAME_CACHE)
+			bb_ug_cache_store('g', gid, idname);
+	}
+	return  bb_getug(group, idname, gid, bufsize, 'g');
 }
 #endif /* L_bb_getgrgid */
 
@@ -105,10 +111,16 @@ long bb_xgetpwnam(const char *name)
 /* gets a username given a uid */
 char * bb_getpwuid(char *name, long uid, int bufsize)
 {
-	struct passwd *myuser = getpwuid(uid);
+	struct passwd *myuser;
+	char *idname;
 
-	return  bb_getug(name, (myuser) ?
-			myuser->pw_name : (char *)myuser , uid, bufsize, 'u');
+	if (!ENABLE_FEATURE_UG_NAME_CACHE || !bb_ug_cache_lookup('u', uid, &idname)) {
+		myuser = getpwuid(uid);
+		idname = (myuser) ? myuser->pw_name : NULL;
+		if (ENABLE_FEATURE_UG_NAME_CACHE)
+			bb_ug_cache_store('u', uid, idname);
+	}
+	return  bb_getug(name, idname, uid, bufsize, 'u');
 }
 #endif /* L_bb_getpwuid */
 
@@ -148,6 +160,216 @@ char * bb_getug(char *buffer, char *idname, long id, int bufsize, char prefix)
 }
 #endif /* L_bb_getug */
 
+#ifdef L_bb_ug_cache
+ /*
+  * uid -> user name and gid -> group name cache for bb_getpwuid and
+  * bb_getgrgid, so that ls -l, ps, top, tar and stat don't go back to
+  * the password database for every file or process they show.
+  *
+  * With the internal password functions, the first lookup indexes all
+  * of /etc/passwd (or /etc/group) at once, and an id that is not in
+  * the index is known not to exist.  With the system functions the
+  * answers getpwuid()/getgrgid() gave, including "no such id", are
+  * remembered one at a time.  Either way everything is forgotten when
+  * the file's mtime, size or inode changes; that is checked at most
+  * once a second.
+  */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libbb.h"
+
+struct ug_ent {
+	long id;
+	char *name;		/* NULL: no such id */
+	int used;
+};
+
+struct ug_cache {
+	struct ug_ent *tab;
+	unsigned count, mask;
+	char *names;		/* name storage of a whole-file index */
+	int full;		/* every id in the file is in tab */
+	int valid;
+	time_t checked;
+	time_t mtime;
+	off_t size;
+	ino_t ino;
+};
+
+static struct ug_cache ug_cache[2];	/* users, groups */
+
+static unsigned ug_hash(long id, unsigned mask)
+{
+	return ((unsigned long)id * 2654435761U) & mask;
+}
+
+static struct ug_ent *ug_find(struct ug_cache *c, long id)
+{
+	unsigned h;
+
+	if (!c->tab)
+		return NULL;
+	for (h = ug_hash(id, c->mask); c->tab[h].used; h = (h + 1) & c->mask)
+		if (c->tab[h].id == id)
+			return &c->tab[h];
+	return NULL;
+}
+
+static void ug_insert(struct ug_cache *c, long id, char *name)
+{
+	unsigned h;
+
+	/* Keep the table at most half full */
+	if (2 * (c->count + 1) > c->mask) {
+		struct ug_ent *old = c->tab;
+		unsigned i, oldsize = old ? c->mask + 1 : 0;
+
+		c->mask = old ? c->mask * 2 + 1 : 63;
+		c->tab = xzalloc((c->mask + 1) * sizeof(*c->tab));
+		for (i = 0; i < oldsize; i++) {
+			if (!old[i].used)
+				continue;
+			for (h = ug_hash(old[i].id, c->mask); c->tab[h].used; )
+				h = (h + 1) & c->mask;
+			c->tab[h] = old[i];
+		}
+		free(old);
+	}
+	for (h = ug_hash(id, c->mask); c->tab[h].used; h = (h + 1) & c->mask)
+		continue;
+	c->tab[h].id = id;
+	c->tab[h].name = name;
+	c->tab[h].used = 1;
+	c->count++;
+}
+
+static void ug_flush(struct ug_cache *c)
+{
+	unsigned i;
+
+	if (c->tab && !c->names)
+		for (i = 0; i <= c->mask; i++)
+			free(c->tab[i].name);
+	free(c->tab);
+	free(c->names);
+	c->tab = NULL;
+	c->names = NULL;
+	c->count = c->mask = 0;
+	c->full = 0;
+	c->valid = 0;
+}
+
+/* Index "name:passwd:id:..." lines, the same for passwd and group */
+static void ug_index_file(struct ug_cache *c, int fd)
+{
+	char *map = NULL, *p, *end, *name, *colon, *pool;
+	long id;
+
+	if (c->size) {
+		map = mmap(NULL, c->size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED)
+			return;
+	}
+	c->full = 1;
+	c->names = pool = xmalloc(c->size + 1);
+	if (!c->size)
+		return;
+	for (p = map, end = map + c->size; p < end; p = colon + 1) {
+		name = p;
+		colon = memchr(p, '\n', end - p);
+		if (!colon)
+			colon = end;
+		/* name */
+		while (p < colon && *p != ':')
+			p++;
+		if (p == colon || p == name)
+			continue;
+		memcpy(pool, name, p - name);
+		pool[p - name] = '\0';
+		/* password */
+		p = memchr(p + 1, ':', colon - p - 1);
+		if (!p || ++p == colon || (unsigned)(*p - '0') > 9)
+			continue;
+		/* id */
+		for (id = 0; p < colon && (unsigned)(*p - '0') <= 9; p++)
+			id = id * 10 + (*p - '0');
+		if (p < colon && *p != ':')
+			continue;
+		/* getpwuid() returns the first entry for an id */
+		if (ug_find(c, id))
+			continue;
+		ug_insert(c, id, pool);
+		pool += strlen(pool) + 1;
+	}
+	munmap(map, c->size);
+}
+
+static struct ug_cache *ug_cache_get(char prefix)
+{
+	struct ug_cache *c = &ug_cache[prefix == 'g'];
+	const char *file = (prefix == 'g') ? bb_path_group_file : bb_path_passwd_file;
+	struct stat st;
+	time_t now = time(NULL);
+	int fd;
+
+	if (c->valid && now == c->checked)
+		return c;
+	c->checked = now;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0)
+		memset(&st, 0, sizeof(st));
+	if (c->valid && st.st_mtime == c->mtime
+			&& st.st_size == c->size && st.st_ino == c->ino) {
+		if (fd >= 0)
+			close(fd);
+		return c;
+	}
+	ug_flush(c);
+	c->mtime = st.st_mtime;
+	c->size = st.st_size;
+	c->ino = st.st_ino;
+	c->valid = 1;
+	if (ENABLE_USE_BB_PWD_GRP && fd >= 0)
+		ug_index_file(c, fd);
+	if (fd >= 0)
+		close(fd);
+	return c;
+}
+
+/* Returns 1 and sets *name (NULL if there is no such id) when the
+ * answer is known, 0 when the caller has to ask the system */
+int bb_ug_cache_lookup(char prefix, long id, char **name)
+{
+	struct ug_cache *c = ug_cache_get(prefix);
+	struct ug_ent *e = ug_find(c, id);
+
+	if (e) {
+		*name = e->name;
+		return 1;
+	}
+	if (c->full) {
+		*name = NULL;
+		return 1;
+	}
+	return 0;
+}
+
+void bb_ug_cache_store(char prefix, long id, const char *name)
+{
+	struct ug_cache *c = &ug_cache[prefix == 'g'];
+
+	if (!c->full && !ug_find(c, id))
+		ug_insert(c, id, name ? bb_xstrdup(name) : NULL);
+}
+#endif /* L_bb_ug_cache */
+
 
 #ifdef L_get_ug_id
 /* indirect dispatcher for pwd helpers.  */
@@ -12,9 +12,236 @@
 #include "libbb.h"
 #include <utime.h>
 #include <errno.h>
+#include <string.h>
 #ifdef CONFIG_SELINUX
 #include <selinux/selinux.h>
 #endif
+#if ENABLE_FEATURE_COPY_FILE_FAST
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#ifndef FICLONE
+#define FICLONE		_IOW(0x94, 9, int)
+#endif
+#ifndef SEEK_DATA
+#define SEEK_DATA	3
+#define SEEK_HOLE	4
+#endif
+
+/* Set once the kernel or filesystem has told us it can't do these */
+static int no_clone, no_copy_range;
+
+static ssize_t copy_range(int src_fd, long long *src_off,
+		int dst_fd, long long *dst_off, size_t len)
+{
+#ifdef __NR_copy_file_range
+	if (!no_copy_range)
+		return syscall(__NR_copy_file_range, src_fd, src_off,
+				dst_fd, dst_off, len, 0);
+#endif
+	errno = ENOSYS;
+	return -1;
+}
+
+/* Copy len bytes (or everything up to EOF if len < 0) at offset off */
+static int copy_extent(int src_fd, int dst_fd, off_t off, off_t len)
+{
+	long long src_off = off, dst_off = off;
+	ssize_t n;
+
+	while (len) {
+		n = copy_range(src_fd, &src_off, dst_fd, &dst_off,
+				(len < 0 || len > 0x40000000) ? 0x40000000 : len);
+		if (n == 0)
+			return 0;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != ENOSYS && errno != EXDEV && errno != EINVAL
+					&& errno != EOPNOTSUPP && errno != EBADF) {
+				bb_perror_msg(bb_msg_write_error);
+				return -1;
+			}
+			/* Not here: do the rest by hand */
+			if (src_off == off)
+				no_copy_range = (errno == ENOSYS);
+			if (lseek(src_fd, src_off, SEEK_SET) < 0
+					|| lseek(dst_fd, dst_off, SEEK_SET) < 0) {
+				bb_perror_msg(bb_msg_read_error);
+				return -1;
+			}
+			if (len < 0)
+				return bb_copyfd_eof(src_fd, dst_fd) < 0 ? -1 : 0;
+			return bb_copyfd_size(src_fd, dst_fd, len) < 0 ? -1 : 0;
+		}
+		if (len > 0)
+			len -= n;
+	}
+	return 0;
+}
+
+/* Copy file contents, sharing the source's blocks if the filesystem
+ * can, and leaving holes where the source has them */
+static int copy_file_data(int src_fd, int dst_fd, const struct stat *src_stat)
+{
+	struct stat dst_stat;
+	off_t pos, data, hole, size = src_stat->st_size;
+
+	if (!S_ISREG(src_stat->st_mode) || fstat(dst_fd, &dst_stat) < 0
+			|| !S_ISREG(dst_stat.st_mode))
+		return bb_copyfd_eof(src_fd, dst_fd) < 0 ? -1 : 0;
+
+	if (!no_clone) {
+		if (ioctl(dst_fd, FICLONE, src_fd) == 0)
+			return 0;
+		if (errno == ENOTTY || errno == ENOSYS)
+			no_clone = 1;
+	}
+
+	/* Only bother looking for holes if the block count says there are some */
+	if ((off_t)src_stat->st_blocks * 512 >= size)
+		return copy_extent(src_fd, dst_fd, 0, -1);
+
+	for (pos = 0; pos < size; pos = hole) {
+		data = lseek(src_fd, pos, SEEK_DATA);
+		if (data < 0) {
+			if (errno == ENXIO)	/* only a hole left */
+				break;
+			/* No SEEK_DATA support: plain copy of the rest */
+			return copy_extent(src_fd, dst_fd, pos, -1);
+		}
+		hole = lseek(src_fd, data, SEEK_HOLE);
+		if (hole < 0)
+			hole = size;
+		if (copy_extent(src_fd, dst_fd, data, hole - data) < 0)
+			return -1;
+	}
+	if (ftruncate(dst_fd, size) < 0) {
+		bb_perror_msg(bb_msg_write_error);
+		return -1;
+	}
+	return 0;
+}
+#else
+#define copy_file_data(src_fd, dst_fd, src_stat) \
+	(bb_copyfd_eof(src_fd, dst_fd) == -1 ? -1 : 0)
+#endif
+
+#if ENABLE_FEATURE_CP_PARALLEL
+/* Small new files are handed to worker processes; directory times and
+ * modes are then set at the end, once nothing is writing into them */
+#define PARALLEL_MAX_SIZE	(256 * 1024)
+
+struct deferred_dir {
+	struct deferred_dir *next;
+	struct stat st;
+	mode_t mode;		/* chmod to this unless preserving status */
+	int flags;
+	char name[1];
+};
+
+static parallel_jobs_t *copy_jobs;
+static int copy_jobs_flags;
+static int copy_jobs_status;
+static struct deferred_dir *deferred, **deferred_tail = &deferred;
+
+static int copy_job(const char *arg, void *result ATTRIBUTE_UNUSED)
+{
+	char *source = bb_xstrdup(arg);
+	char *dest = strchr(source, '\n');
+
+	*dest++ = '\0';
+	return copy_file(source, dest, copy_jobs_flags);
+}
+
+static void copy_job_done(int status, void *result ATTRIBUTE_UNUSED)
+{
+	if (status < 0)
+		copy_jobs_status = -1;
+}
+
+static int copy_file_queue(const char *source, const char *dest,
+		const struct stat *st, int flags)
+{
+	char *arg;
+
+	if (!copy_jobs || st->st_size > PARALLEL_MAX_SIZE
+			|| (st->st_nlink > 1 && !(flags & FILEUTILS_DEREFERENCE))
+			|| strchr(source, '\n') || strchr(dest, '\n'))
+		return 0;
+	arg = xmalloc(strlen(source) + strlen(dest) + 2);
+	sprintf(arg, "%s\n%s", source, dest);
+	parallel_jobs_add(copy_jobs, arg);
+	free(arg);
+	return 1;
+}
+
+static void defer_dir(const char *dest, const struct stat *st, mode_t mode,
+		int flags)
+{
+	struct deferred_dir *d = xmalloc(sizeof(*d) + strlen(dest));
+
+	strcpy(d->name, dest);
+	d->st = *st;
+	d->mode = mode;
+	d->flags = flags;
+	d->next = NULL;
+	*deferred_tail = d;
+	deferred_tail = &d->next;
+}
+
+/* Copy regular files with nworkers processes from now on.  The flags
+ * must be the ones every later copy_file() call will use. */
+void copy_file_parallel_start(int nworkers, int flags)
+{
+	copy_jobs_flags = flags;
+	copy_jobs = parallel_jobs_start(nworkers, copy_job, copy_job_done, 0);
+}
+
+/* Wait for the workers and finish off the directories; returns -1 if
+ * any copy failed */
+int copy_file_parallel_finish(void)
+{
+	struct deferred_dir *d;
+	int status;
+
+	if (!copy_jobs)
+		return 0;
+	parallel_jobs_finish(copy_jobs);
+	copy_jobs = NULL;
+	status = copy_jobs_status;
+
+	/* Children were queued before their parents */
+	while ((d = deferred) != NULL) {
+		if (d->mode != (mode_t)-1 && chmod(d->name, d->mode) < 0) {
+			bb_perror_msg("unable to change permissions of `%s'", d->name);
+			status = -1;
+		}
+		if (d->flags & FILEUTILS_PRESERVE_STATUS) {
+			struct utimbuf times;
+			char *msg="unable to preserve %s of `%s'";
+
+			times.actime = d->st.st_atime;
+			times.modtime = d->st.st_mtime;
+			if (utime(d->name, &times) < 0)
+				bb_perror_msg(msg, "times", d->name);
+			if (chown(d->name, d->st.st_uid, d->st.st_gid) < 0) {
+				d->st.st_mode &= ~(S_ISUID | S_ISGID);
+				bb_perror_msg(msg, "ownership", d->name);
+			}
+			if (chmod(d->name, d->st.st_mode) < 0)
+				bb_perror_msg(msg, "permissions", d->name);
+		}
+		deferred = d->next;
+		free(d);
+	}
+	deferred_tail = &deferred;
+	return status;
+}
+#else
+#define copy_jobs 0
+#define copy_file_queue(source, dest, st, flags) 0
+#define defer_dir(dest, st, mode, flags) ((void)0)
+#endif
 
 int copy_file(const char *source, const char *dest, int flags)
 {
@@ -121,6 +348,12 @@ int copy_file(const char *source, const char *dest, int flags)
 		/* closedir have only EBADF error, but "dp" not changes */
 		closedir(dp);
 
+		if (copy_jobs) {
+			/* Workers may still be filling it */
+			defer_dir(dest, &source_stat, dest_exists ? (mode_t)-1
+					: source_stat.st_mode & ~saved_umask, flags);
+			return status;
+		}
 		if (!dest_exists &&
 				chmod(dest, source_stat.st_mode & ~saved_umask) < 0) {
 			bb_perror_msg("unable to change permissions of `%s'", dest);
@@ -145,6 +378,8 @@ int copy_file(const char *source, const char *dest, int flags)
 			}
 			add_to_ino_dev_hashtable(&source_stat, dest);
 		}
+		if (!dest_exists && copy_file_queue(source, dest, &source_stat, flags))
+			return 0;
 		src_fd = open(source, O_RDONLY);
 		if (src_fd == -1) {
 			bb_perror_msg("unable to open `%s'", source);
@@ -207,7 +442,7 @@ dest_removed:
 			}
 		}
 
-		if (bb_copyfd_eof(src_fd, dst_fd) == -1)
+		if (copy_file_data(src_fd, dst_fd, &source_stat) < 0)
 			status = -1;
 
 		if (close(dst_fd) < 0) {
@@ -13,6 +13,76 @@
 #include <stdlib.h>
 #include "libbb.h"
 
+/* Hash of at most the first COMM_LEN-1 characters of a name */
+static unsigned comm_hash(const char *name, unsigned mask)
+{
+	unsigned h = 0;
+	int i;
+
+	for (i = 0; i < COMM_LEN-1 && name[i]; i++)
+		h = h * 31 + (unsigned char)name[i];
+	return (h * 2654435761U) & mask;
+}
+
+/* find_pids_by_names()
+ *
+ *  Looks up several process names in a single pass over /proc.  The
+ *  names go into a small hash table keyed on the first COMM_LEN-1
+ *  characters (all the kernel keeps), and every process is looked up
+ *  in it once.
+ *
+ *  Returns one pid list per name, in the same order, each in the
+ *  format find_pid_by_name() returns.  It is the caller's duty to
+ *  free every list and the array holding them.
+ */
+long **find_pids_by_names(char **names, int count)
+{
+	long **pidLists = xmalloc(count * sizeof(long *));
+	int *nPids = xzalloc(count * sizeof(int));
+	int *hash, *chain;
+	unsigned mask, h;
+	procps_status_t * p = NULL;
+	int i;
+
+	for (mask = 7; mask < 2U * count; mask = mask * 2 + 1)
+		continue;
+	hash = xmalloc((mask + 1) * sizeof(int));
+	memset(hash, 0xff, (mask + 1) * sizeof(int));
+	chain = xmalloc(count * sizeof(int));	/* other names with the same key */
+	for (i = 0; i < count; i++) {
+		pidLists[i] = xmalloc(sizeof(long));
+		chain[i] = -1;
+		for (h = comm_hash(names[i], mask); hash[h] >= 0; h = (h + 1) & mask)
+			if (strncmp(names[hash[h]], names[i], COMM_LEN-1) == 0)
+				break;
+		if (hash[h] >= 0) {
+			chain[i] = chain[hash[h]];
+			chain[hash[h]] = i;
+		} else
+			hash[h] = i;
+	}
+
+	while ((p = procps_scan(p, PSSCAN_COMM)) != 0)
+	{
+		for (h = comm_hash(p->short_cmd, mask); hash[h] >= 0; h = (h + 1) & mask) {
+			if (strncmp(p->short_cmd, names[hash[h]], COMM_LEN-1) == 0) {
+				for (i = hash[h]; i >= 0; i = chain[i]) {
+					pidLists[i] = xrealloc(pidLists[i], sizeof(long) * (nPids[i]+2));
+					pidLists[i][nPids[i]++] = p->pid;
+				}
+				break;
+			}
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		pidLists[i][nPids[i]] = nPids[i]==0 ? -1 : 0;
+	free(nPids);
+	free(hash);
+	free(chain);
+	return pidLists;
+}
+
 /* find_pid_by_name()
  *
  *  Modified by Vladimir Oleynik for use with libbb/procps.c
@@ -25,20 +95,10 @@
  */
 long* find_pid_by_name( const char* pidName)
 {
-	long* pidList;
-	int i=0;
-	procps_status_t * p;
-
-	pidList = xmalloc(sizeof(long));
-	while ((p = procps_scan(0)) != 0)
-	{
-		if (strncmp(p->short_cmd, pidName, COMM_LEN-1) == 0) {
-			pidList=xrealloc( pidList, sizeof(long) * (i+2));
-			pidList[i++]=p->pid;
-		}
-	}
+	long **pidLists = find_pids_by_names((char **)&pidName, 1);
+	long *pidList = pidLists[0];
 
-	pidList[i] = i==0 ? -1 : 0;
+	free(pidLists);
 	return pidList;
 }
 
@@ -19,5 +19,5 @@ void bb_herror_msg_and_die(const char *s, ...)
 	va_start(p, s);
 	bb_vherror_msg(s, p);
 	va_end(p);
-	exit(bb_default_error_retval);
+	bb_xfunc_exit(bb_default_error_retval);
 }
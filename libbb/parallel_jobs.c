@@ -0,0 +1,363 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * Run independent jobs (one per file, typically) in a small pool of
+ * forked worker processes, delivering their output in submission order.
+ *
+ * Each worker has its own job pipe, result pipe and an unlinked scratch
+ * file its stdout is redirected to.  The parent hands a worker one job
+ * at a time, and when the worker reports back it either copies the
+ * scratch output straight to stdout (if this is the oldest outstanding
+ * job) or stashes it until the jobs before it have been delivered.
+ * The parent never keeps more than a small window of jobs in flight,
+ * so one slow file only ever delays a bounded amount of buffered output.
+ *
+ * Copyright (C) 2006 by BusyBox developers
+ *
+ * Licensed under GPLv2 or later, see file LICENSE in this tarball for details.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "libbb.h"
+
+/* How many submitted-but-undelivered jobs we allow per worker */
+#define WINDOW_PER_WORKER	4
+
+struct pj_worker {
+	pid_t pid;
+	int job_fd;		/* parent -> worker */
+	int res_fd;		/* worker -> parent */
+	int out_fd;		/* scratch file the worker writes stdout to */
+	int idx;		/* job in flight, -1 if idle */
+};
+
+struct pj_slot {
+	int done;
+	int status;
+	int fatal;		/* worker died running this job: exit code */
+	char *out;
+	size_t outlen;
+	void *result;
+};
+
+struct pj_record {
+	int idx;
+	int status;
+	off_t outlen;
+};
+
+struct parallel_jobs_s {
+	int nworkers;
+	int window;
+	int result_size;
+	int (*job)(const char *arg, void *result);
+	void (*done)(int status, void *result);
+	unsigned next;		/* index of the next job to submit */
+	unsigned delivered;	/* index of the next job to deliver */
+	struct pj_worker *w;
+	struct pj_slot *slot;
+	struct pollfd *pfd;
+};
+
+static void pj_worker_loop(parallel_jobs_t *pj, struct pj_worker *w)
+{
+	struct pj_record rec;
+	char *arg = NULL;
+	void *result = xmalloc(pj->result_size + 1);
+	int hdr[2];
+
+	if (dup2(w->out_fd, STDOUT_FILENO) < 0)
+		bb_perror_msg_and_die("dup2");
+
+	while (bb_full_read(w->job_fd, hdr, sizeof(hdr)) == sizeof(hdr)) {
+		arg = xrealloc(arg, hdr[1] + 1);
+		if (bb_full_read(w->job_fd, arg, hdr[1]) != hdr[1])
+			break;
+		arg[hdr[1]] = '\0';
+
+		if (ftruncate(STDOUT_FILENO, 0) < 0
+		 || lseek(STDOUT_FILENO, 0, SEEK_SET) < 0)
+			bb_perror_msg_and_die("scratch file");
+		memset(result, 0, pj->result_size);
+
+		rec.idx = hdr[0];
+		rec.status = pj->job(arg, result);
+		bb_xfflush_stdout();
+		rec.outlen = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+
+		if (bb_full_write(w->res_fd, &rec, sizeof(rec)) != sizeof(rec)
+		 || bb_full_write(w->res_fd, result, pj->result_size) != pj->result_size)
+			break;
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+/* Copy (or stash) the output a worker left in its scratch file */
+static void pj_fetch_output(parallel_jobs_t *pj, struct pj_worker *w,
+		struct pj_slot *s, off_t len)
+{
+	off_t pos = 0;
+	ssize_t n;
+
+	s->outlen = 0;
+	if (w->idx != (int)pj->delivered) {
+		/* Not our turn yet, keep it until the jobs before it are out */
+		s->out = xmalloc(len + 1);
+		while (pos < len) {
+			n = pread(w->out_fd, s->out + pos, len - pos, pos);
+			if (n <= 0)
+				bb_perror_msg_and_die(bb_msg_read_error);
+			pos += n;
+		}
+		s->outlen = len;
+	} else if (len) {
+		RESERVE_CONFIG_BUFFER(buffer, BUFSIZ);
+
+		bb_xfflush_stdout();
+		while (pos < len) {
+			n = pread(w->out_fd, buffer, MIN(len - pos, BUFSIZ), pos);
+			if (n <= 0)
+				bb_perror_msg_and_die(bb_msg_read_error);
+			if (bb_full_write(STDOUT_FILENO, buffer, n) != n)
+				bb_perror_msg_and_die(bb_msg_write_error);
+			pos += n;
+		}
+		RELEASE_CONFIG_BUFFER(buffer);
+	}
+}
+
+/* Hand every finished job at the head of the queue back to the caller */
+static void pj_deliver(parallel_jobs_t *pj)
+{
+	struct pj_slot *s;
+
+	while (pj->delivered != pj->next) {
+		s = &pj->slot[pj->delivered % pj->window];
+		if (!s->done)
+			break;
+		if (s->outlen) {
+			bb_xfflush_stdout();
+			if (bb_full_write(STDOUT_FILENO, s->out, s->outlen) != (ssize_t)s->outlen)
+				bb_perror_msg_and_die(bb_msg_write_error);
+		}
+		free(s->out);
+		s->out = NULL;
+		s->outlen = 0;
+		s->done = 0;
+		if (s->fatal) {
+			/* Behave as if we had died right here, like a serial run would */
+			int i, code = s->fatal;
+
+			for (i = 0; i < pj->nworkers; i++)
+				if (pj->w[i].pid > 0)
+					kill(pj->w[i].pid, SIGTERM);
+			exit(code);
+		}
+		pj->delivered++;
+		if (pj->done)
+			pj->done(s->status, s->result);
+	}
+}
+
+/* Wait until at least one busy worker has finished its job */
+static void pj_collect(parallel_jobs_t *pj)
+{
+	struct pollfd *pfd = pj->pfd;
+	int i, n;
+
+	for (i = n = 0; i < pj->nworkers; i++) {
+		if (pj->w[i].idx < 0)
+			continue;
+		pfd[n].fd = pj->w[i].res_fd;
+		pfd[n].events = POLLIN;
+		n++;
+	}
+	if (!n)
+		return;
+	while (poll(pfd, n, -1) < 0)
+		if (errno != EINTR)
+			bb_perror_msg_and_die("poll");
+
+	for (i = 0; i < pj->nworkers; i++) {
+		struct pj_worker *w = &pj->w[i];
+		struct pj_record rec;
+		struct pj_slot *s;
+		int j;
+
+		for (j = 0; j < n; j++)
+			if (pfd[j].fd == w->res_fd && pfd[j].revents)
+				break;
+		if (w->idx < 0 || j == n)
+			continue;
+
+		s = &pj->slot[w->idx % pj->window];
+		if (bb_full_read(w->res_fd, &rec, sizeof(rec)) != sizeof(rec)
+		 || bb_full_read(w->res_fd, s->result, pj->result_size) != pj->result_size
+		) {
+			int status;
+
+			/* The job killed its worker; let pj_deliver() reproduce that */
+			waitpid(w->pid, &status, 0);
+			s->fatal = WIFEXITED(status) && WEXITSTATUS(status)
+					? WEXITSTATUS(status) : EXIT_FAILURE;
+			s->outlen = 0;
+			w->pid = 0;
+		} else {
+			s->status = rec.status;
+			pj_fetch_output(pj, w, s, rec.outlen);
+		}
+		s->done = 1;
+		w->idx = -1;
+	}
+	pj_deliver(pj);
+}
+
+parallel_jobs_t *parallel_jobs_start(int nworkers,
+		int (*job)(const char *arg, void *result),
+		void (*done)(int status, void *result), int result_size)
+{
+#ifdef BB_NOMMU
+	return NULL;
+#else
+	parallel_jobs_t *pj;
+	const char *tmpdir;
+	char *scratch;
+	int i;
+
+	if (nworkers < 2)
+		return NULL;
+
+	pj = xzalloc(sizeof(*pj));
+	pj->nworkers = nworkers;
+	pj->window = nworkers * WINDOW_PER_WORKER;
+	pj->result_size = result_size;
+	pj->job = job;
+	pj->done = done;
+	pj->w = xzalloc(nworkers * sizeof(*pj->w));
+	pj->slot = xzalloc(pj->window * sizeof(*pj->slot));
+	pj->pfd = xmalloc(nworkers * sizeof(*pj->pfd));
+	for (i = 0; i < pj->window; i++)
+		pj->slot[i].result = xzalloc(result_size + 1);
+
+	tmpdir = getenv("TMPDIR");
+	scratch = concat_path_file(tmpdir ? tmpdir : "/tmp", "bbjobXXXXXX");
+
+	/* Don't let the children inherit (and later repeat) pending output */
+	bb_xfflush_stdout();
+
+	for (i = 0; i < nworkers; i++) {
+		struct pj_worker *w = &pj->w[i];
+		int jp[2], rp[2];
+
+		strcpy(scratch + strlen(scratch) - 6, "XXXXXX");
+		w->out_fd = mkstemp(scratch);
+		if (w->out_fd < 0)
+			break;
+		unlink(scratch);
+		if (pipe(jp) < 0 || pipe(rp) < 0)
+			bb_perror_msg_and_die("pipe");
+		w->idx = -1;
+		w->pid = fork();
+		if (w->pid < 0)
+			bb_perror_msg_and_die("fork");
+		if (w->pid == 0) {
+			int k;
+
+			for (k = 0; k < i; k++) {
+				close(pj->w[k].job_fd);
+				close(pj->w[k].res_fd);
+				close(pj->w[k].out_fd);
+			}
+			close(jp[1]);
+			close(rp[0]);
+			w->job_fd = jp[0];
+			w->res_fd = rp[1];
+			pj_worker_loop(pj, w);
+		}
+		close(jp[0]);
+		close(rp[1]);
+		w->job_fd = jp[1];
+		w->res_fd = rp[0];
+	}
+	free(scratch);
+
+	if (i < nworkers) {
+		/* No scratch space: quietly run with however many we got */
+		if (i < 2) {
+			parallel_jobs_finish(pj);
+			return NULL;
+		}
+		pj->nworkers = i;
+	}
+	return pj;
+#endif
+}
+
+/* Like parallel_jobs_add(), for an arg of len bytes which need not be a
+ * string; the job still gets it NUL terminated */
+void parallel_jobs_add_data(parallel_jobs_t *pj, const char *arg, int len)
+{
+	struct pj_worker *w;
+	int hdr[2];
+	int i;
+
+	for (;;) {
+		w = NULL;
+		if (pj->next - pj->delivered < (unsigned)pj->window) {
+			for (i = 0; i < pj->nworkers; i++) {
+				if (pj->w[i].pid > 0 && pj->w[i].idx < 0) {
+					w = &pj->w[i];
+					break;
+				}
+			}
+		}
+		if (w)
+			break;
+		pj_collect(pj);
+	}
+
+	hdr[0] = pj->next;
+	hdr[1] = len;
+	if (bb_full_write(w->job_fd, hdr, sizeof(hdr)) != sizeof(hdr)
+	 || bb_full_write(w->job_fd, arg, hdr[1]) != hdr[1])
+		bb_perror_msg_and_die(bb_msg_write_error);
+	w->idx = pj->next++;
+}
+
+void parallel_jobs_add(parallel_jobs_t *pj, const char *arg)
+{
+	parallel_jobs_add_data(pj, arg, strlen(arg));
+}
+
+void parallel_jobs_finish(parallel_jobs_t *pj)
+{
+	int i;
+
+	while (pj->delivered != pj->next)
+		pj_collect(pj);
+
+	for (i = 0; i < pj->nworkers; i++) {
+		struct pj_worker *w = &pj->w[i];
+
+		if (w->pid <= 0)
+			continue;
+		close(w->job_fd);
+		close(w->res_fd);
+		close(w->out_fd);
+		waitpid(w->pid, NULL, 0);
+	}
+	if (ENABLE_FEATURE_CLEAN_UP) {
+		for (i = 0; i < pj->window; i++)
+			free(pj->slot[i].result);
+		free(pj->slot);
+		free(pj->pfd);
+		free(pj->w);
+		free(pj);
+	}
+}
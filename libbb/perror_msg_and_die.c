@@ -20,5 +20,5 @@ void bb_perror_msg_and_die(const char *s, ...)
 	va_start(p, s);
 	bb_vperror_msg(s, p);
 	va_end(p);
-	exit(bb_default_error_retval);
+	bb_xfunc_exit(bb_default_error_retval);
 }
@@ -19,7 +19,7 @@ void bb_xprint_and_close_file(FILE *file)
 	 *       and the calling code may have reassigned stdout. */
 	if (bb_copyfd_eof(fileno(file), STDOUT_FILENO) == -1) {
 		/* bb_copyfd outputs any needed messages, so just die. */
-		exit(bb_default_error_retval);
+		bb_xfunc_exit(bb_default_error_retval);
 	}
 	/* Note: Since we're reading, don't bother checking the return value
 	 *       of fclose().  The only possible failure is EINTR which
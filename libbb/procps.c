@@ -12,6 +12,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 
@@ -20,13 +21,17 @@
 
 #define PROCPS_BUFSIZE 1024
 
+/* /proc stays open between scans; each scan just rewinds it */
+static DIR *proc_dir;
+
+/* Read "<pid>/<file>" relative to /proc */
 static int read_to_buf(const char *filename, void *buf)
 {
 	int fd;
 	ssize_t ret;
 
-	fd = open(filename, O_RDONLY);
-	if(fd < 0)
+	fd = openat(dirfd(proc_dir), filename, O_RDONLY);
+	if (fd < 0)
 		return -1;
 	ret = read(fd, buf, PROCPS_BUFSIZE-1);
 	((char *)buf)[ret > 0 ? ret : 0] = 0;
@@ -34,117 +39,248 @@ static int read_to_buf(const char *filename, void *buf)
 	return ret;
 }
 
+/* Step over n blank-separated fields */
+static char *skip_fields(char *p, int n)
+{
+	while (n--) {
+		while (*p == ' ')
+			p++;
+		while (*p && *p != ' ')
+			p++;
+	}
+	while (*p == ' ')
+		p++;
+	return p;
+}
 
-procps_status_t * procps_scan(int save_user_arg0)
+static char *get_ulong(char *p, unsigned long *val)
 {
-	static DIR *dir;
-	struct dirent *entry;
-	static procps_status_t ret_status;
-	char *name;
+	unsigned long v = 0;
+
+	while (*p == ' ')
+		p++;
+	while ((unsigned)(*p - '0') <= 9)
+		v = v * 10 + (*p++ - '0');
+	*val = v;
+	return p;
+}
+
+static char *get_long(char *p, long *val)
+{
+	unsigned long v;
+	int neg;
+
+	while (*p == ' ')
+		p++;
+	neg = (*p == '-');
+	p = get_ulong(p + neg, &v);
+	*val = neg ? -(long)v : (long)v;
+	return p;
+}
+
+/* Fill in the fields of sp that live in <pid>/stat, see proc(5) */
+static int parse_stat(procps_status_t *sp, char *buf, int flags)
+{
+	char *comm, *p;
+	unsigned long v;
+	long tasknice;
+
+	comm = strchr(buf, '(');
+	p = strrchr(buf, ')'); /* split into "PID (cmd" and "<rest>" */
+	if (!comm || !p || p[1] != ' ')
+		return 0;
+	if (flags & PSSCAN_COMM) {
+		int len = p - ++comm;
+
+		if (len > COMM_LEN - 1)
+			len = COMM_LEN - 1;
+		memcpy(sp->short_cmd, comm, len);
+		sp->short_cmd[len] = '\0';
+	}
+	if (!(flags & (PSSCAN_PPID | PSSCAN_STATE | PSSCAN_RSS | PSSCAN_UTIME)))
+		return 1;
+
+	p += 2;
+	sp->state[0] = *p++;
+	p = get_ulong(p, &v);			/* ppid */
+	sp->ppid = v;
+	p = skip_fields(p, 4 + 5);		/* pgrp, session, tty, tpgid,
+						 * flags, min_flt, cmin_flt, maj_flt, cmaj_flt */
+#ifdef CONFIG_FEATURE_TOP_CPU_USAGE_PERCENTAGE
+	p = get_ulong(p, &sp->utime);
+	p = get_ulong(p, &sp->stime);
+#else
+	p = skip_fields(p, 2);			/* utime, stime */
+#endif
+	p = skip_fields(p, 3);			/* cutime, cstime, priority */
+	p = get_long(p, &tasknice);
+	p = skip_fields(p, 3 + 1);		/* timeout, it_real_value, start_time,
+						 * vsize */
+	if (!*p)
+		return 0;
+	get_ulong(p, &sp->rss);
+
+	if (sp->rss == 0 && sp->state[0] != 'Z')
+		sp->state[1] = 'W';
+	else
+		sp->state[1] = ' ';
+	if (tasknice < 0)
+		sp->state[2] = '<';
+	else if (tasknice > 0)
+		sp->state[2] = 'N';
+	else
+		sp->state[2] = ' ';
+	sp->state[3] = '\0';
+
+#ifdef PAGE_SHIFT
+	sp->rss <<= (PAGE_SHIFT - 10);     /* 2**10 = 1kb */
+#else
+	sp->rss *= (getpagesize() >> 10);     /* 2**10 = 1kb */
+#endif
+	return 1;
+}
+
+static char *read_cmdline(const char *filename)
+{
+	char buf[PROCPS_BUFSIZE];
+	char *p;
 	int n;
-	char status[32];
-	char *status_tail;
+
+	n = read_to_buf(filename, buf);
+	if (n <= 0)
+		return NULL;
+	if (buf[n-1] == '\n')
+		buf[--n] = 0;
+	for (p = buf; n; p++, n--)
+		if (((unsigned char)*p) < ' ')
+			*p = ' ';
+	*p = 0;
+	/* if NULL it work true also */
+	return buf[0] ? bb_xstrdup(buf) : NULL;
+}
+
+void free_procps(procps_status_t *sp)
+{
+	if (sp) {
+		free(sp->cmd);
+		free(sp);
+	}
+}
+
+/* Return the next process, or NULL (freeing sp) when there are no more */
+procps_status_t *procps_scan(procps_status_t *sp, int flags)
+{
+	struct dirent *entry;
+	char path[sizeof(int)*3 + sizeof("/cmdline")];
 	char buf[PROCPS_BUFSIZE];
-	procps_status_t curstatus;
-	int pid;
-	long tasknice;
+	char *name, *tail;
 	struct stat sb;
 
-	if (!dir) {
-		dir = bb_xopendir("/proc");
+	if (!sp) {
+		if (!proc_dir)
+			proc_dir = bb_xopendir("/proc");
+		else
+			rewinddir(proc_dir);
+		sp = xzalloc(sizeof(*sp));
 	}
-	for(;;) {
-		if((entry = readdir(dir)) == NULL) {
-			closedir(dir);
-			dir = 0;
-			return 0;
+	for (;;) {
+		entry = readdir(proc_dir);
+		if (!entry) {
+			free_procps(sp);
+			return NULL;
 		}
 		name = entry->d_name;
 		if (!(*name >= '0' && *name <= '9'))
 			continue;
 
-		memset(&curstatus, 0, sizeof(procps_status_t));
-		pid = atoi(name);
-		curstatus.pid = pid;
+		free(sp->cmd);
+		memset(sp, 0, sizeof(*sp));
+		sp->pid = atoi(name);
 
-		status_tail = status + sprintf(status, "/proc/%d", pid);
-		if(stat(status, &sb))
-			continue;
-		bb_getpwuid(curstatus.user, sb.st_uid, sizeof(curstatus.user));
+		tail = path + strlen(strcpy(path, name));
+		if (flags & (PSSCAN_UID | PSSCAN_USER)) {
+			if (fstatat(dirfd(proc_dir), path, &sb, 0))
+				continue;
+			sp->uid = sb.st_uid;
+			if (flags & PSSCAN_USER)
+				bb_getpwuid(sp->user, sb.st_uid, sizeof(sp->user));
+		}
 
-		/* see proc(5) for some details on this */
-		strcpy(status_tail, "/stat");
-		n = read_to_buf(status, buf);
-		if(n < 0)
-			continue;
-		name = strrchr(buf, ')'); /* split into "PID (cmd" and "<rest>" */
-		if(name == 0 || name[1] != ' ')
-			continue;
-		*name = 0;
-		sscanf(buf, "%*s (%15c", curstatus.short_cmd);
-		n = sscanf(name+2,
-		"%c %d "
-		"%*s %*s %*s %*s "     /* pgrp, session, tty, tpgid */
-		"%*s %*s %*s %*s %*s " /* flags, min_flt, cmin_flt, maj_flt, cmaj_flt */
-#ifdef CONFIG_FEATURE_TOP_CPU_USAGE_PERCENTAGE
-		"%lu %lu "             /* utime, stime */
-#else
-		"%*s %*s "             /* utime, stime */
-#endif
-		"%*s %*s %*s "         /* cutime, cstime, priority */
-		"%ld "                 /* nice */
-		"%*s %*s %*s "         /* timeout, it_real_value, start_time */
-		"%*s "                 /* vsize */
-		"%ld",                 /* rss */
-		curstatus.state, &curstatus.ppid,
-#ifdef CONFIG_FEATURE_TOP_CPU_USAGE_PERCENTAGE
-		&curstatus.utime, &curstatus.stime,
-#endif
-		&tasknice,
-		&curstatus.rss);
-#ifdef CONFIG_FEATURE_TOP_CPU_USAGE_PERCENTAGE
-		if(n != 6)
-#else
-		if(n != 4)
-#endif
-			continue;
+		if (flags & (PSSCAN_PPID | PSSCAN_STATE | PSSCAN_RSS
+					| PSSCAN_UTIME | PSSCAN_COMM)) {
+			strcpy(tail, "/stat");
+			if (read_to_buf(path, buf) < 0 || !parse_stat(sp, buf, flags))
+				continue;
+		}
 
-		if (curstatus.rss == 0 && curstatus.state[0] != 'Z')
-			curstatus.state[1] = 'W';
-		else
-			curstatus.state[1] = ' ';
-		if (tasknice < 0)
-			curstatus.state[2] = '<';
-		else if (tasknice > 0)
-			curstatus.state[2] = 'N';
-		else
-			curstatus.state[2] = ' ';
+		if (flags & PSSCAN_CMD) {
+			strcpy(tail, "/cmdline");
+			sp->cmd = read_cmdline(path);
+		}
+		return sp;
+	}
+}
 
-#ifdef PAGE_SHIFT
-		curstatus.rss <<= (PAGE_SHIFT - 10);     /* 2**10 = 1kb */
-#else
-		curstatus.rss *= (getpagesize() >> 10);     /* 2**10 = 1kb */
-#endif
+static unsigned pid_hash(int pid, unsigned mask)
+{
+	return ((unsigned)pid * 2654435761U) & mask;
+}
 
-		if(save_user_arg0) {
-			strcpy(status_tail, "/cmdline");
-			n = read_to_buf(status, buf);
-			if(n > 0) {
-				if(buf[n-1]=='\n')
-					buf[--n] = 0;
-				name = buf;
-				while(n) {
-					if(((unsigned char)*name) < ' ')
-						*name = ' ';
-					name++;
-					n--;
-				}
-				*name = 0;
-				if(buf[0])
-					curstatus.cmd = strdup(buf);
-				/* if NULL it work true also */
-			}
+/* Read every process in one pass, indexed by pid */
+procps_snapshot_t *procps_snapshot(int flags)
+{
+	procps_snapshot_t *snap = xzalloc(sizeof(*snap));
+	procps_status_t *p = NULL;
+	int alloc = 0;
+	unsigned h;
+	int i;
+
+	while ((p = procps_scan(p, flags)) != NULL) {
+		if (snap->count == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			snap->proc = xrealloc(snap->proc, alloc * sizeof(*snap->proc));
 		}
-		return memcpy(&ret_status, &curstatus, sizeof(procps_status_t));
+		snap->proc[snap->count++] = *p;
+		p->cmd = NULL;		/* the snapshot owns it now */
 	}
+
+	/* Open addressing, at most half full */
+	for (snap->hash_mask = 15; snap->hash_mask < 2U * snap->count; )
+		snap->hash_mask = snap->hash_mask * 2 + 1;
+	snap->hash = xmalloc((snap->hash_mask + 1) * sizeof(int));
+	memset(snap->hash, 0xff, (snap->hash_mask + 1) * sizeof(int));
+	for (i = 0; i < snap->count; i++) {
+		h = pid_hash(snap->proc[i].pid, snap->hash_mask);
+		while (snap->hash[h] >= 0)
+			h = (h + 1) & snap->hash_mask;
+		snap->hash[h] = i;
+	}
+	return snap;
+}
+
+procps_status_t *procps_snapshot_find(const procps_snapshot_t *snap, int pid)
+{
+	unsigned h;
+	int i;
+
+	if (!snap)
+		return NULL;
+	for (h = pid_hash(pid, snap->hash_mask);
+			(i = snap->hash[h]) >= 0; h = (h + 1) & snap->hash_mask)
+		if (snap->proc[i].pid == pid)
+			return &snap->proc[i];
+	return NULL;
+}
+
+void procps_snapshot_free(procps_snapshot_t *snap)
+{
+	int i;
+
+	if (!snap)
+		return;
+	for (i = 0; i < snap->count; i++)
+		free(snap->proc[i].cmd);
+	free(snap->proc);
+	free(snap->hash);
+	free(snap);
 }
@@ -0,0 +1,22 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * Utility routines.
+ *
+ * Licensed under GPLv2 or later, see file LICENSE in this tarball for details.
+ */
+
+#include <setjmp.h>
+#include <stdlib.h>
+#include "libbb.h"
+
+/* Set while an applet runs inside a caller that has to outlive it, such
+ * as a NOFORK applet in ash.  The exit is turned into a longjmp with the
+ * status or'ed with 0x100, so that zero still reads as "jumped". */
+jmp_buf *bb_die_jmp;
+
+void bb_xfunc_exit(int retval)
+{
+	if (bb_die_jmp)
+		longjmp(*bb_die_jmp, (retval & 0xff) | 0x100);
+	exit(retval);
+}
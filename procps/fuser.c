@@ -15,6 +15,7 @@
 #include <string.h>
 #include <limits.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
@@ -31,15 +32,24 @@
 #define FUSER_OPT_IP6    8
 #define FUSER_OPT_IP4    16
 
-typedef struct inode_list {
-	ino_t inode;
+/* Open addressing set of (dev, inode) pairs, so that checking each of
+ * the many files every process has open costs one probe regardless of
+ * how many targets were given on the command line */
+typedef struct inode_ent {
 	dev_t dev;
-	struct inode_list *next;
+	ino_t inode;
+	int used;
+} inode_ent;
+
+typedef struct inode_list {
+	inode_ent *tab;
+	unsigned mask;
+	unsigned count;
 } inode_list;
 
 typedef struct pid_list {
-	pid_t pid;
-	struct pid_list *next;
+	pid_t *pid;
+	int count;
 } pid_list;
 
 static int fuser_option(char *option)
@@ -99,44 +109,67 @@ static int fuser_parse_net_arg(const char *filename,
 	return 1;
 }
 
-static int fuser_add_pid(pid_list *plist, pid_t pid)
+static void fuser_add_pid(pid_list *plist, pid_t pid)
 {
-	pid_list *curr = NULL, *last = NULL;
-
-	if(plist->pid == 0) plist->pid = pid;
-	curr = plist;
-	while(curr != NULL) {
-		if(curr->pid == pid) return 1;
-		last = curr;
-		curr = curr->next;
-	}
-	curr = xmalloc(sizeof(pid_list));
-	last->next = curr;
-	curr->pid = pid;
-	curr->next = NULL;
-	return 1;
+	/* Each pid is scanned once and stops at its first hit, so no dups */
+	if(!(plist->count & 31))
+		plist->pid = xrealloc(plist->pid,
+			sizeof(pid_t) * (plist->count + 32));
+	plist->pid[plist->count++] = pid;
 }
 
-static int fuser_add_inode(inode_list *ilist, dev_t dev, ino_t inode)
+static unsigned fuser_hash(dev_t dev, ino_t inode)
 {
-	inode_list *curr = NULL, *last = NULL;
+	unsigned long long h = ((unsigned long long)dev << 32) ^ dev ^ inode;
+
+	h *= 0x9E3779B97F4A7C15ULL;
+	return h >> 32;
+}
 
-	if(!ilist->inode && !ilist->dev) {
-		ilist->dev = dev;
-		ilist->inode = inode;
+static inode_ent *fuser_find_slot(inode_list *ilist, dev_t dev, ino_t inode)
+{
+	unsigned i = fuser_hash(dev, inode) & ilist->mask;
+	inode_ent *e;
+
+	for(;;) {
+		e = &ilist->tab[i];
+		if(!e->used || (e->inode == inode && e->dev == dev))
+			return e;
+		i = (i + 1) & ilist->mask;
 	}
-	curr = ilist;
-	while(curr != NULL) {
-		if(curr->inode == inode && curr->dev == dev) return 1;
-		last = curr;
-		curr = curr->next;
+}
+
+static void fuser_add_inode(inode_list *ilist, dev_t dev, ino_t inode)
+{
+	inode_ent *e;
+
+	if(!ilist->tab || (ilist->count + 1) * 2 > ilist->mask) {
+		inode_list bigger;
+		unsigned i;
+
+		bigger.mask = ilist->tab ? ilist->mask * 2 + 1 : 15;
+		bigger.count = ilist->count;
+		bigger.tab = xzalloc(sizeof(inode_ent) * (bigger.mask + 1));
+		for(i = 0; ilist->tab && i <= ilist->mask; i++) {
+			if(ilist->tab[i].used)
+				*fuser_find_slot(&bigger, ilist->tab[i].dev,
+					ilist->tab[i].inode) = ilist->tab[i];
+		}
+		free(ilist->tab);
+		*ilist = bigger;
+	}
+	e = fuser_find_slot(ilist, dev, inode);
+	if(!e->used) {
+		e->used = 1;
+		e->dev = dev;
+		e->inode = inode;
+		ilist->count++;
 	}
-	curr = xmalloc(sizeof(inode_list));
-	last->next = curr;
-	curr->dev = dev;
-	curr->inode = inode;
-	curr->next = NULL;
-	return 1;
+}
+
+static int fuser_has_inode(inode_list *ilist, dev_t dev, ino_t inode)
+{
+	return ilist->tab && fuser_find_slot(ilist, dev, inode)->used;
 }
 
 static int fuser_scan_proc_net(int opts, const char *proto,
@@ -174,33 +207,33 @@ static int fuser_scan_proc_net(int opts, const char *proto,
 	return 1;
 }
 
+/* With -m only the device matters; mount mode keeps a set of those
+ * alongside the (dev, inode) one, stored with an inode of 0 */
+static inode_list fuser_devs;
+
 static int fuser_search_dev_inode(int opts, inode_list *ilist,
 	dev_t dev, ino_t inode)
 {
-	inode_list *curr;
-	curr = ilist;
-
-	while(curr) {
-		if((opts & FUSER_OPT_MOUNT) &&  curr->dev == dev)
-			return 1;
-		if(curr->inode == inode && curr->dev == dev)
-			return 1;
-		curr = curr->next;
-	}
-	return 0;
+	if(opts & FUSER_OPT_MOUNT)
+		return fuser_has_inode(&fuser_devs, dev, 0);
+	return fuser_has_inode(ilist, dev, inode);
 }
 
-static int fuser_scan_pid_maps(int opts, const char *fname, pid_t pid,
-	inode_list *ilist, pid_list *plist)
+static int fuser_scan_pid_maps(int opts, int pfd, inode_list *ilist)
 {
 	FILE *file;
 	char line[FUSER_MAX_LINE + 1];
-	int major, minor;
+	int major, minor, fd, found = 0;
 	ino_t inode;
 	long long uint64_inode;
 	dev_t dev;
 
-	if (!(file = fopen(fname, "r"))) return 0;
+	fd = openat(pfd, "maps", O_RDONLY);
+	if(fd < 0) return 0;
+	if (!(file = fdopen(fd, "r"))) {
+		close(fd);
+		return 0;
+	}
 	while (fgets(line, FUSER_MAX_LINE, file)) {
 		if(sscanf(line, "%*s %*s %*s %x:%x %llu",
 			&major, &minor, &uint64_inode) != 3) continue;
@@ -208,46 +241,60 @@ static int fuser_scan_pid_maps(int opts, const char *fname, pid_t pid,
 		if(major == 0 && minor == 0 && inode == 0) continue;
 		dev = makedev(major, minor);
 		if(fuser_search_dev_inode(opts, ilist, dev, inode)) {
-			fuser_add_pid(plist, pid);
+			found = 1;
+			break;
 		}
-
 	}
 	fclose(file);
-	return 1;
+	return found;
 }
 
-static int fuser_scan_link(int opts, const char *lname, pid_t pid,
-	inode_list *ilist, pid_list *plist)
+static int fuser_scan_link(int opts, int dfd, const char *lname,
+	inode_list *ilist)
 {
-	ino_t inode;
-	dev_t dev;
+	struct stat st;
 
-	if(!fuser_file_to_dev_inode(lname, &dev, &inode)) return 0;
-	if(fuser_search_dev_inode(opts, ilist, dev, inode))
-		fuser_add_pid(plist, pid);
-	return 1;
+	if(fstatat(dfd, lname, &st, 0) < 0) return 0;
+	return fuser_search_dev_inode(opts, ilist, st.st_dev, st.st_ino);
 }
 
-static int fuser_scan_dir_links(int opts, const char *dname, pid_t pid,
-	inode_list *ilist, pid_list *plist)
+static int fuser_scan_dir_links(int opts, int pfd, const char *dname,
+	inode_list *ilist)
 {
 	DIR *d;
 	struct dirent *de;
-	char *lname;
-
-	if((d = opendir(dname))) {
-		while((de = readdir(d)) != NULL) {
-			lname = concat_subpath_file(dname, de->d_name);
-			if(lname == NULL)
-				continue;
-			fuser_scan_link(opts, lname, pid, ilist, plist);
-			free(lname);
+	int fd, found = 0;
+
+	fd = openat(pfd, dname, O_RDONLY | O_DIRECTORY);
+	if(fd < 0) return 0;
+	if(!(d = fdopendir(fd))) {
+		close(fd);
+		return 0;
+	}
+	while((de = readdir(d)) != NULL) {
+		if(de->d_name[0] == '.' && (!de->d_name[1]
+			|| (de->d_name[1] == '.' && !de->d_name[2])))
+			continue;
+		if(fuser_scan_link(opts, dirfd(d), de->d_name, ilist)) {
+			found = 1;
+			break;
 		}
-		closedir(d);
 	}
-	else return 0;
-	return 1;
+	closedir(d);
+	return found;
+}
 
+/* Does the process whose /proc directory is open on pfd use any of
+ * our targets?  Stops looking at the first hit. */
+static int fuser_scan_pid(int opts, int pfd, inode_list *ilist)
+{
+	return fuser_scan_link(opts, pfd, "cwd", ilist)
+		|| fuser_scan_link(opts, pfd, "exe", ilist)
+		|| fuser_scan_link(opts, pfd, "root", ilist)
+		|| fuser_scan_dir_links(opts, pfd, "fd", ilist)
+		|| fuser_scan_dir_links(opts, pfd, "lib", ilist)
+		|| fuser_scan_dir_links(opts, pfd, "mmap", ilist)
+		|| fuser_scan_pid_maps(opts, pfd, ilist);
 }
 
 static int fuser_scan_proc_pids(int opts, inode_list *ilist, pid_list *plist)
@@ -255,26 +302,17 @@ static int fuser_scan_proc_pids(int opts, inode_list *ilist, pid_list *plist)
 	DIR *d;
 	struct dirent *de;
 	pid_t pid;
-	char *dname;
+	int pfd;
 
 	if(!(d = opendir(FUSER_PROC_DIR))) return 0;
 	while((de = readdir(d)) != NULL) {
 		pid = (pid_t)atoi(de->d_name);
 		if(!pid) continue;
-		dname = concat_subpath_file(FUSER_PROC_DIR, de->d_name);
-		if(chdir(dname) < 0) {
-			free(dname);
-			continue;
-		}
-		free(dname);
-		fuser_scan_link(opts, "cwd", pid, ilist, plist);
-		fuser_scan_link(opts, "exe", pid, ilist, plist);
-		fuser_scan_link(opts, "root", pid, ilist, plist);
-		fuser_scan_dir_links(opts, "fd", pid, ilist, plist);
-		fuser_scan_dir_links(opts, "lib", pid, ilist, plist);
-		fuser_scan_dir_links(opts, "mmap", pid, ilist, plist);
-		fuser_scan_pid_maps(opts, "maps", pid, ilist, plist);
-		chdir("..");
+		pfd = openat(dirfd(d), de->d_name, O_RDONLY | O_DIRECTORY);
+		if(pfd < 0) continue;
+		if(fuser_scan_pid(opts, pfd, ilist))
+			fuser_add_pid(plist, pid);
+		close(pfd);
 	}
 	closedir(d);
 	return 1;
@@ -282,33 +320,28 @@ static int fuser_scan_proc_pids(int opts, inode_list *ilist, pid_list *plist)
 
 static int fuser_print_pid_list(pid_list *plist)
 {
-	pid_list *curr = plist;
+	int i;
 
-	if(plist == NULL) return 0;
-	while(curr != NULL) {
-		if(curr->pid > 0) printf("%d ", curr->pid);
-		curr = curr->next;
-	}
+	for(i = 0; i < plist->count; i++)
+		printf("%d ", plist->pid[i]);
 	printf("\n");
 	return 1;
 }
 
 static int fuser_kill_pid_list(pid_list *plist, int sig)
 {
-	pid_list *curr = plist;
 	pid_t mypid = getpid();
 	int success = 1;
+	int i;
 
-	if(plist == NULL) return 0;
-	while(curr != NULL) {
-		if(curr->pid > 0 && curr->pid != mypid) {
-			if (kill(curr->pid, sig) != 0) {
+	for(i = 0; i < plist->count; i++) {
+		if(plist->pid[i] != mypid) {
+			if (kill(plist->pid[i], sig) != 0) {
 				bb_perror_msg(
-					"Could not kill pid '%d'", curr->pid);
+					"Could not kill pid '%d'", plist->pid[i]);
 				success = 0;
 			}
 		}
-		curr = curr->next;
 	}
 	return success;
 }
@@ -324,6 +357,7 @@ int fuser_main(int argc, char **argv)
 	ino_t inode;
 	pid_list *pids;
 	inode_list *inodes;
+	int k;
 	int killsig = SIGTERM;
 	int success = 1;
 
@@ -345,8 +379,8 @@ int fuser_main(int argc, char **argv)
 	}
 	if(!fnic) return 1;
 
-	pids = xmalloc(sizeof(pid_list));
-	inodes = xmalloc(sizeof(inode_list));
+	pids = xzalloc(sizeof(pid_list));
+	inodes = xzalloc(sizeof(inode_list));
 	for(i=0;i<fnic;i++) {
 		if(fuser_parse_net_arg(argv[fni[i]], &proto, &port)) {
 			fuser_scan_proc_net(opt, proto, port, inodes);
@@ -354,17 +388,19 @@ int fuser_main(int argc, char **argv)
 		else {
 			if(!fuser_file_to_dev_inode(
 				argv[fni[i]], &dev, &inode)) {
-				free(pids);
-				free(inodes);
 				bb_perror_msg_and_die(
 					"Could not open '%s'", argv[fni[i]]);
 			}
 			fuser_add_inode(inodes, dev, inode);
 		}
 	}
+	if(opt & FUSER_OPT_MOUNT) {
+		for(k = 0; k <= inodes->mask && inodes->tab; k++)
+			if(inodes->tab[k].used)
+				fuser_add_inode(&fuser_devs, inodes->tab[k].dev, 0);
+	}
 	success = fuser_scan_proc_pids(opt, inodes, pids);
-	/* if the first pid in the list is 0, none have been found */
-	if(pids->pid == 0) success = 0;
+	if(pids->count == 0) success = 0;
 	if(success) {
 		if(opt & FUSER_OPT_KILL) {
 			success = fuser_kill_pid_list(pids, killsig);
@@ -373,8 +409,13 @@ int fuser_main(int argc, char **argv)
 			success = fuser_print_pid_list(pids);
 		}
 	}
-	free(pids);
-	free(inodes);
+	if (ENABLE_FEATURE_CLEAN_UP) {
+		free(pids->pid);
+		free(pids);
+		free(inodes->tab);
+		free(inodes);
+		free(fuser_devs.tab);
+	}
 	/* return 0 on (success == 1) 1 otherwise */
 	return (success != 1);
 }
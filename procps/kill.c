@@ -17,10 +17,68 @@
 #include <ctype.h>
 #include <string.h>
 #include <unistd.h>
+#if ENABLE_FEATURE_KILLALL_PIDFD
+#include <fcntl.h>
+#include <sys/syscall.h>
+#endif
 
 #define KILL 0
 #define KILLALL 1
 
+#if ENABLE_FEATURE_KILLALL_PIDFD && defined(__NR_pidfd_open) \
+	&& defined(__NR_pidfd_send_signal)
+/* Is pid (still) running a command called name? */
+static int pid_is_named(long pid, const char *name)
+{
+	char buf[sizeof("/proc//stat") + sizeof(long)*3 + 1];
+	char stat[COMM_LEN + sizeof(long)*3 + 8];
+	char *comm, *end;
+	int fd, n;
+
+	sprintf(buf, "/proc/%ld/stat", pid);
+	fd = open(buf, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	n = read(fd, stat, sizeof(stat) - 1);
+	close(fd);
+	if (n <= 0)
+		return 0;
+	stat[n] = '\0';
+	comm = strchr(stat, '(');
+	end = strrchr(stat, ')');
+	if (!comm || !end)
+		return 0;
+	*end = '\0';
+	return strncmp(comm + 1, name, COMM_LEN-1) == 0;
+}
+
+/* Signal pid through a pidfd, so that if the process we found has gone
+ * and its pid been reused by then, the new process is left alone */
+static int killall_pid(long pid, const char *name, int signo)
+{
+	static int no_pidfd;
+	int fd, ret;
+
+	if (!no_pidfd) {
+		fd = syscall(__NR_pidfd_open, (int)pid, 0);
+		if (fd >= 0) {
+			/* The pidfd pins whatever process has this pid now */
+			ret = 0;
+			if (pid_is_named(pid, name))
+				ret = syscall(__NR_pidfd_send_signal, fd, signo, NULL, 0);
+			close(fd);
+			return ret;
+		}
+		if (errno != ENOSYS)
+			return -1;
+		no_pidfd = 1;
+	}
+	return kill(pid, signo);
+}
+#else
+#define killall_pid(pid, name, signo) kill(pid, signo)
+#endif
+
 int kill_main(int argc, char **argv)
 {
 	int whichApp, signo = SIGTERM;
@@ -115,11 +173,14 @@ do_it_now:
 #ifdef CONFIG_KILLALL
 	else {
 		pid_t myPid=getpid();
+		/* Look up all the names in one go */
+		long **pidLists = find_pids_by_names(argv, argc);
+		int i;
+
 		/* Looks like they want to do a killall.  Do that */
-		while (--argc >= 0) {
-			long* pidList;
+		for (i = 0; i < argc; i++) {
+			long* pidList = pidLists[i];
 
-			pidList = find_pid_by_name(*argv);
 			if (!pidList || *pidList<=0) {
 				errors++;
 				if (quiet==0)
@@ -130,7 +191,7 @@ do_it_now:
 				for(pl = pidList; *pl !=0 ; pl++) {
 					if (*pl==myPid)
 						continue;
-					if (kill(*pl, signo) != 0) {
+					if (killall_pid(*pl, *argv, signo) != 0) {
 						errors++;
 						if (quiet==0)
 							bb_perror_msg( "Could not kill pid '%ld'", *pl);
@@ -140,6 +201,7 @@ do_it_now:
 			free(pidList);
 			argv++;
 		}
+		free(pidLists);
 	}
 #endif
 	return errors;
@@ -46,6 +46,8 @@ int pidof_main(int argc, char **argv)
 	unsigned n = 0;
 	unsigned fail = 1;
 	unsigned long int opt;
+	long **pidLists;
+	int first;
 #if ENABLE_FEATURE_PIDOF_OMIT
 	llist_t *omits = NULL; /* list of pids to omit */
 	bb_opt_complementally = _OMIT_COMPL("o::");
@@ -73,12 +75,14 @@ int pidof_main(int argc, char **argv)
 	}
 #endif
 	/* Looks like everything is set to go.  */
+	first = optind;
+	pidLists = find_pids_by_names(argv + first, argc - first);
 	while(optind < argc) {
 		long *pidList;
 		long *pl;
 
 		/* reverse the pidlist like GNU pidof does.  */
-		pidList = pidlist_reverse(find_pid_by_name(argv[optind]));
+		pidList = pidlist_reverse(pidLists[optind - first]);
 		for(pl = pidList; *pl > 0; pl++) {
 #if ENABLE_FEATURE_PIDOF_OMIT
 			unsigned omitted = 0;
@@ -107,6 +111,7 @@ int pidof_main(int argc, char **argv)
 		free(pidList);
 		optind++;
 	}
+	free(pidLists);
 	putchar('\n');
 
 #if ENABLE_FEATURE_PIDOF_OMIT
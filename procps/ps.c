@@ -24,7 +24,7 @@
 
 int ps_main(int argc, char **argv)
 {
-	procps_status_t * p;
+	procps_status_t * p = NULL;
 	int i, len;
 
 #if ENABLE_SELINUX
@@ -75,7 +75,8 @@ int ps_main(int argc, char **argv)
 #endif
 	  printf("  PID  Uid     VmSize Stat Command\n");
 
-	while ((p = procps_scan(1)) != 0)  {
+	while ((p = procps_scan(p, PSSCAN_USER | PSSCAN_STATE | PSSCAN_RSS
+					| PSSCAN_COMM | PSSCAN_CMD)) != 0)  {
 		char *namecmd = p->cmd;
 #if ENABLE_SELINUX
 		if (use_selinux)
@@ -122,9 +123,6 @@ int ps_main(int argc, char **argv)
 				namecmd[i-2] = 0;
 			printf("[%s]\n", namecmd);
 		}
-		/* no check needed, but to make valgrind happy..  */
-		if (ENABLE_FEATURE_CLEAN_UP && p->cmd)
-			free(p->cmd);
 	}
 	return EXIT_SUCCESS;
 }
@@ -47,9 +47,14 @@
 
 typedef int (*cmp_t)(procps_status_t *P, procps_status_t *Q);
 
-static procps_status_t *top;   /* Hehe */
+/* The current sample, and the processes in it in display order */
+static procps_snapshot_t *snap;
+static procps_status_t **top;   /* Hehe */
 static int ntop;
 
+#define TOP_SCAN_FLAGS (PSSCAN_PPID | PSSCAN_STATE | PSSCAN_RSS \
+		| PSSCAN_UTIME | PSSCAN_COMM | PSSCAN_USER)
+
 #ifdef CONFIG_FEATURE_USE_TERMIOS
 static int pid_sort(procps_status_t *P, procps_status_t *Q)
 {
@@ -77,31 +82,25 @@ static int time_sort(procps_status_t *P, procps_status_t *Q)
 	return (int)((Q->stime + Q->utime) - (P->stime + P->utime));
 }
 
-static int mult_lvl_cmp(void* a, void* b) {
+static int mult_lvl_cmp(const void *a, const void *b) {
+	procps_status_t *P = *(procps_status_t **)a;
+	procps_status_t *Q = *(procps_status_t **)b;
 	int i, cmp_val;
 
 	for (i = 0; i < sort_depth; i++) {
-		cmp_val = (*sort_function[i])(a, b);
+		cmp_val = (*sort_function[i])(P, Q);
 		if (cmp_val != 0)
 			return cmp_val;
 	}
 	return 0;
 }
 
-/* This structure stores some critical information from one frame to
-   the next. mostly used for sorting. Added cumulative and resident fields. */
-struct save_hist {
-	int ticks;
-	int pid;
-};
-
 /*
  * Calculates percent cpu usage for each task.
  */
 
-static struct save_hist *prev_hist;
-static int prev_hist_count;
-/* static int hist_iterations; */
+/* The previous sample, looked up by pid for the time deltas */
+static procps_snapshot_t *prev_snap;
 
 
 static unsigned total_pcpu;
@@ -132,57 +131,38 @@ static void get_jiffy_counts(void)
 
 static void do_stats(void)
 {
-	procps_status_t *cur;
-	int pid, total_time, i, last_i, n;
-	struct save_hist *new_hist;
+	procps_status_t *cur, *prev;
+	int n;
 
 	get_jiffy_counts();
 	total_pcpu = 0;
 	/* total_rss = 0; */
-	new_hist = xmalloc(sizeof(struct save_hist)*ntop);
 	/*
 	 * Make a pass through the data to get stats.
 	 */
-	/* hist_iterations = 0; */
-	i = 0;
 	for (n = 0; n < ntop; n++) {
-		cur = top + n;
+		cur = top[n];
 
 		/*
 		 * Calculate time in cur process.  Time is sum of user time
 		 * and system time
 		 */
-		pid = cur->pid;
-		total_time = cur->stime + cur->utime;
-		new_hist[n].ticks = total_time;
-		new_hist[n].pid = pid;
-
-		/* find matching entry from previous pass */
 		cur->pcpu = 0;
-		/* do not start at index 0, continue at last used one
-		 * (brought hist_iterations from ~14000 down to 172) */
-		last_i = i;
-		if (prev_hist_count) do {
-			if (prev_hist[i].pid == pid) {
-				cur->pcpu = total_time - prev_hist[i].ticks;
-				break;
-			}
-			i = (i+1) % prev_hist_count;
-			/* hist_iterations++; */
-		} while (i != last_i);
+		prev = procps_snapshot_find(prev_snap, cur->pid);
+		if (prev)
+			cur->pcpu = (cur->stime + cur->utime)
+					- (prev->stime + prev->utime);
 		total_pcpu += cur->pcpu;
 		/* total_rss += cur->rss; */
 	}
-
-	/*
-	 * Save cur frame's information.
-	 */
-	free(prev_hist);
-	prev_hist = new_hist;
-	prev_hist_count = ntop;
 }
 #else
 static cmp_t sort_function;
+
+static int single_lvl_cmp(const void *a, const void *b)
+{
+	return sort_function(*(procps_status_t **)a, *(procps_status_t **)b);
+}
 #endif /* CONFIG_FEATURE_TOP_CPU_USAGE_PERCENTAGE */
 
 /* display generic info (meminfo / loadavg) */
@@ -280,7 +260,7 @@ static void display_status(int count, int scr_width)
 		bits_per_int = sizeof(int)*8
 	};
 
-	procps_status_t *s = top;
+	procps_status_t **sp = top;
 	char rss_str_buf[8];
 	unsigned long total_memory = display_generic(scr_width); /* or use total_rss? */
 	unsigned pmem_shift, pmem_scale;
@@ -335,6 +315,7 @@ static void display_status(int count, int scr_width)
 #endif
 
 	while (count--) {
+		procps_status_t *s = *sp++;
 		div_t pmem = div( (s->rss*pmem_scale) >> pmem_shift, 10);
 		int col = scr_width+1;
 		USE_FEATURE_TOP_CPU_USAGE_PERCENTAGE(div_t pcpu;)
@@ -353,15 +334,21 @@ static void display_status(int count, int scr_width)
 			printf("%.*s", col, s->short_cmd);
 		/* printf(" %d/%d %lld/%lld", s->pcpu, total_pcpu,
 			jif.busy - prev_jif.busy, jif.total - prev_jif.total); */
-		s++;
 	}
-	/* printf(" %d", hist_iterations); */
 	putchar('\r');
 	fflush(stdout);
 }
 
 static void clearmems(void)
 {
+#ifdef CONFIG_FEATURE_TOP_CPU_USAGE_PERCENTAGE
+	/* keep this sample around for the next round's deltas */
+	procps_snapshot_free(prev_snap);
+	prev_snap = snap;
+#else
+	procps_snapshot_free(snap);
+#endif
+	snap = NULL;
 	free(top);
 	top = 0;
 	ntop = 0;
@@ -380,7 +367,8 @@ static void reset_term(void)
 #ifdef CONFIG_FEATURE_CLEAN_UP
 	clearmems();
 #ifdef CONFIG_FEATURE_TOP_CPU_USAGE_PERCENTAGE
-	free(prev_hist);
+	procps_snapshot_free(prev_snap);
+	prev_snap = NULL;
 #endif
 #endif /* CONFIG_FEATURE_CLEAN_UP */
 }
@@ -437,7 +425,7 @@ int top_main(int argc, char **argv)
 #endif /* CONFIG_FEATURE_TOP_CPU_USAGE_PERCENTAGE */
 
 	while (1) {
-		procps_status_t *p;
+		int n;
 
 		/* Default to 25 lines - 5 lines for status */
 		lines = 24 - 3;
@@ -452,26 +440,25 @@ int top_main(int argc, char **argv)
 #endif /* CONFIG_FEATURE_USE_TERMIOS */
 
 		/* read process IDs & status for all the processes */
-		while ((p = procps_scan(0)) != 0) {
-			int n = ntop;
-
-			top = xrealloc(top, (++ntop)*sizeof(procps_status_t));
-			memcpy(top + n, p, sizeof(procps_status_t));
-		}
+		snap = procps_snapshot(TOP_SCAN_FLAGS);
+		ntop = snap->count;
 		if (ntop == 0) {
 			bb_error_msg_and_die("Can't find process info in /proc");
 		}
+		top = xmalloc(ntop * sizeof(*top));
+		for (n = 0; n < ntop; n++)
+			top[n] = &snap->proc[n];
 #ifdef CONFIG_FEATURE_TOP_CPU_USAGE_PERCENTAGE
-		if (!prev_hist_count) {
-			do_stats();
+		if (!prev_snap) {
+			get_jiffy_counts();
 			sleep(1);
 			clearmems();
 			continue;
 		}
 		do_stats();
-		qsort(top, ntop, sizeof(procps_status_t), (void*)mult_lvl_cmp);
+		qsort(top, ntop, sizeof(*top), mult_lvl_cmp);
 #else
-		qsort(top, ntop, sizeof(procps_status_t), (void*)sort_function);
+		qsort(top, ntop, sizeof(*top), single_lvl_cmp);
 #endif /* CONFIG_FEATURE_TOP_CPU_USAGE_PERCENTAGE */
 		opt = lines;
 		if (opt > ntop) {
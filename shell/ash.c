@@ -60,6 +60,10 @@
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#ifdef CONFIG_ASH_SCRIPT_CACHE
+#include <sys/mman.h>
+#include <sys/time.h>
+#endif
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -512,6 +516,7 @@ static void freefunc(struct funcnode *);
 #define CHKNL           0x4
 
 #define IBUFSIZ (BUFSIZ + 1)
+#define SCRIPTBUFSIZ (64 * 1024) /* largest buffer for a script file */
 
 /*
  * NEOF is returned by parsecmd when it encounters an end of file.  It
@@ -545,6 +550,10 @@ struct parsefile {
 	int lleft;              /* number of chars left in this buffer */
 	char *nextc;            /* next char in buffer */
 	char *buf;              /* input buffer */
+	int bufsize;            /* size of buf */
+#ifdef CONFIG_ASH_SCRIPT_CACHE
+	struct scriptcache *cache; /* parse trees saved for or read from cache */
+#endif
 	struct strpush *strpush; /* for pushing strings at this level */
 	struct strpush basestrpush; /* so pushing one is fast */
 };
@@ -1190,6 +1199,9 @@ static void sizenodelist(struct nodelist *);
 static union node *copynode(union node *);
 static struct nodelist *copynodelist(struct nodelist *);
 static char *nodesavestr(char *);
+#ifdef CONFIG_ASH_SCRIPT_CACHE
+static void relocnode(union node *, ptrdiff_t);
+#endif
 
 
 static int evalstring(char *, int mask);
@@ -1407,6 +1419,15 @@ static const char *pathopt;     /* set by padvance */
 
 static void shellexec(char **, const char *, int)
     ATTRIBUTE_NORETURN;
+#ifdef CONFIG_FEATURE_SH_NOFORK
+static int applet_mode(const struct BB_applet *);
+static int run_nofork_applet(const struct BB_applet *, int, char **);
+static int inprocess_cmd(union node *);
+static int evalcapture(union node *, char **, size_t *);
+static int openbuf(const char *, size_t);
+/* where evalcapture() wants the output of the command it runs */
+static FILE *capturefile;
+#endif
 static char *padvance(const char **, const char *);
 static void find_command(char *, struct cmdentry *, int, const char *);
 static struct builtincmd *find_builtin(const char *);
@@ -1436,6 +1457,14 @@ static void change_random(const char *);
 # endif
 #endif
 
+#ifdef CONFIG_ASH_SCRIPT_CACHE
+static long parsesaved;                 /* microseconds saved by the cache */
+static void change_parsesaved(const char *);
+# ifndef DYNAMIC_VAR
+#  define DYNAMIC_VAR
+# endif
+#endif
+
 /*      init.h        */
 
 static void reset(void);
@@ -1495,7 +1524,12 @@ static void change_lc_ctype(const char *value);
 #endif
 
 
-#define VTABSIZE 39
+#define VTABSIZE 64              /* initial size, must be a power of 2 */
+
+static struct var *vartab0[VTABSIZE];
+static struct var **vartab = vartab0;
+static unsigned int vtabsize = VTABSIZE;
+static unsigned int varcount;           /* variables in vartab */
 
 static const char defpathvar[] = "PATH=/usr/local/bin:/usr/bin:/sbin:/bin";
 #ifdef IFS_BROKEN
@@ -1528,6 +1562,9 @@ static struct var varinit[] = {
 #ifdef CONFIG_ASH_RANDOM_SUPPORT
 	{0, VSTRFIXED|VTEXTFIXED|VUNSET|VDYNAMIC, "RANDOM\0", change_random },
 #endif
+#ifdef CONFIG_ASH_SCRIPT_CACHE
+	{0, VSTRFIXED|VTEXTFIXED|VUNSET|VDYNAMIC, "ASH_PARSE_SAVED\0", change_parsesaved },
+#endif
 #ifdef CONFIG_LOCALE_SUPPORT
 	{0, VSTRFIXED | VTEXTFIXED | VUNSET, "LC_ALL\0", change_lc_all },
 	{0, VSTRFIXED | VTEXTFIXED | VUNSET, "LC_CTYPE\0", change_lc_ctype },
@@ -1554,6 +1591,11 @@ static struct var varinit[] = {
 #else
 #define vrandom (&vps4)[1]
 #endif
+#ifdef CONFIG_ASH_RANDOM_SUPPORT
+#define vparsesaved (&vrandom)[1]
+#else
+#define vparsesaved vrandom
+#endif
 #define defpath (defpathvar + 5)
 
 /*
@@ -1671,6 +1713,7 @@ initvar(void)
 		vpp = hashvar(vp->text);
 		vp->next = *vpp;
 		*vpp = vp;
+		varcount++;
 	} while (++vp < end);
 }
 
@@ -1681,6 +1724,7 @@ init(void)
       /* from input.c: */
       {
 	      basepf.nextc = basepf.buf = basebuf;
+	      basepf.bufsize = IBUFSIZ;
       }
 
       /* from trap.c: */
@@ -1738,6 +1782,12 @@ static void setinputstring(char *);
 static void popfile(void);
 static void popallfiles(void);
 static void closescript(void);
+#ifdef CONFIG_ASH_SCRIPT_CACHE
+static void cacheopen(const struct stat *);
+static void cachefree(struct parsefile *, int);
+static union node *cachedcmd(void);
+static void cacherecord(union node *, const struct timeval *);
+#endif
 
 
 /*      jobs.h    */
@@ -1797,6 +1847,9 @@ static int jobctl;              /* true if doing job control */
 
 static struct job *makejob(union node *, int);
 static int forkshell(struct job *, union node *, int);
+#ifdef CONFIG_FEATURE_SH_VFORK
+static int vforkexec(struct job *, union node *, char **, const char *, int);
+#endif
 static int waitforjob(struct job *);
 static int stoppedjobs(void);
 
@@ -2072,6 +2125,7 @@ reset(void)
 
 #ifdef CONFIG_ASH_ALIAS
 static struct alias *atab[ATABSIZE];
+static int aliasgen;                    /* bumped whenever an alias changes */
 
 static void setalias(const char *, const char *);
 static struct alias *freealias(struct alias *);
@@ -2085,6 +2139,7 @@ setalias(const char *name, const char *val)
 	app = __lookupalias(name);
 	ap = *app;
 	INTOFF;
+	aliasgen++;
 	if (ap) {
 		if (!(ap->flag & ALIASINUSE)) {
 			ckfree(ap->val);
@@ -2113,6 +2168,7 @@ unalias(const char *name)
 	if (*app) {
 		INTOFF;
 		*app = freealias(*app);
+		aliasgen++;
 		INTON;
 		return (0);
 	}
@@ -2127,6 +2183,7 @@ rmaliases(void)
 	int i;
 
 	INTOFF;
+	aliasgen++;
 	for (i = 0; i < ATABSIZE; i++) {
 		app = &atab[i];
 		for (ap = *app; ap; ap = *app) {
@@ -3079,9 +3136,27 @@ evalpipe(union node *n, int flags)
 		pipelen++;
 	flags |= EV_EXIT;
 	INTOFF;
-	jp = makejob(n, pipelen);
 	prevfd = -1;
-	for (lp = n->npipe.cmdlist ; lp ; lp = lp->next) {
+	lp = n->npipe.cmdlist;
+#ifdef CONFIG_FEATURE_SH_NOFORK
+	/* An output-only head such as echo "$x" | ... runs here and feeds
+	 * the rest of the pipeline from memory */
+	if (!n->npipe.backgnd && pipelen > 1 && inprocess_cmd(lp->n)) {
+		int saveexitstatus = exitstatus;
+		char *buf;
+		size_t len;
+
+		if (evalcapture(lp->n, &buf, &len) >= 0) {
+			prevfd = openbuf(buf, len);
+			ckfree(buf);
+			lp = lp->next;
+			pipelen--;
+		}
+		exitstatus = saveexitstatus;
+	}
+#endif
+	jp = makejob(n, pipelen);
+	for (; lp ; lp = lp->next) {
 		prehash(lp->n);
 		pip[1] = -1;
 		if (lp->next) {
@@ -3143,6 +3218,23 @@ evalbackcmd(union node *n, struct backcmd *result)
 	saveherefd = herefd;
 	herefd = -1;
 
+#ifdef CONFIG_FEATURE_SH_NOFORK
+	/* Builtin-only substitutions like $(basename "$f") need no subshell */
+	if (inprocess_cmd(n)) {
+		int saveexitstatus = exitstatus;
+		size_t len;
+
+		back_exitstatus = evalcapture(n, &result->buf, &len);
+		exitstatus = saveexitstatus;
+		if (back_exitstatus >= 0) {
+			result->nleft = len;
+			herefd = saveherefd;
+			goto out;
+		}
+		back_exitstatus = 0;
+	}
+#endif
+
 	{
 		int pip[2];
 		struct job *jp;
@@ -3244,6 +3336,9 @@ evalcommand(union node *cmd, int flags)
 	char **nargv;
 	struct builtincmd *bcmd;
 	int pseudovarflag = 0;
+#ifdef CONFIG_FEATURE_SH_NOFORK
+	FILE *savestdout = stdout;
+#endif
 
 	/* First expand the arguments. */
 	TRACE(("evalcommand(0x%lx, %d) called\n", (long)cmd, flags));
@@ -3384,10 +3479,33 @@ bail:
 	/* Execute the command. */
 	switch (cmdentry.cmdtype) {
 	default:
+#ifdef CONFIG_FEATURE_SH_NOFORK
+		/* NOFORK applets run right here, much like a builtin */
+		if (cmdentry.u.index == -1 && !varlist.list
+		 && strchr(argv[0], '/') == NULL) {
+			const struct BB_applet *applet = find_applet_by_name(argv[0]);
+
+			if (applet && applet_mode(applet) == _BB_MODE_NOFORK) {
+				if (capturefile)
+					stdout = capturefile;
+				exitstatus = run_nofork_applet(applet, argc, argv);
+				stdout = savestdout;
+				break;
+			}
+		}
+#endif
 		/* Fork off a child process if necessary. */
 		if (!(flags & EV_EXIT) || trap[0]) {
 			INTOFF;
 			jp = makejob(cmd, 1);
+#ifdef CONFIG_FEATURE_SH_VFORK
+			if (!iflag && !jp->jobctl && !varlist.list
+			 && vforkexec(jp, cmd, argv, path, cmdentry.u.index) > 0) {
+				exitstatus = waitforjob(jp);
+				INTON;
+				break;
+			}
+#endif
 			if (forkshell(jp, cmd, FORK_FG) != 0) {
 				exitstatus = waitforjob(jp);
 				INTON;
@@ -3411,7 +3529,17 @@ bail:
 			}
 			listsetvar(list, i);
 		}
-		if (evalbltin(cmdentry.u.cmd, argc, argv)) {
+#ifdef CONFIG_FEATURE_SH_NOFORK
+		/* Only now, with the words expanded: children forked for
+		 * command substitutions in them must keep the real stdout */
+		if (capturefile)
+			stdout = capturefile;
+#endif
+		status = evalbltin(cmdentry.u.cmd, argc, argv);
+#ifdef CONFIG_FEATURE_SH_NOFORK
+		stdout = savestdout;
+#endif
+		if (status) {
 			int exit_status;
 			int i, j;
 
@@ -3654,7 +3782,7 @@ execcmd(int argc, char **argv)
  * would make the command name "hash" a misnomer.
  */
 
-#define CMDTABLESIZE 31         /* should be prime */
+#define CMDTABLESIZE 32         /* initial size, must be a power of 2 */
 #define ARB 1                   /* actual size determined at run time */
 
 
@@ -3668,9 +3796,23 @@ struct tblentry {
 };
 
 
-static struct tblentry *cmdtable[CMDTABLESIZE];
+static struct tblentry *cmdtable0[CMDTABLESIZE];
+static struct tblentry **cmdtable = cmdtable0;
+static unsigned int cmdtabsize = CMDTABLESIZE;
+static unsigned int cmdcount;           /* entries in cmdtable */
 static int builtinloc = -1;             /* index in path of %builtin, or -1 */
 
+/*
+ * A command that is not found in PATH is remembered as a CMDUNKNOWN
+ * entry whose index is the value of missgen at the time.  Starting a
+ * child or changing directory bumps missgen, since either may make the
+ * command appear, and stale misses are then searched for again.  So
+ * does the clock ticking over to the next second, which bounds how long
+ * a command installed by some other process can go unnoticed.
+ */
+static int missgen;
+static time_t misstime;
+
 
 static void tryexec(char *, char **, char **);
 static void clearcmdentry(int);
@@ -3732,12 +3874,116 @@ shellexec(char **argv, const char *path, int idx)
 }
 
 
+#ifdef CONFIG_FEATURE_SH_NOFORK
+/*
+ * Decide how an applet may run without re-executing the binary.  Only
+ * applets that never need privileges qualify, and nothing does if the
+ * binary is setuid or SELinux may want a domain transition, since both
+ * only happen at exec time.
+ */
+
+static int
+applet_mode(const struct BB_applet *applet)
+{
+	static int privileged = -1;
+
+	if (privileged < 0) {
+		struct stat statb;
+
+		privileged = stat(CONFIG_BUSYBOX_EXEC_PATH, &statb) != 0
+			|| (statb.st_mode & (S_ISUID | S_ISGID));
+	}
+#if ENABLE_SELINUX_DYNTRANSITION
+	if (is_selinux_enabled())
+		return _BB_MODE_EXEC;
+#endif
+	if (privileged || applet->need_suid != _BB_SUID_NEVER)
+		return _BB_MODE_EXEC;
+	return applet->mode;
+}
+
+
+/*
+ * Run a NOFORK applet inside the shell.  Anything libbb would exit()
+ * with comes back through bb_die_jmp; getopt, stdout and the applet
+ * name are reset around the call so the next command sees a clean slate.
+ */
+
+static int
+run_nofork_applet(const struct BB_applet *applet, int argc, char **argv)
+{
+	struct BB_applet *volatile saveapplet = applet_using;
+	const char *volatile savename = bb_applet_name;
+	jmp_buf jmp;
+	volatile int status;
+
+	INTOFF;
+	status = setjmp(jmp);
+	if (status)
+		status &= 0xff;
+	else {
+		bb_die_jmp = &jmp;
+		applet_using = (struct BB_applet *) applet;
+		bb_applet_name = applet->name;
+		optind = 0;
+		if (argc == 2 && !strcmp(argv[1], "--help"))
+			bb_show_usage();
+		status = applet->main(argc, argv);
+	}
+	bb_die_jmp = NULL;
+	fflush(stdout);
+	status |= ferror(stdout);
+	clearerr(stdout);
+	applet_using = saveapplet;
+	bb_applet_name = savename;
+	bb_default_error_retval = EXIT_FAILURE;
+	INTON;
+	return status;
+}
+
+
+/*
+ * Run a NOEXEC applet in this (forked) process in place of exec.
+ * Caught signals go back to default as exec would have done.
+ */
+
+static void
+run_noexec_applet(const struct BB_applet *applet, char **argv, char **envp)
+{
+	int argc, sig;
+
+	for (sig = 1; sig < NSIG; sig++) {
+		struct sigaction act;
+
+		if (sigaction(sig, NULL, &act) == 0
+		 && act.sa_handler != SIG_DFL && act.sa_handler != SIG_IGN)
+			signal(sig, SIG_DFL);
+	}
+	for (argc = 0; argv[argc]; argc++)
+		;
+	environ = envp;
+	applet_using = (struct BB_applet *) applet;
+	bb_applet_name = applet->name;
+	optind = 0;
+	if (argc == 2 && !strcmp(argv[1], "--help"))
+		bb_show_usage();
+	exit(applet->main(argc, argv));
+}
+#endif
+
+
 static void
 tryexec(char *cmd, char **argv, char **envp)
 {
 	int repeated = 0;
 #ifdef CONFIG_FEATURE_SH_STANDALONE_SHELL
-	if(find_applet_by_name(cmd) != NULL) {
+	const struct BB_applet *applet = find_applet_by_name(cmd);
+
+	if (applet != NULL) {
+#ifdef CONFIG_FEATURE_SH_NOFORK
+		if (applet_mode(applet) != _BB_MODE_EXEC)
+			run_noexec_applet(applet, argv, envp);
+#endif
 		/* re-exec ourselves with the new arguments */
 		execve(CONFIG_BUSYBOX_EXEC_PATH,argv,envp);
 		/* If they called chroot or otherwise made the binary no longer
@@ -3853,7 +4099,7 @@ hashcmd(int argc, char **argv)
 		return 0;
 	}
 	if (*argptr == NULL) {
-		for (pp = cmdtable ; pp < &cmdtable[CMDTABLESIZE] ; pp++) {
+		for (pp = cmdtable ; pp < &cmdtable[cmdtabsize] ; pp++) {
 			for (cmdp = *pp ; cmdp ; cmdp = cmdp->next) {
 				if (cmdp->cmdtype == CMDNORMAL)
 					printentry(cmdp);
@@ -3864,7 +4110,7 @@ hashcmd(int argc, char **argv)
 	c = 0;
 	while ((name = *argptr) != NULL) {
 		if ((cmdp = cmdlookup(name, 0)) != NULL
-		 && (cmdp->cmdtype == CMDNORMAL
+		 && (cmdp->cmdtype == CMDNORMAL || cmdp->cmdtype == CMDUNKNOWN
 		     || (cmdp->cmdtype == CMDBUILTIN && builtinloc >= 0)))
 			delete_cmd_entry();
 		find_command(name, &entry, DO_ERR, pathval());
@@ -3934,6 +4180,7 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 #if DEBUG
 			abort();
 #endif
+		case CMDUNKNOWN:
 		case CMDNORMAL:
 			bit = DO_ALTPATH;
 			break;
@@ -3947,6 +4194,13 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 		if (act & bit) {
 			updatetbl = 0;
 			cmdp = NULL;
+		} else if (cmdp->cmdtype == CMDUNKNOWN) {
+			/* a recent miss is still a miss */
+			if (cmdp->param.index == missgen
+			 && time(NULL) == misstime) {
+				e = ENOENT;
+				goto fail;
+			}
 		} else if (cmdp->rehash == 0)
 			/* if not invalidated by cd, we're done */
 			goto success;
@@ -4029,9 +4283,26 @@ loop:
 		goto success;
 	}
 
-	/* We failed.  If there was an entry for this command, delete it */
-	if (cmdp && updatetbl)
+	/*
+	 * We failed.  Remember a plain miss so that looking for the command
+	 * again is cheap; otherwise drop any entry we had for it.
+	 */
+	if (updatetbl && e == ENOENT) {
+		time_t now = time(NULL);
+
+		INTOFF;
+		cmdp = cmdlookup(name, 1);
+		cmdp->cmdtype = CMDUNKNOWN;
+		if (now != misstime) {
+			misstime = now;
+			missgen++;
+		}
+		cmdp->param.index = missgen;
+		cmdp->rehash = 0;
+		INTON;
+	} else if (cmdp && updatetbl)
 		delete_cmd_entry();
+fail:
 	if (act & DO_ERR)
 		sh_warnx("%s: %s", name, errmsg(e, E_EXEC));
 	entry->cmdtype = CMDUNKNOWN;
@@ -4092,7 +4363,8 @@ hashcd(void)
 	struct tblentry **pp;
 	struct tblentry *cmdp;
 
-	for (pp = cmdtable ; pp < &cmdtable[CMDTABLESIZE] ; pp++) {
+	missgen++;
+	for (pp = cmdtable ; pp < &cmdtable[cmdtabsize] ; pp++) {
 		for (cmdp = *pp ; cmdp ; cmdp = cmdp->next) {
 			if (cmdp->cmdtype == CMDNORMAL || (
 				cmdp->cmdtype == CMDBUILTIN &&
@@ -4154,7 +4426,7 @@ changepath(const char *newval)
 
 /*
  * Clear out command entries.  The argument specifies the first entry in
- * PATH which has changed.
+ * PATH which has changed.  Remembered misses always go.
  */
 
 static void
@@ -4165,15 +4437,17 @@ clearcmdentry(int firstchange)
 	struct tblentry *cmdp;
 
 	INTOFF;
-	for (tblp = cmdtable ; tblp < &cmdtable[CMDTABLESIZE] ; tblp++) {
+	for (tblp = cmdtable ; tblp < &cmdtable[cmdtabsize] ; tblp++) {
 		pp = tblp;
 		while ((cmdp = *pp) != NULL) {
 			if ((cmdp->cmdtype == CMDNORMAL &&
 			     cmdp->param.index >= firstchange)
 			 || (cmdp->cmdtype == CMDBUILTIN &&
-			     builtinloc >= firstchange)) {
+			     builtinloc >= firstchange)
+			 || cmdp->cmdtype == CMDUNKNOWN) {
 				*pp = cmdp->next;
 				ckfree(cmdp);
+				cmdcount--;
 			} else {
 				pp = &cmdp->next;
 			}
@@ -4197,26 +4471,73 @@ clearcmdentry(int firstchange)
 static struct tblentry **lastcmdentry;
 
 
+/*
+ * FNV-1a hash of a command or variable name, which ends at '=' in the
+ * latter case.  The tables are a power of 2 in size and use the low
+ * bits, so every character has to reach them.
+ */
+
+static unsigned int
+hashname(const char *p)
+{
+	unsigned int hashval = 2166136261U;
+
+	while (*p && *p != '=')
+		hashval = (hashval ^ (unsigned char) *p++) * 16777619;
+	return hashval;
+}
+
+
+/*
+ * Double the command table once it has more entries than buckets.
+ */
+
+static void
+growcmdtable(void)
+{
+	struct tblentry **newtab;
+	struct tblentry *cmdp, *next;
+	struct tblentry **pp;
+	unsigned int newsize = cmdtabsize * 2;
+	unsigned int i;
+
+	newtab = xzalloc(newsize * sizeof(*newtab));
+	for (i = 0 ; i < cmdtabsize ; i++) {
+		for (cmdp = cmdtable[i] ; cmdp ; cmdp = next) {
+			next = cmdp->next;
+			pp = &newtab[hashname(cmdp->cmdname) & (newsize - 1)];
+			cmdp->next = *pp;
+			*pp = cmdp;
+		}
+	}
+	if (cmdtable != cmdtable0)
+		ckfree(cmdtable);
+	cmdtable = newtab;
+	cmdtabsize = newsize;
+}
+
+
 static struct tblentry *
 cmdlookup(const char *name, int add)
 {
 	unsigned int hashval;
-	const char *p;
 	struct tblentry *cmdp;
 	struct tblentry **pp;
 
-	p = name;
-	hashval = (unsigned char)*p << 4;
-	while (*p)
-		hashval += (unsigned char)*p++;
-	hashval &= 0x7FFF;
-	pp = &cmdtable[hashval % CMDTABLESIZE];
+	hashval = hashname(name);
+	pp = &cmdtable[hashval & (cmdtabsize - 1)];
 	for (cmdp = *pp ; cmdp ; cmdp = cmdp->next) {
 		if (equal(cmdp->cmdname, name))
 			break;
 		pp = &cmdp->next;
 	}
 	if (add && cmdp == NULL) {
+		if (++cmdcount > cmdtabsize) {
+			growcmdtable();
+			pp = &cmdtable[hashval & (cmdtabsize - 1)];
+			while (*pp)
+				pp = &(*pp)->next;
+		}
 		cmdp = *pp = ckmalloc(sizeof (struct tblentry) - ARB
 					+ strlen(name) + 1);
 		cmdp->next = NULL;
@@ -4242,6 +4563,7 @@ delete_cmd_entry(void)
 	if (cmdp->cmdtype == CMDFUNCTION)
 		freefunc(cmdp->param.func);
 	ckfree(cmdp);
+	cmdcount--;
 	INTON;
 }
 
@@ -4363,11 +4685,13 @@ describe_command(char *command)
 	}
 #endif
 	/* Then check if it is a tracked alias */
-	if ((cmdp = cmdlookup(command, 0)) != NULL) {
+	if ((cmdp = cmdlookup(command, 0)) != NULL
+	 && cmdp->cmdtype != CMDUNKNOWN) {
 		entry.cmdtype = cmdp->cmdtype;
 		entry.u = cmdp->param;
 	} else {
 		/* Finally use brute force */
+		cmdp = NULL;
 		find_command(command, &entry, DO_ABS, path);
 	}
 
@@ -4979,6 +5303,133 @@ read:
 }
 
 
+#ifdef CONFIG_FEATURE_SH_NOFORK
+/*
+ * Builtins that only write to stdout and leave the shell alone, so a
+ * command substitution or pipeline head may run them without forking.
+ */
+
+static const char *const inprocess_builtins[] = {
+	"[", "[[", "echo", "false", "pwd", "test", "true", NULL
+};
+
+/*
+ * Return 1 if n is a simple command that can run inside the shell in
+ * place of a subshell: its name is a literal NOFORK applet or one of
+ * inprocess_builtins, nothing in its words can assign a variable or
+ * raise an expansion error, and it leaves stdout where it is.
+ */
+
+static int
+inprocess_cmd(union node *n)
+{
+	union node *np;
+	struct tblentry *cmdp;
+	const char *name, *p;
+	int i;
+
+	if (n == NULL || n->type != NCMD || n->ncmd.assign || !n->ncmd.args
+	 || uflag)
+		return 0;
+	for (np = n->ncmd.redirect; np; np = np->nfile.next) {
+		if (np->nfile.fd == 1 || np->type == NTOFD || np->type == NFROMFD)
+			return 0;
+	}
+	for (np = n->ncmd.args; np; np = np->narg.next) {
+		for (p = np->narg.text; *p; p++) {
+			switch (*p) {
+			case CTLESC:
+				p++;
+				break;
+			case CTLARI:
+				return 0;
+			case CTLVAR:
+				i = p[1] & VSTYPE;
+				if (i == VSASSIGN || i == VSQUESTION)
+					return 0;
+				break;
+			}
+		}
+	}
+
+	name = n->ncmd.args->narg.text;
+	for (p = name; *p; p++) {
+		if ((unsigned char) *p >= (unsigned char) CTL_FIRST
+		 && (unsigned char) *p <= (unsigned char) CTL_LAST)
+			return 0;
+	}
+#ifdef CONFIG_FEATURE_SH_STANDALONE_SHELL
+	{
+		const struct BB_applet *applet = find_applet_by_name(name);
+
+		if (applet)
+			return applet_mode(applet) == _BB_MODE_NOFORK;
+	}
+#endif
+	if ((cmdp = cmdlookup(name, 0)) != NULL && cmdp->cmdtype == CMDFUNCTION)
+		return 0;
+	for (i = 0; inprocess_builtins[i]; i++) {
+		if (strcmp(name, inprocess_builtins[i]) == 0)
+			return find_builtin(name) != NULL;
+	}
+	return 0;
+}
+
+
+/*
+ * Evaluate n in the shell with stdout collected in a malloc'd buffer.
+ * Returns the exit status, or -1 if no buffer could be set up.  The
+ * caller restores exitstatus, since a subshell would not have set it.
+ */
+
+static int
+evalcapture(union node *n, char **bufp, size_t *lenp)
+{
+	struct jmploc jmploc;
+	struct jmploc *volatile savehandler = handler;
+	FILE *volatile savestdout = stdout;
+	FILE *volatile savecapture = capturefile;
+	/* A subshell would have had its own copy of the expansion state */
+	struct nodelist *saveargbackq = argbackq;
+	char *saveexpdest = expdest;
+	struct ifsregion saveifsfirst = ifsfirst;
+	struct ifsregion *saveifslastp = ifslastp;
+	struct arglist saveexparg = exparg;
+	int savepreverrout_fd = preverrout_fd;
+	FILE *mem;
+	int ex;
+
+	*bufp = NULL;
+	*lenp = 0;
+	flushall();
+	mem = open_memstream(bufp, lenp);
+	if (mem == NULL)
+		return -1;
+	ex = setjmp(jmploc.loc);
+	if (!ex) {
+		handler = &jmploc;
+		capturefile = mem;
+		evaltree(n, EV_TESTED);
+	}
+	capturefile = savecapture;
+	stdout = savestdout;
+	handler = savehandler;
+	argbackq = saveargbackq;
+	expdest = saveexpdest;
+	ifsfirst = saveifsfirst;
+	ifslastp = saveifslastp;
+	exparg = saveexparg;
+	preverrout_fd = savepreverrout_fd;
+	fclose(mem);
+	if (ex) {
+		ckfree(*bufp);
+		longjmp(handler->loc, 1);
+	}
+	return exitstatus;
+}
+#endif
+
+
 static char *
 scanleft(char *startp, char *rmesc, char *rmescend, char *str, int quotes,
 	int zero)
@@ -6039,7 +6490,7 @@ preadfd(void)
 retry:
 #ifdef CONFIG_FEATURE_COMMAND_EDITING
 	if (!iflag || parsefile->fd)
-		nr = safe_read(parsefile->fd, buf, BUFSIZ - 1);
+		nr = safe_read(parsefile->fd, buf, parsefile->bufsize - 2);
 	else {
 #ifdef CONFIG_FEATURE_COMMAND_TAB_COMPLETION
 		cmdedit_path_lookup = pathval();
@@ -6061,7 +6512,7 @@ retry:
 		}
 	}
 #else
-	nr = safe_read(parsefile->fd, buf, BUFSIZ - 1);
+	nr = safe_read(parsefile->fd, buf, parsefile->bufsize - 2);
 #endif
 
 	if (nr < 0) {
@@ -6267,22 +6718,42 @@ out:
 
 /*
  * Like setinputfile, but takes an open file descriptor.  Call this with
- * interrupts off.
+ * interrupts off.  Script files are read in blocks of up to SCRIPTBUFSIZ,
+ * anything else (and stdin, which commands may share) in BUFSIZ blocks.
  */
 
 static void
 setinputfd(int fd, int push)
 {
+	struct stat statb;
+	int size = IBUFSIZ;
+	int regular;
+
 	(void) fcntl(fd, F_SETFD, FD_CLOEXEC);
+	regular = fd != 0 && fstat(fd, &statb) == 0 && S_ISREG(statb.st_mode);
+	if (regular) {
+		if (statb.st_size > SCRIPTBUFSIZ - 2)
+			size = SCRIPTBUFSIZ;
+		else if (statb.st_size + 2 > size)
+			size = statb.st_size + 2;
+	}
 	if (push) {
 		pushfile();
 		parsefile->buf = 0;
 	}
 	parsefile->fd = fd;
-	if (parsefile->buf == NULL)
-		parsefile->buf = ckmalloc(IBUFSIZ);
+	if (parsefile->buf == NULL || parsefile->bufsize < size) {
+		if (parsefile->buf != basebuf)
+			ckfree(parsefile->buf);
+		parsefile->buf = ckmalloc(size);
+		parsefile->bufsize = size;
+	}
 	parselleft = parsenleft = 0;
 	plinno = 1;
+#ifdef CONFIG_ASH_SCRIPT_CACHE
+	if (regular)
+		cacheopen(&statb);
+#endif
 }
 
 
@@ -6320,6 +6791,9 @@ pushfile(void)
 	pf = (struct parsefile *)ckmalloc(sizeof (struct parsefile));
 	pf->prev = parsefile;
 	pf->fd = -1;
+#ifdef CONFIG_ASH_SCRIPT_CACHE
+	pf->cache = NULL;
+#endif
 	pf->strpush = NULL;
 	pf->basestrpush.prev = NULL;
 	parsefile = pf;
@@ -6332,6 +6806,9 @@ popfile(void)
 	struct parsefile *pf = parsefile;
 
 	INTOFF;
+#ifdef CONFIG_ASH_SCRIPT_CACHE
+	cachefree(pf, 1);
+#endif
 	if (pf->fd >= 0)
 		close(pf->fd);
 	if (pf->buf)
@@ -6368,6 +6845,13 @@ popallfiles(void)
 static void
 closescript(void)
 {
+#ifdef CONFIG_ASH_SCRIPT_CACHE
+	struct parsefile *pf;
+
+	/* The child may still be running trees from a mapped cache file. */
+	for (pf = parsefile; pf; pf = pf->prev)
+		cachefree(pf, 0);
+#endif
 	popallfiles();
 	if (parsefile->fd > 0) {
 		close(parsefile->fd);
@@ -6375,6 +6859,339 @@ closescript(void)
 	}
 }
 
+#ifdef CONFIG_ASH_SCRIPT_CACHE
+/*
+ * Parsed script cache.  While a script file is read for the first time,
+ * a copy of every command is kept as it is parsed.  If the file is read
+ * to the end, the copies are laid out in one block with copynode() and
+ * written to CONFIG_ASH_SCRIPT_CACHE_DIR.  The next shell to read the
+ * file maps that block, moves its pointers to where it landed and hands
+ * the trees to cmdloop instead of parsing.
+ *
+ * How a file parses depends only on its text and the aliases defined,
+ * so nothing is saved or replayed while there are aliases.  Should one
+ * be defined (or "set -v" be turned on) during a replay, the rest of the
+ * file is parsed after all, from where the next command starts.
+ */
+
+struct cachecmd {
+	union node *n;
+	off_t next;             /* file offset of the next command */
+	int linno;              /* line number after this command */
+};
+
+struct cachehdr {
+	char build[64];         /* shell version and build time */
+	dev_t dev;              /* the script file */
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	time_t ctime;
+	char *base;             /* address the commands were laid out at */
+	size_t len;             /* bytes after the header */
+	int ncmds;
+	long parsetime;         /* microseconds it took to parse the file */
+};
+
+struct cacherec {               /* a command copied while recording */
+	struct cacherec *next;
+	struct funcnode *f;
+	off_t next_off;
+	int linno;
+};
+
+struct scriptcache {
+	struct cachehdr *map;   /* the mapped cache file, when replaying */
+	struct cachecmd *cmd;   /* next command to hand out */
+	struct cachecmd *end;
+	struct cacherec *recs;  /* commands recorded so far */
+	struct cacherec **lastrec;
+	int ncmds;
+	long parsetime;
+	time_t opened;          /* when we started reading the file */
+	struct stat statb;      /* the script at that time */
+	int aliasgen;
+};
+
+#ifndef CONFIG_ASH_ALIAS
+#define aliasgen 0
+#endif
+
+static const char cachebuild[] = "ash " BB_VER " " BB_BT;
+static const char cachedir[] = CONFIG_ASH_SCRIPT_CACHE_DIR;
+
+
+static long
+cacheusec(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000000L
+		+ now.tv_usec - start->tv_usec;
+}
+
+
+/*
+ * Only root or the user running the shell may have written the cache.
+ */
+
+static int
+cacheowned(const struct stat *st)
+{
+	return (st->st_uid == 0 || st->st_uid == geteuid())
+		&& !(st->st_mode & (S_IWGRP | S_IWOTH));
+}
+
+
+static int
+cachealiases(void)
+{
+#ifdef CONFIG_ASH_ALIAS
+	int i;
+
+	for (i = 0; i < ATABSIZE; i++)
+		if (atab[i])
+			return 1;
+#endif
+	return 0;
+}
+
+
+static void
+cachename(char *path, const struct stat *statb)
+{
+	sprintf(path, "%s/%lx-%lx", cachedir,
+		(unsigned long) statb->st_dev, (unsigned long) statb->st_ino);
+}
+
+#define CACHEPATHSIZE (PATH_MAX + 4 * sizeof(long) + 2)
+
+
+/*
+ * Set up the cache for the file just opened by setinputfd: map a saved
+ * copy if there is a good one, otherwise get ready to record.  Called
+ * with interrupts off.
+ */
+
+static void
+cacheopen(const struct stat *statb)
+{
+	static int dirok = -1;
+	struct scriptcache *sc;
+	struct cachehdr *map;
+	struct cachecmd *cmd;
+	struct stat st;
+	struct timeval start;
+	char path[CACHEPATHSIZE];
+	ptrdiff_t delta;
+	int fd;
+	int i;
+
+	if (dirok < 0) {
+		dirok = sizeof(cachedir) <= PATH_MAX
+			&& stat(cachedir, &st) == 0
+			&& S_ISDIR(st.st_mode) && cacheowned(&st);
+	}
+	if (!dirok || vflag || cachealiases())
+		return;
+	gettimeofday(&start, NULL);
+	sc = xzalloc(sizeof(*sc));
+	sc->statb = *statb;
+	sc->aliasgen = aliasgen;
+	sc->lastrec = &sc->recs;
+	parsefile->cache = sc;
+
+	cachename(path, statb);
+	if ((fd = open(path, O_RDONLY)) >= 0) {
+		map = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+		 && cacheowned(&st) && st.st_size > sizeof(*map))
+			map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (map != MAP_FAILED) {
+			if (map->len == st.st_size - sizeof(*map)
+			 && !strncmp(map->build, cachebuild, sizeof(map->build))
+			 && map->dev == statb->st_dev && map->ino == statb->st_ino
+			 && map->size == statb->st_size
+			 && map->mtime == statb->st_mtime
+			 && map->ctime == statb->st_ctime
+			 && map->ncmds >= 0
+			 && map->ncmds <= map->len / sizeof(*cmd)) {
+				cmd = (struct cachecmd *) (map + 1);
+				delta = (char *) cmd - map->base;
+				for (i = 0; i < map->ncmds; i++) {
+					cmd[i].n = (union node *)
+						((char *) cmd[i].n + delta);
+					relocnode(cmd[i].n, delta);
+				}
+				sc->map = map;
+				sc->cmd = cmd;
+				sc->end = cmd + map->ncmds;
+				parsesaved += map->parsetime - cacheusec(&start);
+				return;
+			}
+			munmap(map, st.st_size);
+		}
+	}
+	/* Not cached yet: record this reading if we can save it after. */
+	if (access(cachedir, W_OK) != 0)
+		cachefree(parsefile, 1);
+	else
+		sc->opened = time(NULL);
+}
+
+
+/*
+ * Drop a file's cache.  A forked child leaves the mapping alone since
+ * it may be running one of its trees.
+ */
+
+static void
+cachefree(struct parsefile *pf, int unmap)
+{
+	struct scriptcache *sc = pf->cache;
+	struct cacherec *rp;
+
+	if (sc == NULL)
+		return;
+	INTOFF;
+	pf->cache = NULL;
+	if (sc->map && unmap)
+		munmap(sc->map, sizeof(*sc->map) + sc->map->len);
+	while ((rp = sc->recs) != NULL) {
+		sc->recs = rp->next;
+		ckfree(rp->f);
+		ckfree(rp);
+	}
+	ckfree(sc);
+	INTON;
+}
+
+
+/*
+ * Return the next command of a replayed file, NEOF at its end, or NULL
+ * if the rest of the file has to be parsed after all.
+ */
+
+static union node *
+cachedcmd(void)
+{
+	struct scriptcache *sc = parsefile->cache;
+	struct cachecmd *cmd = sc->cmd;
+	off_t next = 0;
+
+	if (vflag || aliasgen != sc->aliasgen) {
+		plinno = 1;
+		if (cmd != (struct cachecmd *) (sc->map + 1)) {
+			next = cmd[-1].next;
+			plinno = cmd[-1].linno;
+		}
+		lseek(parsefile->fd, next, SEEK_SET);
+		cachefree(parsefile, 1);
+		return NULL;
+	}
+	if (cmd == sc->end)
+		return NEOF;
+	sc->cmd++;
+	plinno = cmd->linno;
+	return cmd->n;
+}
+
+
+/*
+ * Keep a copy of a command just parsed; at the end of the file, lay
+ * the copies out and save them.
+ */
+
+static void
+cacherecord(union node *n, const struct timeval *start)
+{
+	struct scriptcache *sc = parsefile->cache;
+	struct cacherec *rp;
+	struct cachehdr *map;
+	struct cachecmd *cmd;
+	struct stat st;
+	char path[CACHEPATHSIZE];
+	char tmp[CACHEPATHSIZE + 3 * sizeof(int)];
+	size_t len;
+	ssize_t wrote;
+	int fd;
+
+	sc->parsetime += cacheusec(start);
+	if (aliasgen != sc->aliasgen) {
+		cachefree(parsefile, 1);
+		return;
+	}
+	if (n == NULL)
+		return;
+	if (n != NEOF) {
+		INTOFF;
+		rp = ckmalloc(sizeof(*rp));
+		rp->next = NULL;
+		rp->f = copyfunc(n);
+		rp->next_off = lseek(parsefile->fd, 0, SEEK_CUR)
+			- parselleft - parsenleft;
+		rp->linno = plinno;
+		*sc->lastrec = rp;
+		sc->lastrec = &rp->next;
+		sc->ncmds++;
+		INTON;
+		return;
+	}
+
+	/*
+	 * Don't save a file that changed while we read it, or in the same
+	 * second we opened it, where its times would not show the change.
+	 */
+	if (fstat(parsefile->fd, &st) != 0
+	 || st.st_size != sc->statb.st_size
+	 || st.st_mtime != sc->statb.st_mtime
+	 || st.st_ctime != sc->statb.st_ctime
+	 || st.st_mtime >= sc->opened || st.st_ctime >= sc->opened)
+		goto out;
+	INTOFF;
+	funcblocksize = SHELL_ALIGN(sc->ncmds * sizeof(*cmd));
+	funcstringsize = 0;
+	for (rp = sc->recs; rp; rp = rp->next)
+		calcsize(&rp->f->n);
+	len = funcblocksize + funcstringsize;
+	map = xzalloc(sizeof(*map) + len);
+	cmd = (struct cachecmd *) (map + 1);
+	funcblock = (char *) cmd + SHELL_ALIGN(sc->ncmds * sizeof(*cmd));
+	funcstring = (char *) cmd + funcblocksize;
+	for (rp = sc->recs; rp; rp = rp->next, cmd++) {
+		cmd->n = copynode(&rp->f->n);
+		cmd->next = rp->next_off;
+		cmd->linno = rp->linno;
+	}
+	safe_strncpy(map->build, cachebuild, sizeof(map->build));
+	map->dev = st.st_dev;
+	map->ino = st.st_ino;
+	map->size = st.st_size;
+	map->mtime = st.st_mtime;
+	map->ctime = st.st_ctime;
+	map->base = (char *) (map + 1);
+	map->len = len;
+	map->ncmds = sc->ncmds;
+	map->parsetime = sc->parsetime;
+
+	cachename(path, &st);
+	sprintf(tmp, "%s.%u", path, (unsigned) getpid());
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, st.st_mode & 0644)) >= 0) {
+		wrote = bb_full_write(fd, map, sizeof(*map) + len);
+		if (close(fd) != 0 || wrote != sizeof(*map) + len
+		 || rename(tmp, path) != 0)
+			unlink(tmp);
+	}
+	ckfree(map);
+	INTON;
+out:
+	cachefree(parsefile, 1);
+}
+#endif
+
 /*      jobs.c    */
 
 /* mode flags for set_curjob */
@@ -7137,6 +7954,9 @@ forkchild(struct job *jp, union node *n, int mode)
 
 	closescript();
 	clear_traps();
+#ifdef CONFIG_FEATURE_SH_NOFORK
+	capturefile = NULL;
+#endif
 #if JOBS
 	/* do job control only in root shell */
 	jobctl = 0;
@@ -7178,6 +7998,7 @@ static inline void
 forkparent(struct job *jp, union node *n, int mode, pid_t pid)
 {
 	TRACE(("In parent shell:  child = %d\n", pid));
+	missgen++;
 	if (!jp) {
 		while (jobless && dowait(DOWAIT_NORMAL, 0) > 0);
 		jobless++;
@@ -7231,6 +8052,90 @@ forkshell(struct job *jp, union node *n, int mode)
 	return pid;
 }
 
+#ifdef CONFIG_FEATURE_SH_VFORK
+/*
+ * Start a simple external command with vfork() rather than fork().  The
+ * child only resets signals, drops the fds saved by redirections and
+ * execs; anything that needs shell code in the child (a failed exec,
+ * scripts without #!, NOEXEC applets) returns -1 and the caller forks.
+ */
+
+static int
+vforkexec(struct job *jp, union node *n, char **argv, const char *path, int idx)
+{
+	static volatile int vfork_errno;
+	const char *cmdname = argv[0];
+	struct redirtab *rp;
+	sigset_t all, old;
+	char **envp;
+	pid_t pid;
+	int i;
+
+	if (strchr(cmdname, '/') == NULL) {
+#ifdef CONFIG_FEATURE_SH_STANDALONE_SHELL
+		const struct BB_applet *applet = find_applet_by_name(cmdname);
+
+		if (applet != NULL) {
+#ifdef CONFIG_FEATURE_SH_NOFORK
+			if (applet_mode(applet) != _BB_MODE_EXEC)
+				return -1;
+#endif
+			cmdname = CONFIG_BUSYBOX_EXEC_PATH;
+		} else
+#endif
+		{
+			char *fullname;
+
+			while ((fullname = padvance(&path, argv[0])) != NULL) {
+				if (--idx < 0 && pathopt == NULL)
+					break;
+				stunalloc(fullname);
+			}
+			if (fullname == NULL)
+				return -1;
+			cmdname = fullname;
+		}
+	}
+	envp = environment();
+
+	sigfillset(&all);
+	sigprocmask(SIG_SETMASK, &all, &old);
+	vfork_errno = 0;
+	pid = vfork();
+	if (pid == 0) {
+		/* Our handlers would run on the parent's memory: put caught
+		 * signals back to default before unblocking, as exec does */
+		for (i = 1; i < NSIG; i++) {
+			struct sigaction act;
+
+			if (sigaction(i, NULL, &act) == 0
+			 && act.sa_handler != SIG_DFL && act.sa_handler != SIG_IGN)
+				signal(i, SIG_DFL);
+		}
+		for (rp = redirlist; rp; rp = rp->next) {
+			for (i = 0; i < 10; i++) {
+				if (rp->renamed[i] >= 0)
+					close(rp->renamed[i]);
+			}
+		}
+		sigprocmask(SIG_SETMASK, &old, NULL);
+		execve(cmdname, argv, envp);
+		vfork_errno = errno;
+		_exit(127);
+	}
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	if (pid < 0)
+		return -1;
+	if (vfork_errno) {
+		/* Let the forked path find the next candidate or report it */
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+	forkparent(jp, n, FORK_FG, pid);
+	return pid;
+}
+#endif
+
 /*
  * Wait for job to finish.
  *
@@ -8747,6 +9652,100 @@ nodesavestr(char   *s)
 }
 
 
+#ifdef CONFIG_ASH_SCRIPT_CACHE
+/*
+ * Move the pointers of a tree laid out by copynode() by delta bytes,
+ * after the block holding it has been mapped at another address.
+ */
+
+#define RELOC(p, delta) ((p) = (p) ? (void *) ((char *) (p) + (delta)) : NULL)
+
+static void
+relocnodelist(struct nodelist *lp, ptrdiff_t delta)
+{
+	for (; lp; lp = RELOC(lp->next, delta))
+		relocnode(RELOC(lp->n, delta), delta);
+}
+
+static void
+relocnode(union node *n, ptrdiff_t delta)
+{
+      if (n == NULL)
+	    return;
+      switch (n->type) {
+      case NCMD:
+	    relocnode(RELOC(n->ncmd.redirect, delta), delta);
+	    relocnode(RELOC(n->ncmd.args, delta), delta);
+	    relocnode(RELOC(n->ncmd.assign, delta), delta);
+	    break;
+      case NPIPE:
+	    relocnodelist(RELOC(n->npipe.cmdlist, delta), delta);
+	    break;
+      case NREDIR:
+      case NBACKGND:
+      case NSUBSHELL:
+	    relocnode(RELOC(n->nredir.redirect, delta), delta);
+	    relocnode(RELOC(n->nredir.n, delta), delta);
+	    break;
+      case NAND:
+      case NOR:
+      case NSEMI:
+      case NWHILE:
+      case NUNTIL:
+	    relocnode(RELOC(n->nbinary.ch2, delta), delta);
+	    relocnode(RELOC(n->nbinary.ch1, delta), delta);
+	    break;
+      case NIF:
+	    relocnode(RELOC(n->nif.elsepart, delta), delta);
+	    relocnode(RELOC(n->nif.ifpart, delta), delta);
+	    relocnode(RELOC(n->nif.test, delta), delta);
+	    break;
+      case NFOR:
+	    RELOC(n->nfor.var, delta);
+	    relocnode(RELOC(n->nfor.body, delta), delta);
+	    relocnode(RELOC(n->nfor.args, delta), delta);
+	    break;
+      case NCASE:
+	    relocnode(RELOC(n->ncase.cases, delta), delta);
+	    relocnode(RELOC(n->ncase.expr, delta), delta);
+	    break;
+      case NCLIST:
+	    relocnode(RELOC(n->nclist.body, delta), delta);
+	    relocnode(RELOC(n->nclist.pattern, delta), delta);
+	    relocnode(RELOC(n->nclist.next, delta), delta);
+	    break;
+      case NDEFUN:
+      case NARG:
+	    relocnodelist(RELOC(n->narg.backquote, delta), delta);
+	    RELOC(n->narg.text, delta);
+	    relocnode(RELOC(n->narg.next, delta), delta);
+	    break;
+      case NTO:
+      case NCLOBBER:
+      case NFROM:
+      case NFROMTO:
+      case NAPPEND:
+	    relocnode(RELOC(n->nfile.fname, delta), delta);
+	    relocnode(RELOC(n->nfile.next, delta), delta);
+	    break;
+      case NTOFD:
+      case NFROMFD:
+	    relocnode(RELOC(n->ndup.vname, delta), delta);
+	    relocnode(RELOC(n->ndup.next, delta), delta);
+	    break;
+      case NHERE:
+      case NXHERE:
+	    relocnode(RELOC(n->nhere.doc, delta), delta);
+	    relocnode(RELOC(n->nhere.next, delta), delta);
+	    break;
+      case NNOT:
+	    relocnode(RELOC(n->nnot.com, delta), delta);
+	    break;
+      };
+}
+#endif
+
+
 /*
  * Free a parse tree.
  */
@@ -9069,6 +10068,23 @@ static void change_random(const char *value)
 }
 #endif
 
+#ifdef CONFIG_ASH_SCRIPT_CACHE
+static void change_parsesaved(const char *value)
+{
+	if(value == NULL) {
+		/* "get", report the time saved so far */
+		char buf[sizeof(long) * 3 + 2];
+
+		sprintf(buf, "%ld", parsesaved);
+		setvar(vparsesaved.text, buf, VNOFUNC);
+		vparsesaved.flags &= ~VNOFUNC;
+	} else {
+		/* set/reset */
+		parsesaved = strtol(value, (char **)NULL, 10);
+	}
+}
+#endif
+
 
 #ifdef CONFIG_ASH_GETOPTS
 static int
@@ -9357,6 +10373,16 @@ union node *
 parsecmd(int interact)
 {
 	int t;
+	union node *n;
+#ifdef CONFIG_ASH_SCRIPT_CACHE
+	struct timeval start;
+
+	if (parsefile->cache && parsefile->cache->map
+	 && (n = cachedcmd()) != NULL)
+		return n;
+	if (parsefile->cache)
+		gettimeofday(&start, NULL);
+#endif
 
 	tokpushback = 0;
 	doprompt = interact;
@@ -9365,11 +10391,18 @@ parsecmd(int interact)
 	needprompt = 0;
 	t = readtoken();
 	if (t == TEOF)
-		return NEOF;
-	if (t == TNL)
-		return NULL;
-	tokpushback++;
-	return list(1);
+		n = NEOF;
+	else if (t == TNL)
+		n = NULL;
+	else {
+		tokpushback++;
+		n = list(1);
+	}
+#ifdef CONFIG_ASH_SCRIPT_CACHE
+	if (parsefile->cache)
+		cacherecord(n, &start);
+#endif
+	return n;
 }
 
 
@@ -11003,6 +12036,42 @@ out:
 	return pip[0];
 }
 
+#ifdef CONFIG_FEATURE_SH_NOFORK
+/*
+ * Return an fd from which len bytes of buf can be read, the way openhere
+ * does for here-documents: small buffers go straight into the pipe,
+ * larger ones get a writer process.
+ */
+
+static int
+openbuf(const char *buf, size_t len)
+{
+	int pip[2];
+
+	if (pipe(pip) < 0)
+		sh_error("Pipe call failed");
+	if (len <= PIPESIZE) {
+		bb_full_write(pip[1], buf, len);
+		goto out;
+	}
+	if (forkshell((struct job *)NULL, (union node *)NULL, FORK_NOJOB) == 0) {
+		close(pip[0]);
+		signal(SIGINT, SIG_IGN);
+		signal(SIGQUIT, SIG_IGN);
+		signal(SIGHUP, SIG_IGN);
+#ifdef SIGTSTP
+		signal(SIGTSTP, SIG_IGN);
+#endif
+		signal(SIGPIPE, SIG_DFL);
+		bb_full_write(pip[1], buf, len);
+		_exit(0);
+	}
+out:
+	close(pip[1]);
+	return pip[0];
+}
+#endif
+
 static int
 openredirect(union node *redir)
 {
@@ -11949,10 +13018,9 @@ static int decode_signal(const char *string, int minsig)
 
 /*      var.c     */
 
-static struct var *vartab[VTABSIZE];
-
 static int vpcmp(const void *, const void *);
 static struct var **findvar(struct var **, const char *);
+static void growvartab(void);
 
 /*
  * Initialize the variable symbol tables and import the environment
@@ -12062,6 +13130,10 @@ setvareq(char *s, int flags)
 		if (flags & VNOSET)
 			return;
 		/* not found */
+		if (++varcount > vtabsize) {
+			growvartab();
+			vpp = hashvar(s);
+		}
 		vp = ckmalloc(sizeof (*vp));
 		vp->next = *vpp;
 		vp->func = NULL;
@@ -12160,7 +13232,7 @@ listvars(int on, int off, char ***end)
 					ep = growstackstr();
 				*ep++ = (char *) vp->text;
 			}
-	} while (++vpp < vartab + VTABSIZE);
+	} while (++vpp < vartab + vtabsize);
 	if (ep == stackstrend())
 		ep = growstackstr();
 	if (end)
@@ -12272,7 +13344,7 @@ mklocal(char *name)
 				setvareq(name, VSTRFIXED);
 			else
 				setvar(name, NULL, VSTRFIXED);
-			vp = *vpp;      /* the new variable */
+			vp = *hashvar(name);    /* the new variable */
 			lvp->flags = VUNSET;
 		} else {
 			lvp->text = vp->text;
@@ -12402,6 +13474,7 @@ unsetvar(const char *s)
 				ckfree(vp->text);
 			*vpp = vp->next;
 			ckfree(vp);
+			varcount--;
 			INTON;
 		} else {
 			setvar(s, 0, 0);
@@ -12424,12 +13497,37 @@ out:
 static struct var **
 hashvar(const char *p)
 {
-	unsigned int hashval;
+	return &vartab[hashname(p) & (vtabsize - 1)];
+}
 
-	hashval = ((unsigned char) *p) << 4;
-	while (*p && *p != '=')
-		hashval += (unsigned char) *p++;
-	return &vartab[hashval % VTABSIZE];
+
+/*
+ * Double the variable table once it has more entries than buckets.
+ * Called with interrupts off.
+ */
+
+static void
+growvartab(void)
+{
+	struct var **newtab;
+	struct var *vp, *next;
+	struct var **vpp;
+	unsigned int newsize = vtabsize * 2;
+	unsigned int i;
+
+	newtab = xzalloc(newsize * sizeof(*newtab));
+	for (i = 0 ; i < vtabsize ; i++) {
+		for (vp = vartab[i] ; vp ; vp = next) {
+			next = vp->next;
+			vpp = &newtab[hashname(vp->text) & (newsize - 1)];
+			vp->next = *vpp;
+			*vpp = vp;
+		}
+	}
+	if (vartab != vartab0)
+		ckfree(vartab);
+	vartab = newtab;
+	vtabsize = newsize;
 }
 
 